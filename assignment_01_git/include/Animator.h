@@ -0,0 +1,85 @@
+#ifndef _ANIMATOR_H__
+#define _ANIMATOR_H__
+
+#include <vector>
+
+#include "Skeleton.h"
+
+/**
+ * How the keyframe caches did since the last resetStats
+ */
+struct AnimatorStats {
+	AnimatorStats() : samples(0), cached(0), searched(0) {}
+
+	unsigned long long samples; //< Keyframe lookups
+	unsigned long long cached; //< Found at or after the key of the last lookup
+	unsigned long long searched; //< Found with a binary search, e.g., after looping
+};
+
+/**
+ * Plays an animation of a skeleton and computes the bone matrices of
+ * every frame.
+ *
+ * Time mostly moves forward by less than a keyframe per frame, so every
+ * channel caches the keys it used last, and the next lookup starts from
+ * them instead of searching all keys. It only searches when the time
+ * jumps back, e.g., when the animation loops.
+ */
+class Animator {
+public:
+	/**
+	 * Plays the first animation, if any. Keeps a reference to skeleton.
+	 */
+	Animator(const Skeleton& skeleton);
+
+	/**
+	 * Starts an animation from the beginning. Without one, the skeleton
+	 * keeps its bind pose.
+	 */
+	void setAnimation(unsigned int animation);
+	inline unsigned int getAnimation() const { return animation; }
+	inline bool isAnimated() const { return animation < skeleton.animations.size(); }
+
+	/**
+	 * Moves the time forward by seconds, looping the animation
+	 */
+	void advance(double seconds);
+
+	/**
+	 * Computes the matrix of every bone at the current time, as three
+	 * rows of four floats each, the layout SkinnedMesh uploads
+	 */
+	void sample(std::vector<float>& bone_rows);
+
+	inline const AnimatorStats& getStats() const { return stats; }
+	inline void resetStats() { stats = AnimatorStats(); }
+
+private:
+	Animator(const Animator&);
+	Animator& operator=(const Animator&);
+
+	/**
+	 * Last keys used of a channel
+	 */
+	struct KeyCache {
+		KeyCache() : position(0), rotation(0), scale(0) {}
+
+		unsigned int position, rotation, scale;
+	};
+
+	/**
+	 * The key at or before time, starting from cached, which is updated.
+	 * Sets factor to how far time is towards the key after it.
+	 */
+	unsigned int findKey(const std::vector<float>& times, float time, unsigned int& cached, float& factor);
+
+	const Skeleton& skeleton;
+	unsigned int animation;
+	double time; //< Seconds into the animation
+	std::vector<KeyCache> caches; //< Per channel of the animation
+	std::vector<glm::mat4> locals; //< Per node, relative to the parent
+	std::vector<glm::mat4> globals; //< Per node
+	AnimatorStats stats;
+};
+
+#endif
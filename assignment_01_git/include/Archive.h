@@ -0,0 +1,64 @@
+#ifndef _ARCHIVE_H__
+#define _ARCHIVE_H__
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "MappedFile.h"
+#include "VirtualFileSystem.h"
+
+/**
+ * Packed archive file format (.pga) for the VirtualFileSystem.
+ *
+ * A header, then the file contents, each starting at a multiple of
+ * entry_alignment (a page), then a table of contents with the offset,
+ * stored size, original size and compression of every entry, and the
+ * entry names. The whole archive is memory mapped; stored entries are
+ * used in place without copying, and compressed ones are decoded from
+ * independent blocks of the EntropyCoder in parallel.
+ */
+class Archive {
+public:
+	/**
+	 * Maps and checks an archive. Throws a GameException on errors.
+	 */
+	Archive(const std::string& filename);
+
+	/**
+	 * The entry called name (normalized), or a null pointer if there is none
+	 */
+	std::shared_ptr<VirtualFile> open(const std::string& name) const;
+
+	bool contains(const std::string& name) const;
+
+	inline size_t getEntryCount() const { return entries.size(); }
+	inline size_t getSize() const { return file->size(); }
+
+	/**
+	 * Packs files (read through the VirtualFileSystem) into an archive,
+	 * using their normalized paths as entry names. Entries are compressed
+	 * if compress is set and it saves at least an eighth of their size.
+	 */
+	static void write(const std::string& filename, const std::vector<std::string>& files, bool compress);
+
+	static const unsigned int entry_alignment = 4096;
+
+private:
+	Archive(const Archive&);
+	Archive& operator=(const Archive&);
+
+	struct Entry {
+		unsigned long long offset;
+		unsigned long long stored_size;
+		unsigned long long size;
+		unsigned int compression;
+	};
+
+	std::string filename;
+	std::shared_ptr<MappedFile> file;
+	std::unordered_map<std::string, Entry> entries;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef _ASSETCOMPILER_H__
+#define _ASSETCOMPILER_H__
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Result of compiling one source asset. Times are in seconds.
+ */
+struct AssetRecord {
+	AssetRecord() : hash(0), input_bytes(0), output_bytes(0),
+		import_time(0.0), process_time(0.0), encode_time(0.0), write_time(0.0) {}
+
+	std::string type; //< "model" or "texture"
+	std::string source; //< Relative to the input directory
+	std::string output; //< Relative to the output directory
+	unsigned long long hash; //< Of the source, the files it includes and the compiler settings
+	unsigned long long input_bytes;
+	unsigned long long output_bytes;
+	double import_time; //< Parsing the OBJ and MTL files, or decoding the image
+	double process_time; //< Vertex cache and fetch optimization, or mip generation
+	double encode_time; //< Quantization and entropy coding
+	double write_time;
+	std::string status; //< "compiled", "unchanged" or "failed"
+};
+
+/**
+ * Offline compiler that turns a directory of source assets into the
+ * formats the runtime loads directly: OBJ models (with their MTL files)
+ * are optimized for the vertex cache and written as compressed .pgz
+ * files (GeometryCodec), and PNG, JPG, TGA and BMP images are decoded
+ * and written with all mip levels as .pgt files (TextureCache). Texture
+ * paths in compiled models point to the compiled textures.
+ *
+ * Every asset is one task on a work stealing ThreadPool. Builds are
+ * incremental: an asset is skipped if the content hash of its inputs
+ * matches the manifest of the previous build and its output exists.
+ * The manifest (manifest.tsv in the output directory) lists every
+ * asset with its hash, sizes and the time spent in each step.
+ */
+class AssetCompiler {
+public:
+	AssetCompiler(const std::string& input_dir, const std::string& output_dir);
+
+	/**
+	 * Compiles all assets, even if they are unchanged
+	 */
+	inline void setForce(bool force) { this->force = force; }
+
+	/**
+	 * Compiles the input directory with the given number of threads,
+	 * writes the manifest and prints a summary. Returns the number of
+	 * assets that failed.
+	 */
+	unsigned int run(unsigned int threads);
+
+	/**
+	 * The file a source asset is compiled to, or an empty string if it
+	 * is not an asset
+	 */
+	static std::string getOutputName(const std::string& source);
+
+	/**
+	 * Packs all files below the given directories into an Archive. Entry
+	 * names are the paths the runtime opens, i.e. the directory followed
+	 * by the path of the file within it.
+	 */
+	static void pack(const std::string& archive, const std::vector<std::string>& directories, bool compress);
+
+private:
+	AssetCompiler(const AssetCompiler&);
+	AssetCompiler& operator=(const AssetCompiler&);
+
+	void compile(AssetRecord& record, const AssetRecord* previous);
+	void compileModel(AssetRecord& record);
+	void compileTexture(AssetRecord& record);
+	unsigned long long hashInputs(const AssetRecord& record);
+
+	void readManifest(std::map<std::string, AssetRecord>& records);
+	void writeManifest();
+
+	std::string input_dir;
+	std::string output_dir;
+	bool force;
+	std::vector<AssetRecord> records;
+	std::mutex devil_mutex; //< DevIL is not thread safe
+	std::mutex log_mutex;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef _ASSETMANAGER_H__
+#define _ASSETMANAGER_H__
+
+#include <atomic>
+#include <exception>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AssimpLoader.h"
+#include "GLUtils/VBO.hpp"
+#include "MaterialTextures.h"
+#include "MeshBVH.h"
+#include "MeshData.h"
+#include "ModelInterleavedArray.h"
+#include "TextureCache.h"
+#include "Texture2D.h"
+#include "TextureUploader.h"
+#include "Timer.h"
+
+/**
+ * Loads models without blocking the frame. The model is imported and
+ * its textures decoded on a worker thread, and then uploaded by the
+ * render thread in small slices, at most time_budget seconds per frame
+ * (staged uploads, so no second OpenGL context is needed). Textures are
+ * uploaded through a TextureUploader, so that the driver copies them
+ * from pixel buffers while the frame goes on. The caller
+ * swaps the finished model in between two frames and keeps drawing the
+ * old one until then.
+ *
+ * One model loads at a time; a request made while one is loading is
+ * started when it is done, and replaces any earlier waiting request.
+ *
+ * If a cache directory is set, a model imported from a source file is
+ * also written there as a .pgz file, with its textures as .pgt files,
+ * and loaded from that binary copy when it is requested again, e.g.,
+ * after the ResidencyManager evicted it.
+ */
+class AssetManager {
+public:
+	AssetManager();
+	~AssetManager();
+
+	void setImportProfile(ImportProfile profile);
+
+	/**
+	 * Where binary copies of imported models and the hierarchies of their
+	 * triangles are written, empty to not write them. Must end with a path
+	 * separator.
+	 */
+	void setCacheDirectory(const std::string& directory);
+	inline const std::string& getCacheDirectory() const { return cache_directory; }
+
+	void requestModel(const std::string& filename);
+
+	/**
+	 * Call once per frame on the render thread. Uploads for at most
+	 * time_budget seconds, and returns the model once it is complete
+	 * (only once, a null pointer otherwise). Load errors are printed,
+	 * and the request is dropped. The frame after a swap, prints how
+	 * long the frames during the load were, to show any hitch.
+	 */
+	std::shared_ptr<ModelInterleavedArray> update(double time_budget);
+
+	inline bool isLoading() const { return pending.get() != NULL; }
+
+	/**
+	 * The file of the model last returned by update
+	 */
+	inline const std::string& getSwappedFilename() const { return swapped.filename; }
+
+private:
+	AssetManager(const AssetManager&);
+	AssetManager& operator=(const AssetManager&);
+
+	/**
+	 * A model on its way from the disk to the GPU
+	 */
+	struct PendingModel {
+		std::string filename;
+		std::string source; //< The file read, filename or its binary copy
+		std::string cache_file; //< The binary copy written by the worker, if any
+		MeshData data;
+		std::vector<MipChain> images; //< Per texture, no levels for none
+		std::shared_ptr<MeshBVH> bvh; //< Built or read from the cache by the worker
+		glm::vec3 min_position; //< Bounds of the vertices, computed by the worker
+		glm::vec3 max_position;
+		std::vector<glm::vec3> positions; //< Packed by the worker, see ModelInterleavedArray::getPositions
+		std::exception_ptr error;
+		std::atomic<bool> loaded; //< Set by the worker when data and images are ready
+		double request_time;
+		double load_time;
+
+		//Upload progress, only used by the render thread
+		std::shared_ptr<GLUtils::VBO> interleaved;
+		std::shared_ptr<GLUtils::VBO> indices;
+		std::shared_ptr<GLUtils::VBO> position_buffer;
+		std::shared_ptr<MaterialTextures> materials; //< Created once the buffers are filled
+		size_t vertex_bytes_done;
+		size_t index_bytes_done;
+		size_t position_bytes_done;
+		unsigned int texture; //< Texture being uploaded
+		unsigned int level; //< Its mip level being uploaded
+		unsigned int row; //< The next row of that level
+	};
+
+	void start(const std::string& filename);
+	static void load(PendingModel* model, ImportProfile profile, std::string cache_directory);
+
+	/**
+	 * Writes the mesh and textures of a loaded model to the cache directory
+	 */
+	static void writeBinaryCopy(PendingModel& model, ImportProfile profile, const std::string& cache_directory);
+
+	/**
+	 * Uploads one slice of at most upload_slice_bytes. Returns true when
+	 * everything is uploaded.
+	 */
+	bool uploadSlice(PendingModel& model);
+
+	/**
+	 * Frame times from a request until the frame after its swap, in seconds
+	 */
+	struct SwapStats {
+		SwapStats() : load_time(0.0), longest_frame(0.0), frame_time_sum(0.0), frames(0),
+			longest_upload(0.0), upload_frames(0), total_time(0.0) {}
+
+		std::string filename;
+		double load_time; //< On the worker thread
+		double longest_frame;
+		double frame_time_sum;
+		unsigned int frames;
+		double longest_upload; //< Upload time in one frame
+		unsigned int upload_frames;
+		double total_time; //< From the request to the swap
+		UploadStats textures;
+	};
+
+	ImportProfile profile;
+	std::string cache_directory;
+	std::map<std::string, std::string> cache_files; //< Model file to its binary copy
+	std::shared_ptr<PendingModel> pending;
+	std::shared_ptr<TextureUploader> uploader; //< Created on the first upload, which has a context
+	std::thread worker;
+	std::string next_request;
+
+	double last_frame_time;
+	SwapStats stats; //< Of the pending request
+	SwapStats swapped; //< Of the last swap, reported on the next frame
+	bool report_swap;
+};
+
+#endif
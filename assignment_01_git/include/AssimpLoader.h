@@ -0,0 +1,103 @@
+#ifndef _ASSIMPLOADER_H__
+#define _ASSIMPLOADER_H__
+
+#include <string>
+
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "MeshData.h"
+
+/**
+ * How much work is done on import. Assimp only runs cheap steps; the
+ * expensive ones are done by MeshProcessing and VertexWelder.
+ *
+ * fast: fan triangulation, area weighted normals if missing, no joining
+ * balanced: as fast, and identical vertices are joined
+ * quality: ear clipping, angle weighted normals, and Assimp validates the
+ *          data and removes invalid data and redundant materials
+ */
+enum ImportProfile {
+	IMPORT_FAST,
+	IMPORT_BALANCED,
+	IMPORT_QUALITY
+};
+
+/**
+ * Time spent in each import step, in seconds
+ */
+struct ImportTimings {
+	ImportTimings() : read(0.0), convert(0.0), triangulate(0.0), normals(0.0), join(0.0) {}
+
+	double read; //< importFile, including the Assimp steps
+	double convert; //< Copying from the Assimp scene
+	double triangulate;
+	double normals;
+	double join;
+};
+
+/**
+ * Reads models with Assimp into host memory, without touching OpenGL
+ */
+class AssimpLoader {
+public:
+	/**
+	 * Loads filename into data. Throws a GameException on errors.
+	 */
+	static void load(const std::string& filename, MeshData& data,
+			ImportProfile profile = IMPORT_BALANCED, ImportTimings* timings = NULL);
+
+	/**
+	 * aiImportFile through the VirtualFileSystem. The scene must be freed
+	 * with aiReleaseImport. Throws a GameException on errors.
+	 */
+	static const aiScene* importFile(const std::string& filename, unsigned int flags);
+
+	/**
+	 * The Assimp post-processing steps run for the profile
+	 */
+	static unsigned int getAssimpFlags(ImportProfile profile);
+
+	static const char* getProfileName(ImportProfile profile);
+
+	/**
+	 * Parses "fast", "balanced" or "quality". Throws a GameException otherwise.
+	 */
+	static ImportProfile parseProfile(const std::string& name);
+
+	/**
+	 * Appends the vertices and triangles of mesh to data, and points part
+	 * at them, for converters that go mesh by mesh
+	 */
+	static void loadMesh(
+		MeshPart& part,
+		ImportProfile profile,
+		ImportTimings& timings,
+		MeshData& data,
+		const aiScene* scene,
+		const aiMesh* mesh);
+
+	/**
+	 * The transform of node relative to its parent
+	 */
+	static glm::mat4 getTransform(const aiNode* node);
+
+private:
+	/**
+	 * Reads the bones of the meshes and the animations of the scene into
+	 * data.skeleton and data.weights, if any mesh has bones. Runs after
+	 * loadRecursive, and visits the meshes in the same order.
+	 */
+	static void loadSkeleton(const aiScene* scene, MeshData& data);
+
+	static void loadRecursive(
+		MeshPart& part,
+		ImportProfile profile,
+		ImportTimings& timings,
+		MeshData& data,
+		const aiScene* scene,
+		const aiNode* node);
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef _CLUSTEREDLIGHTS_H__
+#define _CLUSTEREDLIGHTS_H__
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "GLUtils/GLUtils.hpp"
+
+/**
+ * A point light. The first four floats are read four lights at a time
+ * with SSE, so position and radius must stay first and together.
+ */
+struct PointLight {
+	glm::vec3 position; //< World space
+	float radius; //< The light falls off to nothing at this distance
+	glm::vec3 color;
+	float padding;
+};
+
+/**
+ * What the last call to ClusteredLights::assign did, times in seconds
+ */
+struct ClusterStats {
+	ClusterStats() : lights(0), visible(0), indices(0), occupied(0), max_per_cluster(0),
+		assign(0.0), upload(0.0) {}
+
+	unsigned int lights;
+	unsigned int visible; //< Lights inside the view frustum
+	unsigned int indices; //< Light indices over all clusters
+	unsigned int occupied; //< Clusters with at least one light
+	unsigned int max_per_cluster;
+	double assign;
+	double upload;
+};
+
+/**
+ * Point lights for clustered forward shading. The view frustum is split
+ * into tiles_x by tiles_y screen tiles and slices exponential depth
+ * slices, and every frame each light is added to the list of every
+ * cluster its sphere overlaps. The Phong shader finds the cluster of a
+ * fragment from gl_FragCoord and its view depth, and only loops over the
+ * lights in it, so shading costs grow with the lights per cluster rather
+ * than with the total number of lights.
+ *
+ * Lights are transformed and bounded on the CPU four at a time with SSE.
+ * The view space lights, the offset and count of every cluster and the
+ * light indices are uploaded to three texture buffers.
+ */
+class ClusteredLights {
+public:
+	static const unsigned int tiles_x = 16;
+	static const unsigned int tiles_y = 9;
+	static const unsigned int slices = 24;
+	static const unsigned int max_lights = 65535; //< Indices are 16 bit
+
+	ClusteredLights();
+
+	/**
+	 * Adds a light. Throws a GameException beyond max_lights.
+	 */
+	void add(const PointLight& light);
+
+	void clear();
+
+	inline std::vector<PointLight>& getLights() { return lights; }
+
+	/**
+	 * Transforms the lights to view space and builds the cluster lists for
+	 * the given matrices, on the CPU only
+	 */
+	void assign(const glm::mat4& projection, const glm::mat4& view);
+
+	/**
+	 * Uploads what assign built to the texture buffers
+	 */
+	void upload();
+
+	/**
+	 * Binds the texture buffers to the three units from first_unit and sets
+	 * the uniforms of the program that is in use. Leaves GL_TEXTURE0 active.
+	 */
+	void bind(GLUtils::Program& program, unsigned int first_unit, unsigned int viewport_width, unsigned int viewport_height);
+
+	inline const ClusterStats& getStats() const { return stats; }
+
+private:
+	ClusteredLights(const ClusteredLights&);
+	ClusteredLights& operator=(const ClusteredLights&);
+
+	/**
+	 * The lights overlapping a range of tiles in one slice
+	 */
+	struct ClusterSpan {
+		unsigned short light; //< Into view_lights
+		unsigned char slice;
+		unsigned char x0, x1, y0, y1; //< Inclusive
+	};
+
+	/**
+	 * m is the upper 3x4 of the view matrix, row major
+	 */
+	void boundLights(const float* m, float x_scale, float y_scale);
+	void addSpans(unsigned int i, unsigned int light, unsigned int padded, float x_scale, float y_scale);
+	void createBuffers();
+
+	std::vector<PointLight> lights;
+
+	float near_plane, far_plane;
+	float slice_scale, slice_bias; //< slice = log(depth)*slice_scale + slice_bias
+
+	std::vector<float> bounds; //< View x, y, depth, radius and visibility of all lights, one array after the other
+	std::vector<float> view_lights; //< Per visible light: view position, radius, color, unused
+	std::vector<ClusterSpan> spans;
+	std::vector<unsigned int> clusters; //< Offset and count per cluster
+	std::vector<unsigned short> indices;
+
+	GLUtils::BufferHandle light_buffer, cluster_buffer, index_buffer;
+	GLUtils::TextureHandle light_texture, cluster_texture, index_texture;
+
+	ClusterStats stats;
+};
+
+#endif
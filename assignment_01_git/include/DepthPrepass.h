@@ -0,0 +1,98 @@
+#ifndef _DEPTHPREPASS_H__
+#define _DEPTHPREPASS_H__
+
+#include <string>
+
+#include "GLUtils/GLUtils.hpp"
+
+enum PrepassMode {
+	PREPASS_OFF,
+	PREPASS_ON,
+	PREPASS_AUTO //< On while the measured overdraw is high
+};
+
+/**
+ * The last overdraw measurements
+ */
+struct OverdrawStats {
+	OverdrawStats() : overdraw(0.0), depth_samples(0), shaded_samples(0), enabled(false), switches(0) {}
+
+	double overdraw; //< Fragments passing the depth test in draw order per visible pixel
+	unsigned int depth_samples; //< Passed the depth test in the last measured pre-pass
+	unsigned int shaded_samples; //< Passed the depth test in the last Phong pass, i.e., were shaded
+	bool enabled; //< The last frame used the pre-pass
+	unsigned int switches; //< Times auto mode turned the pre-pass on or off
+};
+
+/**
+ * Decides when the Phong pass is preceded by a depth-only pass, and
+ * counts fragments with GL_SAMPLES_PASSED queries to measure overdraw.
+ *
+ * With the pre-pass, the depth pass counts the fragments that pass the
+ * usual GL_LEQUAL test in draw order, which are the fragments the Phong
+ * pass would shade without it, and the GL_EQUAL Phong pass counts the
+ * visible pixels. Their ratio is the overdraw. In auto mode a frame is
+ * drawn with the pre-pass every probe_interval frames to measure it, and
+ * the pre-pass stays on while the overdraw is above enable_overdraw and
+ * until it drops below disable_overdraw.
+ *
+ * Results are read frames_in_flight frames later, so that we do not wait
+ * for the GPU.
+ */
+class DepthPrepass {
+public:
+	static const unsigned int frames_in_flight = 3;
+	static const unsigned int probe_interval = 60;
+
+	DepthPrepass();
+
+	void setMode(PrepassMode mode);
+	inline PrepassMode getMode() const { return mode; }
+
+	static const char* getModeName(PrepassMode mode);
+
+	/**
+	 * Parses "off", "on" or "auto". Throws a GameException otherwise.
+	 */
+	static PrepassMode parseMode(const std::string& name);
+
+	/**
+	 * Reads the queries of an earlier frame, and returns whether this
+	 * frame should draw the pre-pass. Never does if it is not supported
+	 * for the current model.
+	 */
+	bool beginFrame(bool supported);
+
+	void beginDepthPass();
+	void endDepthPass();
+	void beginShadingPass();
+
+	/**
+	 * Ends the frame started by beginFrame
+	 */
+	void endShadingPass();
+
+	inline const OverdrawStats& getStats() const { return stats; }
+
+private:
+	DepthPrepass(const DepthPrepass&);
+	DepthPrepass& operator=(const DepthPrepass&);
+
+	struct FrameQueries {
+		GLUtils::QueryHandle depth;
+		GLUtils::QueryHandle shading;
+		bool prepass; //< Both queries were issued, not just shading
+		bool pending; //< Issued, but not read yet
+	};
+
+	void readResults(FrameQueries& frame);
+
+	PrepassMode mode;
+	bool auto_enabled; //< Auto mode found the overdraw high
+	unsigned int frame_count;
+	unsigned int current; //< Queries of this frame
+	FrameQueries frames[frames_in_flight];
+	OverdrawStats stats;
+};
+
+#endif
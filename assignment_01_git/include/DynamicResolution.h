@@ -0,0 +1,117 @@
+#ifndef _DYNAMICRESOLUTION_H__
+#define _DYNAMICRESOLUTION_H__
+
+#include <string>
+
+#include "GLUtils/GLUtils.hpp"
+
+enum UpscaleFilter {
+	UPSCALE_BILINEAR,
+	UPSCALE_SHARPEN //< Bilinear followed by an unsharp mask
+};
+
+/**
+ * The resolution chosen for the last frame, times in seconds
+ */
+struct ResolutionStats {
+	ResolutionStats() : scale(1.0f), width(0), height(0), gpu_time(0.0), target(0.0), changes(0) {}
+
+	float scale; //< Of the window width and height
+	unsigned int width, height;
+	double gpu_time; //< Of the last measured frame, at the scale it was rendered with
+	double target;
+	unsigned int changes; //< Times the scale has changed
+};
+
+/**
+ * Renders frames into an offscreen framebuffer at a resolution that
+ * follows the GPU time, so that heavy models stay interactive on slow
+ * GPUs, and upscales them to the window.
+ *
+ * The framebuffer is allocated at the window size once, and frames are
+ * rendered to the lower left part of it, so that changing the scale
+ * costs nothing. GL_TIME_ELAPSED queries are read frames_in_flight
+ * frames later. The GPU time is taken to grow with the number of pixels,
+ * so the scale is lowered when a frame is over the target and raised when
+ * it is well under it, by the square root of the ratio, within
+ * [min_scale, max_scale] and in steps of scale_step. After a change the
+ * scale is held until frames at the new scale have been measured.
+ */
+class DynamicResolution {
+public:
+	static const unsigned int frames_in_flight = 3;
+
+	DynamicResolution(unsigned int window_width, unsigned int window_height);
+
+	/**
+	 * Sets the GPU time per frame to hold, in seconds. 0 disables scaling
+	 * and rendering goes straight to the window again.
+	 */
+	void setTarget(double seconds);
+
+	inline bool isEnabled() const { return target > 0.0; }
+
+	void setFilter(UpscaleFilter filter);
+	inline UpscaleFilter getFilter() const { return filter; }
+
+	static const char* getFilterName(UpscaleFilter filter);
+
+	/**
+	 * Parses "bilinear" or "sharpen". Throws a GameException otherwise.
+	 */
+	static UpscaleFilter parseFilter(const std::string& name);
+
+	/**
+	 * Sets the bounds of the scale, within (0, 1]
+	 */
+	void setBounds(float min_scale, float max_scale);
+
+	/**
+	 * The size frames are rendered at, the window size when disabled
+	 */
+	inline unsigned int getWidth() const { return isEnabled() ? stats.width : window_width; }
+	inline unsigned int getHeight() const { return isEnabled() ? stats.height : window_height; }
+
+	/**
+	 * Binds the offscreen framebuffer and its viewport, and starts timing the frame
+	 */
+	void beginFrame();
+
+	/**
+	 * Stops timing, and draws the frame to the window with program (made
+	 * from shaders/upscale.*), reading it from the given texture unit.
+	 * Leaves program in use.
+	 */
+	void endFrame(GLUtils::Program& program, unsigned int texture_unit);
+
+	inline const ResolutionStats& getStats() const { return stats; }
+
+private:
+	DynamicResolution(const DynamicResolution&);
+	DynamicResolution& operator=(const DynamicResolution&);
+
+	struct FrameQuery {
+		GLUtils::QueryHandle query;
+		bool pending;
+	};
+
+	void createFramebuffer();
+	void update(double gpu_time);
+	void setScale(float scale);
+
+	unsigned int window_width, window_height;
+	double target;
+	UpscaleFilter filter;
+	float min_scale, max_scale;
+	unsigned int hold; //< Frames left before the scale may change again
+	unsigned int current; //< Query of this frame
+	FrameQuery frames[frames_in_flight];
+
+	GLUtils::FramebufferHandle framebuffer;
+	GLUtils::TextureHandle color, depth;
+	GLUtils::VertexArrayHandle empty_vao; //< The upscaling triangle has no attributes
+
+	ResolutionStats stats;
+};
+
+#endif
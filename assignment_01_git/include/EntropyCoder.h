@@ -0,0 +1,106 @@
+#ifndef _ENTROPYCODER_H__
+#define _ENTROPYCODER_H__
+
+#include <cstring>
+#include <vector>
+
+#include "GameException.h"
+
+/**
+ * Appends bytes and varints to a buffer
+ */
+class ByteWriter {
+public:
+	ByteWriter(std::vector<unsigned char>& out) : out(out) {}
+
+	inline void put(unsigned char byte) {
+		out.push_back(byte);
+	}
+
+	inline void putBytes(const void* data, size_t bytes) {
+		const unsigned char* p = static_cast<const unsigned char*>(data);
+		out.insert(out.end(), p, p + bytes);
+	}
+
+	inline void putVarint(unsigned long long value) {
+		while (value >= 0x80) {
+			out.push_back(static_cast<unsigned char>(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<unsigned char>(value));
+	}
+
+private:
+	std::vector<unsigned char>& out;
+};
+
+/**
+ * Reads bytes and varints from memory. Throws a GameException when
+ * reading past the end.
+ */
+class ByteReader {
+public:
+	ByteReader(const unsigned char* begin, const unsigned char* end) : p(begin), end(end) {}
+
+	inline unsigned char get() {
+		check(1);
+		return *p++;
+	}
+
+	inline void getBytes(void* data, size_t bytes) {
+		check(bytes);
+		memcpy(data, p, bytes);
+		p += bytes;
+	}
+
+	inline unsigned long long getVarint() {
+		unsigned long long value = 0;
+		for (unsigned int shift = 0; shift < 64; shift += 7) {
+			unsigned char byte = get();
+			value |= static_cast<unsigned long long>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				return value;
+		}
+		THROW_EXCEPTION("Corrupt varint");
+	}
+
+	inline const unsigned char* skip(size_t bytes) {
+		check(bytes);
+		const unsigned char* result = p;
+		p += bytes;
+		return result;
+	}
+
+private:
+	inline void check(size_t bytes) {
+		if (static_cast<size_t>(end - p) < bytes)
+			THROW_EXCEPTION("Truncated data");
+	}
+
+	const unsigned char* p;
+	const unsigned char* end;
+};
+
+/**
+ * Order-0 rANS coder for byte streams (12 bit frequencies). Streams
+ * with a single symbol are stored as that symbol, and streams that
+ * do not get smaller are stored raw, so encoding never expands data
+ * by more than a few bytes. Used by GeometryCodec and Archive.
+ */
+class EntropyCoder {
+public:
+	static void encode(const unsigned char* data, size_t n, ByteWriter& out);
+
+	static inline void encode(const std::vector<unsigned char>& data, ByteWriter& out) {
+		encode(data.data(), data.size(), out);
+	}
+
+	/**
+	 * Decodes one stream written by encode into data. Throws a
+	 * GameException on corrupt input, and on streams longer than
+	 * max_size, before allocating them.
+	 */
+	static void decode(ByteReader& in, std::vector<unsigned char>& data, size_t max_size);
+};
+
+#endif
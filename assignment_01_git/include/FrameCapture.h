@@ -0,0 +1,125 @@
+#ifndef _FRAMECAPTURE_H__
+#define _FRAMECAPTURE_H__
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "GLUtils/GLUtils.hpp"
+#include "ThreadPool.h"
+
+/**
+ * What the captures since the last resetStats did, times in seconds
+ */
+struct CaptureStats {
+	CaptureStats() : frames(0), read_time(0.0), retrieve_time(0.0), write_time(0.0), latency(0), stalls(0) {}
+
+	unsigned int frames; //< Read back and handed to the writer
+	double read_time; //< Issuing glReadPixels
+	double retrieve_time; //< Copying finished readbacks out of the pixel buffers
+	double write_time; //< Writing files, on the writer thread
+	unsigned int latency; //< Frames from the last readback until it was retrieved
+	unsigned int stalls; //< Waits for a readback because all pixel buffers were in flight
+};
+
+/**
+ * Screenshots and video capture without stalling the frame.
+ *
+ * glReadPixels reads the frame into a ring of pixel buffer objects
+ * (GL_PIXEL_PACK_BUFFER), so it returns at once, and a fence is issued
+ * after it. Later frames poll the fences, and once the GPU is done, a
+ * readback is mapped, copied out and written to a file on a writer
+ * thread, usually one or two frames later. Only when every pixel buffer
+ * is in flight does a frame wait for the oldest one.
+ *
+ * Frames are written as uncompressed 24 bit TGA files: screenshots as
+ * screenshot_<n>.tga, and recorded video as one numbered file per frame,
+ * frame_<n>.tga, to be encoded with an external tool.
+ */
+class FrameCapture {
+public:
+	static const unsigned int buffers = 3;
+
+	/**
+	 * Does not touch OpenGL, the pixel buffers are created on the first capture
+	 */
+	FrameCapture(unsigned int width, unsigned int height);
+
+	/**
+	 * Waits for the writer thread, see finish for the readbacks
+	 */
+	~FrameCapture();
+
+	/**
+	 * Where the files are written, empty for the working directory.
+	 * Must end with a path separator.
+	 */
+	void setDirectory(const std::string& directory);
+
+	/**
+	 * Captures the next frame
+	 */
+	void screenshot();
+
+	/**
+	 * Captures every frame while recording
+	 */
+	void setRecording(bool recording);
+	inline bool isRecording() const { return recording; }
+
+	/**
+	 * Call once the frame is drawn to the window, before it is swapped.
+	 * Reads it back if a capture is due, and retrieves earlier readbacks
+	 * that the GPU has finished.
+	 */
+	void endFrame();
+
+	/**
+	 * Retrieves all readbacks in flight, and waits until they are written
+	 */
+	void finish();
+
+	CaptureStats getStats() const;
+	void resetStats();
+
+private:
+	FrameCapture(const FrameCapture&);
+	FrameCapture& operator=(const FrameCapture&);
+
+	struct Readback {
+		Readback() : fence(0), frame(0) {}
+
+		GLUtils::BufferHandle buffer;
+		GLsync fence; //< 0 when not in flight
+		unsigned int frame; //< When it was read
+		std::vector<std::string> filenames; //< A screenshot, a video frame, or both
+	};
+
+	/**
+	 * Copies a finished readback out of its buffer, and hands it to the writer
+	 */
+	void retrieve(Readback& readback);
+
+	/**
+	 * Writes bottom up BGRA pixels as a TGA file
+	 */
+	static void writeTga(const std::string& filename, unsigned int width, unsigned int height,
+		const std::vector<unsigned char>& pixels);
+
+	unsigned int width, height;
+	std::string directory;
+	bool screenshot_requested;
+	bool recording;
+	unsigned int frame; //< Frames seen by endFrame
+	unsigned int screenshots, video_frames; //< Numbers of the next files
+
+	Readback readbacks[buffers];
+	unsigned int oldest; //< Readback retrieved next
+	unsigned int in_flight;
+
+	CaptureStats stats;
+	std::atomic<long long> write_microseconds; //< Summed by the writer thread
+	ThreadPool writer; //< One thread, so that writing takes at most one core from rendering
+};
+
+#endif
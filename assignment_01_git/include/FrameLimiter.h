@@ -0,0 +1,95 @@
+#ifndef _FRAMELIMITER_H_
+#define _FRAMELIMITER_H_
+
+#include "Timer.h"
+
+/**
+ * Statistics for the frames run since the last report
+ */
+struct FrameStats {
+	FrameStats() {
+		frames = 0;
+		rendered = 0;
+		skipped = 0;
+		late = 0;
+		cpu_time = 0.0;
+		elapsed = 0.0;
+	}
+
+	unsigned int frames; //< Iterations of the main loop
+	unsigned int rendered; //< Frames that were rendered and swapped
+	unsigned int skipped; //< Frames that were not redrawn because nothing changed
+	unsigned int late; //< Frames that missed their deadline
+	double cpu_time; //< Seconds spent working (not sleeping or swapping)
+	double elapsed; //< Wall clock seconds covered by these stats
+};
+
+/**
+ * Keeps the main loop at a target frame rate by sleeping between frames.
+ * The OS sleep is only used for the coarse part of the wait, and the
+ * margin left for the scheduler is adapted to the oversleep we measure,
+ * so that the last part can be spun away with high precision.
+ */
+class FrameLimiter {
+public:
+	/**
+	 * Constructor
+	 * @param fps the target frame rate, 0 disables the limiter
+	 */
+	FrameLimiter(double fps=60.0);
+	~FrameLimiter();
+
+	/**
+	 * Sets the target frame rate, 0 disables the limiter
+	 */
+	void setTargetFrameRate(double fps);
+	inline double getTargetFrameRate() const { return target_fps; }
+
+	/**
+	 * Marks the start of the CPU work for a frame
+	 */
+	void beginFrame();
+
+	/**
+	 * Marks the end of the CPU work for a frame. Call this before swapping
+	 * buffers, so that waiting for vsync is not counted as CPU time.
+	 */
+	void endWork();
+
+	/**
+	 * Counts the frame as rendered or skipped
+	 */
+	inline void frameRendered() { ++current.rendered; }
+	inline void frameSkipped() { ++current.skipped; }
+
+	/**
+	 * Milliseconds until the next frame is due. Used to block on input
+	 * instead of spinning when there is nothing to draw.
+	 */
+	unsigned int getMillisecondsToNextFrame() const;
+
+	/**
+	 * Sleeps until the next frame is due
+	 */
+	void waitForNextFrame();
+
+	/**
+	 * Fills stats with the frames of the last second and starts a new
+	 * period. Returns false if a second has not passed yet.
+	 */
+	bool getStats(FrameStats& stats);
+
+private:
+	void sleepUntil(double deadline);
+
+	double target_fps;
+	double frame_period; //< Seconds per frame, 0 when unlimited
+	double next_deadline; //< Time at which the next frame should start
+	double sleep_margin; //< Seconds we expect the OS sleep to overshoot
+	double work_begin;
+
+	Timer stats_timer;
+	FrameStats current;
+};
+
+#endif // _FRAMELIMITER_H_
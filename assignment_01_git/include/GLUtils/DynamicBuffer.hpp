@@ -0,0 +1,189 @@
+#ifndef _DYNAMICBUFFER_HPP__
+#define _DYNAMICBUFFER_HPP__
+
+#include "GameException.h"
+#include "GLUtils/Handles.hpp"
+
+#include <sstream>
+
+#include <GL/glew.h>
+
+namespace GLUtils {
+
+/**
+ * Buffer for data that is rewritten every frame, e.g., animated vertices.
+ * The buffer is split into three regions used round robin, and each region
+ * is fenced when the frame that used it is submitted. The CPU only waits
+ * if the GPU is still reading the region we are about to overwrite, which
+ * with three regions means it is more than two frames behind.
+ * Uses persistent mapping (ARB_buffer_storage) when available, and
+ * unsynchronized glMapBufferRange otherwise.
+ */
+class DynamicBuffer {
+public:
+	static const unsigned int regions = 3;
+
+	DynamicBuffer(unsigned int region_bytes, int mode=GL_ARRAY_BUFFER) {
+		region_size = region_bytes;
+		region = 0;
+		cursor = 0;
+		persistent_ptr = NULL;
+		mapped = false;
+		stalls = 0;
+		frame_bytes = 0;
+		frame_stalls = 0;
+		last_frame_bytes = 0;
+		last_frame_stalls = 0;
+		for (unsigned int i=0; i<regions; ++i)
+			fences[i] = 0;
+
+		buffer.create(mode);
+		if (GLEW_ARB_buffer_storage) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			bind();
+			glBufferStorage(mode, regions*region_size, NULL, flags);
+			buffer.setBytes(regions*region_size);
+			persistent_ptr = static_cast<char*>(glMapBufferRange(mode, 0, regions*region_size, flags));
+			if (persistent_ptr == NULL)
+				THROW_EXCEPTION("Unable to persistently map dynamic buffer");
+		} else {
+			buffer.data(regions*region_size, NULL, GL_STREAM_DRAW);
+		}
+		unbind();
+	}
+
+	~DynamicBuffer() {
+		for (unsigned int i=0; i<regions; ++i)
+			if (fences[i] != 0) glDeleteSync(fences[i]);
+		if (persistent_ptr != NULL) {
+			bind();
+			glUnmapBuffer(buffer.target());
+			unbind();
+		}
+	}
+
+	/**
+	 * Reserves bytes in the region of the current frame and returns
+	 * a pointer to write them through. The byte offset of the data
+	 * in the buffer (for attribute pointers and draw calls) is
+	 * returned in offset. Call unmap() when done writing.
+	 */
+	void* map(unsigned int bytes, unsigned int& offset) {
+		if (cursor + bytes > region_size) {
+			std::stringstream err;
+			err << "Dynamic buffer region overflow: " << cursor + bytes << " > " << region_size << " bytes";
+			THROW_EXCEPTION(err.str());
+		}
+		if (cursor == 0)
+			waitForRegion();
+
+		offset = region*region_size + cursor;
+		cursor += bytes;
+		frame_bytes += bytes;
+
+		if (persistent_ptr != NULL)
+			return persistent_ptr + offset;
+
+		// The fences guarantee the GPU is done with this range, so the
+		// driver does not have to synchronize or preserve the old contents
+		bind();
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+		void* ptr = glMapBufferRange(buffer.target(), offset, bytes, flags);
+		if (ptr == NULL)
+			THROW_EXCEPTION("Unable to map dynamic buffer");
+		mapped = true;
+		return ptr;
+	}
+
+	/**
+	 * Finishes writing the range returned by map()
+	 */
+	void unmap() {
+		if (!mapped) return;
+		bind();
+		glUnmapBuffer(buffer.target());
+		mapped = false;
+	}
+
+	/**
+	 * Call after the draw calls that read the current region have been
+	 * issued. Fences the region and moves on to the next one.
+	 */
+	void endFrame() {
+		if (cursor > 0) {
+			if (fences[region] != 0) glDeleteSync(fences[region]);
+			fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			region = (region + 1) % regions;
+			cursor = 0;
+		}
+		last_frame_bytes = frame_bytes;
+		last_frame_stalls = frame_stalls;
+		frame_bytes = 0;
+		frame_stalls = 0;
+	}
+
+	inline void bind() {
+		buffer.bind();
+	}
+
+	inline void unbind() {
+		buffer.unbind();
+	}
+
+	inline GLuint name() {
+		return buffer.name();
+	}
+
+	/**
+	 * Bytes of all regions, as recorded in the MemoryLedger
+	 */
+	inline long long bytes() {
+		return buffer.bytes();
+	}
+
+	inline bool isPersistent() { return persistent_ptr != NULL; }
+	inline unsigned int getRegionSize() { return region_size; }
+	inline unsigned int getStalls() const { return stalls; }
+	inline unsigned int getLastFrameStalls() { return last_frame_stalls; }
+	inline unsigned int getLastFrameBytes() { return last_frame_bytes; }
+
+private:
+	DynamicBuffer(const DynamicBuffer&);
+	DynamicBuffer& operator=(const DynamicBuffer&);
+
+	void waitForRegion() {
+		GLsync fence = fences[region];
+		if (fence == 0) return;
+
+		// Poll first, so that we only count real stalls
+		GLenum result = glClientWaitSync(fence, 0, 0);
+		if (result == GL_TIMEOUT_EXPIRED) {
+			++stalls;
+			++frame_stalls;
+			do {
+				result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			} while (result == GL_TIMEOUT_EXPIRED);
+		}
+		if (result == GL_WAIT_FAILED)
+			THROW_EXCEPTION("glClientWaitSync failed");
+
+		glDeleteSync(fence);
+		fences[region] = 0;
+	}
+
+	BufferHandle buffer; //< Buffer name and target
+	unsigned int region_size; //< Bytes per region
+	unsigned int region; //< Region written this frame
+	unsigned int cursor; //< Bytes used of the current region
+	GLsync fences[regions]; //< Fence for the last frame that used each region
+	char* persistent_ptr; //< Start of the buffer if persistently mapped
+	bool mapped;
+
+	unsigned int stalls; //< Total number of times we waited for the GPU
+	unsigned int frame_bytes, frame_stalls;
+	unsigned int last_frame_bytes, last_frame_stalls;
+};
+
+};//namespace GLUtils
+
+#endif
@@ -7,12 +7,18 @@
 #include <assert.h>
 #include <iostream>
 #include <fstream>
+#include <memory>
 
 #include <GL/glew.h>
 
 #include "GLUtils/Program.hpp"
 #include "GLUtils/VBO.hpp"
+#include "GLUtils/DynamicBuffer.hpp"
+#include "GLUtils/Handles.hpp"
+#include "GLUtils/MemoryLedger.hpp"
+#include "GLUtils/ProgramCache.hpp"
 #include "GameException.h"
+#include "VirtualFileSystem.h"
 
 namespace GLUtils {
 
@@ -28,36 +34,42 @@ inline void checkGLErrors(const char* file, unsigned int line) {
 #define CHECK_GL_ERROR() GLUtils::checkGLErrors(__FILE__, __LINE__)
 
 
+/**
+ * Reads a whole file through the VirtualFileSystem, so that it may come
+ * from a mounted archive. Throws a GameException if it does not exist.
+ */
 inline std::string readFile(std::string file) {
-	int length;
-	std::string buffer;
-	std::string contents;
-
-	std::ifstream is;
-	is.open(file.c_str());
-
-	if (!is.good()) {
-		std::string err = "Could not open ";
-		err.append(file);
-		THROW_EXCEPTION(err);
-	}
-
-	// get length of file:
-	is.seekg (0, std::ios::end);
-	length = static_cast<int>(is.tellg());
-	is.seekg (0, std::ios::beg);
+	std::shared_ptr<VirtualFile> contents = VirtualFileSystem::open(file);
+	return std::string(contents->data(), contents->size());
+}
 
-	// reserve memory:
-	contents.reserve(length);
+/**
+ * Reads a shader source like readFile, and replaces every line
+ * #include "name" by the source of name, relative to the directory of file.
+ * Included files may include others, but not themselves.
+ */
+inline std::string readShader(std::string file, unsigned int depth=0) {
+	if (depth > 8)
+		THROW_EXCEPTION("Shader includes nested too deep in " + file);
 
-	// read data
-	while(getline(is,buffer)) {
-		contents.append(buffer);
-		contents.append("\n");
+	std::string directory = file.substr(0, file.find_last_of('/') + 1);
+	std::istringstream in(readFile(file));
+	std::string source, line;
+	while (std::getline(in, line)) {
+		size_t start = line.find_first_not_of(" \t");
+		if (start != std::string::npos && line.compare(start, 8, "#include") == 0) {
+			size_t first = line.find('"', start);
+			size_t last = (first == std::string::npos) ? first : line.find('"', first + 1);
+			if (last == std::string::npos)
+				THROW_EXCEPTION("Malformed #include in " + file + ": " + line);
+			source += readShader(directory + line.substr(first + 1, last - first - 1), depth + 1);
+		}
+		else {
+			source += line;
+		}
+		source += '\n';
 	}
-	is.close();
-
-	return contents;
+	return source;
 }
 }; //Namespace GLUtils
 
@@ -0,0 +1,294 @@
+#ifndef _HANDLES_HPP__
+#define _HANDLES_HPP__
+
+#include "GameException.h"
+#include "GLUtils/MemoryLedger.hpp"
+
+#include <utility>
+
+#include <GL/glew.h>
+
+namespace GLUtils {
+
+/**
+ * Move-only owner of an OpenGL object name. The object is deleted
+ * when the handle goes out of scope, and creation, deletion and the
+ * memory the object uses are reported to the MemoryLedger.
+ * Traits supplies the ledger type and how to delete the object.
+ */
+template <class Traits>
+class Handle {
+public:
+	Handle() : handle_name(0), handle_bytes(0) {}
+
+	Handle(Handle&& other) : handle_name(other.handle_name), handle_bytes(other.handle_bytes) {
+		other.handle_name = 0;
+		other.handle_bytes = 0;
+	}
+
+	Handle& operator=(Handle&& other) {
+		if (this != &other) {
+			reset();
+			handle_name = other.handle_name;
+			handle_bytes = other.handle_bytes;
+			other.handle_name = 0;
+			other.handle_bytes = 0;
+		}
+		return *this;
+	}
+
+	~Handle() {
+		reset();
+	}
+
+	/**
+	 * Deletes the OpenGL object, if any
+	 */
+	void reset() {
+		if (handle_name == 0) return;
+		setBytes(0);
+		Traits::destroy(handle_name);
+		MemoryLedger::get().destroyed(Traits::type);
+		handle_name = 0;
+	}
+
+	/**
+	 * Sets the number of bytes of GPU memory the object uses
+	 */
+	void setBytes(long long bytes) {
+		MemoryLedger::get().account(Traits::type, bytes - handle_bytes);
+		handle_bytes = bytes;
+	}
+
+	inline GLuint name() const { return handle_name; }
+	inline long long bytes() const { return handle_bytes; }
+	inline bool valid() const { return handle_name != 0; }
+
+protected:
+	/**
+	 * Takes ownership of a newly created object
+	 */
+	void adopt(GLuint name) {
+		reset();
+		if (name == 0)
+			THROW_EXCEPTION("Unable to create OpenGL object");
+		handle_name = name;
+		MemoryLedger::get().created(Traits::type);
+	}
+
+	GLuint handle_name;
+	long long handle_bytes;
+
+private:
+	Handle(const Handle&);
+	Handle& operator=(const Handle&);
+};
+
+struct BufferTraits {
+	static const MemoryLedger::ObjectType type = MemoryLedger::LEDGER_BUFFER;
+	static inline void destroy(GLuint name) { glDeleteBuffers(1, &name); }
+};
+
+struct TextureTraits {
+	static const MemoryLedger::ObjectType type = MemoryLedger::LEDGER_TEXTURE;
+	static inline void destroy(GLuint name) { glDeleteTextures(1, &name); }
+};
+
+struct ShaderTraits {
+	static const MemoryLedger::ObjectType type = MemoryLedger::LEDGER_SHADER;
+	static inline void destroy(GLuint name) { glDeleteShader(name); }
+};
+
+struct ProgramTraits {
+	static const MemoryLedger::ObjectType type = MemoryLedger::LEDGER_PROGRAM;
+	static inline void destroy(GLuint name) { glDeleteProgram(name); }
+};
+
+struct VertexArrayTraits {
+	static const MemoryLedger::ObjectType type = MemoryLedger::LEDGER_VERTEX_ARRAY;
+	static inline void destroy(GLuint name) { glDeleteVertexArrays(1, &name); }
+};
+
+struct FramebufferTraits {
+	static const MemoryLedger::ObjectType type = MemoryLedger::LEDGER_FRAMEBUFFER;
+	static inline void destroy(GLuint name) { glDeleteFramebuffers(1, &name); }
+};
+
+struct QueryTraits {
+	static const MemoryLedger::ObjectType type = MemoryLedger::LEDGER_QUERY;
+	static inline void destroy(GLuint name) { glDeleteQueries(1, &name); }
+};
+
+/**
+ * Buffer object that remembers the target it is used with,
+ * so that bind and unbind always affect the same binding point
+ */
+class BufferHandle : public Handle<BufferTraits> {
+public:
+	BufferHandle() : buffer_target(GL_ARRAY_BUFFER) {}
+
+	explicit BufferHandle(GLenum target) {
+		create(target);
+	}
+
+	BufferHandle(BufferHandle&& other) : Handle<BufferTraits>(std::move(other)), buffer_target(other.buffer_target) {}
+
+	BufferHandle& operator=(BufferHandle&& other) {
+		buffer_target = other.buffer_target;
+		Handle<BufferTraits>::operator=(std::move(other));
+		return *this;
+	}
+
+	void create(GLenum target) {
+		GLuint name = 0;
+		glGenBuffers(1, &name);
+		adopt(name);
+		buffer_target = target;
+	}
+
+	/**
+	 * (Re)allocates the buffer storage. Binds the buffer.
+	 */
+	void data(GLsizeiptr bytes, const void* data, GLenum usage) {
+		bind();
+		glBufferData(buffer_target, bytes, data, usage);
+		setBytes(bytes);
+	}
+
+	inline void bind() const { glBindBuffer(buffer_target, handle_name); }
+	inline void unbind() const { glBindBuffer(buffer_target, 0); }
+	inline GLenum target() const { return buffer_target; }
+
+private:
+	GLenum buffer_target;
+};
+
+/**
+ * Texture object that remembers its target
+ */
+class TextureHandle : public Handle<TextureTraits> {
+public:
+	TextureHandle() : texture_target(GL_TEXTURE_2D) {}
+
+	explicit TextureHandle(GLenum target) {
+		create(target);
+	}
+
+	TextureHandle(TextureHandle&& other) : Handle<TextureTraits>(std::move(other)), texture_target(other.texture_target) {}
+
+	TextureHandle& operator=(TextureHandle&& other) {
+		texture_target = other.texture_target;
+		Handle<TextureTraits>::operator=(std::move(other));
+		return *this;
+	}
+
+	void create(GLenum target) {
+		GLuint name = 0;
+		glGenTextures(1, &name);
+		adopt(name);
+		texture_target = target;
+	}
+
+	inline void bind() const { glBindTexture(texture_target, handle_name); }
+	inline void unbind() const { glBindTexture(texture_target, 0); }
+	inline GLenum target() const { return texture_target; }
+
+private:
+	GLenum texture_target;
+};
+
+class ShaderHandle : public Handle<ShaderTraits> {
+public:
+	ShaderHandle() {}
+
+	explicit ShaderHandle(GLenum type) {
+		adopt(glCreateShader(type));
+	}
+
+	ShaderHandle(ShaderHandle&& other) : Handle<ShaderTraits>(std::move(other)) {}
+
+	ShaderHandle& operator=(ShaderHandle&& other) {
+		Handle<ShaderTraits>::operator=(std::move(other));
+		return *this;
+	}
+};
+
+class ProgramHandle : public Handle<ProgramTraits> {
+public:
+	ProgramHandle() {}
+
+	ProgramHandle(ProgramHandle&& other) : Handle<ProgramTraits>(std::move(other)) {}
+
+	ProgramHandle& operator=(ProgramHandle&& other) {
+		Handle<ProgramTraits>::operator=(std::move(other));
+		return *this;
+	}
+
+	void create() {
+		adopt(glCreateProgram());
+	}
+};
+
+class VertexArrayHandle : public Handle<VertexArrayTraits> {
+public:
+	VertexArrayHandle() {}
+
+	VertexArrayHandle(VertexArrayHandle&& other) : Handle<VertexArrayTraits>(std::move(other)) {}
+
+	VertexArrayHandle& operator=(VertexArrayHandle&& other) {
+		Handle<VertexArrayTraits>::operator=(std::move(other));
+		return *this;
+	}
+
+	void create() {
+		GLuint name = 0;
+		glGenVertexArrays(1, &name);
+		adopt(name);
+	}
+
+	inline void bind() const { glBindVertexArray(handle_name); }
+	static inline void unbind() { glBindVertexArray(0); }
+};
+
+class FramebufferHandle : public Handle<FramebufferTraits> {
+public:
+	FramebufferHandle() {}
+
+	FramebufferHandle(FramebufferHandle&& other) : Handle<FramebufferTraits>(std::move(other)) {}
+
+	FramebufferHandle& operator=(FramebufferHandle&& other) {
+		Handle<FramebufferTraits>::operator=(std::move(other));
+		return *this;
+	}
+
+	void create() {
+		GLuint name = 0;
+		glGenFramebuffers(1, &name);
+		adopt(name);
+	}
+
+	inline void bind(GLenum target = GL_FRAMEBUFFER) const { glBindFramebuffer(target, handle_name); }
+	static inline void unbind(GLenum target = GL_FRAMEBUFFER) { glBindFramebuffer(target, 0); }
+};
+
+class QueryHandle : public Handle<QueryTraits> {
+public:
+	QueryHandle() {}
+
+	QueryHandle(QueryHandle&& other) : Handle<QueryTraits>(std::move(other)) {}
+
+	QueryHandle& operator=(QueryHandle&& other) {
+		Handle<QueryTraits>::operator=(std::move(other));
+		return *this;
+	}
+
+	void create() {
+		GLuint name = 0;
+		glGenQueries(1, &name);
+		adopt(name);
+	}
+};
+
+};//namespace GLUtils
+
+#endif
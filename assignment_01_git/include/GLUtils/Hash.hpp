@@ -0,0 +1,27 @@
+#ifndef _HASH_HPP__
+#define _HASH_HPP__
+
+#include <cstddef>
+#include <string>
+
+namespace GLUtils {
+
+/**
+ * 64 bit FNV-1a hash
+ */
+inline unsigned long long hashBytes(const void* data, size_t bytes, unsigned long long hash=14695981039346656037ULL) {
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	for (size_t i=0; i<bytes; ++i) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+inline unsigned long long hashString(const std::string& str, unsigned long long hash=14695981039346656037ULL) {
+	return hashBytes(str.data(), str.size(), hash);
+}
+
+};//namespace GLUtils
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef _MEMORYLEDGER_HPP__
+#define _MEMORYLEDGER_HPP__
+
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX //< Keeps std::min and std::max usable in the files that include us
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#endif
+
+#include <GL/glew.h>
+
+namespace GLUtils {
+
+/**
+ * Book keeping of the OpenGL objects and GPU memory we have allocated.
+ * All the GLUtils handles report here, so after unloading a model
+ * the ledger should be back where it was before it was loaded.
+ */
+class MemoryLedger {
+public:
+	enum ObjectType {
+		LEDGER_BUFFER = 0,
+		LEDGER_TEXTURE,
+		LEDGER_SHADER,
+		LEDGER_PROGRAM,
+		LEDGER_VERTEX_ARRAY,
+		LEDGER_FRAMEBUFFER,
+		LEDGER_QUERY,
+		LEDGER_TYPES
+	};
+
+	static MemoryLedger& get() {
+		static MemoryLedger ledger;
+		return ledger;
+	}
+
+	inline void created(ObjectType type) {
+		std::lock_guard<std::mutex> lock(mutex);
+		++objects[type];
+	}
+
+	inline void destroyed(ObjectType type) {
+		std::lock_guard<std::mutex> lock(mutex);
+		--objects[type];
+	}
+
+	/**
+	 * Adjusts the number of bytes used by objects of the given type
+	 */
+	inline void account(ObjectType type, long long bytes) {
+		std::lock_guard<std::mutex> lock(mutex);
+		this->bytes[type] += bytes;
+	}
+
+	inline long long getObjects(ObjectType type) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return objects[type];
+	}
+
+	inline long long getBytes(ObjectType type) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return bytes[type];
+	}
+
+	inline long long getTotalBytes() {
+		std::lock_guard<std::mutex> lock(mutex);
+		long long total = 0;
+		for (int i=0; i<LEDGER_TYPES; ++i)
+			total += bytes[i];
+		return total;
+	}
+
+	/**
+	 * Free video memory as reported by the driver through
+	 * GL_NVX_gpu_memory_info or GL_ATI_meminfo, or -1 if it has neither.
+	 * Unlike the ledger this also sees what the driver allocates behind
+	 * our back.
+	 */
+	static long long getDriverFreeBytes() {
+		GLint kib[4] = { -1, -1, -1, -1 };
+		if (GLEW_NVX_gpu_memory_info)
+			glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, kib);
+		else if (GLEW_ATI_meminfo)
+			glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, kib);
+		return (kib[0] < 0) ? -1 : kib[0] * 1024LL;
+	}
+
+	/**
+	 * Private bytes of the process (resident anonymous memory on Linux),
+	 * or -1 if unknown. Drivers without video memory of their own, and the
+	 * shadow copies of the others, allocate here.
+	 */
+	static long long getProcessBytes() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS_EX counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters), sizeof(counters)))
+			return -1;
+		return counters.PrivateUsage;
+#else
+		std::ifstream status("/proc/self/status");
+		std::string line;
+		while (std::getline(status, line)) {
+			if (line.compare(0, 8, "RssAnon:") == 0) {
+				long long kib = -1;
+				std::istringstream(line.substr(8)) >> kib;
+				return (kib < 0) ? -1 : kib * 1024;
+			}
+		}
+		return -1;
+#endif
+	}
+
+	void print(std::ostream& out=std::cout) {
+		static const char* names[LEDGER_TYPES] = { "buffers", "textures", "shaders", "programs", "vertex arrays", "framebuffers", "queries" };
+		std::lock_guard<std::mutex> lock(mutex);
+		out << "GPU memory ledger:";
+		for (int i=0; i<LEDGER_TYPES; ++i) {
+			out << " " << objects[i] << " " << names[i];
+			if (bytes[i] != 0) out << " (" << bytes[i] / 1024 << " KiB)";
+			out << ((i+1 < LEDGER_TYPES) ? "," : "");
+		}
+		out << std::endl;
+	}
+
+private:
+	MemoryLedger() {
+		for (int i=0; i<LEDGER_TYPES; ++i) {
+			objects[i] = 0;
+			bytes[i] = 0;
+		}
+	}
+	MemoryLedger(const MemoryLedger&);
+	MemoryLedger& operator=(const MemoryLedger&);
+
+	std::mutex mutex;
+	long long objects[LEDGER_TYPES];
+	long long bytes[LEDGER_TYPES];
+};
+
+};//namespace GLUtils
+
+#endif
@@ -2,7 +2,10 @@
 #define _PROGRAM_HPP__
 
 #include "GameException.h"
+#include "GLUtils/Handles.hpp"
 
+#include <cassert>
+#include <memory>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -14,14 +17,16 @@ namespace GLUtils {
 class Program {
 public:
 	Program(std::string vs, std::string fs) {
-		name = glCreateProgram();
+		pending = false;
+		program.create();
 		attachShader(vs, GL_VERTEX_SHADER);
 		attachShader(fs, GL_FRAGMENT_SHADER);
 		link();
 	}
 
 	Program(std::string vs, std::string gs, std::string fs) {
-		name = glCreateProgram();
+		pending = false;
+		program.create();
 		attachShader(vs, GL_VERTEX_SHADER);
 		attachShader(gs, GL_GEOMETRY_SHADER);
 		attachShader(fs, GL_FRAGMENT_SHADER);
@@ -29,7 +34,87 @@ public:
 	}
 
 	inline void use() {
-		glUseProgram(name);
+		glUseProgram(program.name());
+	}
+
+	inline GLuint name() {
+		return program.name();
+	}
+
+	/**
+	 * Creates a program from a binary previously returned by getBinary.
+	 * Returns an empty pointer if the driver rejects the binary, e.g.,
+	 * because the driver has been updated.
+	 */
+	static std::shared_ptr<Program> fromBinary(GLenum format, const std::vector<char>& binary) {
+		std::shared_ptr<Program> p(new Program());
+		p->program.create();
+		glProgramBinary(p->program.name(), format, binary.data(), static_cast<GLsizei>(binary.size()));
+
+		GLint linkstatus;
+		glGetProgramiv(p->program.name(), GL_LINK_STATUS, &linkstatus);
+		if (linkstatus != GL_TRUE) {
+			p.reset();
+			//A rejected binary may also raise GL_INVALID_ENUM or GL_INVALID_VALUE,
+			//which must not fail the next CHECK_GL_ERROR of the caller
+			while (glGetError() != GL_NO_ERROR) {}
+		}
+		return p;
+	}
+
+	/**
+	 * Retrieves the linked program binary. Returns false if the
+	 * driver does not support program binaries.
+	 */
+	bool getBinary(GLenum& format, std::vector<char>& binary) {
+		if (!GLEW_ARB_get_program_binary) return false;
+
+		GLint length = 0;
+		glGetProgramiv(program.name(), GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) return false;
+
+		binary.resize(length);
+		glGetProgramBinary(program.name(), length, NULL, &format, binary.data());
+		return true;
+	}
+
+	/**
+	 * Starts compiling and linking a program without waiting for the
+	 * driver. With KHR_parallel_shader_compile the work is done on driver
+	 * threads, and isReady() can be polled once per frame. Call finish()
+	 * when it returns true, which throws if compiling or linking failed.
+	 * Without the extension isReady() is always true, and finish() blocks.
+	 */
+	static std::shared_ptr<Program> createAsync(std::string vs, std::string fs) {
+		static bool threads_set = false;
+		if (!threads_set && GLEW_KHR_parallel_shader_compile) {
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+			threads_set = true;
+		}
+
+		std::shared_ptr<Program> p(new Program());
+		p->program.create();
+		p->startCompile(vs, GL_VERTEX_SHADER);
+		p->startCompile(fs, GL_FRAGMENT_SHADER);
+		p->startLink();
+		p->pending = true;
+		return p;
+	}
+
+	bool isReady() {
+		if (!pending || !GLEW_KHR_parallel_shader_compile)
+			return true;
+		GLint done = GL_FALSE;
+		glGetProgramiv(program.name(), GL_COMPLETION_STATUS_KHR, &done);
+		return done == GL_TRUE;
+	}
+
+	void finish() {
+		if (!pending) return;
+		pending = false;
+		for (unsigned int i=0; i<shaders.size(); ++i)
+			checkCompile(i);
+		checkLink();
 	}
 
 	static inline void disuse() {
@@ -37,35 +122,54 @@ public:
 	}
 
 	inline GLint getUniform(std::string var) {
-		GLint loc = glGetUniformLocation(name, var.c_str());
+		GLint loc = glGetUniformLocation(program.name(), var.c_str());
 		assert(loc >= 0);
 		return loc;
 	}
 
 	inline void setAttributePointer(std::string var, unsigned int size, GLenum type=GL_FLOAT, GLboolean normalized=GL_FALSE, GLsizei stride=0, GLvoid* pointer=NULL) {
-		GLint loc = glGetAttribLocation(name, var.c_str());
+		GLint loc = glGetAttribLocation(program.name(), var.c_str());
 		assert(loc >= 0);
 		glVertexAttribPointer(loc, size, type, normalized, stride, pointer);
 		glEnableVertexAttribArray(loc);
 	}
 
 private:
+	Program() : pending(false) {}
+	Program(const Program&);
+	Program& operator=(const Program&);
+
 	void link() {
+		startLink();
+		checkLink();
+	}
+
+	void attachShader(std::string& src, unsigned int type) {
+		startCompile(src, type);
+		checkCompile(static_cast<unsigned int>(shaders.size()) - 1);
+	}
+
+	void startLink() {
+		if (GLEW_ARB_get_program_binary)
+			glProgramParameteri(program.name(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(program.name());
+	}
+
+	void checkLink() {
 		std::stringstream log;
-		glLinkProgram(name);
 
 		// check for errors
 		GLint linkstatus;
-		glGetProgramiv(name, GL_LINK_STATUS, &linkstatus);
+		glGetProgramiv(program.name(), GL_LINK_STATUS, &linkstatus);
 		if (linkstatus != GL_TRUE) {
 			log << "Linking failed!" << std::endl;
 
 			GLint logsize;
-			glGetProgramiv(name, GL_INFO_LOG_LENGTH, &logsize);
+			glGetProgramiv(program.name(), GL_INFO_LOG_LENGTH, &logsize);
 
 			if (logsize > 0) {
 				std::vector < GLchar > infolog(logsize + 1);
-				glGetProgramInfoLog(name, logsize, NULL, &infolog[0]);
+				glGetProgramInfoLog(program.name(), logsize, NULL, &infolog[0]);
 				log << "--- error log ---" << std::endl;
 				log << std::string(infolog.begin(), infolog.end()) << std::endl;
 			} else {
@@ -73,21 +177,30 @@ private:
 			}
 			THROW_EXCEPTION(log.str());
 		}
+
+		//The shaders are not needed once the program is linked
+		for (unsigned int i=0; i<shaders.size(); ++i)
+			glDetachShader(program.name(), shaders[i].name());
+		shaders.clear();
+		sources.clear();
 	}
 
-	void attachShader(std::string& src, unsigned int type) {
-		std::stringstream log;
+	void startCompile(std::string& src, unsigned int type) {
 		// create shader object
-		GLuint s = glCreateShader(type);
-		if (s == 0) {
-			log << "Failed to create shader of type " << type << std::endl;
-			THROW_EXCEPTION(log.str());
-		}
+		shaders.push_back(ShaderHandle(type));
+		sources.push_back(src);
+		GLuint s = shaders.back().name();
 
 		// set source code and compile
 		const GLchar* src_list[1] = { src.c_str() };
 		glShaderSource(s, 1, src_list, NULL);
 		glCompileShader(s);
+		glAttachShader(program.name(), s);
+	}
+
+	void checkCompile(unsigned int i) {
+		std::stringstream log;
+		GLuint s = shaders.at(i).name();
 
 		// check for errors
 		GLint compile_status;
@@ -96,7 +209,7 @@ private:
 			// compilation failed
 			log << "Compilation failed!" << std::endl;
 			log << "--- source code ---" << std::endl;
-			log << src << std::endl;
+			log << sources.at(i) << std::endl;
 
 			GLint logsize;
 			glGetShaderiv(s, GL_INFO_LOG_LENGTH, &logsize);
@@ -112,11 +225,12 @@ private:
 			}
 			THROW_EXCEPTION(log.str());
 		}
-		
-		glAttachShader(name, s);
 	}
 
-	GLuint name; //< OpenGL shader program
+	ProgramHandle program; //< OpenGL shader program
+	std::vector<ShaderHandle> shaders; //< Shaders attached until the program is linked
+	std::vector<std::string> sources; //< Source of each shader, for error messages
+	bool pending; //< Compile and link started by createAsync, but not checked yet
 
 };
 
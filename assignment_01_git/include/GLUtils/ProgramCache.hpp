@@ -0,0 +1,158 @@
+#ifndef _PROGRAMCACHE_HPP__
+#define _PROGRAMCACHE_HPP__
+
+#include "GLUtils/Hash.hpp"
+#include "GLUtils/Program.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#include <GL/glew.h>
+
+namespace GLUtils {
+
+inline void createDirectory(const std::string& dir) {
+#ifdef _WIN32
+	_mkdir(dir.c_str());
+#else
+	mkdir(dir.c_str(), 0755);
+#endif
+}
+
+/**
+ * Caches linked program binaries on disk, so that programs do not have
+ * to be compiled and linked on every launch. Binaries are keyed by the
+ * hash of the shader sources and of the driver vendor, renderer and
+ * version strings, so that a driver update gives a cache miss. If the
+ * driver rejects a cached binary, the program is compiled from source
+ * and the cache entry rewritten.
+ */
+class ProgramCache {
+public:
+	ProgramCache(std::string directory="cache/") {
+		this->directory = directory;
+		enabled = true;
+		hits = 0;
+		misses = 0;
+	}
+
+	/**
+	 * Returns the program for the given sources, from the cache if possible
+	 */
+	std::shared_ptr<Program> getProgram(const std::string& vs, const std::string& fs) {
+		if (!enabled || !GLEW_ARB_get_program_binary) {
+			++misses;
+			return std::shared_ptr<Program>(new Program(vs, fs));
+		}
+
+		std::string driver = getDriverString();
+		unsigned long long key = hashString(driver, hashString(fs, hashString(vs)));
+		std::string filename = getFilename(key);
+
+		std::shared_ptr<Program> program = load(filename, driver);
+		if (program) {
+			++hits;
+			return program;
+		}
+
+		++misses;
+		program.reset(new Program(vs, fs));
+		store(filename, driver, *program);
+		return program;
+	}
+
+	inline void setEnabled(bool enabled) { this->enabled = enabled; }
+	inline bool isEnabled() { return enabled; }
+	inline unsigned int getHits() { return hits; }
+	inline unsigned int getMisses() { return misses; }
+
+private:
+	static const unsigned int magic = 0x42504750; //< "PGPB"
+
+	static std::string getDriverString() {
+		std::stringstream ss;
+		ss << glGetString(GL_VENDOR) << "|" << glGetString(GL_RENDERER) << "|" << glGetString(GL_VERSION);
+		return ss.str();
+	}
+
+	std::string getFilename(unsigned long long key) {
+		std::stringstream ss;
+		ss << directory << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+		return ss.str();
+	}
+
+	/**
+	 * File layout: magic, binary format, driver string length,
+	 * binary length, driver string, binary
+	 */
+	std::shared_ptr<Program> load(const std::string& filename, const std::string& driver) {
+		std::ifstream is(filename.c_str(), std::ios::binary);
+		if (!is.good())
+			return std::shared_ptr<Program>();
+
+		is.seekg(0, std::ios::end);
+		std::streamoff file_size = is.tellg();
+		is.seekg(0, std::ios::beg);
+
+		unsigned int header[4];
+		is.read(reinterpret_cast<char*>(header), sizeof(header));
+		if (!is.good() || header[0] != magic || header[2] != driver.size())
+			return std::shared_ptr<Program>();
+		//A truncated or corrupt file must not make us allocate up to 4 GiB
+		if (static_cast<std::streamoff>(sizeof(header)) + header[2] + header[3] != file_size)
+			return std::shared_ptr<Program>();
+
+		std::string file_driver(header[2], '\0');
+		std::vector<char> binary(header[3]);
+		is.read(&file_driver[0], file_driver.size());
+		is.read(binary.data(), binary.size());
+		if (!is.good() || file_driver != driver)
+			return std::shared_ptr<Program>();
+
+		std::shared_ptr<Program> program = Program::fromBinary(header[1], binary);
+		if (!program)
+			std::cout << "Cached program " << filename << " rejected by the driver, recompiling" << std::endl;
+		return program;
+	}
+
+	void store(const std::string& filename, const std::string& driver, Program& program) {
+		GLenum format;
+		std::vector<char> binary;
+		if (!program.getBinary(format, binary))
+			return;
+
+		createDirectory(directory);
+		std::ofstream os(filename.c_str(), std::ios::binary);
+		if (!os.good()) {
+			std::cout << "Unable to write program cache " << filename << std::endl;
+			return;
+		}
+		unsigned int header[4] = { magic, format, static_cast<unsigned int>(driver.size()), static_cast<unsigned int>(binary.size()) };
+		os.write(reinterpret_cast<const char*>(header), sizeof(header));
+		os.write(driver.data(), driver.size());
+		os.write(binary.data(), binary.size());
+	}
+
+	std::string directory;
+	bool enabled;
+	unsigned int hits;
+	unsigned int misses;
+};
+
+};//namespace GLUtils
+
+#endif
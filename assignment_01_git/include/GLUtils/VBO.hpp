@@ -3,41 +3,46 @@
 
 #include <GL/glew.h>
 
+#include "GLUtils/Handles.hpp"
+
 namespace GLUtils {
 
 class VBO {
 public:
-	VBO(const void* data, unsigned int bytes, int mode, int usage=GL_STATIC_DRAW) {
-		buffer_mode = mode;
-		glGenBuffers(1, &vbo_name);
-		bind();
-		glBufferData(buffer_mode, bytes, data, usage);
-		unbind();
-	}
-
-	~VBO() {
+	VBO(const void* data, GLsizeiptr bytes, int mode, int usage=GL_STATIC_DRAW) {
+		buffer.create(mode);
+		buffer.data(bytes, data, usage);
 		unbind();
-		glDeleteBuffers(1, &vbo_name);
 	}
 
 	inline void bind() {
-		glBindBuffer(buffer_mode, vbo_name);
+		buffer.bind();
 	}
 
-	static inline void unbind() {
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	/**
+	 * Unbinds the target this buffer was created for. Note that unbinding
+	 * an element array buffer while a VAO is bound detaches it from the VAO.
+	 */
+	inline void unbind() {
+		buffer.unbind();
 	}
 	
 	inline GLuint name() {
-		return vbo_name;
+		return buffer.name();
+	}
+
+	inline long long bytes() {
+		return buffer.bytes();
 	}
 
 private:
-	VBO() {}
-	int buffer_mode;
-	GLuint vbo_name; //< VBO name
+	VBO();
+	VBO(const VBO&);
+	VBO& operator=(const VBO&);
+
+	BufferHandle buffer; //< VBO name and target
 };
 
 };//namespace GLUtils
 
-#endif
\ No newline at end of file
+#endif
@@ -8,16 +8,32 @@
 #include <glm/glm.hpp>
 
 #include "Timer.h"
+#include "AssetManager.h"
+#include "ClusteredLights.h"
+#include "DepthPrepass.h"
+#include "DynamicResolution.h"
+#include "FrameCapture.h"
+#include "FrameLimiter.h"
 #include "GLUtils/GLUtils.hpp"
 #include "Model.h"
 #include "ModelInterleavedArray.h"
+#include "PointCloud.h"
+#include "RenderMode.h"
+#include "ResidencyManager.h"
+#include "StreamingModel.h"
 #include "VirtualTrackball.h"
+#include "ShaderWatcher.h"
+#include "SoftwareRasterizer.h"
+#include "StartupScheduler.h"
 
-enum RenderMode {
-	RENDERMODE_FLAT, 
-	RENDERMODE_PHONG, 
-	RENDERMODE_WIREFRAME, 
-	RENDERMODE_HIDDENLINE
+
+/**
+ * A program being recompiled in the background after its sources changed
+ */
+struct ProgramReload {
+	std::string name; //< Shader path without extension, e.g., "shaders/phongshader"
+	std::shared_ptr<GLUtils::Program> program;
+	double changed_time; //< When the source change was detected
 };
 
 
@@ -45,6 +61,30 @@ public:
 	 */
 	void init();
 
+	/**
+	 * Unloads and loads the model again, and prints the GPU memory ledger
+	 */
+	void reloadModel();
+
+	/**
+	 * Adds a model to the list that N cycles through
+	 */
+	void addModel(const std::string& filename);
+
+	/**
+	 * Starts loading the next model in the list in the background. It is
+	 * swapped in once it is uploaded, and the current one is drawn until then.
+	 */
+	void nextModel();
+
+	/**
+	 * Reloads the model the given number of times, and checks that the
+	 * GPU memory ledger is the same afterwards, and that neither the free
+	 * video memory of the driver nor the private bytes of the process have
+	 * grown by more than a small tolerance. Returns true if so.
+	 */
+	bool reloadTest(unsigned int iterations);
+
 	/**
 	 * The main loop of the game. Runs the SDL main loop
 	 */
@@ -60,6 +100,129 @@ public:
 	 */
 	void render();
 
+	/**
+	 * Sets the swap interval: 0 for immediate swaps, 1 for vsync
+	 * and -1 for adaptive vsync (falls back to vsync if unsupported)
+	 */
+	void setSwapInterval(int interval);
+
+	/**
+	 * Sets the frame rate the main loop is limited to, 0 for unlimited
+	 */
+	void setTargetFrameRate(double fps);
+
+	/**
+	 * When enabled, frames are only redrawn when the view has changed
+	 */
+	void setIdleRendering(bool enabled);
+
+	/**
+	 * Enables or disables the on-disk shader program binary cache
+	 */
+	void setProgramCacheEnabled(bool enabled);
+
+	/**
+	 * Sets the host memory used for reading stream files (.pgs)
+	 */
+	void setStreamingMemoryCap(size_t bytes);
+
+	/**
+	 * Sets the GPU memory for buffers and textures, 0 for no limit. Models
+	 * stay resident after they are swapped out, until they exceed it.
+	 */
+	void setGpuBudget(long long bytes);
+
+	/**
+	 * Loads models with the legacy Model class in indexed mode, merging
+	 * vertices whose positions are closer than weld_epsilon, and whose
+	 * normals and texture coordinates are closer than normal_epsilon and
+	 * tex_coord_epsilon (0 for identical components only)
+	 */
+	void setLegacyModel(bool enabled, float weld_epsilon = 0.0f, float normal_epsilon = 0.0f, float tex_coord_epsilon = 0.0f);
+
+	/**
+	 * Sets the post-processing done when models are imported with Assimp
+	 */
+	void setImportProfile(ImportProfile profile);
+
+	/**
+	 * Renders with the SoftwareRasterizer instead of OpenGL. OpenGL only
+	 * shows the frames it produces.
+	 */
+	void setSoftwareRendering(bool enabled);
+
+	/**
+	 * Renders the given number of frames in every render mode, with OpenGL
+	 * and with the software rasterizer, and prints the time per frame
+	 */
+	void benchmarkRasterizers(unsigned int frames);
+
+	/**
+	 * Deforms a grid on the CPU and streams it through a
+	 * GLUtils::DynamicBuffer for the given number of frames, and prints
+	 * the bytes streamed, the stalls and the time per frame
+	 */
+	void benchmarkStreaming(unsigned int frames);
+
+	/**
+	 * Replaces the point lights with count lights orbiting the model
+	 */
+	void setLightCount(unsigned int count);
+
+	/**
+	 * Renders at a resolution that holds the given GPU time per frame, in
+	 * seconds, and upscales to the window. 0 renders to the window directly.
+	 */
+	void setDynamicResolution(double target, UpscaleFilter filter = UPSCALE_BILINEAR,
+		float min_scale = 0.5f, float max_scale = 1.0f);
+
+	/**
+	 * Sets when the Phong pass is preceded by a depth-only pass
+	 */
+	void setDepthPrepass(PrepassMode mode);
+
+	/**
+	 * Renders the given number of Phong frames with 1 to 10000 lights,
+	 * and prints the time per frame and how the lights were clustered
+	 */
+	void benchmarkLights(unsigned int frames);
+
+	/**
+	 * Sets where skinned models are skinned, K toggles it
+	 */
+	void setSkinningMode(SkinningMode mode);
+
+	/**
+	 * Renders the given number of frames with CPU and with GPU skinning,
+	 * and prints what each costs per skinned vertex
+	 */
+	void benchmarkSkinning(unsigned int frames);
+
+	/**
+	 * Sets where screenshots and video frames are written. Must end with
+	 * a path separator, empty for the working directory.
+	 */
+	void setCaptureDirectory(const std::string& directory);
+
+	/**
+	 * Captures every frame, as C toggles
+	 */
+	void setRecording(bool enabled);
+
+	/**
+	 * Takes a screenshot of the given rendered frame, and quits once it is
+	 * written, e.g., for regression images. 0 for none.
+	 */
+	void setScreenshotFrame(unsigned int frame);
+
+	/**
+	 * Draws the point cloud in filename, a point octree (.pgp) or a PLY or
+	 * XYZ scan, which is converted into the cache directory first, with at
+	 * most point_budget points per frame. Starts in RENDERMODE_POINTS (5),
+	 * the other modes draw the model.
+	 */
+	void setPointCloud(const std::string& filename, unsigned long long point_budget);
+
 protected:
 	/**
 	 * Creates the OpenGL context using SDL
@@ -85,41 +248,190 @@ protected:
 	void createSimpleProgram();
 
 	/**
-	 * Creates vertex array objects
+	 * Loads model_to_load, and creates the vertex array object for it
 	 */
 	void createVAO();
 
+	/**
+	 * Creates the vertex array object for the current model, and binds its textures
+	 */
+	void bindModel();
+
+	/**
+	 * Replaces the current model with one loaded by the asset manager
+	 */
+	void swapModel(const std::string& filename, std::shared_ptr<ModelInterleavedArray> loaded);
+
 	static const unsigned int window_width = 1200;
 	static const unsigned int window_height = 900;
 
 private:
+	/**
+	 * Draws the parts whose material is in the given texture array, with
+	 * its layer. Draws all parts with layer 0 if materials is NULL.
+	 * base_vertex is added to the base vertex of every part. The part
+	 * selected is drawn in the selection color.
+	 */
 	static void renderMeshRecursive(MeshPart& mesh, 
 			const std::shared_ptr<GLUtils::Program>& program, 
 			const glm::mat4& modelview, 
 			const glm::mat4& transform,
-			glm::vec3 color);
+			glm::vec3 color,
+			const MaterialTextures* materials,
+			unsigned int array,
+			unsigned int base_vertex,
+			const MeshPart* selected);
+
+	/**
+	 * Draws the current model with the active program, one texture array at a time
+	 */
+	void renderMesh(glm::vec3 color);
 
 	glm::mat4 getNewViewMatrix();
+
+	/**
+	 * Selects the part under the window coordinates x, y with the hierarchy
+	 * of the model, and prints where it was hit and how far that is from
+	 * the point picked before it
+	 */
+	void pick(int x, int y);
 	void renderWireframe(glm::vec3 color);
 	void renderPhong(glm::vec3 color);
 	void renderFlat(glm::vec3 color);
 	void renderHiddenLine();
+
+	/**
+	 * Draws the point cloud as splats, or the vertices of the model if there is none
+	 */
+	void renderPoints(glm::vec3 color);
+
+	/**
+	 * Loads point_file, converting it first if it is a scan
+	 */
+	void loadPointCloud();
 	void zoom(float factor);
 	void ChangeToProgram(std::shared_ptr<GLUtils::Program>& program);
+	void setAttributePointers(std::shared_ptr<GLUtils::Program>& program);
+	MeshPart& getMesh();
+	std::shared_ptr<GLUtils::VBO> getModelArray();
+	void updateShaderReloads();
+	void reportStats();
+
+	/**
+	 * Renders a frame with the software rasterizer and blits it to the window
+	 */
+	void renderSoftware();
+
+	/**
+	 * Gives the rasterizer the current model, if it does not have it already
+	 */
+	void updateSoftwareMesh();
+
+	/**
+	 * Renders the depth of the mesh tree with the depth pre-pass program,
+	 * or with the virtual texture feedback program, which also needs to
+	 * know the parts that use the virtual texture from materials
+	 */
+	static void renderDepthRecursive(MeshPart& mesh,
+			const std::shared_ptr<GLUtils::Program>& program,
+			const glm::mat4& view_matrix,
+			const glm::mat4& model_matrix,
+			const MaterialTextures* materials = NULL);
+
+	/**
+	 * Creates the vertex array object of the depth pre-pass for the current model
+	 */
+	void bindPrepass();
+
+	/**
+	 * The virtual texture of the current model, NULL if it has none
+	 */
+	VirtualTexture* getVirtualTexture();
+
+	/**
+	 * The animated vertices of the current model, NULL if it has no bones
+	 */
+	SkinnedMesh* getSkinnedMesh();
+
+	/**
+	 * Creates the vertex array object of the feedback pass for the current model
+	 */
+	void bindFeedback();
+
+	/**
+	 * Draws the pages the frame needs into the feedback of the virtual texture
+	 */
+	void renderFeedback(VirtualTexture& virtual_texture);
+
+	/**
+	 * Moves the point lights along their orbits
+	 */
+	void updateLights();
 
 private:
-	GLuint vao; //< Vertex array object
-	//GLuint vertex_vbo; //< VBO for vertex data
-	std::shared_ptr<GLUtils::VBO> vertices, normals;
+	GLUtils::VertexArrayHandle vao; //< Vertex array object
 	//GLuint program; //< OpenGL shader program
 	std::shared_ptr<GLUtils::Program> phong_program;
 	std::shared_ptr<GLUtils::Program> flat_program;
 	std::shared_ptr<GLUtils::Program> active_program;
+	std::shared_ptr<GLUtils::Program> prepass_program; //< Depth only
+	GLUtils::VertexArrayHandle prepass_vao; //< Positions only, created when first needed
+	DepthPrepass prepass; //< Decides when to use the pre-pass, and measures overdraw
+	std::shared_ptr<GLUtils::Program> feedback_program; //< Pages a virtual texture needs
+	GLUtils::VertexArrayHandle feedback_vao; //< Positions and texture coordinates, created when first needed
+	std::shared_ptr<GLUtils::Program> upscale_program; //< Draws dynamic resolution frames to the window
+	DynamicResolution dynamic_resolution;
+	GLUtils::ProgramCache program_cache; //< Program binaries from earlier runs
+	ShaderWatcher shader_watcher; //< Reports edited files in shaders/
+	std::vector<ProgramReload> program_reloads; //< Programs being recompiled
 
-	std::shared_ptr<Model> model;
+	std::shared_ptr<Model> model; //< Used instead of modelInterleaved if legacy_model is set
+	bool legacy_model;
+	float weld_epsilon;
+	float weld_normal_epsilon;
+	float weld_tex_coord_epsilon;
+	ImportProfile import_profile;
 	std::shared_ptr<ModelInterleavedArray> modelInterleaved;
+	std::shared_ptr<StreamingModel> streamingModel; //< Used instead of modelInterleaved for .pgs files
+	size_t stream_memory_cap; //< Host memory for reading stream files
+	AssetManager asset_manager; //< Loads models in the background
+	ResidencyManager residency; //< Models kept on the GPU, including the current one
+	std::vector<std::string> models; //< Models to cycle through
+	unsigned int model_index;
+
+	bool software_rendering;
+	std::shared_ptr<SoftwareRasterizer> rasterizer;
+	std::string software_model; //< The model the rasterizer has
+	GLUtils::TextureHandle software_texture; //< The frames of the rasterizer
+	GLUtils::FramebufferHandle software_framebuffer; //< To blit software_texture to the window
+	RasterStats software_stats; //< Summed since the last report
+	double software_present_time; //< Summed since the last report
+	unsigned int software_frames;
+
+	std::shared_ptr<PointCloud> point_cloud; //< Drawn in RENDERMODE_POINTS instead of the model
+	std::shared_ptr<GLUtils::Program> points_program; //< Splats of the point cloud
+	std::string point_file; //< Loaded by init, empty for none
+	unsigned long long point_budget; //< Points of the cloud drawn per frame at most
+
+	ClusteredLights lights; //< Point lights of the Phong shader
+	std::vector<glm::vec3> light_origins; //< Where each light starts its orbit
+	std::vector<float> light_speeds; //< Radians per second around the y axis
+
+	SkinningMode skinning_mode; //< Of skinned models, also those loaded later
+	Timer animation_timer; //< Time between the poses of skinned models
+
+	const MeshPart* selected_part; //< Picked with the right mouse button, NULL for none
+	glm::vec3 last_pick; //< Where the model was last picked, in the space of its hierarchy
+	bool has_pick; //< Whether last_pick is set
+
+	FrameCapture capture; //< Screenshots (F12) and video frames (C)
+	unsigned int screenshot_frame; //< Rendered frame to capture before quitting, 0 for none
 
 	Timer my_timer; //< Timer for machine independent motion
+	FrameLimiter frame_limiter; //< Sleeps between frames to hold the target frame rate
+	int swap_interval; //< 0 = immediate, 1 = vsync, -1 = adaptive vsync
+	bool idle_rendering; //< Only redraw when the view has changed
+	bool redraw; //< The view has changed since the last rendered frame
 
 	glm::mat4 projection_matrix; //< OpenGL projection matrix
 	glm::mat4 model_matrix; //< OpenGL model transformation matrix
@@ -0,0 +1,52 @@
+#ifndef _GEOMETRYCODEC_H__
+#define _GEOMETRYCODEC_H__
+
+#include <string>
+#include <vector>
+
+#include "MeshData.h"
+
+/**
+ * Compressed file format (.pgz) for MeshData, so that models load
+ * faster from slow disks and network shares.
+ *
+ * Vertices are quantized to 16 bits per component: positions within
+ * the bounding box of the model, normals with the octahedral mapping,
+ * and texture coordinates within their range. Each component is delta
+ * coded against the previous vertex, zigzag coded, and split into a low
+ * and a high byte plane. Indices are coded per triangle against a small
+ * FIFO of recently used edges, so that a triangle sharing an edge with
+ * a recent one costs one byte, plus a varint if its third vertex is not
+ * the next unused vertex. Every byte stream is then entropy coded with
+ * an order-0 rANS coder, or stored if that does not help.
+ *
+ * Vertices and triangles are coded in independent blocks, which are
+ * decoded in parallel directly into their place in the output.
+ * Indices are lossless, vertices are not (the position error is at most
+ * half of the bounding box size divided by 65535).
+ */
+class GeometryCodec {
+public:
+	static void encode(const MeshData& data, std::vector<unsigned char>& out);
+
+	/**
+	 * Decodes a .pgz file in memory. Throws a GameException on errors.
+	 */
+	static void decode(const unsigned char* data, size_t size, MeshData& out);
+
+	static void write(const MeshData& data, const std::string& filename);
+	static void read(const std::string& filename, MeshData& out);
+
+	/**
+	 * True if the file name ends in .pgz
+	 */
+	static bool isCompressedFile(const std::string& filename);
+
+	/**
+	 * Encodes the mesh, and prints the compression ratio, the decode
+	 * throughput (best of iterations) and the largest position error
+	 */
+	static void benchmark(const MeshData& data, unsigned int iterations = 5);
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _MAPPEDFILE_H__
+#define _MAPPEDFILE_H__
+
+#include <string>
+#include <cstddef>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/**
+ * Read-only memory mapping of a whole file. Lets large files be parsed
+ * in place by several threads without copying them into memory first.
+ */
+class MappedFile {
+public:
+	MappedFile(const std::string& filename);
+	~MappedFile();
+
+	inline const char* data() const { return ptr; }
+	inline size_t size() const { return length; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const char* ptr;
+	size_t length;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef _MATERIALTEXTURES_H__
+#define _MATERIALTEXTURES_H__
+
+#include <vector>
+
+#include "Texture2D.h"
+#include "TextureCache.h"
+
+/**
+ * Where the texture of a material is
+ */
+struct MaterialSlot {
+	MaterialSlot() : array(0), layer(-1), paged(false) {}
+
+	unsigned int array; //< Into the texture arrays
+	int layer; //< -1 for materials without a texture, which are drawn white
+	bool paged; //< Sampled from the virtual texture of the model instead, see VirtualTexture
+};
+
+/**
+ * The diffuse textures of all materials of a model, packed into as few
+ * GL_TEXTURE_2D_ARRAYs as possible. Textures with the same size and
+ * number of mip levels share an array, one layer each, so that the parts
+ * of a model can be drawn one array at a time with the layer set per
+ * draw, instead of binding a texture per part.
+ *
+ * Materials without a texture get no layer at all, and the shaders use
+ * white for layer -1.
+ */
+class MaterialTextures {
+public:
+	/**
+	 * Allocates the arrays for one image per material (no levels for
+	 * none), without uploading them
+	 */
+	MaterialTextures(const std::vector<MipChain>& images);
+
+	/**
+	 * Uploads rows of a mip level of the texture of a material, see
+	 * Texture2D::uploadRows. Does nothing for materials without one.
+	 */
+	void uploadRows(unsigned int material, unsigned int level, unsigned int first_row, unsigned int rows, const void* pixels);
+
+	/**
+	 * Uploads all levels of the images given to the constructor
+	 */
+	void upload(const std::vector<MipChain>& images);
+
+	inline unsigned int getArrayCount() const { return static_cast<unsigned int>(arrays.size()); }
+	inline unsigned int getMaterialCount() const { return static_cast<unsigned int>(slots.size()); }
+
+	/**
+	 * The slot of a material. Materials the model does not have are untextured.
+	 */
+	inline const MaterialSlot& getSlot(unsigned int material) const {
+		return (material < slots.size()) ? slots[material] : untextured;
+	}
+
+	/**
+	 * Marks a material as using the virtual texture of the model. Its
+	 * image is a page file, which is not given to the constructor.
+	 */
+	void setPaged(unsigned int material);
+
+	inline Texture2D& getArray(unsigned int array) { return arrays[array]; }
+
+	void bind(unsigned int array);
+
+	/**
+	 * GPU memory used by all arrays
+	 */
+	long long bytes() const;
+
+private:
+	MaterialTextures(const MaterialTextures&);
+	MaterialTextures& operator=(const MaterialTextures&);
+
+	std::vector<Texture2D> arrays;
+	std::vector<MaterialSlot> slots; //< Per material
+	MaterialSlot untextured;
+};
+
+#endif
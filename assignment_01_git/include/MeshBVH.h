@@ -0,0 +1,189 @@
+#ifndef _MESHBVH_H__
+#define _MESHBVH_H__
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "MeshData.h"
+
+/**
+ * Where a ray hit the mesh, or the point of the mesh closest to a point
+ */
+struct MeshHit {
+	MeshHit() : triangle(invalid), part(invalid), distance(std::numeric_limits<float>::max()) {}
+
+	static const unsigned int invalid = ~0u;
+
+	inline bool valid() const { return triangle != invalid; }
+
+	unsigned int triangle; //< Over all parts, in the order of the part tree
+	unsigned int part; //< In the order of the part tree, the root is 0
+	float distance; //< Along the ray, in lengths of its direction, or from the point
+	glm::vec3 position;
+};
+
+/**
+ * A bounding volume hierarchy over the triangles of a mesh, for ray,
+ * closest point and frustum queries on the CPU, e.g., to pick parts with
+ * the mouse.
+ *
+ * Triangles are in the space of the root of the part tree, with the
+ * transforms of the parts below it, but not that of the root, which the
+ * uploaded model changes to scale and center the model.
+ *
+ * Nodes are split with the surface area heuristic over 16 bins along each
+ * axis, until they have at most four triangles. The top of the tree is
+ * built on the calling thread, and the subtrees below it on all cores.
+ * Every leaf keeps its triangles in one block, laid out so that a ray is
+ * tested against all four at once with SSE, which also tests the boxes
+ * of the nodes.
+ */
+class MeshBVH {
+public:
+	static const unsigned int leaf_triangles = 4; //< One block per leaf
+	static const unsigned int bins = 16; //< Per axis, for the surface area heuristic
+
+	/**
+	 * Builds the hierarchy over the triangles of data
+	 */
+	MeshBVH(const MeshData& data);
+
+	/**
+	 * Reads the hierarchy of data from cache_directory, or builds and
+	 * writes it there. The file name is a hash of the vertices, indices and
+	 * parts, so edited models are built again. Empty for no caching.
+	 */
+	static std::shared_ptr<MeshBVH> create(const MeshData& data, const std::string& cache_directory);
+
+	/**
+	 * The nearest hit of the ray origin + t*direction with t in
+	 * (0, max_distance], false if there is none
+	 */
+	bool intersect(const glm::vec3& origin, const glm::vec3& direction, MeshHit& hit,
+		float max_distance = std::numeric_limits<float>::max()) const;
+
+	/**
+	 * The point of the mesh closest to point, false if none is closer than max_distance
+	 */
+	bool closestPoint(const glm::vec3& point, MeshHit& hit,
+		float max_distance = std::numeric_limits<float>::max()) const;
+
+	/**
+	 * Counts the triangles whose bounds are not outside the frustum of
+	 * view_projection, and adds them to triangles unless it is NULL
+	 */
+	unsigned int frustum(const glm::mat4& view_projection, std::vector<unsigned int>* triangles) const;
+
+	inline unsigned int getTriangleCount() const { return n_triangles; }
+	inline unsigned int getNodeCount() const { return static_cast<unsigned int>(nodes.size()); }
+	inline glm::vec3 getMin() const { return nodes.empty() ? glm::vec3(0.0f) : nodes[0].min; }
+	inline glm::vec3 getMax() const { return nodes.empty() ? glm::vec3(0.0f) : nodes[0].max; }
+
+	/**
+	 * Seconds spent building, 0 if it was read from a cache file
+	 */
+	inline double getBuildTime() const { return build_time; }
+
+	/**
+	 * Host memory used by the nodes and triangles
+	 */
+	long long bytes() const;
+
+	void write(const std::string& filename, unsigned long long key) const;
+
+	/**
+	 * Reads a file written with the same key. Throws a GameException otherwise.
+	 */
+	static std::shared_ptr<MeshBVH> read(const std::string& filename, unsigned long long key);
+
+	/**
+	 * Builds the hierarchy of data, and prints the build time and the time
+	 * per query of random rays, points and frusta, checking some of them
+	 * against testing every triangle
+	 */
+	static void benchmark(const MeshData& data, unsigned int queries = 1000000);
+
+private:
+	MeshBVH();
+	MeshBVH(const MeshBVH&);
+	MeshBVH& operator=(const MeshBVH&);
+
+	/**
+	 * 32 bytes. Leaves have count triangles in blocks[first], the children
+	 * of other nodes are nodes[first] and nodes[first + 1].
+	 */
+	struct Node {
+		glm::vec3 min;
+		unsigned int first;
+		glm::vec3 max;
+		unsigned int count; //< 0 for nodes that are not leaves
+	};
+
+	/**
+	 * The triangles of a leaf, structure of arrays. Lanes beyond the
+	 * triangles of the leaf have zero edges, which no ray hits.
+	 */
+	struct Block {
+		float v0[3][4];
+		float e1[3][4]; //< v1 - v0
+		float e2[3][4]; //< v2 - v0
+		unsigned int triangles[4];
+	};
+
+	/**
+	 * A range of triangles and the node of its subtree
+	 */
+	struct BuildTask {
+		unsigned int node;
+		unsigned int begin;
+		unsigned int end;
+		unsigned int depth;
+	};
+
+	/**
+	 * Triangle data while building, by triangle
+	 */
+	struct BuildInput {
+		std::vector<glm::vec3> vertices; //< Three per triangle
+		std::vector<glm::vec3> min, max, centroid;
+		std::vector<unsigned int> order; //< Triangles, sorted into the leaves
+	};
+
+	/**
+	 * Adds the triangles of part and its children, transform is that of part
+	 */
+	void addParts(const MeshPart& part, const glm::mat4& transform, const std::vector<VertexData>& vertices,
+		const std::vector<unsigned int>& indices, BuildInput& input, unsigned int& part_index);
+
+	/**
+	 * Builds the subtree of root.begin to root.end of input.order into
+	 * out[root.node]. With tasks, ranges smaller than task_size are left to
+	 * be built later, with their bounds set.
+	 */
+	static void buildRange(BuildInput& input, std::vector<Node>& out, const BuildTask& root,
+		std::vector<BuildTask>* tasks, unsigned int task_size);
+
+	/**
+	 * Sorts [begin, end) of input.order into two halves, with the surface
+	 * area heuristic, or at the median along the longest axis. Returns the
+	 * first triangle of the second half.
+	 */
+	static unsigned int split(BuildInput& input, unsigned int begin, unsigned int end,
+		const glm::vec3& centroid_min, const glm::vec3& centroid_max, bool heuristic);
+
+	void build(BuildInput& input);
+
+	static unsigned long long getKey(const MeshData& data);
+
+	std::vector<Node> nodes;
+	std::vector<Block> blocks;
+	std::vector<unsigned int> parts; //< By triangle
+	unsigned int n_triangles;
+	double build_time;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _MESHDATA_H__
+#define _MESHDATA_H__
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Skeleton.h"
+
+struct MeshPart {
+	MeshPart() {
+		transform = glm::mat4(1.0f);
+		first = 0;
+		count = 0;
+		vertexCount = 0;
+		material = 0;
+	}
+
+	glm::mat4 transform;
+	unsigned int first;
+	unsigned int count;
+	unsigned int vertexCount;
+	unsigned int material; //< Index into MeshData::textures of its diffuse texture
+	std::vector<MeshPart> children;
+};
+
+// 32 Bytes!
+struct VertexData {
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 tex_coords;
+};
+
+enum VertexDataLayout {
+	V_POSITION = 0,
+	V_NORMAL = sizeof(glm::vec3),
+	V_TEX_COORD = sizeof(glm::vec3) * 2
+};
+
+/**
+ * Geometry of a model in host memory, as produced by the loaders
+ * and before it is uploaded to the GPU
+ */
+struct MeshData {
+	MeshPart root;
+	std::vector<VertexData> vertices;
+	std::vector<unsigned int> indices; //< Relative to the vertexCount of their part
+	std::vector<std::string> textures; //< Diffuse texture per mesh, empty for none
+	std::vector<SkinWeights> weights; //< Per vertex of skinned models, empty otherwise
+	Skeleton skeleton;
+};
+
+#endif
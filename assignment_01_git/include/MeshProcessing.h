@@ -0,0 +1,68 @@
+#ifndef _MESHPROCESSING_H__
+#define _MESHPROCESSING_H__
+
+#include <vector>
+
+#include "MeshData.h"
+
+/**
+ * Post-processing steps for imported meshes, run in parallel over blocks
+ * of faces and vertices. These replace the single threaded Assimp steps
+ * (aiProcess_Triangulate and aiProcess_GenSmoothNormals); joining of
+ * identical vertices is done by VertexWelder.
+ */
+class MeshProcessing {
+public:
+	/**
+	 * Splits polygons into triangles. face_sizes holds the number of
+	 * corners of each face, and polygons the corners of all faces after
+	 * each other. Faces with fewer than three corners (points and lines)
+	 * are dropped. Polygons are split into fans, or with ear clipping in
+	 * the plane of the polygon, which also handles concave polygons.
+	 */
+	static void triangulate(const VertexData* vertices,
+			const std::vector<unsigned int>& face_sizes,
+			const std::vector<unsigned int>& polygons,
+			std::vector<unsigned int>& triangles,
+			bool ear_clipping);
+
+	/**
+	 * Computes smooth normals for a triangle mesh. Vertices at the same
+	 * position share a normal, also across texture seams. Face normals are
+	 * weighted by the area of the face, or by the angle of the corner,
+	 * which does not depend on how the surface is tessellated.
+	 */
+	static void generateNormals(VertexData* vertices, unsigned int n_vertices,
+			const unsigned int* indices, unsigned int n_indices,
+			bool angle_weighted);
+
+	/**
+	 * Reorders the triangles of every part for the post-transform vertex
+	 * cache (Tipsify, Sander et al. 2007), and then the vertices of every
+	 * part in the order they are first used, so that vertex fetches are
+	 * close to sequential. Parts are processed in parallel; the vertex
+	 * ranges of parts must not overlap, as produced by the loaders.
+	 */
+	static void optimize(MeshData& data, unsigned int cache_size = 16);
+
+	/**
+	 * Average cache miss ratio (vertex shader runs per triangle) of a FIFO
+	 * vertex cache of the given size. 3.0 is the worst case, about 0.7 is
+	 * typical after optimizing.
+	 */
+	static float getACMR(const unsigned int* indices, size_t n_indices, unsigned int cache_size = 16);
+
+	/**
+	 * Reorders triangles for a vertex cache of the given size. indices
+	 * refer to vertices in [0, n_vertices).
+	 */
+	static void optimizeVertexCache(unsigned int* indices, size_t n_indices, unsigned int n_vertices, unsigned int cache_size);
+
+	/**
+	 * Renumbers vertices in the order they are first used by indices.
+	 * Unused vertices are moved after the used ones.
+	 */
+	static void optimizeVertexFetch(VertexData* vertices, unsigned int n_vertices, unsigned int* indices, size_t n_indices);
+};
+
+#endif
@@ -12,45 +12,65 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "AssimpLoader.h"
 #include "GLUtils/VBO.hpp"
+#include "MeshData.h"
+#include "Texture2D.h"
 
-struct MeshPart {
-	MeshPart() {
-		transform = glm::mat4(1.0f);
-		first = 0;
-		count = 0;
-		vertexCount = 0;
-	}
-
-	glm::mat4 transform;
-	unsigned int first;
-	unsigned int count;
-	unsigned int vertexCount;
-	std::vector<MeshPart> children;
+enum ModelMode {
+	MODEL_EXPANDED, //< Three vertices per triangle, separate position and normal VBOs
+	MODEL_INDEXED //< Welded VertexData and an index buffer, as in ModelInterleavedArray
 };
 
 class Model {
 public:
-	Model(std::string filename, bool invert=0);
+	/**
+	 * In indexed mode, vertices whose positions are closer than
+	 * weld_epsilon (per component), and whose normals and texture
+	 * coordinates are closer than normal_epsilon and tex_coord_epsilon,
+	 * are merged. A tolerance of zero only lets identical components match.
+	 * invert turns the model inside out: the winding of every triangle is
+	 * reversed and the normals flipped. The expanded mode ignores it.
+	 */
+	Model(std::string filename, bool invert=0, ModelMode mode=MODEL_EXPANDED, float weld_epsilon=0.0f,
+		float normal_epsilon=0.0f, float tex_coord_epsilon=0.0f, ImportProfile profile=IMPORT_BALANCED);
 	~Model();
 
-	inline MeshPart getMesh() {return root;}
+	inline MeshPart& getMesh() {return root;}
+	inline bool isIndexed() {return mode == MODEL_INDEXED;}
+
+	/**
+	 * Expanded mode
+	 */
 	inline std::shared_ptr<GLUtils::VBO> getVertices() {return vertices;}
 	inline std::shared_ptr<GLUtils::VBO> getNormals() {return normals;}
 
+	/**
+	 * Indexed mode
+	 */
+	inline std::shared_ptr<GLUtils::VBO> getArray() {return interleaved;}
+	inline std::shared_ptr<GLUtils::VBO> getIndices() {return indices;}
+	void bindTextures();
+
 private:
 	static void loadRecursive(MeshPart& part, bool invert,
 			std::vector<float>& vertex_data, std::vector<float>& normal_data, const aiScene* scene, const aiNode* node);
+	static void expandRecursive(MeshPart& part, const MeshData& data,
+			std::vector<float>& vertex_data, std::vector<float>& normal_data);
 			
 
-	std::pair<glm::vec3, glm::vec3> getTranslateVectors(const std::vector<float>& vertex_data);
+	std::pair<glm::vec3, glm::vec3> getTranslateVectors(const float* vertex_data, size_t count, size_t stride);
 
 
 	const aiScene* scene;
 	MeshPart root;
 
+	ModelMode mode;
 	std::shared_ptr<GLUtils::VBO> normals;
 	std::shared_ptr<GLUtils::VBO> vertices;
+	std::shared_ptr<GLUtils::VBO> interleaved;
+	std::shared_ptr<GLUtils::VBO> indices;
+	Texture2D texture;
 
 	glm::vec3 min_dim;
 	glm::vec3 max_dim;
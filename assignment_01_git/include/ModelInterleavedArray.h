@@ -5,67 +5,185 @@
 #include <string>
 #include <vector>
 
-#include <assimp/cimport.h>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
-
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "AssimpLoader.h"
 #include "GLUtils/VBO.hpp"
 #include "GLUtils/Program.hpp"
+#include "MaterialTextures.h"
+#include "MeshBVH.h"
+#include "VirtualTexture.h"
+#include "SkinnedMesh.h"
+#include "MeshData.h"
 #include "Model.h"
 #include "Texture2D.h"
+#include "TextureCache.h"
 
-// 32 Bytes!
-struct VertexData {
-	glm::vec3 position;
-	glm::vec3 normal;
-	glm::vec2 tex_coords;
-};
-
-enum VertexDataLayout {
-	V_POSITION = 0,
-	V_NORMAL = sizeof(glm::vec3),
-	V_TEX_COORD = sizeof(glm::vec3) * 2
+enum ModelLoader {
+	LOADER_AUTO, //< Native loader for OBJ files, Assimp for everything else
+	LOADER_ASSIMP,
+	LOADER_NATIVE
 };
 
 class ModelInterleavedArray {
 public:
-	ModelInterleavedArray(std::string filename, bool invert = 0);
+	/**
+	 * Loads and uploads filename on this thread. The hierarchy of its
+	 * triangles is read from or written to cache_directory, see
+	 * MeshBVH::create.
+	 */
+	ModelInterleavedArray(std::string filename, bool invert = 0, ModelLoader loader = LOADER_AUTO, ImportProfile profile = IMPORT_BALANCED,
+		const std::string& cache_directory = "");
+
+	/**
+	 * Creates the model from data that is already uploaded, e.g., by the
+	 * AssetManager, with the bounds of its vertices (see getBounds) and
+	 * the hierarchy computed on its worker, so that the swap does not
+	 * go over the vertices again. Takes over the vertices, indices and
+	 * images as its host copy.
+	 */
+	ModelInterleavedArray(MeshData&& data, std::vector<MipChain>&& images,
+		const glm::vec3& min_position, const glm::vec3& max_position,
+		std::shared_ptr<GLUtils::VBO> interleaved, std::shared_ptr<GLUtils::VBO> indices,
+		std::shared_ptr<GLUtils::VBO> positions, std::shared_ptr<MaterialTextures> materials,
+		std::shared_ptr<MeshBVH> bvh = std::shared_ptr<MeshBVH>());
+
+	/**
+	 * Uploads a model that was read into host memory, e.g., on a worker
+	 * thread, with one decoded image per texture (no levels for none), and
+	 * the bounds and hierarchy of its triangles computed there too. Takes
+	 * over the vertices, indices and images as its host copy.
+	 */
+	ModelInterleavedArray(MeshData&& data, std::vector<MipChain>&& images,
+		const glm::vec3& min_position, const glm::vec3& max_position,
+		std::shared_ptr<MeshBVH> bvh = std::shared_ptr<MeshBVH>());
+
 	~ModelInterleavedArray();
 
-	inline MeshPart getMesh() { return root; }
+	/**
+	 * Reads a model into host memory, without touching OpenGL: compressed
+	 * .pgz files with GeometryCodec, OBJ files with the native loader
+	 * (unless Assimp is asked for), and anything else with Assimp
+	 */
+	static void loadMeshData(const std::string& filename, MeshData& data,
+		ModelLoader loader = LOADER_AUTO, ImportProfile profile = IMPORT_BALANCED);
+
+	/**
+	 * The corners of the box around the vertices. Does not need an
+	 * OpenGL context.
+	 */
+	static void getBounds(const std::vector<VertexData>& vertices, glm::vec3& min_position, glm::vec3& max_position);
+
+	/**
+	 * The positions of the vertices, tightly packed for getPositions. Does
+	 * not need an OpenGL context.
+	 */
+	static void packPositions(const std::vector<VertexData>& vertices, std::vector<glm::vec3>& positions);
+
+	/**
+	 * Loads the model with both the Assimp and the native loader, and
+	 * prints the time each of them takes. Does not need an OpenGL context.
+	 */
+	static void benchmarkLoaders(const std::string& filename, unsigned int iterations = 3);
+
+	inline MeshPart& getMesh() { return root; }
 	inline std::shared_ptr<GLUtils::VBO> getArray() {return interleaved;}
 	inline std::shared_ptr<GLUtils::VBO> getIndices() {return indices;}
 
-	void loadTexture(const std::string& filename);
+	/**
+	 * Tightly packed positions, for passes that need nothing else, e.g.,
+	 * the depth pre-pass. Uploaded with the rest of the model.
+	 */
+	inline std::shared_ptr<GLUtils::VBO> getPositions() { return positions; }
+
+	/**
+	 * The host copy of the mesh, as in MeshData, and of the images of its
+	 * textures (level 0 only, no levels for none), e.g., for the software
+	 * rasterizer
+	 */
+	inline const std::vector<VertexData>& getHostVertices() const { return host_vertices; }
+	inline const std::vector<unsigned int>& getHostIndices() const { return host_indices; }
+	inline const std::vector<MipChain>& getHostImages() const { return host_images; }
+
+	/**
+	 * The textures of the parts, see MeshPart::material
+	 */
+	inline MaterialTextures& getMaterials() { return *materials; }
+
+	/**
+	 * The texture of the materials whose image is a page file, NULL if none
+	 */
+	inline VirtualTexture* getVirtualTexture() { return virtual_texture.get(); }
+
+	/**
+	 * The animated vertices of models with bones, NULL for rigid models
+	 */
+	inline SkinnedMesh* getSkinnedMesh() { return skinned.get(); }
+
+	/**
+	 * The triangles of the mesh for picking, in the space of getMesh()
+	 * without its own transform. Skinned models are in their bind pose.
+	 * NULL if the model was created without one.
+	 */
+	inline const MeshBVH* getBVH() const { return bvh.get(); }
+
+	/**
+	 * Binds the first texture array, the only one for most models
+	 */
 	void bindTextures();
 	
 
 	inline unsigned int getIndeceSize() {return n_indices;}
 
-private:
-	static void loadRecursive(
-		MeshPart& part, 
-		bool invert, 
-		std::vector<VertexData>& array_data,
-		std::vector<unsigned int>& indices_data,
-		std::vector<Texture2D>& textures, 
-		const aiScene* scene,
-		const aiNode* node);
-
+	/**
+	 * GPU memory used by the buffers and textures of the model
+	 */
+	long long getBytes() const;
 
-	std::pair<glm::vec3, glm::vec3> getTranslateVectors(const std::vector<VertexData>& vertex_data);
+private:
+	/**
+	 * Takes the part tree and sizes from data, and scales and centers the
+	 * model in the box of its vertices
+	 */
+	void setMesh(const MeshData& data, const glm::vec3& min_position, const glm::vec3& max_position);
+
+	/**
+	 * Opens the page file of the first material that has one, see VirtualTexture
+	 */
+	void createVirtualTexture(const MeshData& data);
+
+	/**
+	 * Keeps the bind pose, weights and skeleton of data, if it has weights
+	 */
+	void createSkinnedMesh(const MeshData& data);
+
+	/**
+	 * Uploads the packed positions of vertices for getPositions
+	 */
+	void createPositions(const std::vector<VertexData>& vertices);
+
+	/**
+	 * Moves the vertices, indices and the level 0 of the images into the host copy
+	 */
+	void keepHostCopy(MeshData& data, std::vector<MipChain>& images);
+	std::pair<glm::vec3, glm::vec3> getTranslateVectors(const glm::vec3& min_position, const glm::vec3& max_position);
 
 
 private:
-	const aiScene* scene;
 	MeshPart root;
 
 	std::shared_ptr<GLUtils::VBO> interleaved;
 	std::shared_ptr<GLUtils::VBO> indices;
-	std::vector<Texture2D> textures;
+	std::shared_ptr<GLUtils::VBO> positions;
+	std::shared_ptr<MaterialTextures> materials;
+	std::shared_ptr<VirtualTexture> virtual_texture;
+	std::string virtual_texture_file;
+	std::shared_ptr<SkinnedMesh> skinned;
+	std::shared_ptr<MeshBVH> bvh;
+	std::vector<VertexData> host_vertices;
+	std::vector<unsigned int> host_indices;
+	std::vector<MipChain> host_images;
 
 	glm::vec3 min_dim;
 	glm::vec3 max_dim;
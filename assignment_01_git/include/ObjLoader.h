@@ -0,0 +1,51 @@
+#ifndef _OBJLOADER_H__
+#define _OBJLOADER_H__
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "MeshData.h"
+
+/**
+ * A block of an OBJ file as parsed by ObjLoader::stream
+ */
+struct ObjBlock {
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> tex_coords;
+	std::vector<unsigned int> corners; //< Position, texture coordinate and normal of every triangle corner, 0 based
+	std::vector<unsigned int> groups; //< Object and material of every triangle, numbered as they first appear
+	size_t bytes; //< Host memory the parser held for the block, including the text
+};
+
+/**
+ * Native reader for Wavefront OBJ files and their MTL material libraries.
+ * The file is memory mapped and split into line aligned chunks that are
+ * parsed in parallel. Faces are then grouped by object and material,
+ * triangulated, and vertices are welded by their (position, texture
+ * coordinate, normal) index triple with a hash map, one group per thread.
+ * Produces the same layout as the Assimp path in ModelInterleavedArray:
+ * a root part with one child part per mesh.
+ */
+class ObjLoader {
+public:
+	static const unsigned int no_index = 0xFFFFFFFF; //< A missing texture coordinate or normal
+
+	/**
+	 * Loads filename into data. Throws a GameException on errors.
+	 */
+	static void load(const std::string& filename, MeshData& data);
+
+	/**
+	 * Reads filename from disk about block_bytes per thread at a time,
+	 * without mapping or holding all of it, for models too large to
+	 * load, and hands every block to consume. Faces are triangulated as
+	 * fans and their indices made absolute, but not checked, as they may
+	 * refer to vertices of later blocks. Returns the number of groups.
+	 */
+	static unsigned int stream(const std::string& filename, size_t block_bytes,
+		const std::function<void(ObjBlock&)>& consume);
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef _PARALLEL_H__
+#define _PARALLEL_H__
+
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+
+/**
+ * Number of worker threads to use for data parallel work
+ */
+inline unsigned int getThreadCount() {
+	unsigned int threads = std::thread::hardware_concurrency();
+	return (threads > 0) ? threads : 1;
+}
+
+/**
+ * Calls fn(i) for i in [0, count) from several threads. Iterations are
+ * handed out one at a time, so uneven work is balanced. The calling
+ * thread takes part. The first exception thrown by fn is rethrown
+ * here once all threads are done.
+ */
+template <class Function>
+void parallelFor(unsigned int count, Function fn) {
+	unsigned int threads = getThreadCount();
+	if (threads > count)
+		threads = count;
+	if (threads <= 1) {
+		for (unsigned int i=0; i<count; ++i)
+			fn(i);
+		return;
+	}
+
+	std::atomic<unsigned int> next(0);
+	std::atomic<bool> failed(false);
+	std::exception_ptr error;
+
+	auto worker = [&]() {
+		unsigned int i;
+		while (!failed && (i = next++) < count) {
+			try {
+				fn(i);
+			} catch (...) {
+				if (!failed.exchange(true))
+					error = std::current_exception();
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned int t=1; t<threads; ++t)
+		workers.push_back(std::thread(worker));
+	worker();
+	for (unsigned int t=0; t<workers.size(); ++t)
+		workers[t].join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef _POINTCLOUD_H__
+#define _POINTCLOUD_H__
+
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "GLUtils/GLUtils.hpp"
+#include "PointOctree.h"
+#include "ThreadPool.h"
+
+/**
+ * What the point cloud did, the node counts of the last draw and the
+ * rest since the last resetStats, times in seconds
+ */
+struct PointCloudStats {
+	PointCloudStats() : frames(0), points(0), nodes(0), missing(0), resident(0), loaded(0), evicted(0), dropped(0),
+		traverse_time(0.0), upload_time(0.0) {}
+
+	unsigned int frames;
+	unsigned long long points; //< Drawn, over all frames
+	unsigned int nodes; //< Drawn
+	unsigned int missing; //< Wanted, but not resident
+	unsigned int resident;
+	unsigned int loaded; //< Uploaded
+	unsigned int evicted;
+	unsigned int dropped; //< Read, but every resident node was wanted by the last draw
+	double traverse_time; //< Choosing the nodes to draw
+	double upload_time;
+};
+
+/**
+ * Draws a point octree file (.pgp, see PointOctree) of any size as
+ * screen-space sized splats.
+ *
+ * Every frame, the nodes are visited largest on screen first, skipping
+ * those outside the view frustum, until the point budget is used. A node
+ * is refined into its children while its points are more than a pixel
+ * apart on screen. Nodes that are not resident are read from the file
+ * on a worker thread, and drawn from the next frame on, their parents
+ * until then. Nodes not drawn recently are evicted when the GPU cache of
+ * three times the point budget is full.
+ *
+ * Every node is a buffer of 8 byte points, quantized within the cube of
+ * the node. The vertex shader scales them back with the cube of the node
+ * and sizes the splat by the spacing of the points, so that neighbouring
+ * splats touch; the fragment shader makes them round.
+ */
+class PointCloud {
+public:
+	static const unsigned int max_reads = 32; //< Node reads handed to the worker and not uploaded yet
+
+	/**
+	 * Opens a point octree file and reads its node table. Needs an OpenGL
+	 * context. Throws a GameException on failure.
+	 */
+	PointCloud(const std::string& filename, unsigned long long point_budget = 10000000);
+
+	/**
+	 * Waits for the node reads in flight
+	 */
+	~PointCloud();
+
+	/**
+	 * Uploads the nodes the worker has read, for at most time_budget
+	 * seconds. Returns true if nodes were uploaded, so the view should be
+	 * drawn again.
+	 */
+	bool update(double time_budget);
+
+	/**
+	 * Draws the nodes the view needs with program (made from
+	 * shaders/pointsplat.*), which is in use and has its projection
+	 * matrix set, and requests those that are not resident. modelview is
+	 * that of the unit cube of getTransform.
+	 */
+	void draw(GLUtils::Program& program, const glm::mat4& modelview, const glm::mat4& projection);
+
+	/**
+	 * Scales and centers the cloud to the unit cube around the origin,
+	 * like the root transform of models
+	 */
+	glm::mat4 getTransform() const;
+
+	inline unsigned long long getPointCount() const { return header.points; }
+	inline unsigned int getNodeCount() const { return header.nodes; }
+
+	void setPointBudget(unsigned long long points);
+	inline unsigned long long getPointBudget() const { return point_budget; }
+
+	/**
+	 * GPU memory used by the resident nodes
+	 */
+	inline long long bytes() const { return resident_bytes; }
+
+	inline const PointCloudStats& getStats() const { return stats; }
+	void resetStats();
+
+private:
+	PointCloud(const PointCloud&);
+	PointCloud& operator=(const PointCloud&);
+
+	/**
+	 * A node the worker has read
+	 */
+	struct LoadedNode {
+		unsigned int node;
+		std::vector<PointOctree::Point> points;
+	};
+
+	/**
+	 * A node chosen by the traversal, and the node it was refined from
+	 */
+	struct DrawNode {
+		unsigned int node;
+		int parent; //< In the draw list, -1 for the root
+		float spacing; //< Of the points, or of the finest children drawn in all its octants
+		unsigned int children; //< Drawn
+	};
+
+	/**
+	 * Evicts the node wanted least recently, and not by the last draw.
+	 * False if there is none.
+	 */
+	bool evict();
+
+	std::string filename;
+	PointOctree::Header header;
+	std::vector<PointOctree::Node> nodes;
+	std::vector<GLUtils::BufferHandle> buffers; //< Of the resident nodes
+	std::vector<unsigned int> node_wanted; //< Draw that last wanted it
+	std::vector<bool> node_resident;
+	std::vector<bool> node_loading;
+	std::vector<unsigned int> resident; //< Nodes with a buffer
+	unsigned int draws; //< So far, 0 is none
+
+	unsigned long long point_budget;
+	long long cache_bytes; //< GPU memory of the resident nodes is kept below this
+	long long resident_bytes;
+	std::vector<DrawNode> draw_list; //< Kept to reuse its memory
+	std::vector<unsigned int> missing; //< Of the last draw, most important first
+
+	GLUtils::VertexArrayHandle vao;
+
+	std::ifstream file; //< Only read by the worker
+	unsigned int reads; //< Submitted to the reader and not uploaded yet
+	std::mutex loaded_mutex;
+	std::deque<std::shared_ptr<LoadedNode> > loaded; //< Read by the worker, not uploaded yet
+	ThreadPool reader; //< Reads nodes from the file, declared after what its tasks use so it is stopped first
+
+	PointCloudStats stats;
+};
+
+#endif
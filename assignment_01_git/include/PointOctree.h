@@ -0,0 +1,154 @@
+#ifndef _POINTOCTREE_H__
+#define _POINTOCTREE_H__
+
+#include <string>
+#include <vector>
+
+#include "PointReader.h"
+
+/**
+ * What building a point octree took, per pass
+ */
+struct PointOctreeStats {
+	PointOctreeStats() : points(0), nodes(0), chunks(0), bounds_time(0.0), count_time(0.0),
+		distribute_time(0.0), build_time(0.0), total_time(0.0), peak_bytes(0), file_bytes(0) {}
+
+	unsigned long long points;
+	unsigned int nodes;
+	unsigned int chunks; //< Subtrees built in memory one at a time
+	double bounds_time;
+	double count_time;
+	double distribute_time;
+	double build_time;
+	double total_time;
+	long long peak_bytes; //< Largest host memory held by the converter at once
+	unsigned long long file_bytes;
+};
+
+/**
+ * Point cloud file format (.pgp) for scans too large to mesh or to keep
+ * in memory, drawn with PointCloud.
+ *
+ * The points are sorted into an octree over the bounding cube of the
+ * scan. Every inner node keeps at most one point per cell of a 128^3
+ * grid over its cube, picked from the points below it, and passes the
+ * rest on to its children, so drawing a node and some of its children
+ * adds detail without drawing any point twice. Leaves keep all their
+ * points. Points are quantized to 10 bits per axis within the cube of
+ * their node (GL_UNSIGNED_INT_2_10_10_10_REV) plus 8 bit RGBA, 8 bytes
+ * each.
+ *
+ * Building holds about memory_cap at most. The scan is read three
+ * times: for its bounds, to count the points in each cell of a 128^3
+ * grid over the cube, and to sort the points into chunks (subtrees of 40
+ * bytes per point that fit the cap, less the counts, the reader and the
+ * write buffers) in a temporary file. Cells with more points than a
+ * chunk are counted again in a 16^3 grid over them, one more read for
+ * each such round, so only a cell near max_depth can be larger. Then
+ * every chunk is read back and built in memory, one at a time, on all
+ * cores. The nodes above the chunks take their samples from the chunks
+ * as they are built.
+ *
+ * File layout: Header, the points of every node, and the node table
+ * (breadth first, the children of a node are next to each other).
+ */
+class PointOctree {
+public:
+	static const unsigned int magic = 0x50504750; //< "PGPP"
+	static const unsigned int version = 1;
+	static const unsigned int sample_grid = 128; //< Cells across a node for its sample
+	static const unsigned int leaf_points = 20000; //< Nodes with more are split
+	static const unsigned int max_depth = 20;
+
+	struct Header {
+		unsigned int magic;
+		unsigned int version;
+		unsigned long long points;
+		unsigned long long node_table; //< Offset in the file
+		unsigned int nodes;
+		unsigned int colors; //< 0 if the scan had none and every point is white
+		double origin[3]; //< The minimum of the bounding cube in the coordinates of the scan, node minimums are relative to it
+		float size; //< Of the bounding cube
+		unsigned int reserved;
+	};
+
+	struct Node {
+		float min[3]; //< Relative to the origin
+		float size;
+		unsigned long long offset; //< Of the first point, in points after the header
+		unsigned int count;
+		unsigned int first_child; //< In the node table, 0 if it has none
+		unsigned int children;
+		float spacing; //< About the distance between neighbouring points of the node
+	};
+
+	struct Point {
+		unsigned int position; //< x, y, z in the bits 0-9, 10-19 and 20-29, within the node cube
+		unsigned char color[4];
+	};
+
+	/**
+	 * Builds the octree of the points of reader into filename. A temporary
+	 * file of 16 bytes per point is written next to it.
+	 */
+	static PointOctreeStats build(PointReader& reader, const std::string& filename, size_t memory_cap = 512 << 20);
+
+	/**
+	 * Converts a PLY or XYZ scan, and prints what it took
+	 */
+	static void convert(const std::string& in, const std::string& out, size_t memory_cap = 512 << 20);
+
+	/**
+	 * The octree of a PLY or XYZ scan in cache_directory, which is built
+	 * first if it is not there. The file name is a hash of the name and the
+	 * size of the scan, so edited scans are built again.
+	 */
+	static std::string getCachedFile(const std::string& scan, const std::string& cache_directory, size_t memory_cap = 512 << 20);
+
+	/**
+	 * True if the file name ends in .pgp
+	 */
+	static bool isPointCloudFile(const std::string& filename);
+
+	/**
+	 * Writes synthetic scans of 1, 10, 100, ... million points up to
+	 * max_millions into directory, and prints the throughput in points per
+	 * second and the peak memory of building each one. The files are
+	 * removed again.
+	 */
+	static void benchmark(unsigned int max_millions, const std::string& directory, size_t memory_cap = 512 << 20);
+
+	static inline unsigned int quantize(const float position[3], const float min[3], float size) {
+		unsigned int q[3];
+		for (int i = 0; i < 3; ++i) {
+			float t = (position[i] - min[i]) / size;
+			t = (t < 0.0f) ? 0.0f : ((t > 1.0f) ? 1.0f : t);
+			q[i] = static_cast<unsigned int>(t * 1023.0f + 0.5f);
+		}
+		return q[0] | (q[1] << 10) | (q[2] << 20);
+	}
+
+private:
+	/**
+	 * A node while building, with the points of the chunk in [begin, end)
+	 */
+	struct BuildNode {
+		float min[3];
+		float size;
+		unsigned int depth;
+		size_t begin;
+		size_t sample_end; //< [begin, sample_end) stay in the node, the rest go to the children
+		size_t end;
+		unsigned int first_child; //< Among the nodes of the chunk
+		unsigned int children;
+	};
+
+	/**
+	 * Sorts the points of node into its sample and its children, and
+	 * appends the children to out
+	 */
+	static void split(std::vector<PointRecord>& points, BuildNode& node, std::vector<BuildNode>& out,
+		std::vector<unsigned long long>& sample);
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef _POINTREADER_H__
+#define _POINTREADER_H__
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * A point of a scan as it is read, before it is quantized
+ */
+struct PointRecord {
+	float position[3]; //< Relative to PointReader::getOrigin, so that scans far from zero keep their precision
+	unsigned char color[4]; //< RGBA, white for files without colors
+};
+
+/**
+ * Reads the points of a scan in batches, so that files of any size are
+ * read in the memory of one batch: PLY files whose first element with
+ * properties we need is the vertex element (ASCII or binary, either byte
+ * order), and XYZ text files with "x y z", "x y z i", "x y z r g b" or
+ * "x y z i r g b" on every line. Text is cut at line ends and parsed on
+ * all cores, binary records are decoded on all cores.
+ *
+ * Coordinates are read as doubles, and the first point of the file is
+ * subtracted before they are made floats.
+ */
+class PointReader {
+public:
+	static const unsigned int batch_points = 1 << 20; //< Binary points per batch
+	static const unsigned int batch_bytes = 32 << 20; //< Text per batch
+
+	/**
+	 * Opens the file and reads its header. Throws a GameException if it is
+	 * not a point file we can read.
+	 */
+	PointReader(const std::string& filename);
+
+	/**
+	 * True for .xyz files, and .ply files with vertices but no faces (PLY
+	 * files with faces are meshes, for the model loaders)
+	 */
+	static bool isPointFile(const std::string& filename);
+
+	/**
+	 * Replaces points with the next batch, false at the end of the file
+	 */
+	bool read(std::vector<PointRecord>& points);
+
+	/**
+	 * Starts again from the first point
+	 */
+	void rewind();
+
+	/**
+	 * Points in the PLY header. For XYZ files 0 until they have been read to the end once.
+	 */
+	inline unsigned long long getCount() const { return count; }
+	inline bool hasColors() const { return colors; }
+	inline unsigned long long getFileSize() const { return file_size; }
+
+	/**
+	 * The first point of the file, which positions are relative to. Zero
+	 * until the first batch has been read.
+	 */
+	inline const double* getOrigin() const { return origin; }
+
+	/**
+	 * Writes n points of a synthetic scan, a noisy colored terrain, as
+	 * binary PLY, e.g., to benchmark point clouds of a given size
+	 */
+	static void writeSynthetic(const std::string& filename, unsigned long long n);
+
+private:
+	PointReader(const PointReader&);
+	PointReader& operator=(const PointReader&);
+
+	enum Format {
+		FORMAT_XYZ,
+		FORMAT_PLY_ASCII,
+		FORMAT_PLY_BINARY
+	};
+
+	/**
+	 * A scalar property of the vertex element
+	 */
+	struct Property {
+		int type; //< One of the PLY types, see parseType
+		unsigned int offset; //< In the binary record
+		int target; //< 0-2 for x, y, z, 3-6 for r, g, b, a, -1 for none
+	};
+
+	void readHeader(const std::string& filename);
+
+	/**
+	 * Parses the line at p, which it moves past it, false if it is not a point
+	 */
+	bool parseLine(const char*& p, const char* end, double position[3], unsigned char color[4]) const;
+
+	/**
+	 * Parses the lines of [begin, end) into points
+	 */
+	void parseText(const char* begin, const char* end, std::vector<PointRecord>& points) const;
+	void decodeBinary(const char* record, double position[3], unsigned char color[4]) const;
+
+	std::string filename;
+	std::ifstream file;
+	Format format;
+	bool big_endian;
+	bool colors;
+	unsigned long long file_size;
+	unsigned long long data_start; //< Of the first point
+	unsigned long long count;
+	unsigned long long points_read;
+	std::vector<Property> properties; //< Of the vertex element
+	unsigned int record_size; //< Of binary vertices
+	unsigned long long skip_lines; //< Of ASCII elements before the vertices
+	double origin[3];
+	bool has_origin; //< Set from the first point, and kept when rewinding
+
+	std::vector<char> buffer;
+	size_t buffered; //< Bytes of buffer carried over from the last batch
+	bool end_of_file;
+};
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef _RENDERMODE_H__
+#define _RENDERMODE_H__
+
+enum RenderMode {
+	RENDERMODE_FLAT, 
+	RENDERMODE_PHONG, 
+	RENDERMODE_WIREFRAME, 
+	RENDERMODE_HIDDENLINE,
+	RENDERMODE_POINTS //< The point cloud as splats, or the vertices of the model
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef _RESIDENCYMANAGER_H__
+#define _RESIDENCYMANAGER_H__
+
+#include <list>
+#include <memory>
+#include <string>
+
+#include "ModelInterleavedArray.h"
+
+/**
+ * GPU memory residency at the end of the last frame
+ */
+struct ResidencyStats {
+	ResidencyStats() : budget(0), used(0), cached(0), models(0), hits(0), misses(0),
+		evictions(0), frame_evictions(0) {}
+
+	long long budget; //< Bytes, 0 for no budget
+	long long used; //< Bytes of all buffers and textures in the MemoryLedger
+	long long cached; //< Of that, bytes of resident models that are not drawn
+	unsigned int models; //< Resident models
+	unsigned int hits; //< Models found resident, since the start
+	unsigned int misses; //< Models that had to be loaded, since the start
+	unsigned int evictions; //< Since the start
+	unsigned int frame_evictions; //< In the last frame
+};
+
+/**
+ * Keeps models on the GPU after they are swapped out, so that switching
+ * back to one is instant, for as long as everything fits in the budget.
+ * The budget covers all buffers and textures, as accounted by the
+ * GLUtils::MemoryLedger, so models that are not managed here (and models
+ * being uploaded) count against it too. At the end of every frame, the
+ * least recently drawn models are evicted until the budget is met again.
+ * A model drawn in the frame is never evicted.
+ *
+ * Evicted models are reloaded by the AssetManager, from the binary copy
+ * it wrote when the model was first imported.
+ */
+class ResidencyManager {
+public:
+	ResidencyManager(long long budget = 0);
+
+	/**
+	 * Sets the budget in bytes, 0 for no budget
+	 */
+	void setBudget(long long bytes);
+	inline long long getBudget() const { return budget; }
+
+	/**
+	 * Returns the model if it is resident, and marks it drawn, or a null
+	 * pointer. Counts as a hit or a miss.
+	 */
+	std::shared_ptr<ModelInterleavedArray> find(const std::string& filename);
+
+	/**
+	 * Adds a model that was just loaded, marked drawn. Replaces any
+	 * resident model of the same file.
+	 */
+	void insert(const std::string& filename, std::shared_ptr<ModelInterleavedArray> model);
+
+	/**
+	 * Drops the model, e.g., to force it to be loaded again
+	 */
+	void erase(const std::string& filename);
+
+	/**
+	 * Marks the model drawn in this frame. Does nothing for files that
+	 * are not resident.
+	 */
+	void drawn(const std::string& filename);
+
+	/**
+	 * Call at the end of every frame: evicts models until the budget is
+	 * met, and updates the stats
+	 */
+	void endFrame();
+
+	inline const ResidencyStats& getStats() const { return stats; }
+
+private:
+	ResidencyManager(const ResidencyManager&);
+	ResidencyManager& operator=(const ResidencyManager&);
+
+	struct Entry {
+		std::string filename;
+		std::shared_ptr<ModelInterleavedArray> model;
+		long long bytes;
+		unsigned long long last_drawn; //< Frame number
+	};
+
+	std::list<Entry>::iterator findEntry(const std::string& filename);
+
+	/**
+	 * Moves an entry to the front and marks it drawn
+	 */
+	void touch(std::list<Entry>::iterator entry);
+
+	static long long getUsedBytes();
+
+	std::list<Entry> entries; //< Most recently drawn first
+	long long budget;
+	unsigned long long frame;
+	bool over_budget; //< Reported once until the budget is met again
+	ResidencyStats stats;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef _SHADERWATCHER_H_
+#define _SHADERWATCHER_H_
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Watches a directory on a background thread, and collects the names of
+ * files that are written to. Uses inotify on Linux, and change
+ * notifications plus modification times on Windows.
+ */
+class ShaderWatcher {
+public:
+	ShaderWatcher();
+	~ShaderWatcher();
+
+	/**
+	 * Starts watching the directory (e.g., "shaders/")
+	 */
+	void start(const std::string& directory);
+
+	/**
+	 * Stops the watcher thread
+	 */
+	void stop();
+
+	/**
+	 * Returns the files changed since the last call, and the time
+	 * (Timer::getCurrentTime) each change was first seen
+	 */
+	std::map<std::string, double> getChanged();
+
+private:
+	void run();
+	void fileChanged(const std::string& filename);
+
+#ifndef __linux__
+	/**
+	 * Compares modification times against the last scan, and reports
+	 * the files that have changed
+	 */
+	void scan(bool report);
+	std::map<std::string, long long> mtimes;
+#endif
+
+	std::string directory;
+	std::thread thread;
+	std::atomic<bool> running;
+	std::mutex mutex;
+	std::map<std::string, double> changed; //< Guarded by mutex
+};
+
+#endif // _SHADERWATCHER_H_
@@ -0,0 +1,66 @@
+#ifndef _SKELETON_H__
+#define _SKELETON_H__
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+/**
+ * The bones that move a vertex, packed as they are uploaded: four bone
+ * indices, and four weights in 1/255ths that sum to 255. Vertices that
+ * no bone moves have all weights 0.
+ */
+struct SkinWeights {
+	unsigned char bones[4];
+	unsigned char weights[4];
+};
+
+/**
+ * A node of the scene. Bones are nodes, and so are the nodes above them,
+ * which move the bones when they are animated.
+ */
+struct SkeletonNode {
+	std::string name;
+	int parent; //< -1 for the root, parents come before their children
+	glm::mat4 transform; //< Relative to the parent, when the node is not animated
+};
+
+/**
+ * The keyframes of one node, times in seconds
+ */
+struct AnimationChannel {
+	unsigned int node;
+	std::vector<float> position_times;
+	std::vector<glm::vec3> positions;
+	std::vector<float> rotation_times;
+	std::vector<glm::quat> rotations;
+	std::vector<float> scale_times;
+	std::vector<glm::vec3> scales;
+};
+
+struct Animation {
+	std::string name;
+	float duration; //< Seconds
+	std::vector<AnimationChannel> channels; //< Nodes without one keep their transform
+};
+
+/**
+ * The bones and animations of a skinned model. Bone b moves a vertex of
+ * the bind pose by mesh_inverse * global(bone_nodes[b]) * bone_offsets[b],
+ * where global is the transform of the node with those of its parents.
+ */
+struct Skeleton {
+	static const unsigned int max_bones = 256; //< Bone indices are bytes
+
+	Skeleton() : mesh_inverse(1.0f) {}
+
+	std::vector<SkeletonNode> nodes;
+	std::vector<unsigned int> bone_nodes;
+	std::vector<glm::mat4> bone_offsets; //< From the mesh to the bone, in the bind pose
+	glm::mat4 mesh_inverse; //< From the scene to the node of the skinned meshes, which the parts are drawn with
+	std::vector<Animation> animations;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef _SKINNEDMESH_H__
+#define _SKINNEDMESH_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Animator.h"
+#include "MeshData.h"
+#include "GLUtils/GLUtils.hpp"
+#include "GLUtils/DynamicBuffer.hpp"
+
+/**
+ * Where the vertices of skinned models are moved by their bones
+ */
+enum SkinningMode {
+	SKINNING_CPU, //< On all cores with SSE, streamed to the GPU every frame
+	SKINNING_GPU //< In the vertex shaders
+};
+
+/**
+ * What skinning cost since the last resetStats, times in seconds
+ */
+struct SkinningStats {
+	SkinningStats() : frames(0), vertices(0), animate_time(0.0), skin_time(0.0), upload_time(0.0), stalls(0),
+		gpu_frames(0), gpu_vertices(0), gpu_time(0.0) {}
+
+	unsigned int frames;
+	unsigned long long vertices; //< Skinned on the CPU
+	double animate_time; //< Sampling the animation
+	double skin_time; //< Skinning on the CPU, into the streaming buffer
+	double upload_time; //< Bone matrices
+	unsigned int stalls; //< Waits for the GPU to finish with a region of the streaming buffer
+	unsigned int gpu_frames; //< Whose draws were timed on the GPU
+	unsigned long long gpu_vertices; //< Of those frames
+	double gpu_time; //< Drawing the model, also the skinning in SKINNING_GPU
+};
+
+/**
+ * The animated vertices of a skinned model, see Skeleton.
+ *
+ * Keeps the bind pose and the bone weights in host memory, and plays the
+ * animations of the skeleton with an Animator. The bone matrices are
+ * uploaded every frame into a texture buffer, three texels per bone.
+ *
+ * SKINNING_CPU blends the matrices of the bones of every vertex with SSE
+ * on all cores, and writes the moved vertices straight into a
+ * GLUtils::DynamicBuffer, whose region of the frame is drawn with a base
+ * vertex. SKINNING_GPU leaves the vertices in the interleaved array of
+ * the model, adds the packed weights as two more attributes, and the
+ * vertex shaders do the same blend. Timestamps around the draws give the
+ * GPU cost of each, so both can be compared per skinned vertex.
+ */
+class SkinnedMesh {
+public:
+	static const unsigned int timer_frames = 3; //< Timestamp queries in flight
+
+	/**
+	 * Keeps the vertices, weights and skeleton of data, which must have weights
+	 */
+	SkinnedMesh(const MeshData& data);
+
+	static const char* getModeName(SkinningMode mode);
+
+	/**
+	 * Parses "cpu" or "gpu". Throws a GameException otherwise.
+	 */
+	static SkinningMode parseMode(const std::string& name);
+
+	/**
+	 * Takes effect once the attribute pointers are set again
+	 */
+	void setMode(SkinningMode mode);
+	inline SkinningMode getMode() const { return mode; }
+
+	inline Animator& getAnimator() { return animator; }
+	inline unsigned int getVertexCount() const { return static_cast<unsigned int>(vertices.size()); }
+
+	/**
+	 * Advances the animation by seconds, uploads the bone matrices and, in
+	 * SKINNING_CPU, skins the vertices into the streaming buffer. Call
+	 * once per frame, before the model is drawn.
+	 */
+	void update(double seconds);
+
+	/**
+	 * Sets the vertex attributes of program on the bound vertex array:
+	 * the streaming buffer in SKINNING_CPU, or the interleaved array of the
+	 * model and the weights in SKINNING_GPU. Leaves no buffer bound.
+	 */
+	void setAttributePointers(GLUtils::Program& program, GLUtils::VBO& interleaved);
+
+	/**
+	 * Binds the bone matrices to texture_unit and sets the skinning
+	 * uniforms of the program in use
+	 */
+	void bind(GLUtils::Program& program, unsigned int texture_unit);
+
+	/**
+	 * Added to the base vertex of every draw: the region of the streaming
+	 * buffer of this frame in SKINNING_CPU, 0 otherwise
+	 */
+	inline unsigned int getBaseVertex() const { return base_vertex; }
+
+	/**
+	 * Call around all draws of the model in a frame. endDraw fences the
+	 * streaming buffer.
+	 */
+	void beginDraw();
+	void endDraw();
+
+	/**
+	 * Skins vertices [begin, end) of source into destination, with the
+	 * bone matrices as rows of Animator::sample
+	 */
+	static void skin(const VertexData* source, const SkinWeights* weights, const float* bone_rows,
+		VertexData* destination, unsigned int begin, unsigned int end);
+
+	/**
+	 * GPU memory used by the weights, the bone matrices and the streaming buffer
+	 */
+	long long bytes() const;
+
+	SkinningStats getStats() const;
+	void resetStats();
+
+private:
+	SkinnedMesh(const SkinnedMesh&);
+	SkinnedMesh& operator=(const SkinnedMesh&);
+
+	/**
+	 * Adds the timings of the draws the GPU has finished
+	 */
+	void readTimers();
+
+	std::vector<VertexData> vertices; //< Bind pose
+	std::vector<SkinWeights> weights;
+	Skeleton skeleton;
+	Animator animator;
+	SkinningMode mode;
+
+	std::vector<float> bone_rows;
+	GLUtils::BufferHandle weight_buffer;
+	GLUtils::BufferHandle bone_buffer;
+	GLUtils::TextureHandle bone_texture;
+	std::shared_ptr<GLUtils::DynamicBuffer> stream; //< Created when SKINNING_CPU is first used
+	unsigned int base_vertex;
+
+	struct DrawTimer {
+		DrawTimer() : pending(false), vertices(0) {}
+
+		GLUtils::QueryHandle begin, end;
+		bool pending;
+		unsigned int vertices;
+	};
+	DrawTimer timers[timer_frames];
+	unsigned int timer; //< Used by the next frame
+
+	SkinningStats stats;
+	unsigned int stalls_at_reset;
+};
+
+#endif
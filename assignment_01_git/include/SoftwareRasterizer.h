@@ -0,0 +1,134 @@
+#ifndef _SOFTWARERASTERIZER_H__
+#define _SOFTWARERASTERIZER_H__
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "MeshData.h"
+#include "RenderMode.h"
+#include "TextureCache.h"
+
+/**
+ * Time spent in each stage of the last frame, in seconds, and what was drawn
+ */
+struct RasterStats {
+	RasterStats() : transform(0.0), bin(0.0), raster(0.0), triangles(0), culled(0), clipped(0),
+		binned(0), fragments(0) {}
+
+	double transform;
+	double bin; //< Triangle setup, clipping, culling and binning
+	double raster; //< Clearing, rasterizing and shading the tiles
+	unsigned int triangles;
+	unsigned int culled; //< Back facing or outside the view
+	unsigned int clipped; //< Crossed the near plane
+	unsigned long long binned; //< Triangle and tile pairs
+	unsigned long long fragments; //< Pixels shaded, including ones that fail the depth test later
+};
+
+/**
+ * Renders models on the CPU, for machines where the only OpenGL is a slow
+ * generic software implementation. Produces the same images as the flat
+ * and Phong shaders and the polygon modes GameManager uses.
+ *
+ * Vertices are transformed four at a time with SSE, in parallel blocks.
+ * Triangles are then set up, clipped against the near plane, culled and
+ * binned into 64x64 pixel tiles by several threads, and finally the tiles
+ * are cleared, rasterized and shaded in parallel. Each binning thread
+ * keeps its own bins, and tiles read them in order, so triangles are drawn
+ * in the order they are submitted, like OpenGL does.
+ *
+ * The color buffer is RGBA8 with the bottom row first, ready for
+ * glTexSubImage2D.
+ */
+class SoftwareRasterizer {
+public:
+	SoftwareRasterizer(unsigned int width, unsigned int height);
+
+	/**
+	 * Copies the mesh. The part tree is the one of the uploaded model (with
+	 * its root transform), the vertices and indices are as in MeshData.
+	 * Parts are textured with the image of their material, the level 0 of it.
+	 */
+	void setMesh(const MeshPart& root, const std::vector<VertexData>& vertices,
+		const std::vector<unsigned int>& indices, const std::vector<MipChain>& images);
+
+	/**
+	 * Renders a frame. background is the clear color and, like the GL
+	 * path, the color of the filled pass in hidden line mode.
+	 */
+	void render(const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model,
+		RenderMode mode, const glm::vec3& color, const glm::vec3& background);
+
+	inline const unsigned int* getColorBuffer() const { return color_buffer.data(); }
+	inline unsigned int getWidth() const { return width; }
+	inline unsigned int getHeight() const { return height; }
+	inline const RasterStats& getStats() const { return stats; }
+
+private:
+	SoftwareRasterizer(const SoftwareRasterizer&);
+	SoftwareRasterizer& operator=(const SoftwareRasterizer&);
+
+	/**
+	 * A part of the tree with its transform relative to the model
+	 */
+	struct Part {
+		float transform[16];
+		unsigned int first; //< Of its indices
+		unsigned int count;
+		unsigned int base_vertex; //< Its indices are relative to this
+		unsigned int vertex_count;
+		unsigned int output; //< Its first transformed vertex
+		unsigned int first_triangle; //< Over all parts
+		unsigned int material; //< Into textures
+	};
+
+	/**
+	 * A triangle in window coordinates, ready to be rasterized
+	 */
+	struct RasterTriangle {
+		float x[3], y[3], z[3];
+		float inv_w[3];
+		float attributes[3][8]; //< View position, normal and texture coordinates, divided by w
+		const MipChain* texture; //< Of its part
+		float flat_diffuse; //< The flat shader lighting, at the provoking vertex
+		float depth_offset; //< Like glPolygonOffset(1, 1), for the filled pass of hidden lines
+	};
+
+	/**
+	 * What one binning thread produced
+	 */
+	struct Bins {
+		std::vector<RasterTriangle> triangles;
+		std::vector<std::vector<unsigned int> > tiles; //< Triangle indices per tile
+		RasterStats stats;
+	};
+
+	void addParts(const MeshPart& part, const float* parent);
+	void transformVertices(const glm::mat4& projection, const glm::mat4& modelview);
+	void binTriangles(unsigned int bin, unsigned int first, unsigned int last);
+	void setupTriangle(Bins& bins, const float (*vertices)[12], float flat_diffuse, const MipChain* texture);
+	void rasterTile(unsigned int tile, RenderMode mode, const glm::vec3& color, const glm::vec3& background);
+
+	unsigned int width;
+	unsigned int height;
+	unsigned int tiles_x;
+	unsigned int tiles_y;
+	std::vector<unsigned int> color_buffer;
+	std::vector<float> depth_buffer;
+
+	std::vector<Part> parts;
+	std::vector<VertexData> vertices;
+	std::vector<unsigned int> indices;
+	unsigned int n_triangles;
+	unsigned int n_output_vertices;
+	std::vector<MipChain> textures; //< Per material, no levels for none
+	MipChain untextured; //< For materials beyond textures
+	std::vector<float> stream; //< Transformed vertices, 12 floats each
+
+	std::vector<Bins> bins;
+	std::vector<unsigned long long> tile_fragments;
+	RasterStats stats;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef _STARTUPSCHEDULER_H__
+#define _STARTUPSCHEDULER_H__
+
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Runs startup work that does not need the window or the OpenGL context
+ * (e.g., importing the model) on worker threads, while the main thread
+ * creates them, and records a timeline of both. Each thread is a lane of
+ * consecutive phases: begin ends the current phase of the calling thread
+ * and starts the next one.
+ *
+ * The critical path is found by walking back from the end of the main
+ * lane: through a join that had to wait into the task it waited for, and
+ * from the start of a task to the phase that started it.
+ */
+class StartupScheduler {
+public:
+	/**
+	 * The thread that creates the scheduler is the main lane
+	 */
+	StartupScheduler();
+
+	/**
+	 * Joins any tasks that are still running, e.g., after an exception
+	 */
+	~StartupScheduler();
+
+	/**
+	 * Runs fn on a new thread, as a lane called name whose first phase is
+	 * also called name. fn may call begin to split its lane into phases.
+	 */
+	void start(const std::string& name, std::function<void()> fn);
+
+	/**
+	 * Waits for a task, recorded as a phase on the calling lane. Rethrows
+	 * an exception thrown by the task.
+	 */
+	void join(const std::string& name);
+
+	/**
+	 * Ends the current phase of the calling thread, and begins the next
+	 */
+	void begin(const std::string& name);
+
+	/**
+	 * Ends the current phase of the calling thread
+	 */
+	void end();
+
+	/**
+	 * Prints every phase with its start and end in milliseconds and a bar,
+	 * marking the phases on the critical path with a *, and then the path
+	 */
+	void print(std::ostream& out=std::cout);
+
+private:
+	StartupScheduler(const StartupScheduler&);
+	StartupScheduler& operator=(const StartupScheduler&);
+
+	struct Phase {
+		std::string name;
+		unsigned int lane;
+		double start;
+		double end; //< Negative while it runs
+		int joined_lane; //< The lane a join waited for, -1 for other phases
+	};
+
+	struct Lane {
+		std::string name;
+		std::thread::id id;
+		std::thread thread;
+		std::exception_ptr error;
+		double start;
+		unsigned int parent; //< The lane that started this one
+	};
+
+	unsigned int getLane(); //< Of the calling thread, with the mutex locked
+	void endLane(unsigned int lane, double now); //< With the mutex locked
+	int findLane(const std::string& name);
+	int findLastPhase(unsigned int lane, double before);
+
+	std::mutex mutex;
+	double start_time;
+	std::vector<Phase> phases;
+	std::vector<Lane*> lanes; //< Lanes own their threads, so they do not move
+};
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef _STREAMINGMODEL_H__
+#define _STREAMINGMODEL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "GLUtils/VBO.hpp"
+#include "MeshData.h"
+#include "Texture2D.h"
+#include "VirtualFileSystem.h"
+
+/**
+ * Renders models that are too large to hold in host memory. The model is
+ * first converted (with write()) into a stream file of self-contained
+ * chunks, each with its own vertices and indices. When the stream file
+ * is opened, GPU buffers large enough for the whole model are allocated
+ * up front, and a background thread reads the chunks into a fixed set of
+ * host blocks. update() uploads the blocks that have arrived into the GPU
+ * buffers, so the model is drawn progressively while it streams in.
+ * Host memory use never goes above the memory cap given to the constructor.
+ *
+ * File layout: StreamHeader, StreamPart[n_parts] (tree in preorder),
+ * StreamChunk[n_chunks], then for every chunk its vertices and indices.
+ */
+class StreamingModel {
+public:
+	/**
+	 * Opens a stream file. memory_cap is the number of bytes of host
+	 * memory that may be used for reading chunks.
+	 */
+	StreamingModel(const std::string& filename, size_t memory_cap = 64 << 20);
+	~StreamingModel();
+
+	/**
+	 * Converts a model to a stream file. Triangles of each part are split
+	 * into chunks of at most max_chunk_vertices vertices, and of at most
+	 * half the memory_cap of the StreamingModel that is to read them.
+	 */
+	static void write(const MeshData& data, const std::string& filename, unsigned int max_chunk_vertices = 65536,
+		size_t memory_cap = 64 << 20);
+
+	/**
+	 * Converts a model (OBJ or anything Assimp reads) to a stream file for
+	 * a StreamingModel with the given memory_cap, and holds no more than
+	 * about memory_cap of host memory itself. OBJ files are read a block
+	 * at a time, and their vertices and triangles spilled to temporary
+	 * files next to filename. Assimp scenes are converted one mesh at a
+	 * time, but Assimp itself holds the whole scene.
+	 */
+	static void convert(const std::string& model_filename, const std::string& filename, size_t memory_cap = 64 << 20);
+
+	/**
+	 * Uploads chunks that have been read, until time_budget (in seconds)
+	 * is used up. Returns true if anything new is visible.
+	 */
+	bool update(double time_budget);
+
+	/**
+	 * True when every chunk is on the GPU
+	 */
+	inline bool isComplete() { return uploaded_chunks == chunks.size(); }
+
+	/**
+	 * The parts of the model, with one child per chunk uploaded so far
+	 */
+	inline MeshPart& getMesh() { return root; }
+	inline std::shared_ptr<GLUtils::VBO> getArray() { return interleaved; }
+	inline std::shared_ptr<GLUtils::VBO> getIndices() { return indices; }
+	void bindTextures();
+
+private:
+	struct StreamHeader {
+		unsigned int magic;
+		unsigned int version;
+		unsigned int n_parts;
+		unsigned int n_chunks;
+		unsigned long long n_vertices;
+		unsigned long long n_indices;
+		unsigned int max_chunk_bytes; //< Largest chunk, to check it fits a block
+		unsigned int reserved;
+	};
+
+	struct StreamPart {
+		float transform[16];
+		unsigned int n_children;
+		unsigned int n_chunks;
+	};
+
+	struct StreamChunk {
+		unsigned int part; //< Index of the part in preorder
+		unsigned int n_vertices;
+		unsigned int n_indices;
+		unsigned int reserved;
+		unsigned long long first_vertex; //< Where the vertices go in the vertex buffer
+		unsigned long long first_index; //< Where the indices go in the index buffer
+
+		inline size_t bytes() const { return n_vertices*sizeof(VertexData) + n_indices*sizeof(unsigned int); }
+	};
+
+	/**
+	 * A piece of host memory holding one or more whole chunks
+	 */
+	struct Block {
+		std::vector<char> data;
+		size_t used;
+		unsigned int first_chunk;
+		unsigned int n_chunks;
+	};
+
+	static const unsigned int magic = 0x54534750; //< "PGST"
+	static const unsigned int version = 1;
+	static const unsigned int n_blocks = 2; //< Read one block while uploading the other
+
+	/**
+	 * Splits triangles into chunks, and writes the stream file (defined in
+	 * StreamingModel.cpp)
+	 */
+	class ChunkWriter;
+
+	static void writePart(const MeshData& data, const MeshPart& part, ChunkWriter& writer);
+	static void convertObj(const std::string& model_filename, ChunkWriter& writer, size_t memory_cap);
+	static void convertAssimp(const std::string& model_filename, ChunkWriter& writer);
+	void readParts(MeshPart& part, unsigned int& next);
+	void findChunkParts(MeshPart& part, unsigned int& next);
+	void readChunks();
+
+	/**
+	 * Copies the next bytes of the file, false at the end of the file
+	 */
+	bool readBytes(void* data, size_t bytes);
+
+	std::shared_ptr<VirtualFile> file; //< Mapped, so the reader thread only touches the pages it copies
+	size_t file_position;
+	std::vector<StreamPart> parts;
+	std::vector<StreamChunk> chunks;
+	std::vector<MeshPart*> chunk_parts; //< Per part, the node chunks are added to
+	MeshPart root;
+
+	std::shared_ptr<GLUtils::VBO> interleaved;
+	std::shared_ptr<GLUtils::VBO> indices;
+	Texture2D texture;
+
+	std::vector<Block> blocks;
+	std::deque<Block*> free_blocks; //< Guarded by mutex
+	std::deque<Block*> full_blocks; //< Guarded by mutex
+	std::mutex mutex;
+	std::condition_variable block_freed;
+	std::thread reader;
+	std::atomic<bool> running;
+
+	Block* uploading; //< Block update() is taking chunks from
+	unsigned int uploading_chunk; //< Next chunk in that block
+	size_t uploading_offset; //< Where that chunk starts in the block
+
+	size_t uploaded_chunks;
+	unsigned long long uploaded_bytes;
+	unsigned long long total_bytes;
+	double start_time;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef _TEXTURE_2D__
 #define _TEXTURE_2D__
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <IL/il.h>
@@ -8,6 +9,10 @@
 
 #include <GL/glew.h>
 
+#include "GLUtils/Handles.hpp"
+
+struct MipChain;
+
 struct Image {
 	std::vector<char> data;
 	unsigned int components;
@@ -15,19 +20,66 @@ struct Image {
 	unsigned long height;
 };
 
+/**
+ * A 2D texture that owns its OpenGL texture object. Textures can be
+ * moved, e.g., into a std::vector, but not copied.
+ *
+ * The texture object is a GL_TEXTURE_2D_ARRAY, with one layer unless more
+ * are asked for, so that the shaders sample every texture with a
+ * sampler2DArray and a layer, see MaterialTextures.
+ */
 class Texture2D {
 public:
 	Texture2D();
 	Texture2D(const std::string& filename);
+
+	/**
+	 * Creates an RGBA texture with storage for the given number of mip
+	 * levels and layers but no contents, to be filled with uploadRows,
+	 * e.g., a few rows per frame
+	 */
+	Texture2D(unsigned int width, unsigned int height, unsigned int levels, unsigned int layers = 1);
+
+	Texture2D(Texture2D&& other);
+	Texture2D& operator=(Texture2D&& other);
 	void bind();
 
-	GLuint texture_name;
+	/**
+	 * Uploads rows [first_row, first_row + rows) of a mip level of a
+	 * layer. Leaves the texture bound.
+	 */
+	void uploadRows(unsigned int level, unsigned int first_row, unsigned int rows, const void* pixels, unsigned int layer = 0);
+
+	inline GLuint name() { return texture.name(); }
+
+	/**
+	 * GPU memory used by all mip levels
+	 */
+	inline long long bytes() const { return texture.bytes(); }
+
+	/**
+	 * Decodes an image file, or a .pgt file with all its mip levels, into
+	 * host memory without using OpenGL. Can be called from any thread.
+	 * Returns false if the file could not be read, and for the page files
+	 * of virtual textures, which are never decoded whole.
+	 */
+	static bool decode(const std::string& filename, MipChain& chain);
 
 private:
+	Texture2D(const Texture2D&);
+	Texture2D& operator=(const Texture2D&);
+
 	void createWhiteImage();
 	void readImageFile(const std::string& filename);
 	void createGLTexture();
+
+	/**
+	 * Uploads a .pgt file from the asset compiler with all its mip levels
+	 */
+	void readCacheFile(const std::string& filename);
 	std::shared_ptr<Image> image;
+	GLUtils::TextureHandle texture;
+	std::vector<unsigned int> level_widths; //< Set where the levels are allocated, for uploadRows
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef _TEXTURECACHE_H__
+#define _TEXTURECACHE_H__
+
+#include <string>
+#include <vector>
+
+/**
+ * A decoded RGBA8 image with its complete mip chain, level 0 first
+ */
+struct MipChain {
+	unsigned int width;
+	unsigned int height;
+	std::vector<std::vector<unsigned char> > levels;
+
+	inline unsigned int getLevelWidth(unsigned int level) const { return (width >> level) > 0 ? (width >> level) : 1; }
+	inline unsigned int getLevelHeight(unsigned int level) const { return (height >> level) > 0 ? (height >> level) : 1; }
+};
+
+/**
+ * Cache file format (.pgt) for textures: RGBA8 pixels with all mip
+ * levels precomputed by the asset compiler, so that textures can be
+ * uploaded without decoding image files or generating mipmaps at
+ * runtime. Does not use OpenGL or DevIL.
+ */
+class TextureCache {
+public:
+	/**
+	 * Fills levels 1 and up of chain from level 0 with a 2x2 box filter,
+	 * down to 1x1
+	 */
+	static void generateMipmaps(MipChain& chain);
+
+	static void write(const MipChain& chain, const std::string& filename);
+
+	/**
+	 * Reads a .pgt file through the VirtualFileSystem. Throws a
+	 * GameException on errors.
+	 */
+	static void read(const std::string& filename, MipChain& chain);
+
+	/**
+	 * Decodes a .pgt file in memory. Throws a GameException on errors.
+	 */
+	static void decode(const unsigned char* data, size_t size, MipChain& chain);
+
+	/**
+	 * True if the file name ends in .pgt
+	 */
+	static bool isCacheFile(const std::string& filename);
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef _TEXTUREUPLOADER_H__
+#define _TEXTUREUPLOADER_H__
+
+#include "GLUtils/DynamicBuffer.hpp"
+#include "Texture2D.h"
+
+/**
+ * What the uploads since the last resetStats did, times in seconds
+ */
+struct UploadStats {
+	UploadStats() : bytes(0), uploads(0), direct(0), copy_time(0.0), stalls(0) {}
+
+	unsigned long long bytes; //< Through the pixel buffers
+	unsigned int uploads;
+	unsigned int direct; //< Did not fit in the pixel buffer of the frame, uploaded from client memory
+	double copy_time; //< Copying into the pixel buffers and issuing the uploads
+	unsigned int stalls; //< Waits for the GPU to finish with a pixel buffer
+};
+
+/**
+ * Uploads texture rows through a ring of pixel buffer objects, so that
+ * glTexSubImage returns at once and the driver copies from the buffer
+ * while the frame goes on, instead of copying from client memory before
+ * it returns.
+ *
+ * Every frame writes to its own region of a GLUtils::DynamicBuffer bound
+ * as GL_PIXEL_UNPACK_BUFFER, which is fenced at endFrame, so a region is
+ * only written again once the GPU has read it, frames_in_flight frames
+ * later. A frame can upload at most frame_bytes; reserveRows tells how
+ * much of it is left.
+ */
+class TextureUploader {
+public:
+	static const unsigned int frames_in_flight = GLUtils::DynamicBuffer::regions;
+
+	TextureUploader(unsigned int frame_bytes);
+
+	/**
+	 * Returns how many of rows rows of row_bytes each fit in what is left
+	 * of this frame, 0 once it is full. Rows that are larger than a whole
+	 * frame always fit, and are uploaded directly.
+	 */
+	unsigned int reserveRows(unsigned int row_bytes, unsigned int rows);
+
+	/**
+	 * Whether reserveRows found the frame full
+	 */
+	inline bool isFull() const { return full; }
+
+	/**
+	 * Uploads rows of width pixels, see Texture2D::uploadRows. Leaves no
+	 * pixel buffer bound.
+	 */
+	void uploadRows(Texture2D& texture, unsigned int level, unsigned int first_row, unsigned int rows,
+		unsigned int width, const void* pixels, unsigned int layer = 0);
+
+	/**
+	 * Call after the uploads of a frame have been issued
+	 */
+	void endFrame();
+
+	UploadStats getStats() const;
+	void resetStats();
+
+private:
+	TextureUploader(const TextureUploader&);
+	TextureUploader& operator=(const TextureUploader&);
+
+	GLUtils::DynamicBuffer buffer;
+	unsigned int frame_bytes;
+	unsigned int used; //< Bytes of this frame
+	bool full;
+	UploadStats stats;
+	unsigned int stalls_at_reset; //< The buffer counts all its stalls
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef _THREADPOOL_H__
+#define _THREADPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Parallel.h"
+
+/**
+ * Work stealing thread pool for many independent tasks of uneven size,
+ * e.g., one task per asset. Every worker has its own queue. It takes
+ * its own work from the back (the most recent task, which is likely
+ * still in cache), and when that is empty it steals from the front of
+ * the other queues (the oldest tasks, which are likely the largest).
+ * Tasks submitted from outside the pool are spread round robin, tasks
+ * submitted from a worker go to its own queue.
+ */
+class ThreadPool {
+public:
+	typedef std::function<void()> Task;
+
+	ThreadPool(unsigned int threads = ::getThreadCount()) : queued(0), pending(0), next_queue(0), steals(0), running(true) {
+		if (threads == 0)
+			threads = 1;
+		for (unsigned int i=0; i<threads; ++i)
+			queues.push_back(std::unique_ptr<Queue>(new Queue()));
+		for (unsigned int i=0; i<threads; ++i)
+			workers.push_back(std::thread(&ThreadPool::run, this, i));
+	}
+
+	/**
+	 * Finishes all tasks before the workers are stopped
+	 */
+	~ThreadPool() {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			all_done.wait(lock, [&]() { return pending == 0; });
+			running = false;
+		}
+		work_available.notify_all();
+		for (unsigned int i=0; i<workers.size(); ++i)
+			workers[i].join();
+	}
+
+	void submit(Task task) {
+		int self = getWorkerIndex();
+		unsigned int index = (self >= 0) ? self : next_queue++ % queues.size();
+		++pending;
+		{
+			std::lock_guard<std::mutex> lock(queues[index]->mutex);
+			queues[index]->tasks.push_back(std::move(task));
+		}
+		{
+			//Under the lock, so that a worker cannot miss the wake up
+			std::lock_guard<std::mutex> lock(mutex);
+			++queued;
+		}
+		work_available.notify_one();
+	}
+
+	/**
+	 * Blocks until all submitted tasks, including tasks they submitted,
+	 * are done. The first exception thrown by a task is rethrown here.
+	 * Must not be called from a task.
+	 */
+	void wait() {
+		std::exception_ptr e;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			all_done.wait(lock, [&]() { return pending == 0; });
+			std::swap(e, error);
+		}
+		if (e)
+			std::rethrow_exception(e);
+	}
+
+	inline unsigned int getThreadCount() const { return static_cast<unsigned int>(workers.size()); }
+
+	/**
+	 * Number of tasks that were run by another worker than the one they were queued on
+	 */
+	inline unsigned long long getSteals() const { return steals; }
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	int getWorkerIndex() const {
+		std::thread::id self = std::this_thread::get_id();
+		for (unsigned int i=0; i<workers.size(); ++i)
+			if (workers[i].get_id() == self)
+				return i;
+		return -1;
+	}
+
+	bool popTask(unsigned int index, Task& task) {
+		{
+			Queue& own = *queues[index];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.tasks.empty()) {
+				task = std::move(own.tasks.back());
+				own.tasks.pop_back();
+				--queued;
+				return true;
+			}
+		}
+		for (unsigned int i=1; i<queues.size(); ++i) {
+			Queue& victim = *queues[(index + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.tasks.empty()) {
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				--queued;
+				++steals;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void run(unsigned int index) {
+		Task task;
+		for (;;) {
+			if (popTask(index, task)) {
+				try {
+					task();
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(mutex);
+					if (!error)
+						error = std::current_exception();
+				}
+				task = Task();
+				if (--pending == 0) {
+					std::lock_guard<std::mutex> lock(mutex);
+					all_done.notify_all();
+				}
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+			work_available.wait(lock, [&]() { return queued > 0 || !running; });
+			if (!running && queued == 0)
+				return;
+		}
+	}
+
+	std::vector<std::unique_ptr<Queue> > queues;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex; //< Guards error, and the sleeping and waking of workers
+	std::condition_variable work_available;
+	std::condition_variable all_done;
+	std::exception_ptr error;
+
+	std::atomic<unsigned int> queued; //< Tasks in the queues
+	std::atomic<unsigned int> pending; //< Tasks queued or running
+	std::atomic<unsigned int> next_queue;
+	std::atomic<unsigned long long> steals;
+	bool running;
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef _VERTEXWELDER_H__
+#define _VERTEXWELDER_H__
+
+#include "MeshData.h"
+
+/**
+ * Merges duplicate vertices of a mesh and rewrites its indices. Vertices
+ * are merged if their positions, normals and texture coordinates all
+ * match, each within its own tolerance: with a tolerance of zero only
+ * bit for bit identical components match, otherwise the components are
+ * snapped to a grid of cells of that size, and components in the same
+ * cell match. Vertices on either side of a cell boundary are not merged,
+ * even if they are closer than the tolerance. Vertices of different parts
+ * are never merged. The bone weights of a skinned model are not part of
+ * the key; merged vertices keep those of the first.
+ *
+ * Keys are hashed in parallel, and the hash table is split into one
+ * partition per thread, so that no locking is needed. The result does
+ * not depend on the number of threads.
+ */
+class VertexWelder {
+public:
+	static void weld(MeshData& data, float epsilon = 0.0f, float normal_epsilon = 0.0f, float tex_coord_epsilon = 0.0f);
+};
+
+#endif
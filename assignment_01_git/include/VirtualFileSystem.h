@@ -0,0 +1,75 @@
+#ifndef _VIRTUALFILESYSTEM_H__
+#define _VIRTUALFILESYSTEM_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class Archive;
+class MappedFile;
+
+/**
+ * Contents of a file opened through the VirtualFileSystem. Points into
+ * a mapped archive or a mapped file on disk, or owns the bytes of a
+ * decompressed archive entry. The data stays valid as long as the
+ * VirtualFile exists, also if its archive is unmounted.
+ */
+class VirtualFile {
+public:
+	VirtualFile() : ptr(NULL), length(0) {}
+
+	inline const char* data() const { return ptr; }
+	inline size_t size() const { return length; }
+
+private:
+	VirtualFile(const VirtualFile&);
+	VirtualFile& operator=(const VirtualFile&);
+
+	friend class Archive;
+	friend class VirtualFileSystem;
+
+	const char* ptr;
+	size_t length;
+	std::vector<char> buffer; //< Decompressed entries
+	std::shared_ptr<MappedFile> mapping; //< Keeps the mapping alive
+};
+
+/**
+ * All file access of the program goes through here. Files are looked up
+ * in the mounted archives, most recently mounted first, and then on
+ * disk, so that loose files work without packing anything. Archives are
+ * opened and mapped once, which avoids a file open and seeks for every
+ * shader, model and texture on a cold start.
+ *
+ * Paths are normalized ('\' to '/', "." and ".." resolved), so that
+ * "models/sub/../tex.png" finds the entry "models/tex.png".
+ * open() may be called from several threads.
+ */
+class VirtualFileSystem {
+public:
+	/**
+	 * Mounts a .pga archive. Throws a GameException if it is invalid.
+	 */
+	static void mount(const std::string& archive);
+	static void unmountAll();
+
+	/**
+	 * Opens a file from the archives or from disk. Throws a GameException
+	 * if it exists in neither.
+	 */
+	static std::shared_ptr<VirtualFile> open(const std::string& filename);
+
+	static bool exists(const std::string& filename);
+
+	/**
+	 * Prints how many files were opened from archives and from disk
+	 */
+	static void printStats();
+
+	static std::string normalizePath(const std::string& path);
+
+private:
+	static std::shared_ptr<VirtualFile> openFromDisk(const std::string& filename);
+};
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef _VIRTUALTEXTURE_H__
+#define _VIRTUALTEXTURE_H__
+
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "GLUtils/GLUtils.hpp"
+#include "ThreadPool.h"
+
+/**
+ * What the virtual texture did, the page counts of the last update and
+ * the rest since the last resetStats, times in seconds
+ */
+struct VirtualTextureStats {
+	VirtualTextureStats() : requested(0), missing(0), resident(0), loaded(0), evicted(0), dropped(0),
+		feedback_time(0.0), upload_time(0.0), table_time(0.0) {}
+
+	unsigned int requested; //< Pages the last feedback asked for, with their coarser ancestors
+	unsigned int missing; //< Of them not in the cache
+	unsigned int resident; //< Pages in the cache
+	unsigned int loaded; //< Uploaded to the cache
+	unsigned int evicted;
+	unsigned int dropped; //< Read, but every cache slot held a page the feedback asked for
+	double feedback_time; //< Reading back and analysing the feedback
+	double upload_time;
+	double table_time; //< Rebuilding and uploading the indirection table
+};
+
+/**
+ * A texture that is larger than we want in GPU memory, e.g., a 32k scan.
+ *
+ * The texture and all its mip levels are cut into pages of page_size
+ * texels, with a border of the neighbouring texels for bilinear
+ * filtering, and stored uncompressed in a page file (.pgv) that is
+ * read a page at a time, so neither the file nor the texture ever has
+ * to fit in memory.
+ *
+ * Every frame, a feedback pass renders the model at 1/feedback_divisor
+ * of the window, writing the page and mip level each fragment needs. It
+ * is read back through pixel buffers a few frames later, and the pages
+ * that are asked for are read from the file on a worker thread and
+ * uploaded into a physical cache texture of cache_pages by cache_pages
+ * pages, replacing the pages that were asked for least recently. The
+ * levels that fit in one page are loaded up front and never evicted.
+ *
+ * An indirection table in a texture buffer has an entry per page of
+ * every level: the cache slot of the page, or of its nearest resident
+ * ancestor, and the level of the page in that slot. The shaders sample
+ * the cache through it, so missing pages are drawn blurred rather than
+ * not at all. GPU memory is the cache, the table and the feedback
+ * framebuffer, whatever the size of the texture.
+ */
+class VirtualTexture {
+public:
+	static const unsigned int page_size = 128; //< Texels across a page, without borders
+	static const unsigned int border = 4; //< Texels on every side of a page
+	static const unsigned int max_levels = 16; //< Must match vt_levels in the shaders
+	static const unsigned int feedback_divisor = 8;
+	static const unsigned int feedback_frames = 3; //< Readbacks in flight
+
+	/**
+	 * Opens a page file, loads the levels that fit in one page, and
+	 * allocates a cache of cache_pages by cache_pages pages (at most 256).
+	 * Needs an OpenGL context. Throws a GameException on failure.
+	 */
+	VirtualTexture(const std::string& filename, unsigned int cache_pages = 32);
+
+	/**
+	 * Waits for the page reads in flight
+	 */
+	~VirtualTexture();
+
+	static bool isPageFile(const std::string& filename);
+
+	/**
+	 * Cuts an image into the pages of a page file, a band of page rows at
+	 * a time, and builds every mip level from the pages of the level
+	 * before it in the file. Binary PPM images (P6, 8 bit) are read a band
+	 * at a time too, so that memory is a few bands whatever the size of
+	 * the image; other formats are decoded whole by DevIL first. Does not
+	 * need an OpenGL context.
+	 */
+	static void convert(const std::string& image, const std::string& page_file);
+
+	/**
+	 * Binds the feedback framebuffer, at 1/feedback_divisor of the given
+	 * size, and clears it. The framebuffer is made for the size of the
+	 * first call, pass the window size. Draw the model with program (made from
+	 * shaders/vtfeedback.*), after setting its uniforms with
+	 * bindFeedback, until endFeedback.
+	 */
+	void beginFeedback(unsigned int width, unsigned int height);
+
+	/**
+	 * Sets the uniforms of the feedback program, which is in use
+	 */
+	void bindFeedback(GLUtils::Program& program);
+
+	/**
+	 * Starts reading the feedback back and binds the window framebuffer
+	 * again. The caller restores its viewport.
+	 */
+	void endFeedback();
+
+	/**
+	 * Requests the pages of the feedback that has arrived, and uploads
+	 * at most max_uploads pages that the worker has read. Call every
+	 * frame, also when nothing is drawn. Returns true if pages were
+	 * uploaded, so the view should be drawn again.
+	 */
+	bool update(unsigned int max_uploads);
+
+	/**
+	 * Binds the cache and the indirection table to first_unit and the
+	 * unit after it, and sets the uniforms of the program that is in use.
+	 * Leaves GL_TEXTURE0 active.
+	 */
+	void bind(GLUtils::Program& program, unsigned int first_unit);
+
+	inline unsigned int getWidth() const { return width; }
+	inline unsigned int getHeight() const { return height; }
+
+	/**
+	 * GPU memory used by the cache, the table and the feedback framebuffer
+	 */
+	long long bytes() const;
+
+	inline const VirtualTextureStats& getStats() const { return stats; }
+	void resetStats();
+
+private:
+	VirtualTexture(const VirtualTexture&);
+	VirtualTexture& operator=(const VirtualTexture&);
+
+	struct Level {
+		unsigned int width, height;
+		unsigned int pages_x, pages_y;
+		unsigned int first; //< Index of its first page
+	};
+
+	struct Readback {
+		Readback() : fence(0), width(0), height(0) {}
+
+		GLUtils::BufferHandle buffer;
+		GLsync fence; //< 0 when not in flight
+		unsigned int width, height;
+	};
+
+	/**
+	 * A page the worker has read
+	 */
+	struct LoadedPage {
+		unsigned int page;
+		std::vector<unsigned char> texels;
+	};
+
+	static unsigned int getPageBytes() { return (page_size + 2*border) * (page_size + 2*border) * 4; }
+
+	/**
+	 * Copies rows [first, first + count) of a level, RGBA with the bottom
+	 * row first like MipChain, to out
+	 */
+	typedef std::function<void(unsigned int first, unsigned int count, unsigned char* out)> RowReader;
+
+	/**
+	 * Reads a binary PPM image a few rows at a time
+	 */
+	static RowReader openPpm(const std::string& filename, unsigned int& width, unsigned int& height);
+
+	/**
+	 * Reads the rows of a level from the pages that convert wrote to file
+	 */
+	static RowReader readLevel(std::fstream& file, const Level& level);
+
+	/**
+	 * The rows of the next mip level of a width by height level, filtered
+	 * like TextureCache::generateMipmaps
+	 */
+	static RowReader downsample(const RowReader& rows, unsigned int width, unsigned int height);
+
+	/**
+	 * Writes the pages of a level to file, a row of pages at a time
+	 */
+	static void writeLevel(std::fstream& file, const Level& level, const RowReader& rows);
+
+	/**
+	 * The levels of a width by height texture down to 1x1, returns the
+	 * number of pages of all of them
+	 */
+	static unsigned int buildLevels(unsigned int width, unsigned int height, std::vector<Level>& levels);
+
+	void createFeedback(unsigned int width, unsigned int height);
+	void readFeedback(Readback& readback);
+
+	/**
+	 * Stamps a page of the feedback and its ancestors as used, and adds
+	 * those that are neither resident nor loading to missing
+	 */
+	void request(unsigned int level, unsigned int x, unsigned int y);
+	void setLevelUniforms(GLUtils::Program& program);
+	void uploadPage(unsigned int slot, unsigned int page, const unsigned char* texels);
+
+	/**
+	 * A free slot, or the one with the page asked for least recently. -1
+	 * if every slot holds a page of the last feedback or a pinned one.
+	 */
+	int findSlot() const;
+	void updateTable();
+
+	std::ifstream file; //< Only read by the reader once the constructor is done
+	unsigned int width, height;
+	std::vector<Level> levels;
+	unsigned int n_pages;
+
+	unsigned int cache_pages; //< Slots across the cache
+	std::vector<int> slot_page; //< Page in every cache slot, -1 for none
+	std::vector<unsigned int> slot_used; //< Feedback that last asked for it
+	std::vector<bool> slot_pinned;
+	std::vector<int> page_slot; //< Slot of every page, -1 if not resident
+	std::vector<unsigned int> page_requested; //< Feedback that last asked for it
+	std::vector<bool> page_loading;
+	unsigned int feedback_count; //< Feedbacks read so far, 0 is none
+	std::vector<unsigned int> missing; //< Of the feedback being read
+
+	ThreadPool reader; //< Reads pages from the file
+	unsigned int reads; //< Submitted to the reader and not uploaded yet
+	std::mutex loaded_mutex;
+	std::deque<std::shared_ptr<LoadedPage> > loaded; //< Read by the worker, not uploaded yet
+
+	GLUtils::TextureHandle cache;
+	std::vector<unsigned int> table; //< Slot x, y and level per page
+	bool table_dirty;
+	GLUtils::BufferHandle table_buffer;
+	GLUtils::TextureHandle table_texture;
+
+	GLUtils::FramebufferHandle feedback_framebuffer;
+	GLUtils::TextureHandle feedback_color, feedback_depth;
+	unsigned int feedback_width, feedback_height; //< Of the framebuffer
+	unsigned int feedback_view_width, feedback_view_height; //< Drawn this frame
+	Readback readbacks[feedback_frames];
+	unsigned int oldest; //< Readback read next
+	unsigned int in_flight;
+
+	VirtualTextureStats stats;
+};
+
+#endif
@@ -40,6 +40,12 @@ public:
 	  */
 	void setWindowSize(int w, int h);
 
+	/**
+	  * Returns true between rotateBegin and rotateEnd, i.e., when
+	  * mouse motion changes the view
+	  */
+	inline bool isRotating() { return rotating; }
+
 private:
 	/**
 	  * Returns the normalized (x=[-0.5, 0.5], y=[-0.5, 0.5]) window
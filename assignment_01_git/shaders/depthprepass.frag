@@ -0,0 +1,7 @@
+#version 140
+out vec4 out_color;
+
+// Color writes are disabled, only the depth is kept
+void main() {
+	out_color = vec4(1.0f);
+}
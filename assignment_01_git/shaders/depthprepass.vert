@@ -0,0 +1,18 @@
+#version 140
+uniform mat4 projection_matrix;
+uniform mat4 modelview_matrix;
+
+in vec3 in_Position;
+
+// Computed exactly like in phongshader.vert, with the same skinning
+// uniform, so that its depths pass GL_EQUAL
+invariant gl_Position;
+
+#include "skinning.glsl"
+
+void main() {
+	vec3 normal = vec3(0.0);
+	vec3 position = skinVertex(in_Position, normal);
+	vec4 pos = modelview_matrix * vec4(position, 1.0);
+	gl_Position = projection_matrix * pos;
+}
@@ -1,11 +1,18 @@
-#version 130
+#version 140
 flat in vec3 ex_Color;
 out vec4 out_color;
 
-uniform sampler2D texture_sampler;
+uniform sampler2DArray texture_sampler;
+uniform float texture_layer; // Of the part, -1 for none
 in vec2 ex_Texture_Coords;
 
+#include "virtualtexture.glsl"
+
 void main() {
-	vec4 textureColor = texture(texture_sampler, ex_Texture_Coords);
+	vec4 textureColor;
+	if (virtual_texture != 0)
+		textureColor = sampleVirtualTexture(ex_Texture_Coords);
+	else
+		textureColor = (texture_layer < 0.0f) ? vec4(1.0f) : texture(texture_sampler, vec3(ex_Texture_Coords, texture_layer));
 	out_color = textureColor * vec4(ex_Color, 1.0f);
 }
\ No newline at end of file
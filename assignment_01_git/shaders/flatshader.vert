@@ -1,4 +1,4 @@
-#version 130
+#version 140
 uniform mat4 projection_matrix;
 uniform mat4 modelview_matrix;
 uniform mat3 normal_matrix;
@@ -11,14 +11,18 @@ in vec2 in_Texture_Coords;
 flat out vec3 ex_Color;
 out vec2 ex_Texture_Coords;
 
+#include "skinning.glsl"
+
 void main() {
-	vec4 pos = modelview_matrix * vec4(in_Position, 1.0f);
+	vec3 normal = in_Normal;
+	vec3 position = skinVertex(in_Position, normal);
+	vec4 pos = modelview_matrix * vec4(position, 1.0f);
 	
 	vec3 view = normalize(-pos.xyz);
 	vec3 light = normalize(vec3(200.0f, 200.0f, 200.0f) - pos.xyz);
 
 	vec3 h = normalize(view + light);
-	vec3 n = normalize(normal_matrix * in_Normal);
+	vec3 n = normalize(normal_matrix * normal);
 
 	float diff = max(0.1f, dot(n, light));
 
@@ -1,23 +1,58 @@
-#version 130
+#version 140
 flat in vec3 ex_Color;
 smooth in vec3 normal_smooth;
 smooth in vec3 ex_View;
 smooth in vec3 ex_Light;
+smooth in vec3 ex_Position;
 out vec4 out_color;
 
-// Texture
-uniform sampler2D texture_sampler;
+// Texture array with the texture of the part in texture_layer, -1 for none
+uniform sampler2DArray texture_sampler;
+uniform float texture_layer;
 in vec2 ex_Texture_Coords;
 
+#include "virtualtexture.glsl"
+
+// Clustered point lights, see ClusteredLights
+uniform samplerBuffer light_data; // View position and radius, then color, per light
+uniform usamplerBuffer cluster_data; // Offset and count of the light indices of each cluster
+uniform usamplerBuffer light_indices;
+uniform ivec3 cluster_grid;
+uniform vec2 cluster_tile_scale; // Tiles per pixel
+uniform vec2 cluster_slice; // slice = log(depth)*x + y
+
 void main() {
     vec3 h = normalize(ex_View + ex_Light);
     vec3 n = normalize(normal_smooth);
     float diff = max(0.1f, dot(n, ex_Light));
     float spec = pow(max(0.0f, dot(n, h)), 128.0f);
-	vec4 textureColor = texture(texture_sampler, ex_Texture_Coords);
+	vec4 textureColor;
+	if (virtual_texture != 0)
+		textureColor = sampleVirtualTexture(ex_Texture_Coords);
+	else
+		textureColor = (texture_layer < 0.0f) ? vec4(1.0f) : texture(texture_sampler, vec3(ex_Texture_Coords, texture_layer));
+
+	//Only the lights of the cluster this fragment is in
+	ivec3 cell = ivec3(ivec2(gl_FragCoord.xy * cluster_tile_scale), int(log(-ex_Position.z) * cluster_slice.x + cluster_slice.y));
+	cell = clamp(cell, ivec3(0), cluster_grid - 1);
+	uvec2 range = texelFetch(cluster_data, (cell.z * cluster_grid.y + cell.y) * cluster_grid.x + cell.x).xy;
 
-	//vec4 testColor = vec4(ex_Color,1.0f) * textureColor;
-	//out_color = vec4(textureColor, 1.0f);
+	vec3 light_diffuse = vec3(0.0f);
+	vec3 light_specular = vec3(0.0f);
+	for (uint i = 0u; i < range.y; ++i) {
+		int light = int(texelFetch(light_indices, int(range.x + i)).x);
+		vec4 position = texelFetch(light_data, 2*light);
+		vec3 l = position.xyz - ex_Position;
+		float distance2 = dot(l, l);
+		float falloff = clamp(1.0f - distance2 / (position.w * position.w), 0.0f, 1.0f);
+		if (falloff > 0.0f) {
+			vec3 color = texelFetch(light_data, 2*light + 1).rgb * falloff * falloff;
+			l *= inversesqrt(distance2);
+			light_diffuse += max(0.0f, dot(n, l)) * color;
+			light_specular += pow(max(0.0f, dot(n, normalize(ex_View + l))), 128.0f) * color;
+		}
+	}
 
-    out_color = diff  * textureColor * vec4(ex_Color, 1.0f) + vec4(spec);
-}
\ No newline at end of file
+    out_color = diff  * textureColor * vec4(ex_Color, 1.0f) + vec4(spec)
+		+ textureColor * vec4(ex_Color * light_diffuse, 0.0f) + vec4(light_specular, 0.0f);
+}
@@ -1,4 +1,4 @@
-#version 130
+#version 140
 uniform mat4 projection_matrix;
 uniform mat4 modelview_matrix;
 uniform mat3 normal_matrix;
@@ -11,17 +11,27 @@ in	vec2 in_Texture_Coords;
 flat out vec3 ex_Color;
 smooth out vec3 ex_View;
 smooth out vec3 ex_Light;
+smooth out vec3 ex_Position;
 smooth out vec3 normal_smooth;
 out vec2 ex_Texture_Coords;
 
+// The depth pre-pass computes the same positions with skinVertex, see
+// depthprepass.vert. It is not used for skinned models.
+invariant gl_Position;
+
+#include "skinning.glsl"
+
 void main() {
-	vec4 pos = modelview_matrix * vec4(in_Position, 1.0);
+	vec3 normal = in_Normal;
+	vec3 position = skinVertex(in_Position, normal);
+	vec4 pos = modelview_matrix * vec4(position, 1.0);
+	ex_Position = pos.xyz;
 	ex_View = normalize(-pos.xyz);
 	ex_Light = normalize(vec3(200.0f, 200.0f, 200.0f) - pos.xyz);
 	gl_Position = projection_matrix * pos;
 	ex_Color = color;
 	ex_Texture_Coords = in_Texture_Coords;
 
-	normal_smooth = normal_matrix * in_Normal;
+	normal_smooth = normal_matrix * normal;
 }
 
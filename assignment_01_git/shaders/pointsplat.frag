@@ -0,0 +1,12 @@
+#version 140
+flat in vec3 ex_Color;
+out vec4 out_color;
+
+// Round splats, a little darker towards their edge so that overlapping splats stay apart
+void main() {
+	vec2 coord = gl_PointCoord * 2.0f - 1.0f;
+	float r2 = dot(coord, coord);
+	if (r2 > 1.0f)
+		discard;
+	out_color = vec4(ex_Color * (1.0f - 0.25f * r2), 1.0f);
+}
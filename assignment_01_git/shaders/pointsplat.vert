@@ -0,0 +1,26 @@
+#version 140
+uniform mat4 projection_matrix;
+uniform mat4 modelview_matrix;
+
+// The cube of the node, its points are quantized within it, see PointOctree
+uniform vec3 node_min;
+uniform float node_size;
+
+uniform float spacing; // Between the points of the node
+uniform float splat_scale; // Pixels per unit of the node at a distance of one
+uniform float max_splat_size;
+
+in vec4 in_Position; // GL_UNSIGNED_INT_2_10_10_10_REV, normalized
+in vec4 in_Color;
+
+flat out vec3 ex_Color;
+
+void main() {
+	vec3 position = node_min + in_Position.xyz * node_size;
+	vec4 pos = modelview_matrix * vec4(position, 1.0f);
+	gl_Position = projection_matrix * pos;
+
+	//Large enough that the splats of neighbouring points touch
+	gl_PointSize = clamp(spacing * splat_scale / max(-pos.z, 1e-4f), 1.0f, max_splat_size);
+	ex_Color = in_Color.rgb;
+}
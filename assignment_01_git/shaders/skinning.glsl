@@ -0,0 +1,33 @@
+// Skinning on the GPU, see SkinnedMesh
+uniform int skinning; // 1 when the vertices are moved by in_Bones
+uniform samplerBuffer bone_matrices;
+
+in vec4 in_Bones;
+in vec4 in_Weights;
+
+// Blend of the bones of the vertex, three texels per bone, see SkinnedMesh.
+// The weight no bone takes keeps the bind pose: vertices of the meshes
+// without bones have no weights at all, and SkinnedMesh::skin leaves them
+mat4 skinMatrix() {
+	float rest = 1.0 - dot(in_Weights, vec4(1.0));
+	mat4 rows = mat4(rest);
+	for (int i = 0; i < 4; ++i) {
+		int bone = int(in_Bones[i]) * 3;
+		rows[0] += in_Weights[i] * texelFetch(bone_matrices, bone);
+		rows[1] += in_Weights[i] * texelFetch(bone_matrices, bone + 1);
+		rows[2] += in_Weights[i] * texelFetch(bone_matrices, bone + 2);
+	}
+	rows[3] = vec4(0.0, 0.0, 0.0, 1.0);
+	return transpose(rows);
+}
+
+// The position moved by the bones when skinning is 1, and the normal with it.
+// Every shader that must compute the positions of depthprepass.vert calls it
+vec3 skinVertex(vec3 position, inout vec3 normal) {
+	if (skinning != 0) {
+		mat4 skin = skinMatrix();
+		position = (skin * vec4(position, 1.0)).xyz;
+		normal = mat3(skin) * normal;
+	}
+	return position;
+}
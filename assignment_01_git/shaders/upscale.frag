@@ -0,0 +1,25 @@
+#version 140
+uniform sampler2D source;
+uniform vec2 source_scale;
+uniform vec2 texel_size; // Of the source texture
+uniform float sharpness; // Weight of the neighbours in the unsharp mask, 0 for bilinear only
+
+in vec2 ex_Texture_Coords;
+out vec4 out_color;
+
+// Bilinear lookup that stays half a texel inside the rendered part of the source
+vec3 fetch(vec2 uv) {
+	return texture(source, clamp(uv, 0.5f * texel_size, source_scale - 0.5f * texel_size)).rgb;
+}
+
+void main() {
+	vec3 color = fetch(ex_Texture_Coords);
+	if (sharpness > 0.0f) {
+		vec3 neighbours = fetch(ex_Texture_Coords + vec2(texel_size.x, 0.0f))
+			+ fetch(ex_Texture_Coords - vec2(texel_size.x, 0.0f))
+			+ fetch(ex_Texture_Coords + vec2(0.0f, texel_size.y))
+			+ fetch(ex_Texture_Coords - vec2(0.0f, texel_size.y));
+		color = clamp(color + sharpness * (4.0f * color - neighbours), 0.0f, 1.0f);
+	}
+	out_color = vec4(color, 1.0f);
+}
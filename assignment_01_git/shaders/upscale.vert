@@ -0,0 +1,11 @@
+#version 140
+uniform vec2 source_scale; // The part of the source texture that was rendered to
+
+out vec2 ex_Texture_Coords;
+
+// One triangle covering the window, made from gl_VertexID alone
+void main() {
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	ex_Texture_Coords = corner * source_scale;
+	gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+}
@@ -0,0 +1,30 @@
+// Virtual texture, see VirtualTexture. Used instead of texture_sampler when virtual_texture is 1
+uniform int virtual_texture;
+uniform sampler2D vt_cache;
+uniform usamplerBuffer vt_table; // Cache slot x, y and level of every page
+uniform ivec4 vt_levels[16]; // First page, pages across, width and height of every level
+uniform int vt_level_count;
+uniform vec2 vt_size;
+uniform float vt_cache_size; // Texels across the cache
+const float vt_page = 128.0f;
+const float vt_border = 4.0f;
+
+vec4 sampleVirtualTexture(vec2 uv) {
+	//The level the hardware would pick for a texture of vt_size
+	vec2 dx = dFdx(uv * vt_size);
+	vec2 dy = dFdy(uv * vt_size);
+	float lod = 0.5f * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0f));
+	int level = clamp(int(lod + 0.5f), 0, vt_level_count - 1);
+
+	//The page may not be resident, then the entry is that of an ancestor
+	uv = fract(uv);
+	ivec4 info = vt_levels[level];
+	ivec2 page = min(ivec2(uv * vec2(info.zw) / vt_page), ivec2(info.y, (info.w + 127) / 128) - 1);
+	uint entry = texelFetch(vt_table, info.x + page.y * info.y + page.x).x;
+	vec2 slot = vec2(float(entry & 255u), float((entry >> 8u) & 255u));
+	vec2 position = uv * vec2(vt_levels[int(entry >> 16u)].zw) / vt_page;
+
+	//Within the page, its border holds the texels of the neighbours for bilinear filtering
+	vec2 texel = slot * (vt_page + 2.0f * vt_border) + vt_border + fract(position) * vt_page;
+	return textureLod(vt_cache, texel / vt_cache_size, 0.0f);
+}
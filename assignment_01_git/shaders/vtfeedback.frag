@@ -0,0 +1,28 @@
+#version 140
+uniform int virtual_texture; // 0 for parts with another texture, which only occlude
+uniform ivec4 vt_levels[16]; // First page, pages across, width and height of every level
+uniform int vt_level_count;
+uniform vec2 vt_size;
+uniform float vt_lod_bias; // The feedback is smaller than the window
+const float vt_page = 128.0f;
+
+in vec2 ex_Texture_Coords;
+out uvec4 out_page;
+
+// The page and level sampleVirtualTexture of virtualtexture.glsl reads, and 1 to mark it
+void main() {
+	if (virtual_texture == 0) {
+		out_page = uvec4(0u);
+		return;
+	}
+
+	vec2 dx = dFdx(ex_Texture_Coords * vt_size);
+	vec2 dy = dFdy(ex_Texture_Coords * vt_size);
+	float lod = 0.5f * log2(max(dot(dx, dx), dot(dy, dy))) + vt_lod_bias;
+	int level = clamp(int(max(lod, 0.0f) + 0.5f), 0, vt_level_count - 1);
+
+	vec2 uv = fract(ex_Texture_Coords);
+	ivec4 info = vt_levels[level];
+	ivec2 page = min(ivec2(uv * vec2(info.zw) / vt_page), ivec2(info.y, (info.w + 127) / 128) - 1);
+	out_page = uvec4(uvec2(page), uint(level), 1u);
+}
@@ -0,0 +1,13 @@
+#version 140
+uniform mat4 projection_matrix;
+uniform mat4 modelview_matrix;
+
+in vec3 in_Position;
+in vec2 in_Texture_Coords;
+
+out vec2 ex_Texture_Coords;
+
+void main() {
+	gl_Position = projection_matrix * modelview_matrix * vec4(in_Position, 1.0);
+	ex_Texture_Coords = in_Texture_Coords;
+}
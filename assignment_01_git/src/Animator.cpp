@@ -0,0 +1,108 @@
+#include "Animator.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+Animator::Animator(const Skeleton& skeleton) : skeleton(skeleton) {
+	locals.resize(skeleton.nodes.size());
+	globals.resize(skeleton.nodes.size());
+	setAnimation(0);
+}
+
+void Animator::setAnimation(unsigned int animation) {
+	this->animation = animation;
+	time = 0.0;
+	caches.assign(isAnimated() ? skeleton.animations[animation].channels.size() : 0, KeyCache());
+}
+
+void Animator::advance(double seconds) {
+	if (!isAnimated())
+		return;
+	double duration = skeleton.animations[animation].duration;
+	time += seconds;
+	if (duration > 0.0)
+		time = std::fmod(time, duration);
+	else
+		time = 0.0;
+}
+
+unsigned int Animator::findKey(const std::vector<float>& times, float time, unsigned int& cached, float& factor) {
+	++stats.samples;
+	factor = 0.0f;
+	unsigned int n = static_cast<unsigned int>(times.size());
+	if (n <= 1)
+		return 0;
+
+	if (cached < n && times[cached] <= time) {
+		++stats.cached;
+		while (cached + 1 < n && times[cached + 1] <= time)
+			++cached;
+	} else {
+		++stats.searched;
+		unsigned int after = static_cast<unsigned int>(std::upper_bound(times.begin(), times.end(), time) - times.begin());
+		cached = (after > 0) ? after - 1 : 0;
+	}
+
+	//Before the first key and after the last one, the key is held
+	if (cached + 1 < n && time > times[cached])
+		factor = std::min(1.0f, (time - times[cached]) / (times[cached + 1] - times[cached]));
+	return cached;
+}
+
+void Animator::sample(std::vector<float>& bone_rows) {
+	for (unsigned int i = 0; i < skeleton.nodes.size(); ++i)
+		locals[i] = skeleton.nodes[i].transform;
+
+	if (isAnimated()) {
+		const Animation& current = skeleton.animations[animation];
+		float t = static_cast<float>(time);
+		for (unsigned int c = 0; c < current.channels.size(); ++c) {
+			const AnimationChannel& channel = current.channels[c];
+			KeyCache& cache = caches[c];
+			float factor;
+
+			glm::vec3 position(0.0f);
+			if (!channel.positions.empty()) {
+				unsigned int k = findKey(channel.position_times, t, cache.position, factor);
+				position = channel.positions[k];
+				if (factor > 0.0f)
+					position = glm::mix(position, channel.positions[k + 1], factor);
+			}
+
+			glm::quat rotation;
+			if (!channel.rotations.empty()) {
+				unsigned int k = findKey(channel.rotation_times, t, cache.rotation, factor);
+				rotation = channel.rotations[k];
+				if (factor > 0.0f)
+					rotation = glm::slerp(rotation, channel.rotations[k + 1], factor);
+			}
+
+			glm::vec3 scale(1.0f);
+			if (!channel.scales.empty()) {
+				unsigned int k = findKey(channel.scale_times, t, cache.scale, factor);
+				scale = channel.scales[k];
+				if (factor > 0.0f)
+					scale = glm::mix(scale, channel.scales[k + 1], factor);
+			}
+
+			locals[channel.node] = glm::translate(glm::mat4(1.0f), position) * glm::mat4_cast(glm::normalize(rotation))
+				* glm::scale(glm::mat4(1.0f), scale);
+		}
+	}
+
+	for (unsigned int i = 0; i < skeleton.nodes.size(); ++i) {
+		int parent = skeleton.nodes[i].parent;
+		globals[i] = (parent < 0) ? locals[i] : globals[parent] * locals[i];
+	}
+
+	//Rows of the 3x4 part, the last row is always 0 0 0 1
+	bone_rows.resize(skeleton.bone_nodes.size() * 12);
+	for (unsigned int b = 0; b < skeleton.bone_nodes.size(); ++b) {
+		glm::mat4 bone = skeleton.mesh_inverse * globals[skeleton.bone_nodes[b]] * skeleton.bone_offsets[b];
+		for (int r = 0; r < 3; ++r)
+			for (int c = 0; c < 4; ++c)
+				bone_rows[b*12 + r*4 + c] = bone[c][r];
+	}
+}
@@ -0,0 +1,238 @@
+#include "Archive.h"
+#include "EntropyCoder.h"
+#include "GameException.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+
+namespace {
+
+	const unsigned int magic = 0x41504750; //< "PGPA"
+	const unsigned int version = 1;
+
+	// Compressed entries are split into blocks that are coded independently
+	const unsigned int compression_block_size = 1 << 18;
+
+	enum Compression {
+		COMPRESSION_NONE,
+		COMPRESSION_RANS
+	};
+
+	struct ArchiveHeader {
+		unsigned int magic;
+		unsigned int version;
+		unsigned int n_entries;
+		unsigned int names_bytes;
+		unsigned long long toc_offset;
+	};
+
+	struct TocEntry {
+		unsigned long long offset;
+		unsigned long long stored_size;
+		unsigned long long size;
+		unsigned int name_offset;
+		unsigned int name_length;
+		unsigned int compression;
+		unsigned int reserved;
+	};
+
+	inline unsigned int getBlockCount(size_t size) {
+		return static_cast<unsigned int>((size + compression_block_size - 1) / compression_block_size);
+	}
+
+	/**
+	 * Layout: the number of blocks, the end of every block relative to
+	 * the first one, then the blocks
+	 */
+	void compressEntry(const unsigned char* data, size_t size, std::vector<unsigned char>& out) {
+		unsigned int n_blocks = getBlockCount(size);
+		std::vector<std::vector<unsigned char> > blocks(n_blocks);
+		parallelFor(n_blocks, [&](unsigned int b) {
+			size_t begin = static_cast<size_t>(b) * compression_block_size;
+			ByteWriter writer(blocks[b]);
+			EntropyCoder::encode(data + begin, std::min<size_t>(compression_block_size, size - begin), writer);
+		});
+
+		ByteWriter writer(out);
+		writer.putBytes(&n_blocks, sizeof(n_blocks));
+		unsigned long long end = 0;
+		for (unsigned int b=0; b<n_blocks; ++b) {
+			end += blocks[b].size();
+			writer.putBytes(&end, sizeof(end));
+		}
+		for (unsigned int b=0; b<n_blocks; ++b)
+			writer.putBytes(blocks[b].data(), blocks[b].size());
+	}
+
+	void decompressEntry(const unsigned char* data, size_t stored_size, char* out, size_t size) {
+		ByteReader reader(data, data + stored_size);
+		unsigned int n_blocks;
+		reader.getBytes(&n_blocks, sizeof(n_blocks));
+		if (n_blocks != getBlockCount(size))
+			THROW_EXCEPTION("Corrupt compressed archive entry");
+		std::vector<unsigned long long> ends(n_blocks);
+		reader.getBytes(ends.data(), ends.size()*sizeof(unsigned long long));
+		if (n_blocks == 0)
+			return;
+		const unsigned char* first = reader.skip(static_cast<size_t>(ends.back()));
+
+		parallelFor(n_blocks, [&](unsigned int b) {
+			unsigned long long begin = (b > 0) ? ends[b-1] : 0;
+			if (ends[b] < begin)
+				THROW_EXCEPTION("Corrupt compressed archive entry");
+			ByteReader block_reader(first + begin, first + ends[b]);
+			std::vector<unsigned char> block;
+			size_t offset = static_cast<size_t>(b) * compression_block_size;
+			EntropyCoder::decode(block_reader, block, std::min<size_t>(compression_block_size, size - offset));
+			if (block.size() != std::min<size_t>(compression_block_size, size - offset))
+				THROW_EXCEPTION("Corrupt compressed archive entry");
+			memcpy(out + offset, block.data(), block.size());
+		});
+	}
+
+	void pad(std::ofstream& out, unsigned long long& offset, unsigned long long alignment) {
+		static const char zeros[Archive::entry_alignment] = { 0 };
+		unsigned long long padding = (alignment - offset % alignment) % alignment;
+		out.write(zeros, static_cast<std::streamsize>(padding));
+		offset += padding;
+	}
+}
+
+Archive::Archive(const std::string& filename) : filename(filename) {
+	file.reset(new MappedFile(filename));
+
+	ArchiveHeader header;
+	if (file->size() < sizeof(header))
+		THROW_EXCEPTION(filename + " is not an archive");
+	memcpy(&header, file->data(), sizeof(header));
+	if (header.magic != magic || header.version != version)
+		THROW_EXCEPTION(filename + " is not an archive, or has the wrong version");
+	unsigned long long toc_bytes = static_cast<unsigned long long>(header.n_entries)*sizeof(TocEntry) + header.names_bytes;
+	if (header.toc_offset > file->size() || toc_bytes > file->size() - header.toc_offset)
+		THROW_EXCEPTION(filename + " has a truncated table of contents");
+
+	const char* toc = file->data() + header.toc_offset;
+	const char* names = toc + header.n_entries*sizeof(TocEntry);
+	entries.reserve(header.n_entries);
+	for (unsigned int i=0; i<header.n_entries; ++i) {
+		TocEntry toc_entry;
+		memcpy(&toc_entry, toc + i*sizeof(TocEntry), sizeof(TocEntry));
+		if (toc_entry.offset > header.toc_offset || toc_entry.stored_size > header.toc_offset - toc_entry.offset
+				|| static_cast<unsigned long long>(toc_entry.name_offset) + toc_entry.name_length > header.names_bytes
+				|| toc_entry.compression > COMPRESSION_RANS
+				|| (toc_entry.compression == COMPRESSION_NONE && toc_entry.size != toc_entry.stored_size))
+			THROW_EXCEPTION(filename + " has a corrupt table of contents");
+
+		Entry entry;
+		entry.offset = toc_entry.offset;
+		entry.stored_size = toc_entry.stored_size;
+		entry.size = toc_entry.size;
+		entry.compression = toc_entry.compression;
+		entries[std::string(names + toc_entry.name_offset, toc_entry.name_length)] = entry;
+	}
+}
+
+std::shared_ptr<VirtualFile> Archive::open(const std::string& name) const {
+	std::shared_ptr<VirtualFile> result;
+	std::unordered_map<std::string, Entry>::const_iterator it = entries.find(VirtualFileSystem::normalizePath(name));
+	if (it == entries.end())
+		return result;
+
+	const Entry& entry = it->second;
+	const char* data = file->data() + entry.offset;
+	result.reset(new VirtualFile());
+	if (entry.compression == COMPRESSION_NONE) {
+		result->ptr = data;
+		result->length = static_cast<size_t>(entry.size);
+		result->mapping = file;
+	} else {
+		result->buffer.resize(static_cast<size_t>(entry.size));
+		decompressEntry(reinterpret_cast<const unsigned char*>(data), static_cast<size_t>(entry.stored_size),
+			result->buffer.data(), result->buffer.size());
+		result->ptr = result->buffer.data();
+		result->length = result->buffer.size();
+	}
+	return result;
+}
+
+bool Archive::contains(const std::string& name) const {
+	return entries.find(VirtualFileSystem::normalizePath(name)) != entries.end();
+}
+
+void Archive::write(const std::string& filename, const std::vector<std::string>& files, bool compress) {
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (!out.good())
+		THROW_EXCEPTION("Could not create " + filename);
+
+	ArchiveHeader header;
+	memset(&header, 0, sizeof(header));
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	unsigned long long offset = sizeof(header);
+
+	std::vector<TocEntry> toc;
+	std::string names;
+	std::set<std::string> packed;
+	unsigned long long input_bytes = 0;
+	unsigned int n_compressed = 0;
+	for (unsigned int i=0; i<files.size(); ++i) {
+		std::string name = VirtualFileSystem::normalizePath(files[i]);
+		if (!packed.insert(name).second)
+			continue;
+
+		std::shared_ptr<VirtualFile> input = VirtualFileSystem::open(files[i]);
+		const unsigned char* data = reinterpret_cast<const unsigned char*>(input->data());
+		input_bytes += input->size();
+
+		//Stream files are read a chunk at a time with bounded memory, so they are never compressed
+		bool streamed = name.size() >= 4 && name.compare(name.size() - 4, 4, ".pgs") == 0;
+		std::vector<unsigned char> compressed;
+		if (compress && !streamed && input->size() > 0) {
+			compressEntry(data, input->size(), compressed);
+			if (compressed.size() > input->size() - input->size() / 8)
+				compressed.clear();
+		}
+
+		pad(out, offset, entry_alignment);
+		TocEntry entry;
+		entry.offset = offset;
+		entry.size = input->size();
+		entry.name_offset = static_cast<unsigned int>(names.size());
+		entry.name_length = static_cast<unsigned int>(name.size());
+		entry.reserved = 0;
+		if (!compressed.empty()) {
+			entry.compression = COMPRESSION_RANS;
+			entry.stored_size = compressed.size();
+			out.write(reinterpret_cast<const char*>(compressed.data()), compressed.size());
+			++n_compressed;
+		} else {
+			entry.compression = COMPRESSION_NONE;
+			entry.stored_size = input->size();
+			out.write(input->data(), input->size());
+		}
+		offset += entry.stored_size;
+		toc.push_back(entry);
+		names.append(name);
+	}
+
+	pad(out, offset, sizeof(unsigned long long));
+	header.magic = magic;
+	header.version = version;
+	header.n_entries = static_cast<unsigned int>(toc.size());
+	header.names_bytes = static_cast<unsigned int>(names.size());
+	header.toc_offset = offset;
+	if (!toc.empty())
+		out.write(reinterpret_cast<const char*>(toc.data()), toc.size()*sizeof(TocEntry));
+	out.write(names.data(), names.size());
+	out.seekp(0);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (!out.good())
+		THROW_EXCEPTION("Could not write " + filename);
+
+	std::cout << "Packed " << toc.size() << " files (" << n_compressed << " compressed) into " << filename
+		<< ": " << input_bytes / 1024 << " KiB -> " << (offset + toc.size()*sizeof(TocEntry) + names.size()) / 1024
+		<< " KiB" << std::endl;
+}
@@ -0,0 +1,420 @@
+#include "AssetCompiler.h"
+#include "Archive.h"
+#include "GameException.h"
+#include "GeometryCodec.h"
+#include "GLUtils/Hash.hpp"
+#include "MeshProcessing.h"
+#include "ObjLoader.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <IL/il.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <sys/stat.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+namespace {
+
+	// Part of every content hash, so that changing the compiler or its settings rebuilds everything
+	const std::string compiler_version = "assetc 2";
+	const unsigned int vertex_cache_size = 16;
+	const char* manifest_name = "manifest.tsv";
+
+	std::string getExtension(const std::string& filename) {
+		size_t dot = filename.find_last_of('.');
+		size_t slash = filename.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			return std::string();
+		std::string extension = filename.substr(dot);
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		return extension;
+	}
+
+	std::string replaceExtension(const std::string& filename, const std::string& extension) {
+		size_t dot = filename.find_last_of('.');
+		size_t slash = filename.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			return filename + extension;
+		return filename.substr(0, dot) + extension;
+	}
+
+	inline bool isModel(const std::string& filename) {
+		return getExtension(filename) == ".obj";
+	}
+
+	inline bool isTexture(const std::string& filename) {
+		std::string extension = getExtension(filename);
+		return extension == ".png" || extension == ".jpg" || extension == ".jpeg"
+			|| extension == ".tga" || extension == ".bmp";
+	}
+
+	inline std::string withSlash(const std::string& dir) {
+		if (dir.empty() || dir[dir.size()-1] == '/' || dir[dir.size()-1] == '\\')
+			return dir;
+		return dir + "/";
+	}
+
+	bool fileExists(const std::string& filename) {
+		struct stat st;
+		return stat(filename.c_str(), &st) == 0;
+	}
+
+	unsigned long long getFileSize(const std::string& filename) {
+		struct stat st;
+		if (stat(filename.c_str(), &st) != 0)
+			return 0;
+		return static_cast<unsigned long long>(st.st_size);
+	}
+
+	/**
+	 * Creates every directory on the way to filename
+	 */
+	void createDirectories(const std::string& filename) {
+		for (size_t slash = filename.find_first_of("/\\", 1); slash != std::string::npos;
+				slash = filename.find_first_of("/\\", slash + 1)) {
+			std::string dir = filename.substr(0, slash);
+#ifdef _WIN32
+			_mkdir(dir.c_str());
+#else
+			mkdir(dir.c_str(), 0755);
+#endif
+		}
+	}
+
+	/**
+	 * Appends the files under root + relative to files, relative to root
+	 */
+	void listFiles(const std::string& root, const std::string& relative, std::vector<std::string>& files) {
+		std::string directory = root + relative;
+#ifdef _WIN32
+		WIN32_FIND_DATAA data;
+		HANDLE find = FindFirstFileA((directory + "*").c_str(), &data);
+		if (find == INVALID_HANDLE_VALUE)
+			return;
+		do {
+			std::string name = data.cFileName;
+			bool is_directory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+		DIR* dir = opendir(directory.c_str());
+		if (dir == NULL)
+			return;
+		struct dirent* entry;
+		while ((entry = readdir(dir)) != NULL) {
+			std::string name = entry->d_name;
+			struct stat st;
+			if (stat((directory + name).c_str(), &st) != 0)
+				continue;
+			bool is_directory = S_ISDIR(st.st_mode);
+#endif
+			if (name == "." || name == "..")
+				continue;
+			if (is_directory)
+				listFiles(root, relative + name + "/", files);
+			else
+				files.push_back(relative + name);
+#ifdef _WIN32
+		} while (FindNextFileA(find, &data));
+		FindClose(find);
+#else
+		}
+		closedir(dir);
+#endif
+	}
+
+	unsigned long long hashFile(const std::string& filename, unsigned long long hash, unsigned long long* bytes) {
+		std::ifstream file(filename.c_str(), std::ios::binary);
+		if (!file.good())
+			THROW_EXCEPTION("Could not open " + filename);
+		std::vector<char> buffer(1 << 20);
+		while (file) {
+			file.read(buffer.data(), buffer.size());
+			size_t read = static_cast<size_t>(file.gcount());
+			hash = GLUtils::hashBytes(buffer.data(), read, hash);
+			if (bytes != NULL)
+				*bytes += read;
+		}
+		return hash;
+	}
+
+	/**
+	 * The material libraries an OBJ file refers to
+	 */
+	std::vector<std::string> findMaterialLibraries(const std::string& filename) {
+		std::vector<std::string> libraries;
+		std::ifstream file(filename.c_str());
+		std::string line;
+		while (std::getline(file, line)) {
+			if (line.compare(0, 7, "mtllib ") != 0)
+				continue;
+			std::stringstream ss(line.substr(7));
+			std::string name;
+			while (ss >> name)
+				libraries.push_back(name);
+		}
+		return libraries;
+	}
+
+	void addMisses(const MeshData& data, const MeshPart& part, double& misses, double& triangles) {
+		if (part.count >= 3) {
+			float acmr = MeshProcessing::getACMR(&data.indices[part.first], part.count, vertex_cache_size);
+			misses += acmr * (part.count / 3);
+			triangles += part.count / 3;
+		}
+		for (unsigned int i=0; i<part.children.size(); ++i)
+			addMisses(data, part.children[i], misses, triangles);
+	}
+
+	float getMeshACMR(const MeshData& data) {
+		double misses = 0.0;
+		double triangles = 0.0;
+		addMisses(data, data.root, misses, triangles);
+		return (triangles > 0.0) ? static_cast<float>(misses / triangles) : 0.0f;
+	}
+}
+
+AssetCompiler::AssetCompiler(const std::string& input_dir, const std::string& output_dir)
+	: input_dir(withSlash(input_dir)), output_dir(withSlash(output_dir)), force(false) {
+}
+
+std::string AssetCompiler::getOutputName(const std::string& source) {
+	if (isModel(source))
+		return replaceExtension(source, ".pgz");
+	else if (isTexture(source))
+		return replaceExtension(source, ".pgt");
+	return std::string();
+}
+
+void AssetCompiler::pack(const std::string& archive, const std::vector<std::string>& directories, bool compress) {
+	std::vector<std::string> files;
+	for (unsigned int i=0; i<directories.size(); ++i) {
+		std::string directory = withSlash(directories[i]);
+		std::vector<std::string> found;
+		listFiles(directory, std::string(), found);
+		std::sort(found.begin(), found.end());
+		for (unsigned int j=0; j<found.size(); ++j)
+			if (found[j] != manifest_name)
+				files.push_back(directory + found[j]);
+	}
+	Archive::write(archive, files, compress);
+}
+
+unsigned int AssetCompiler::run(unsigned int threads) {
+	Timer timer;
+	std::vector<std::string> files;
+	listFiles(input_dir, std::string(), files);
+	std::sort(files.begin(), files.end());
+
+	records.clear();
+	for (unsigned int i=0; i<files.size(); ++i) {
+		AssetRecord record;
+		record.source = files[i];
+		record.output = getOutputName(files[i]);
+		if (record.output.empty())
+			continue; //< MTL files are compiled as part of their OBJ files
+		record.type = isModel(files[i]) ? "model" : "texture";
+		records.push_back(record);
+	}
+
+	std::map<std::string, AssetRecord> previous;
+	if (!force)
+		readManifest(previous);
+
+	unsigned long long steals;
+	{
+		ThreadPool pool(threads);
+		for (unsigned int i=0; i<records.size(); ++i) {
+			std::map<std::string, AssetRecord>::const_iterator it = previous.find(records[i].source);
+			const AssetRecord* last = (it != previous.end()) ? &it->second : NULL;
+			pool.submit([this, i, last]() { compile(records[i], last); });
+		}
+		pool.wait();
+		steals = pool.getSteals();
+	}
+
+	createDirectories(output_dir + manifest_name);
+	writeManifest();
+
+	unsigned int compiled = 0, unchanged = 0, failed = 0;
+	unsigned long long input_bytes = 0, output_bytes = 0;
+	for (unsigned int i=0; i<records.size(); ++i) {
+		if (records[i].status == "compiled") ++compiled;
+		else if (records[i].status == "unchanged") ++unchanged;
+		else ++failed;
+		input_bytes += records[i].input_bytes;
+		output_bytes += records[i].output_bytes;
+	}
+	std::cout << records.size() << " assets: " << compiled << " compiled, " << unchanged << " unchanged, "
+		<< failed << " failed in " << timer.elapsed() << " s on " << threads << " threads ("
+		<< steals << " tasks stolen). " << input_bytes / 1024 << " KiB in, "
+		<< output_bytes / 1024 << " KiB out" << std::endl;
+	return failed;
+}
+
+unsigned long long AssetCompiler::hashInputs(const AssetRecord& record) {
+	unsigned long long hash = GLUtils::hashString(compiler_version);
+	std::string filename = input_dir + record.source;
+	hash = hashFile(filename, hash, NULL);
+	if (record.type == "model") {
+		std::string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+		std::vector<std::string> libraries = findMaterialLibraries(filename);
+		for (unsigned int i=0; i<libraries.size(); ++i) {
+			hash = GLUtils::hashString(libraries[i], hash);
+			if (fileExists(directory + libraries[i]))
+				hash = hashFile(directory + libraries[i], hash, NULL);
+		}
+	}
+	return hash;
+}
+
+void AssetCompiler::compile(AssetRecord& record, const AssetRecord* previous) {
+	try {
+		record.hash = hashInputs(record);
+		if (previous != NULL && previous->status != "failed" && previous->hash == record.hash
+				&& fileExists(output_dir + record.output)) {
+			record.input_bytes = previous->input_bytes;
+			record.output_bytes = previous->output_bytes;
+			record.status = "unchanged";
+			return;
+		}
+
+		record.input_bytes = getFileSize(input_dir + record.source);
+		createDirectories(output_dir + record.output);
+		if (record.type == "model")
+			compileModel(record);
+		else
+			compileTexture(record);
+		record.output_bytes = getFileSize(output_dir + record.output);
+		record.status = "compiled";
+
+		std::lock_guard<std::mutex> lock(log_mutex);
+		std::cout << record.source << " -> " << record.output << ": " << record.input_bytes / 1024 << " KiB -> "
+			<< record.output_bytes / 1024 << " KiB, " << (record.import_time + record.process_time
+			+ record.encode_time + record.write_time) * 1000.0 << " ms" << std::endl;
+	} catch (std::exception& e) {
+		record.status = "failed";
+		std::lock_guard<std::mutex> lock(log_mutex);
+		std::cout << record.source << " failed: " << e.what() << std::endl;
+	}
+}
+
+void AssetCompiler::compileModel(AssetRecord& record) {
+	Timer timer;
+	MeshData data;
+	ObjLoader::load(input_dir + record.source, data);
+	record.import_time = timer.elapsedAndRestart();
+
+	float acmr = getMeshACMR(data);
+	MeshProcessing::optimize(data, vertex_cache_size);
+	record.process_time = timer.elapsedAndRestart();
+	{
+		std::lock_guard<std::mutex> lock(log_mutex);
+		std::cout << record.source << ": vertex cache misses per triangle " << acmr
+			<< " -> " << getMeshACMR(data) << std::endl;
+	}
+	timer.restart();
+
+	//Point textures from the input directory to their compiled versions
+	for (unsigned int i=0; i<data.textures.size(); ++i) {
+		std::string& texture = data.textures[i];
+		if (texture.compare(0, input_dir.size(), input_dir) == 0 && isTexture(texture))
+			texture = output_dir + getOutputName(texture.substr(input_dir.size()));
+	}
+
+	std::vector<unsigned char> bytes;
+	GeometryCodec::encode(data, bytes);
+	record.encode_time = timer.elapsedAndRestart();
+
+	std::string filename = output_dir + record.output;
+	std::ofstream file(filename.c_str(), std::ios::binary);
+	file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+	if (!file.good())
+		THROW_EXCEPTION("Could not write " + filename);
+	file.close();
+	record.write_time = timer.elapsed();
+}
+
+void AssetCompiler::compileTexture(AssetRecord& record) {
+	Timer timer;
+	std::string filename = input_dir + record.source;
+	MipChain chain;
+	chain.levels.resize(1);
+	{
+		std::lock_guard<std::mutex> lock(devil_mutex);
+		ILuint image_name;
+		ilGenImages(1, &image_name);
+		ilBindImage(image_name);
+		if (!ilLoadImage(filename.c_str())) {
+			ilDeleteImages(1, &image_name);
+			THROW_EXCEPTION("Could not decode " + filename);
+		}
+		chain.width = ilGetInteger(IL_IMAGE_WIDTH);
+		chain.height = ilGetInteger(IL_IMAGE_HEIGHT);
+		chain.levels[0].resize(static_cast<size_t>(chain.width) * chain.height * 4);
+		ilCopyPixels(0, 0, 0, chain.width, chain.height, 1, IL_RGBA, IL_UNSIGNED_BYTE, chain.levels[0].data());
+		ilDeleteImages(1, &image_name);
+	}
+	record.import_time = timer.elapsedAndRestart();
+
+	TextureCache::generateMipmaps(chain);
+	record.process_time = timer.elapsedAndRestart();
+
+	TextureCache::write(chain, output_dir + record.output);
+	record.write_time = timer.elapsed();
+}
+
+void AssetCompiler::readManifest(std::map<std::string, AssetRecord>& previous) {
+	std::ifstream file((output_dir + manifest_name).c_str());
+	std::string line;
+	std::getline(file, line); //< Header
+	while (std::getline(file, line)) {
+		std::vector<std::string> fields;
+		std::stringstream ss(line);
+		std::string field;
+		while (std::getline(ss, field, '\t'))
+			fields.push_back(field);
+		if (fields.size() < 11)
+			continue;
+
+		AssetRecord record;
+		record.type = fields[0];
+		record.source = fields[1];
+		record.output = fields[2];
+		std::stringstream(fields[3]) >> std::hex >> record.hash;
+		std::stringstream(fields[4]) >> record.input_bytes;
+		std::stringstream(fields[5]) >> record.output_bytes;
+		record.status = fields[10];
+		previous[record.source] = record;
+	}
+}
+
+void AssetCompiler::writeManifest() {
+	std::string filename = output_dir + manifest_name;
+	std::ofstream file(filename.c_str());
+	file << "type\tsource\toutput\thash\tinput_bytes\toutput_bytes\timport_ms\tprocess_ms\tencode_ms\twrite_ms\tstatus\n";
+	file << std::fixed << std::setprecision(3);
+	for (unsigned int i=0; i<records.size(); ++i) {
+		const AssetRecord& r = records[i];
+		file << r.type << '\t' << r.source << '\t' << r.output << '\t'
+			<< std::hex << std::setw(16) << std::setfill('0') << r.hash << std::dec << std::setfill(' ') << '\t'
+			<< r.input_bytes << '\t' << r.output_bytes << '\t'
+			<< r.import_time*1000.0 << '\t' << r.process_time*1000.0 << '\t'
+			<< r.encode_time*1000.0 << '\t' << r.write_time*1000.0 << '\t' << r.status << '\n';
+	}
+	if (!file.good())
+		THROW_EXCEPTION("Could not write " + filename);
+}
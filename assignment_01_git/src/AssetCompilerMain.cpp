@@ -0,0 +1,71 @@
+#include "AssetCompiler.h"
+#include "Parallel.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <IL/il.h>
+
+/**
+ * Offline asset compiler, so that the runtime never has to read source
+ * formats. See AssetCompiler.
+ *
+ * Usage: assetc <input_dir> <output_dir> [options]
+ *   --threads <n>  worker threads, default is one per core
+ *   --force        compile all assets, also unchanged ones
+ *
+ * Usage: assetc --pack <archive.pga> <dir>... [--no-compress]
+ *   packs the directories (e.g. the output directory and shaders) into
+ *   an archive for the runtime's --archive option
+ */
+int main(int argc, char *argv[]) {
+	std::string input_dir;
+	std::string output_dir;
+	unsigned int threads = getThreadCount();
+	bool force = false;
+	std::string archive;
+	std::vector<std::string> pack_dirs;
+	bool compress = true;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--pack" && i+1 < argc)
+			archive = argv[++i];
+		else if (arg == "--no-compress")
+			compress = false;
+		else if (!archive.empty())
+			pack_dirs.push_back(arg);
+		else if (arg == "--threads" && i+1 < argc)
+			threads = atoi(argv[++i]);
+		else if (arg == "--force")
+			force = true;
+		else if (input_dir.empty())
+			input_dir = arg;
+		else if (output_dir.empty())
+			output_dir = arg;
+	}
+	if ((archive.empty() && (input_dir.empty() || output_dir.empty())) || (!archive.empty() && pack_dirs.empty())) {
+		std::cerr << "Usage: assetc <input_dir> <output_dir> [--threads n] [--force]" << std::endl;
+		std::cerr << "       assetc --pack <archive.pga> <dir>... [--no-compress]" << std::endl;
+		return 1;
+	}
+	if (threads == 0)
+		threads = 1;
+
+	ilInit();
+	try {
+		if (!archive.empty()) {
+			AssetCompiler::pack(archive, pack_dirs, compress);
+			return 0;
+		}
+
+		AssetCompiler compiler(input_dir, output_dir);
+		compiler.setForce(force);
+		return (compiler.run(threads) > 0) ? 1 : 0;
+	} catch (std::exception& e) {
+		std::cerr << "Unhandled exception: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,275 @@
+#include "AssetManager.h"
+#include "GameException.h"
+#include "GeometryCodec.h"
+#include "GLUtils/Hash.hpp"
+#include "GLUtils/ProgramCache.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace {
+	// Largest piece uploaded with one call, so that the budget is not overrun by much
+	const size_t upload_slice_bytes = 1 << 20;
+
+	// Texture bytes that may be uploaded through pixel buffers per frame
+	const unsigned int upload_frame_bytes = 4 << 20;
+}
+
+AssetManager::AssetManager() {
+	profile = IMPORT_BALANCED;
+	last_frame_time = 0.0;
+	report_swap = false;
+}
+
+AssetManager::~AssetManager() {
+	if (worker.joinable())
+		worker.join();
+}
+
+void AssetManager::setImportProfile(ImportProfile profile) {
+	this->profile = profile;
+}
+
+void AssetManager::setCacheDirectory(const std::string& directory) {
+	cache_directory = directory;
+}
+
+void AssetManager::requestModel(const std::string& filename) {
+	if (pending) {
+		std::cout << "Will load " << filename << " when " << pending->filename << " is done" << std::endl;
+		next_request = filename;
+		return;
+	}
+	start(filename);
+}
+
+void AssetManager::start(const std::string& filename) {
+	std::cout << "Loading model in the background: " << filename << std::endl;
+	pending.reset(new PendingModel());
+	pending->filename = filename;
+	pending->source = filename;
+	std::map<std::string, std::string>::iterator copy = cache_files.find(filename);
+	if (copy != cache_files.end()) {
+		std::cout << "Reading the binary copy " << copy->second << std::endl;
+		pending->source = copy->second;
+	}
+	pending->loaded = false;
+	pending->request_time = Timer::getCurrentTime();
+	pending->load_time = 0.0;
+	pending->vertex_bytes_done = 0;
+	pending->index_bytes_done = 0;
+	pending->position_bytes_done = 0;
+	pending->texture = 0;
+	pending->level = 0;
+	pending->row = 0;
+
+	stats = SwapStats();
+	stats.filename = filename;
+	if (uploader)
+		uploader->resetStats();
+	last_frame_time = pending->request_time;
+	worker = std::thread(&AssetManager::load, pending.get(), profile, cache_directory);
+}
+
+/**
+ * Runs on the worker thread, and touches nothing but model
+ */
+void AssetManager::load(PendingModel* model, ImportProfile profile, std::string cache_directory) {
+	Timer timer;
+	try {
+		ModelInterleavedArray::loadMeshData(model->source, model->data, LOADER_AUTO, profile);
+		model->images.resize(model->data.textures.size());
+		for (unsigned int i=0; i<model->data.textures.size(); ++i) {
+			if (!model->data.textures[i].empty() && !Texture2D::decode(model->data.textures[i], model->images[i]))
+				model->images[i].levels.clear(); //< Drawn white, like a missing texture file
+		}
+		model->bvh = MeshBVH::create(model->data, cache_directory);
+		ModelInterleavedArray::getBounds(model->data.vertices, model->min_position, model->max_position);
+		ModelInterleavedArray::packPositions(model->data.vertices, model->positions);
+		//GeometryCodec stores no bones, skinned models are always read from the source
+		if (!cache_directory.empty() && !GeometryCodec::isCompressedFile(model->source) && model->data.weights.empty())
+			writeBinaryCopy(*model, profile, cache_directory);
+	} catch (...) {
+		model->error = std::current_exception();
+	}
+	model->load_time = timer.elapsed();
+	model->loaded = true;
+}
+
+void AssetManager::writeBinaryCopy(PendingModel& model, ImportProfile profile, const std::string& cache_directory) {
+	std::stringstream ss;
+	ss << cache_directory << std::hex << std::setw(16) << std::setfill('0')
+		<< GLUtils::hashString(model.filename + AssimpLoader::getProfileName(profile));
+	std::string base = ss.str();
+
+	//The copy refers to the copies of the textures, the model keeps the original names
+	std::vector<std::string> textures(model.data.textures);
+	try {
+		GLUtils::createDirectory(cache_directory);
+		for (unsigned int i=0; i<model.images.size(); ++i) {
+			if (model.images[i].levels.empty() || TextureCache::isCacheFile(textures[i]))
+				continue;
+			std::stringstream name;
+			name << base << "_" << i << ".pgt";
+			TextureCache::write(model.images[i], name.str());
+			model.data.textures[i] = name.str();
+		}
+		GeometryCodec::write(model.data, base + ".pgz");
+		model.cache_file = base + ".pgz";
+	} catch (GameException&) {
+		std::cout << "Unable to write a binary copy of " << model.filename << " to " << cache_directory << std::endl;
+	}
+	model.data.textures.swap(textures);
+}
+
+std::shared_ptr<ModelInterleavedArray> AssetManager::update(double time_budget) {
+	std::shared_ptr<ModelInterleavedArray> result;
+	double now = Timer::getCurrentTime();
+	double frame_time = now - last_frame_time;
+	last_frame_time = now;
+
+	if (report_swap) {
+		//This frame drew the new model for the first time
+		swapped.longest_frame = std::max(swapped.longest_frame, frame_time);
+		swapped.frame_time_sum += frame_time;
+		++swapped.frames;
+		std::cout << "Swapped in " << swapped.filename << " after " << swapped.total_time*1000.0 << " ms (loaded in "
+			<< swapped.load_time*1000.0 << " ms on a worker, uploaded in " << swapped.upload_frames << " frames, at most "
+			<< swapped.longest_upload*1000.0 << " ms per frame). Frames: longest " << swapped.longest_frame*1000.0
+			<< " ms, average " << swapped.frame_time_sum / swapped.frames * 1000.0 << " ms" << std::endl;
+		std::cout << "Textures: " << swapped.textures.bytes / 1024 << " KiB in " << swapped.textures.uploads
+			<< " pixel buffer uploads (" << swapped.textures.copy_time*1000.0 << " ms copying, "
+			<< swapped.textures.stalls << " stalls), " << swapped.textures.direct << " direct uploads" << std::endl;
+		report_swap = false;
+	}
+
+	if (!pending)
+		return result;
+	stats.longest_frame = std::max(stats.longest_frame, frame_time);
+	stats.frame_time_sum += frame_time;
+	++stats.frames;
+	if (!pending->loaded)
+		return result;
+
+	if (worker.joinable())
+		worker.join();
+	if (pending->error) {
+		try {
+			std::rethrow_exception(pending->error);
+		} catch (std::exception& e) {
+			std::cout << "Loading " << pending->filename << " failed: " << e.what() << std::endl;
+		}
+		pending.reset();
+	} else {
+		//Uploading textures changes the binding the current model draws with
+		GLint bound_texture;
+		glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &bound_texture);
+		if (!uploader)
+			uploader.reset(new TextureUploader(upload_frame_bytes));
+
+		Timer timer;
+		bool done;
+		do {
+			done = uploadSlice(*pending);
+		} while (!done && timer.elapsed() < time_budget && !uploader->isFull());
+		uploader->endFrame();
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, bound_texture);
+		stats.longest_upload = std::max(stats.longest_upload, timer.elapsed());
+		++stats.upload_frames;
+		if (!done)
+			return result;
+
+		try {
+			result.reset(new ModelInterleavedArray(std::move(pending->data), std::move(pending->images), pending->min_position, pending->max_position, pending->interleaved, pending->indices,
+				pending->position_buffer, pending->materials, pending->bvh));
+			if (!pending->cache_file.empty())
+				cache_files[pending->filename] = pending->cache_file;
+			stats.load_time = pending->load_time;
+			stats.total_time = Timer::getCurrentTime() - pending->request_time;
+			stats.textures = uploader->getStats();
+			swapped = stats;
+			report_swap = true;
+		} catch (GameException&) {
+			std::cout << "Loading " << pending->filename << " failed" << std::endl;
+		}
+		pending.reset();
+	}
+
+	if (!next_request.empty()) {
+		start(next_request);
+		next_request.clear();
+	}
+	return result;
+}
+
+bool AssetManager::uploadSlice(PendingModel& model) {
+	const MeshData& data = model.data;
+	size_t vertex_bytes = data.vertices.size()*sizeof(VertexData);
+	size_t index_bytes = data.indices.size()*sizeof(unsigned int);
+	size_t position_bytes = model.positions.size()*sizeof(glm::vec3);
+
+	//Allocate the buffers first, then fill them a slice at a time
+	if (!model.interleaved) {
+		model.interleaved.reset(new GLUtils::VBO(NULL, vertex_bytes, GL_ARRAY_BUFFER));
+		model.indices.reset(new GLUtils::VBO(NULL, index_bytes, GL_ELEMENT_ARRAY_BUFFER));
+		model.position_buffer.reset(new GLUtils::VBO(NULL, position_bytes, GL_ARRAY_BUFFER));
+		return false;
+	}
+	if (model.vertex_bytes_done < vertex_bytes) {
+		size_t bytes = std::min(upload_slice_bytes, vertex_bytes - model.vertex_bytes_done);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, model.interleaved->name());
+		glBufferSubData(GL_COPY_WRITE_BUFFER, model.vertex_bytes_done, bytes,
+			reinterpret_cast<const char*>(data.vertices.data()) + model.vertex_bytes_done);
+		model.vertex_bytes_done += bytes;
+		return false;
+	}
+	if (model.index_bytes_done < index_bytes) {
+		size_t bytes = std::min(upload_slice_bytes, index_bytes - model.index_bytes_done);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, model.indices->name());
+		glBufferSubData(GL_COPY_WRITE_BUFFER, model.index_bytes_done, bytes,
+			reinterpret_cast<const char*>(data.indices.data()) + model.index_bytes_done);
+		model.index_bytes_done += bytes;
+		return false;
+	}
+	if (model.position_bytes_done < position_bytes) {
+		size_t bytes = std::min(upload_slice_bytes, position_bytes - model.position_bytes_done);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, model.position_buffer->name());
+		glBufferSubData(GL_COPY_WRITE_BUFFER, model.position_bytes_done, bytes,
+			reinterpret_cast<const char*>(model.positions.data()) + model.position_bytes_done);
+		model.position_bytes_done += bytes;
+		return false;
+	}
+
+	//Textures: allocate the arrays of all of them, then upload each level a band of rows at a time
+	if (!model.materials) {
+		model.materials.reset(new MaterialTextures(model.images));
+		return false;
+	}
+	while (model.texture < model.images.size()) {
+		const MipChain& image = model.images[model.texture];
+		if (model.level < image.levels.size()) {
+			unsigned int width = image.getLevelWidth(model.level);
+			unsigned int height = image.getLevelHeight(model.level);
+			unsigned int rows = std::max<unsigned int>(1, static_cast<unsigned int>(upload_slice_bytes / (width*4)));
+			rows = uploader->reserveRows(width*4, std::min(rows, height - model.row));
+			if (rows == 0)
+				return false; //< Until the next frame
+			const MaterialSlot& slot = model.materials->getSlot(model.texture);
+			uploader->uploadRows(model.materials->getArray(slot.array), model.level, model.row, rows, width,
+				&image.levels[model.level][static_cast<size_t>(model.row)*width*4], static_cast<unsigned int>(slot.layer));
+			model.row += rows;
+			if (model.row == height) {
+				++model.level;
+				model.row = 0;
+			}
+			return false;
+		}
+		++model.texture;
+		model.level = 0;
+		model.row = 0;
+	}
+	return true;
+}
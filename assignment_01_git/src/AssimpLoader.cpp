@@ -0,0 +1,417 @@
+#include "AssimpLoader.h"
+#include "GameException.h"
+#include "MeshProcessing.h"
+#include "Timer.h"
+#include "VertexWelder.h"
+#include "VirtualFileSystem.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+	/**
+	 * Assimp reads the model, and the files it refers to (e.g. MTL files),
+	 * through these callbacks, so that they may come from an archive
+	 */
+	struct AssimpFile {
+		std::shared_ptr<VirtualFile> file;
+		size_t position;
+	};
+
+	inline AssimpFile* getAssimpFile(aiFile* file) {
+		return reinterpret_cast<AssimpFile*>(file->UserData);
+	}
+
+	size_t readProc(aiFile* file, char* buffer, size_t size, size_t count) {
+		AssimpFile* f = getAssimpFile(file);
+		if (size == 0)
+			return 0;
+		size_t n = std::min(count, (f->file->size() - f->position) / size);
+		memcpy(buffer, f->file->data() + f->position, n*size);
+		f->position += n*size;
+		return n;
+	}
+
+	size_t writeProc(aiFile*, const char*, size_t, size_t) {
+		return 0;
+	}
+
+	size_t tellProc(aiFile* file) {
+		return getAssimpFile(file)->position;
+	}
+
+	size_t sizeProc(aiFile* file) {
+		return getAssimpFile(file)->file->size();
+	}
+
+	aiReturn seekProc(aiFile* file, size_t offset, aiOrigin origin) {
+		AssimpFile* f = getAssimpFile(file);
+		//Offsets back from the current position or the end wrap around
+		size_t position = offset;
+		if (origin == aiOrigin_CUR)
+			position = f->position + offset;
+		else if (origin == aiOrigin_END)
+			position = f->file->size() + offset;
+		if (position > f->file->size())
+			return aiReturn_FAILURE;
+		f->position = position;
+		return aiReturn_SUCCESS;
+	}
+
+	void flushProc(aiFile*) {
+	}
+
+	aiFile* openProc(aiFileIO*, const char* filename, const char* mode) {
+		//Assimp probes for files that may not exist, which is not an error
+		if (strchr(mode, 'w') != NULL || !VirtualFileSystem::exists(filename))
+			return NULL;
+
+		AssimpFile* f = new AssimpFile();
+		f->file = VirtualFileSystem::open(filename);
+		f->position = 0;
+
+		aiFile* file = new aiFile();
+		file->ReadProc = readProc;
+		file->WriteProc = writeProc;
+		file->TellProc = tellProc;
+		file->FileSizeProc = sizeProc;
+		file->SeekProc = seekProc;
+		file->FlushProc = flushProc;
+		file->UserData = reinterpret_cast<aiUserData>(f);
+		return file;
+	}
+
+	void closeProc(aiFileIO*, aiFile* file) {
+		delete getAssimpFile(file);
+		delete file;
+	}
+
+	// Keyframe times are in ticks, at this rate if the file does not say
+	const double default_ticks_per_second = 25.0;
+
+	glm::mat4 toMat4(const aiMatrix4x4& m) {
+		glm::mat4 result;
+		for (int j=0; j<4; ++j)
+			for (int i=0; i<4; ++i)
+				result[j][i] = m[i][j];
+		return result;
+	}
+
+	/**
+	 * The nodes in the order loadRecursive visits them, parents first
+	 */
+	void collectNodes(const aiNode* node, int parent, std::vector<const aiNode*>& nodes, std::vector<int>& parents) {
+		int index = static_cast<int>(nodes.size());
+		nodes.push_back(node);
+		parents.push_back(parent);
+		for (unsigned int n = 0; n < node->mNumChildren; ++n)
+			collectNodes(node->mChildren[n], index, nodes, parents);
+	}
+
+	int findNode(const Skeleton& skeleton, const std::string& name) {
+		for (unsigned int i = 0; i < skeleton.nodes.size(); ++i)
+			if (skeleton.nodes[i].name == name)
+				return static_cast<int>(i);
+		return -1;
+	}
+
+	/**
+	 * Keeps the four largest influences of a vertex, largest first
+	 */
+	void addInfluence(std::pair<float, unsigned int>* influences, unsigned int bone, float weight) {
+		if (weight <= influences[3].first)
+			return;
+		int i = 3;
+		while (i > 0 && influences[i-1].first < weight) {
+			influences[i] = influences[i-1];
+			--i;
+		}
+		influences[i] = std::make_pair(weight, bone);
+	}
+
+	/**
+	 * Normalizes the influences to 255, rounding so that they sum to it exactly
+	 */
+	SkinWeights packInfluences(const std::pair<float, unsigned int>* influences) {
+		SkinWeights result;
+		float total = influences[0].first + influences[1].first + influences[2].first + influences[3].first;
+		int sum = 0;
+		for (int i = 0; i < 4; ++i) {
+			result.bones[i] = static_cast<unsigned char>(influences[i].second);
+			int weight = (total > 0.0f) ? static_cast<int>(influences[i].first / total * 255.0f + 0.5f) : 0;
+			result.weights[i] = static_cast<unsigned char>(std::min(weight, 255));
+			sum += result.weights[i];
+		}
+		if (total > 0.0f)
+			result.weights[0] = static_cast<unsigned char>(result.weights[0] + 255 - sum);
+		return result;
+	}
+}
+
+void AssimpLoader::load(const std::string& filename, MeshData& data, ImportProfile profile, ImportTimings* timings) {
+	ImportTimings local_timings;
+	ImportTimings& t = (timings != NULL) ? *timings : local_timings;
+	Timer timer;
+
+	const aiScene* scene = importFile(filename, getAssimpFlags(profile));
+	t.read = timer.elapsedAndRestart();
+
+	//Triangulation and normals are timed per mesh inside loadRecursive
+	loadRecursive(data.root, profile, t, data, scene, scene->mRootNode);
+	loadSkeleton(scene, data);
+	aiReleaseImport(scene);
+	t.convert = timer.elapsedAndRestart() - t.triangulate - t.normals;
+
+	if (profile != IMPORT_FAST)
+		VertexWelder::weld(data);
+	t.join = timer.elapsed();
+
+	std::cout << "Imported " << filename << " (" << getProfileName(profile) << "): read " << t.read*1000.0
+		<< " ms, convert " << t.convert*1000.0 << " ms, triangulate " << t.triangulate*1000.0
+		<< " ms, normals " << t.normals*1000.0 << " ms, join " << t.join*1000.0 << " ms" << std::endl;
+	if (!data.weights.empty())
+		std::cout << "Skeleton: " << data.skeleton.bone_nodes.size() << " bones, " << data.skeleton.nodes.size()
+			<< " nodes, " << data.skeleton.animations.size() << " animations" << std::endl;
+}
+
+const aiScene* AssimpLoader::importFile(const std::string& filename, unsigned int flags) {
+	aiFileIO io;
+	io.OpenProc = openProc;
+	io.CloseProc = closeProc;
+	io.UserData = NULL;
+
+	const aiScene* scene = aiImportFileEx(filename.c_str(), flags, &io);
+	if(!scene) {
+		std::string log = "Unable to load mesh from ";
+		log.append(filename);
+		THROW_EXCEPTION(log);
+	}
+	return scene;
+}
+
+unsigned int AssimpLoader::getAssimpFlags(ImportProfile profile) {
+	switch (profile) {
+	case IMPORT_FAST:
+		return 0;
+	case IMPORT_BALANCED:
+		return aiProcess_RemoveRedundantMaterials;
+	case IMPORT_QUALITY:
+	default:
+		return aiProcess_ValidateDataStructure | aiProcess_RemoveRedundantMaterials | aiProcess_FindInvalidData;
+	}
+}
+
+const char* AssimpLoader::getProfileName(ImportProfile profile) {
+	switch (profile) {
+	case IMPORT_FAST: return "fast";
+	case IMPORT_BALANCED: return "balanced";
+	case IMPORT_QUALITY: return "quality";
+	default: return "unknown";
+	}
+}
+
+ImportProfile AssimpLoader::parseProfile(const std::string& name) {
+	if (name == "fast") return IMPORT_FAST;
+	if (name == "balanced") return IMPORT_BALANCED;
+	if (name == "quality") return IMPORT_QUALITY;
+	THROW_EXCEPTION("Unknown import profile " + name + ", use fast, balanced or quality");
+}
+
+void AssimpLoader::loadRecursive(
+	MeshPart& part,
+	ImportProfile profile,
+	ImportTimings& timings,
+	MeshData& data,
+	const aiScene* scene,
+	const aiNode* node) {
+
+
+	part.transform = toMat4(node->mTransformation);
+
+	for(unsigned int n=0; n < node->mNumMeshes; ++n)
+		loadMesh(part, profile, timings, data, scene, scene->mMeshes[node->mMeshes[n]]);
+
+	//Load children
+	for(unsigned int n = 0; n < node->mNumChildren; ++n) {
+		part.children.push_back(MeshPart());
+		loadRecursive(part.children.back(), profile, timings, data, scene, node->mChildren[n]);
+	}
+}
+
+glm::mat4 AssimpLoader::getTransform(const aiNode* node) {
+	return toMat4(node->mTransformation);
+}
+
+void AssimpLoader::loadMesh(
+	MeshPart& part,
+	ImportProfile profile,
+	ImportTimings& timings,
+	MeshData& data,
+	const aiScene* scene,
+	const aiMesh* mesh) {
+	part.first = data.indices.size();
+	part.vertexCount = data.vertices.size();
+
+	for(unsigned int i = 0; i < mesh->mNumVertices; i++) {
+		VertexData tmp;
+		tmp.position.x = mesh->mVertices[i].x;
+		tmp.position.y = mesh->mVertices[i].y;
+		tmp.position.z = mesh->mVertices[i].z;
+
+		if(mesh->HasNormals()) {
+			tmp.normal.x = mesh->mNormals[i].x;
+			tmp.normal.y = mesh->mNormals[i].y;
+			tmp.normal.z = mesh->mNormals[i].z;
+		}
+
+		if(mesh->HasTextureCoords(0)) {
+			tmp.tex_coords.x = mesh->mTextureCoords[0][i].x;
+			tmp.tex_coords.y = mesh->mTextureCoords[0][i].y;
+		}
+		data.vertices.push_back(tmp);
+	}
+
+	std::vector<unsigned int> face_sizes(mesh->mNumFaces);
+	std::vector<unsigned int> polygons;
+	for (unsigned int t = 0; t < mesh->mNumFaces; ++t) {
+		const struct aiFace* face = &mesh->mFaces[t];
+		face_sizes[t] = face->mNumIndices;
+		polygons.insert(polygons.end(), face->mIndices, face->mIndices + face->mNumIndices);
+	}
+
+	Timer timer;
+	std::vector<unsigned int> triangles;
+	MeshProcessing::triangulate(data.vertices.data() + part.vertexCount, face_sizes, polygons, triangles, profile == IMPORT_QUALITY);
+	data.indices.insert(data.indices.end(), triangles.begin(), triangles.end());
+	part.count = triangles.size();
+	timings.triangulate += timer.elapsedAndRestart();
+
+	if (!mesh->HasNormals()) {
+		MeshProcessing::generateNormals(data.vertices.data() + part.vertexCount, mesh->mNumVertices,
+			triangles.data(), part.count, profile == IMPORT_QUALITY);
+		timings.normals += timer.elapsed();
+	}
+
+	//The first diffuse texture of the mesh
+	part.material = data.textures.size();
+	if(scene->HasMaterials()) {
+		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+		for(unsigned int i = 0; i < material->GetTextureCount(aiTextureType_DIFFUSE); i++) {
+			aiString str;
+			material->GetTexture(aiTextureType_DIFFUSE, i, &str);
+			std::stringstream ss;
+			ss << "models/" << str.C_Str();
+			data.textures.push_back(ss.str());
+		}
+
+		if(material->GetTextureCount(aiTextureType_DIFFUSE) <= 0) {
+			data.textures.push_back(std::string());
+		}
+	} else {
+		data.textures.push_back(std::string());
+	}
+}
+
+/* * *
+* Bones refer to nodes by name. Every vertex keeps the four bones that
+* move it most, as GPUs usually take no more; the rest are dropped and
+* the weights normalized again.
+* * */
+void AssimpLoader::loadSkeleton(const aiScene* scene, MeshData& data) {
+	bool skinned = false;
+	for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+		skinned = skinned || scene->mMeshes[m]->HasBones();
+	if (!skinned)
+		return;
+
+	Skeleton& skeleton = data.skeleton;
+	std::vector<const aiNode*> nodes;
+	std::vector<int> parents;
+	collectNodes(scene->mRootNode, -1, nodes, parents);
+	std::vector<glm::mat4> globals(nodes.size());
+	skeleton.nodes.resize(nodes.size());
+	for (unsigned int i = 0; i < nodes.size(); ++i) {
+		SkeletonNode& node = skeleton.nodes[i];
+		node.name = nodes[i]->mName.C_Str();
+		node.parent = parents[i];
+		node.transform = toMat4(nodes[i]->mTransformation);
+		globals[i] = (node.parent < 0) ? node.transform : globals[node.parent] * node.transform;
+	}
+
+	//Vertices were appended mesh by mesh, in node order
+	data.weights.resize(data.vertices.size());
+	unsigned int first_vertex = 0;
+	unsigned int dropped_bones = 0;
+	for (unsigned int i = 0; i < nodes.size(); ++i) {
+		for (unsigned int n = 0; n < nodes[i]->mNumMeshes; ++n) {
+			const aiMesh* mesh = scene->mMeshes[nodes[i]->mMeshes[n]];
+			std::vector<std::pair<float, unsigned int> > influences(mesh->mNumVertices * 4, std::make_pair(0.0f, 0u));
+			if (mesh->HasBones() && skeleton.bone_nodes.empty())
+				skeleton.mesh_inverse = glm::inverse(globals[i]);
+
+			for (unsigned int b = 0; b < mesh->mNumBones; ++b) {
+				const aiBone* bone = mesh->mBones[b];
+				int node = findNode(skeleton, bone->mName.C_Str());
+				if (node < 0)
+					continue;
+				unsigned int index = static_cast<unsigned int>(
+					std::find(skeleton.bone_nodes.begin(), skeleton.bone_nodes.end(), node) - skeleton.bone_nodes.begin());
+				if (index == skeleton.bone_nodes.size()) {
+					if (index == Skeleton::max_bones) {
+						++dropped_bones;
+						continue;
+					}
+					skeleton.bone_nodes.push_back(node);
+					skeleton.bone_offsets.push_back(toMat4(bone->mOffsetMatrix));
+				}
+				for (unsigned int w = 0; w < bone->mNumWeights; ++w)
+					if (bone->mWeights[w].mVertexId < mesh->mNumVertices)
+						addInfluence(&influences[bone->mWeights[w].mVertexId * 4], index, bone->mWeights[w].mWeight);
+			}
+
+			for (unsigned int v = 0; v < mesh->mNumVertices && first_vertex + v < data.weights.size(); ++v)
+				data.weights[first_vertex + v] = packInfluences(&influences[v * 4]);
+			first_vertex += mesh->mNumVertices;
+		}
+	}
+	if (dropped_bones > 0)
+		std::cout << "Skeleton: " << dropped_bones << " bones past the first " << Skeleton::max_bones << " ignored" << std::endl;
+
+	for (unsigned int a = 0; a < scene->mNumAnimations; ++a) {
+		const aiAnimation* source = scene->mAnimations[a];
+		double ticks = (source->mTicksPerSecond > 0.0) ? source->mTicksPerSecond : default_ticks_per_second;
+		Animation animation;
+		animation.name = source->mName.C_Str();
+		animation.duration = static_cast<float>(source->mDuration / ticks);
+		for (unsigned int c = 0; c < source->mNumChannels; ++c) {
+			const aiNodeAnim* keys = source->mChannels[c];
+			int node = findNode(skeleton, keys->mNodeName.C_Str());
+			if (node < 0)
+				continue;
+
+			AnimationChannel channel;
+			channel.node = node;
+			for (unsigned int k = 0; k < keys->mNumPositionKeys; ++k) {
+				const aiVector3D& p = keys->mPositionKeys[k].mValue;
+				channel.position_times.push_back(static_cast<float>(keys->mPositionKeys[k].mTime / ticks));
+				channel.positions.push_back(glm::vec3(p.x, p.y, p.z));
+			}
+			for (unsigned int k = 0; k < keys->mNumRotationKeys; ++k) {
+				const aiQuaternion& q = keys->mRotationKeys[k].mValue;
+				channel.rotation_times.push_back(static_cast<float>(keys->mRotationKeys[k].mTime / ticks));
+				channel.rotations.push_back(glm::quat(q.w, q.x, q.y, q.z));
+			}
+			for (unsigned int k = 0; k < keys->mNumScalingKeys; ++k) {
+				const aiVector3D& s = keys->mScalingKeys[k].mValue;
+				channel.scale_times.push_back(static_cast<float>(keys->mScalingKeys[k].mTime / ticks));
+				channel.scales.push_back(glm::vec3(s.x, s.y, s.z));
+			}
+			animation.channels.push_back(channel);
+		}
+		skeleton.animations.push_back(animation);
+	}
+}
@@ -0,0 +1,324 @@
+#include "ClusteredLights.h"
+#include "GameException.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define CLUSTER_SSE
+#endif
+
+namespace {
+	// Texels of the light buffer per light: view position and radius, color
+	const unsigned int light_texels = 2;
+
+	// Arrays of bounds, each padded to a multiple of four lights
+	enum Bound {
+		BOUND_X = 0, BOUND_Y, BOUND_DEPTH, BOUND_RADIUS, BOUND_VISIBLE,
+		BOUNDS
+	};
+
+	/**
+	 * The normalized device coordinates a view space range [lo, hi] of x
+	 * (or y) can project to between the depths near_depth and far_depth
+	 */
+	inline void projectRange(float lo, float hi, float near_depth, float far_depth, float scale,
+			float& out_lo, float& out_hi) {
+		out_lo = scale * ((lo >= 0.0f) ? lo / far_depth : lo / near_depth);
+		out_hi = scale * ((hi >= 0.0f) ? hi / near_depth : hi / far_depth);
+	}
+
+	inline unsigned int toTile(float ndc, unsigned int tiles) {
+		int tile = static_cast<int>((ndc * 0.5f + 0.5f) * tiles);
+		return static_cast<unsigned int>(std::min(std::max(tile, 0), static_cast<int>(tiles) - 1));
+	}
+
+#ifdef CLUSTER_SSE
+	/**
+	 * a where mask is set, b elsewhere
+	 */
+	inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+#endif
+}
+
+ClusteredLights::ClusteredLights() {
+	near_plane = 1.0f;
+	far_plane = 10.0f;
+	slice_scale = slices / std::log(far_plane / near_plane);
+	slice_bias = -std::log(near_plane) * slice_scale;
+	clusters.resize(2 * tiles_x * tiles_y * slices, 0);
+}
+
+void ClusteredLights::add(const PointLight& light) {
+	if (lights.size() >= max_lights) {
+		std::stringstream err;
+		err << "Too many lights, at most " << max_lights << " are supported";
+		THROW_EXCEPTION(err.str());
+	}
+	lights.push_back(light);
+}
+
+void ClusteredLights::clear() {
+	lights.clear();
+}
+
+void ClusteredLights::assign(const glm::mat4& projection, const glm::mat4& view) {
+	Timer timer;
+
+	//The depth range and the scale to normalized device coordinates of a perspective projection
+	near_plane = projection[3][2] / (projection[2][2] - 1.0f);
+	far_plane = projection[3][2] / (projection[2][2] + 1.0f);
+	slice_scale = slices / std::log(far_plane / near_plane);
+	slice_bias = -std::log(near_plane) * slice_scale;
+
+	unsigned int padded = (static_cast<unsigned int>(lights.size()) + 3) & ~3u;
+	bounds.resize(BOUNDS * padded);
+	const float* v = glm::value_ptr(view);
+	float m[12] = { v[0], v[4], v[8], v[12], v[1], v[5], v[9], v[13], v[2], v[6], v[10], v[14] };
+	boundLights(m, projection[0][0], projection[1][1]);
+
+	//Visible lights in view space, and the tiles they overlap in each slice
+	view_lights.clear();
+	spans.clear();
+	for (unsigned int i = 0; i < lights.size(); ++i) {
+		if (bounds[BOUND_VISIBLE * padded + i] == 0.0f)
+			continue;
+		unsigned int light = static_cast<unsigned int>(view_lights.size()) / (4 * light_texels);
+		view_lights.push_back(bounds[BOUND_X * padded + i]);
+		view_lights.push_back(bounds[BOUND_Y * padded + i]);
+		view_lights.push_back(-bounds[BOUND_DEPTH * padded + i]);
+		view_lights.push_back(bounds[BOUND_RADIUS * padded + i]);
+		view_lights.push_back(lights[i].color.r);
+		view_lights.push_back(lights[i].color.g);
+		view_lights.push_back(lights[i].color.b);
+		view_lights.push_back(0.0f);
+		addSpans(i, light, padded, projection[0][0], projection[1][1]);
+	}
+
+	//Count the lights per cluster, turn the counts into offsets, and fill in the indices in light order
+	std::fill(clusters.begin(), clusters.end(), 0);
+	for (unsigned int i = 0; i < spans.size(); ++i) {
+		const ClusterSpan& span = spans[i];
+		for (unsigned int y = span.y0; y <= span.y1; ++y)
+			for (unsigned int x = span.x0; x <= span.x1; ++x)
+				++clusters[2 * ((span.slice * tiles_y + y) * tiles_x + x) + 1];
+	}
+
+	stats = ClusterStats();
+	unsigned int offset = 0;
+	for (unsigned int c = 0; c < clusters.size(); c += 2) {
+		unsigned int count = clusters[c + 1];
+		clusters[c] = offset;
+		clusters[c + 1] = 0;
+		offset += count;
+		stats.occupied += (count > 0) ? 1 : 0;
+		stats.max_per_cluster = std::max(stats.max_per_cluster, count);
+	}
+
+	indices.resize(offset);
+	for (unsigned int i = 0; i < spans.size(); ++i) {
+		const ClusterSpan& span = spans[i];
+		for (unsigned int y = span.y0; y <= span.y1; ++y) {
+			for (unsigned int x = span.x0; x <= span.x1; ++x) {
+				unsigned int* cluster = &clusters[2 * ((span.slice * tiles_y + y) * tiles_x + x)];
+				indices[cluster[0] + cluster[1]++] = span.light;
+			}
+		}
+	}
+
+	stats.lights = static_cast<unsigned int>(lights.size());
+	stats.visible = static_cast<unsigned int>(view_lights.size()) / (4 * light_texels);
+	stats.indices = offset;
+	stats.assign = timer.elapsed();
+}
+
+/* * *
+* Transforms the lights to view space and culls them against the view
+* frustum. A light is visible if its view space bounding box, clamped to
+* the depth range, projects inside the window. The box projects furthest
+* out at its near or far depth, depending on which side of the axis the
+* edge is on, which projectRange picks with a division by either depth.
+* */
+void ClusteredLights::boundLights(const float* m, float x_scale, float y_scale) {
+	unsigned int padded = static_cast<unsigned int>(bounds.size()) / BOUNDS;
+	float* out_x = &bounds[BOUND_X * padded];
+	float* out_y = &bounds[BOUND_Y * padded];
+	float* out_depth = &bounds[BOUND_DEPTH * padded];
+	float* out_radius = &bounds[BOUND_RADIUS * padded];
+	float* out_visible = &bounds[BOUND_VISIBLE * padded];
+	unsigned int i = 0;
+
+#ifdef CLUSTER_SSE
+	//Four lights at a time, transposed from PointLight to one register per component
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minus_one = _mm_set1_ps(-1.0f);
+	const __m128 near_depth = _mm_set1_ps(near_plane);
+	const __m128 far_depth = _mm_set1_ps(far_plane);
+	const __m128 sx = _mm_set1_ps(x_scale);
+	const __m128 sy = _mm_set1_ps(y_scale);
+	for (; i + 4 <= lights.size(); i += 4) {
+		__m128 px = _mm_loadu_ps(&lights[i].position.x);
+		__m128 py = _mm_loadu_ps(&lights[i+1].position.x);
+		__m128 pz = _mm_loadu_ps(&lights[i+2].position.x);
+		__m128 r = _mm_loadu_ps(&lights[i+3].position.x);
+		_MM_TRANSPOSE4_PS(px, py, pz, r);
+
+		__m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0]), px), _mm_mul_ps(_mm_set1_ps(m[1]), py)),
+			_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[2]), pz), _mm_set1_ps(m[3])));
+		__m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[4]), px), _mm_mul_ps(_mm_set1_ps(m[5]), py)),
+			_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[6]), pz), _mm_set1_ps(m[7])));
+		__m128 depth = _mm_sub_ps(zero, _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[8]), px),
+			_mm_mul_ps(_mm_set1_ps(m[9]), py)), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[10]), pz), _mm_set1_ps(m[11]))));
+
+		__m128 d0 = _mm_max_ps(_mm_sub_ps(depth, r), near_depth);
+		__m128 d1 = _mm_min_ps(_mm_add_ps(depth, r), far_depth);
+		__m128 visible = _mm_cmplt_ps(d0, d1);
+
+		__m128 lo = _mm_sub_ps(x, r);
+		__m128 hi = _mm_add_ps(x, r);
+		__m128 ndc_lo = _mm_mul_ps(sx, _mm_div_ps(lo, select(_mm_cmpge_ps(lo, zero), d1, d0)));
+		__m128 ndc_hi = _mm_mul_ps(sx, _mm_div_ps(hi, select(_mm_cmpge_ps(hi, zero), d0, d1)));
+		visible = _mm_and_ps(visible, _mm_and_ps(_mm_cmplt_ps(ndc_lo, one), _mm_cmpgt_ps(ndc_hi, minus_one)));
+
+		lo = _mm_sub_ps(y, r);
+		hi = _mm_add_ps(y, r);
+		ndc_lo = _mm_mul_ps(sy, _mm_div_ps(lo, select(_mm_cmpge_ps(lo, zero), d1, d0)));
+		ndc_hi = _mm_mul_ps(sy, _mm_div_ps(hi, select(_mm_cmpge_ps(hi, zero), d0, d1)));
+		visible = _mm_and_ps(visible, _mm_and_ps(_mm_cmplt_ps(ndc_lo, one), _mm_cmpgt_ps(ndc_hi, minus_one)));
+
+		_mm_storeu_ps(out_x + i, x);
+		_mm_storeu_ps(out_y + i, y);
+		_mm_storeu_ps(out_depth + i, depth);
+		_mm_storeu_ps(out_radius + i, r);
+		_mm_storeu_ps(out_visible + i, _mm_and_ps(visible, one));
+	}
+#endif
+
+	for (; i < lights.size(); ++i) {
+		const float* p = &lights[i].position.x;
+		float r = lights[i].radius;
+		float x = m[0]*p[0] + m[1]*p[1] + m[2]*p[2] + m[3];
+		float y = m[4]*p[0] + m[5]*p[1] + m[6]*p[2] + m[7];
+		float depth = -(m[8]*p[0] + m[9]*p[1] + m[10]*p[2] + m[11]);
+
+		float d0 = std::max(depth - r, near_plane);
+		float d1 = std::min(depth + r, far_plane);
+		float x_lo, x_hi, y_lo, y_hi;
+		projectRange(x - r, x + r, d0, d1, x_scale, x_lo, x_hi);
+		projectRange(y - r, y + r, d0, d1, y_scale, y_lo, y_hi);
+		bool visible = d0 < d1 && x_lo < 1.0f && x_hi > -1.0f && y_lo < 1.0f && y_hi > -1.0f;
+
+		out_x[i] = x;
+		out_y[i] = y;
+		out_depth[i] = depth;
+		out_radius[i] = r;
+		out_visible[i] = visible ? 1.0f : 0.0f;
+	}
+}
+
+/* * *
+* Adds the tiles a visible light overlaps in each slice it reaches. Within
+* a slice the sphere is bounded by its widest cross section there, which
+* is narrower than the sphere unless the slice contains its center.
+* */
+void ClusteredLights::addSpans(unsigned int i, unsigned int light, unsigned int padded, float x_scale, float y_scale) {
+	float x = bounds[BOUND_X * padded + i];
+	float y = bounds[BOUND_Y * padded + i];
+	float depth = bounds[BOUND_DEPTH * padded + i];
+	float r = bounds[BOUND_RADIUS * padded + i];
+	float d0 = std::max(depth - r, near_plane);
+	float d1 = std::min(depth + r, far_plane);
+
+	int first = static_cast<int>(std::log(d0) * slice_scale + slice_bias);
+	int last = static_cast<int>(std::log(d1) * slice_scale + slice_bias);
+	first = std::max(first, 0);
+	last = std::min(last, static_cast<int>(slices) - 1);
+
+	for (int slice = first; slice <= last; ++slice) {
+		float a = std::max(std::exp((slice - slice_bias) / slice_scale), d0);
+		float b = std::min(std::exp((slice + 1 - slice_bias) / slice_scale), d1);
+		float dz = (depth < a) ? a - depth : ((depth > b) ? depth - b : 0.0f);
+		float w = std::sqrt(std::max(r*r - dz*dz, 0.0f));
+
+		float x_lo, x_hi, y_lo, y_hi;
+		projectRange(x - w, x + w, a, b, x_scale, x_lo, x_hi);
+		projectRange(y - w, y + w, a, b, y_scale, y_lo, y_hi);
+		if (x_lo >= 1.0f || x_hi <= -1.0f || y_lo >= 1.0f || y_hi <= -1.0f)
+			continue;
+
+		ClusterSpan span;
+		span.light = static_cast<unsigned short>(light);
+		span.slice = static_cast<unsigned char>(slice);
+		span.x0 = static_cast<unsigned char>(toTile(x_lo, tiles_x));
+		span.x1 = static_cast<unsigned char>(toTile(x_hi, tiles_x));
+		span.y0 = static_cast<unsigned char>(toTile(y_lo, tiles_y));
+		span.y1 = static_cast<unsigned char>(toTile(y_hi, tiles_y));
+		spans.push_back(span);
+	}
+}
+
+void ClusteredLights::createBuffers() {
+	light_buffer.create(GL_TEXTURE_BUFFER);
+	cluster_buffer.create(GL_TEXTURE_BUFFER);
+	index_buffer.create(GL_TEXTURE_BUFFER);
+	light_buffer.data(16, NULL, GL_STREAM_DRAW);
+	cluster_buffer.data(clusters.size() * sizeof(unsigned int), NULL, GL_STREAM_DRAW);
+	index_buffer.data(16, NULL, GL_STREAM_DRAW);
+	light_buffer.unbind();
+
+	light_texture.create(GL_TEXTURE_BUFFER);
+	light_texture.bind();
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, light_buffer.name());
+	cluster_texture.create(GL_TEXTURE_BUFFER);
+	cluster_texture.bind();
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, cluster_buffer.name());
+	index_texture.create(GL_TEXTURE_BUFFER);
+	index_texture.bind();
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, index_buffer.name());
+	index_texture.unbind();
+	CHECK_GL_ERROR();
+}
+
+void ClusteredLights::upload() {
+	Timer timer;
+	if (!light_buffer.valid())
+		createBuffers();
+
+	//New storage every frame, so that we never wait for the GPU to finish reading the last one
+	light_buffer.data(std::max<size_t>(view_lights.size() * sizeof(float), 16), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, view_lights.size() * sizeof(float), view_lights.data());
+	cluster_buffer.data(clusters.size() * sizeof(unsigned int), clusters.data(), GL_STREAM_DRAW);
+	index_buffer.data(std::max<size_t>(indices.size() * sizeof(unsigned short), 16), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, indices.size() * sizeof(unsigned short), indices.data());
+	index_buffer.unbind();
+	stats.upload = timer.elapsed();
+}
+
+void ClusteredLights::bind(GLUtils::Program& program, unsigned int first_unit, unsigned int viewport_width, unsigned int viewport_height) {
+	if (!light_buffer.valid())
+		createBuffers();
+
+	glActiveTexture(GL_TEXTURE0 + first_unit);
+	light_texture.bind();
+	glActiveTexture(GL_TEXTURE0 + first_unit + 1);
+	cluster_texture.bind();
+	glActiveTexture(GL_TEXTURE0 + first_unit + 2);
+	index_texture.bind();
+	glActiveTexture(GL_TEXTURE0);
+
+	glUniform1i(program.getUniform("light_data"), first_unit);
+	glUniform1i(program.getUniform("cluster_data"), first_unit + 1);
+	glUniform1i(program.getUniform("light_indices"), first_unit + 2);
+	glUniform3i(program.getUniform("cluster_grid"), tiles_x, tiles_y, slices);
+	glUniform2f(program.getUniform("cluster_tile_scale"),
+		tiles_x / static_cast<float>(viewport_width), tiles_y / static_cast<float>(viewport_height));
+	glUniform2f(program.getUniform("cluster_slice"), slice_scale, slice_bias);
+}
@@ -0,0 +1,105 @@
+#include "DepthPrepass.h"
+#include "GameException.h"
+
+#include <iostream>
+
+namespace {
+	// Auto mode turns the pre-pass on above this overdraw...
+	const double enable_overdraw = 1.6;
+
+	// ...and off again below this one, so that it does not flip every probe
+	const double disable_overdraw = 1.3;
+}
+
+DepthPrepass::DepthPrepass() {
+	mode = PREPASS_AUTO;
+	auto_enabled = false;
+	frame_count = 0;
+	current = 0;
+	for (unsigned int i = 0; i < frames_in_flight; ++i) {
+		frames[i].prepass = false;
+		frames[i].pending = false;
+	}
+}
+
+void DepthPrepass::setMode(PrepassMode mode) {
+	this->mode = mode;
+	auto_enabled = false;
+}
+
+const char* DepthPrepass::getModeName(PrepassMode mode) {
+	switch (mode) {
+	case PREPASS_OFF: return "off";
+	case PREPASS_ON: return "on";
+	case PREPASS_AUTO: return "auto";
+	default: return "unknown";
+	}
+}
+
+PrepassMode DepthPrepass::parseMode(const std::string& name) {
+	if (name == "off") return PREPASS_OFF;
+	if (name == "on") return PREPASS_ON;
+	if (name == "auto") return PREPASS_AUTO;
+	THROW_EXCEPTION("Unknown depth pre-pass mode " + name + ", use off, on or auto");
+}
+
+bool DepthPrepass::beginFrame(bool supported) {
+	FrameQueries& frame = frames[current];
+	if (!frame.shading.valid()) {
+		frame.depth.create();
+		frame.shading.create();
+	}
+	if (frame.pending)
+		readResults(frame);
+
+	++frame_count;
+	frame.prepass = supported && ((mode == PREPASS_ON)
+		|| (mode == PREPASS_AUTO && (auto_enabled || frame_count % probe_interval == 0)));
+	stats.enabled = frame.prepass;
+	return frame.prepass;
+}
+
+void DepthPrepass::beginDepthPass() {
+	glBeginQuery(GL_SAMPLES_PASSED, frames[current].depth.name());
+}
+
+void DepthPrepass::endDepthPass() {
+	glEndQuery(GL_SAMPLES_PASSED);
+}
+
+void DepthPrepass::beginShadingPass() {
+	glBeginQuery(GL_SAMPLES_PASSED, frames[current].shading.name());
+}
+
+void DepthPrepass::endShadingPass() {
+	glEndQuery(GL_SAMPLES_PASSED);
+	frames[current].pending = true;
+	current = (current + 1) % frames_in_flight;
+}
+
+void DepthPrepass::readResults(FrameQueries& frame) {
+	//Issued frames_in_flight frames ago, so this rarely has to wait
+	GLuint shaded = 0;
+	glGetQueryObjectuiv(frame.shading.name(), GL_QUERY_RESULT, &shaded);
+	stats.shaded_samples = shaded;
+	frame.pending = false;
+	if (!frame.prepass)
+		return;
+
+	GLuint depth = 0;
+	glGetQueryObjectuiv(frame.depth.name(), GL_QUERY_RESULT, &depth);
+	stats.depth_samples = depth;
+	stats.overdraw = (shaded > 0) ? depth / static_cast<double>(shaded) : 1.0;
+
+	if (mode != PREPASS_AUTO)
+		return;
+	if (!auto_enabled && stats.overdraw > enable_overdraw) {
+		auto_enabled = true;
+		++stats.switches;
+		std::cout << "Depth pre-pass on, overdraw is " << stats.overdraw << std::endl;
+	} else if (auto_enabled && stats.overdraw < disable_overdraw) {
+		auto_enabled = false;
+		++stats.switches;
+		std::cout << "Depth pre-pass off, overdraw is " << stats.overdraw << std::endl;
+	}
+}
@@ -0,0 +1,192 @@
+#include "DynamicResolution.h"
+#include "GameException.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+	// Lower the scale when a frame takes longer than the target...
+	const double over_budget = 1.0;
+
+	// ...and raise it when a frame takes less than this part of it
+	const double headroom = 0.8;
+
+	// New scales aim for this part of the target, inside the band above
+	const double aim = 0.9;
+
+	// Most a single change may lower or raise the scale by
+	const float max_decrease = 0.75f;
+	const float max_increase = 1.1f;
+
+	// Scales are multiples of this, so that small changes in GPU time do not change it
+	const float scale_step = 0.025f;
+
+	// Weight of the neighbours in the unsharp mask of UPSCALE_SHARPEN
+	const float sharpen_amount = 0.2f;
+}
+
+DynamicResolution::DynamicResolution(unsigned int window_width, unsigned int window_height)
+		: window_width(window_width), window_height(window_height) {
+	target = 0.0;
+	filter = UPSCALE_BILINEAR;
+	min_scale = 0.5f;
+	max_scale = 1.0f;
+	hold = 0;
+	current = 0;
+	for (unsigned int i = 0; i < frames_in_flight; ++i)
+		frames[i].pending = false;
+	stats.width = window_width;
+	stats.height = window_height;
+}
+
+void DynamicResolution::setTarget(double seconds) {
+	target = seconds;
+	stats.target = seconds;
+	if (target > 0.0)
+		return;
+
+	//Back to the window, the framebuffer and the unread queries are released
+	framebuffer.reset();
+	color.reset();
+	depth.reset();
+	empty_vao.reset();
+	for (unsigned int i = 0; i < frames_in_flight; ++i) {
+		frames[i].query.reset();
+		frames[i].pending = false;
+	}
+	setScale(max_scale);
+}
+
+void DynamicResolution::setFilter(UpscaleFilter filter) {
+	this->filter = filter;
+}
+
+const char* DynamicResolution::getFilterName(UpscaleFilter filter) {
+	switch (filter) {
+	case UPSCALE_BILINEAR: return "bilinear";
+	case UPSCALE_SHARPEN: return "sharpen";
+	default: return "unknown";
+	}
+}
+
+UpscaleFilter DynamicResolution::parseFilter(const std::string& name) {
+	if (name == "bilinear") return UPSCALE_BILINEAR;
+	if (name == "sharpen") return UPSCALE_SHARPEN;
+	THROW_EXCEPTION("Unknown upscale filter " + name + ", use bilinear or sharpen");
+}
+
+void DynamicResolution::setBounds(float min_scale, float max_scale) {
+	if (!(min_scale > 0.0f && min_scale <= max_scale && max_scale <= 1.0f))
+		THROW_EXCEPTION("The resolution scale bounds must be within (0, 1], and the lower one not above the upper one");
+	this->min_scale = min_scale;
+	this->max_scale = max_scale;
+	setScale(stats.scale);
+}
+
+void DynamicResolution::createFramebuffer() {
+	color.create(GL_TEXTURE_2D);
+	color.bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, window_width, window_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	color.setBytes(window_width * window_height * 4);
+
+	depth.create(GL_TEXTURE_2D);
+	depth.bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, window_width, window_height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	depth.setBytes(window_width * window_height * 4);
+	depth.unbind();
+
+	framebuffer.create();
+	framebuffer.bind();
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color.name(), 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth.name(), 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		THROW_EXCEPTION("The dynamic resolution framebuffer is incomplete");
+	GLUtils::FramebufferHandle::unbind();
+
+	empty_vao.create();
+	for (unsigned int i = 0; i < frames_in_flight; ++i)
+		frames[i].query.create();
+	CHECK_GL_ERROR();
+}
+
+void DynamicResolution::beginFrame() {
+	if (!framebuffer.valid())
+		createFramebuffer();
+
+	//Issued frames_in_flight frames ago, so this rarely has to wait
+	FrameQuery& frame = frames[current];
+	if (frame.pending) {
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(frame.query.name(), GL_QUERY_RESULT, &nanoseconds);
+		frame.pending = false;
+		update(nanoseconds * 1.0e-9);
+	}
+
+	framebuffer.bind();
+	glViewport(0, 0, stats.width, stats.height);
+	glBeginQuery(GL_TIME_ELAPSED, frame.query.name());
+}
+
+void DynamicResolution::endFrame(GLUtils::Program& program, unsigned int texture_unit) {
+	glEndQuery(GL_TIME_ELAPSED);
+	frames[current].pending = true;
+	current = (current + 1) % frames_in_flight;
+
+	GLUtils::FramebufferHandle::unbind();
+	glViewport(0, 0, window_width, window_height);
+	glDisable(GL_DEPTH_TEST);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+	glActiveTexture(GL_TEXTURE0 + texture_unit);
+	color.bind();
+	glActiveTexture(GL_TEXTURE0);
+
+	program.use();
+	glUniform1i(program.getUniform("source"), texture_unit);
+	glUniform2f(program.getUniform("source_scale"),
+		stats.width / static_cast<float>(window_width), stats.height / static_cast<float>(window_height));
+	glUniform2f(program.getUniform("texel_size"), 1.0f / window_width, 1.0f / window_height);
+	glUniform1f(program.getUniform("sharpness"), (filter == UPSCALE_SHARPEN) ? sharpen_amount : 0.0f);
+
+	empty_vao.bind();
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	empty_vao.unbind();
+	glEnable(GL_DEPTH_TEST);
+}
+
+void DynamicResolution::update(double gpu_time) {
+	stats.gpu_time = gpu_time;
+	if (hold > 0) {
+		--hold;
+		return;
+	}
+
+	//Pixels, and so roughly the GPU time, grow with the square of the scale
+	float ratio = static_cast<float>(std::sqrt(target * aim / std::max(gpu_time, 1.0e-6)));
+	if (gpu_time > target * over_budget)
+		setScale(stats.scale * std::max(ratio, max_decrease));
+	else if (gpu_time < target * headroom)
+		setScale(stats.scale * std::min(ratio, max_increase));
+}
+
+void DynamicResolution::setScale(float scale) {
+	scale = std::floor(scale / scale_step + 0.5f) * scale_step;
+	scale = std::min(std::max(scale, min_scale), max_scale);
+	if (scale == stats.scale)
+		return;
+
+	stats.scale = scale;
+	stats.width = std::max(1u, static_cast<unsigned int>(window_width * scale + 0.5f));
+	stats.height = std::max(1u, static_cast<unsigned int>(window_height * scale + 0.5f));
+	++stats.changes;
+
+	//Wait for frames rendered at the new scale before judging it
+	hold = frames_in_flight;
+}
@@ -0,0 +1,175 @@
+#include "EntropyCoder.h"
+
+#include <algorithm>
+
+namespace {
+
+	const unsigned int rans_precision = 12;
+	const unsigned int rans_total = 1 << rans_precision;
+	const unsigned int rans_low = 1u << 23;
+
+	enum StreamMode {
+		STREAM_RAW,
+		STREAM_CONSTANT,
+		STREAM_RANS
+	};
+
+	/**
+	 * Scales symbol counts to frequencies that sum to rans_total,
+	 * keeping every symbol that occurs at a frequency of at least one
+	 */
+	void normalizeFrequencies(const size_t counts[256], size_t total, unsigned int freqs[256]) {
+		unsigned int sum = 0;
+		for (unsigned int s=0; s<256; ++s) {
+			freqs[s] = 0;
+			if (counts[s] > 0)
+				freqs[s] = std::max<unsigned int>(1, static_cast<unsigned int>(static_cast<unsigned long long>(counts[s]) * rans_total / total));
+			sum += freqs[s];
+		}
+		while (sum != rans_total) {
+			unsigned int largest = 0;
+			for (unsigned int s=1; s<256; ++s)
+				if (freqs[s] > freqs[largest])
+					largest = s;
+			if (sum > rans_total) {
+				unsigned int take = std::min(sum - rans_total, freqs[largest] - 1);
+				if (take == 0) take = 1; //< Cannot happen with 256 symbols and rans_total >= 256
+				freqs[largest] -= take;
+				sum -= take;
+			} else {
+				freqs[largest] += rans_total - sum;
+				sum = rans_total;
+			}
+		}
+	}
+}
+
+/**
+ * Stream layout: mode, length, then the bytes (raw), the symbol
+ * (constant), or a bitmap of used symbols, their frequencies, and
+ * the rANS payload
+ */
+void EntropyCoder::encode(const unsigned char* data, size_t n, ByteWriter& out) {
+	size_t counts[256] = { 0 };
+	for (size_t i=0; i<n; ++i)
+		++counts[data[i]];
+	unsigned int used = 0;
+	for (unsigned int s=0; s<256; ++s)
+		if (counts[s] > 0)
+			++used;
+
+	if (used == 1) {
+		out.put(STREAM_CONSTANT);
+		out.putVarint(n);
+		out.put(data[0]);
+		return;
+	}
+
+	std::vector<unsigned char> table;
+	std::vector<unsigned char> payload;
+	if (used > 1) {
+		unsigned int freqs[256];
+		unsigned int starts[256];
+		normalizeFrequencies(counts, n, freqs);
+		for (unsigned int s=0, start=0; s<256; ++s) {
+			starts[s] = start;
+			start += freqs[s];
+		}
+
+		//Encode backwards, so that the decoder reads forwards
+		payload.reserve(n / 2 + 16);
+		unsigned int x = rans_low;
+		for (size_t i=n; i-- > 0; ) {
+			unsigned int f = freqs[data[i]];
+			unsigned int x_max = ((rans_low >> rans_precision) << 8) * f;
+			while (x >= x_max) {
+				payload.push_back(static_cast<unsigned char>(x & 0xFF));
+				x >>= 8;
+			}
+			x = ((x / f) << rans_precision) + (x % f) + starts[data[i]];
+		}
+		for (int shift=24; shift>=0; shift-=8)
+			payload.push_back(static_cast<unsigned char>(x >> shift));
+		std::reverse(payload.begin(), payload.end());
+
+		ByteWriter table_writer(table);
+		unsigned char bitmap[32] = { 0 };
+		for (unsigned int s=0; s<256; ++s)
+			if (freqs[s] > 0)
+				bitmap[s >> 3] |= 1 << (s & 7);
+		table_writer.putBytes(bitmap, sizeof(bitmap));
+		for (unsigned int s=0; s<256; ++s)
+			if (freqs[s] > 0)
+				table_writer.putVarint(freqs[s] - 1);
+		table_writer.putVarint(payload.size());
+	}
+
+	if (used == 0 || table.size() + payload.size() >= n) {
+		out.put(STREAM_RAW);
+		out.putVarint(n);
+		out.putBytes(data, n);
+	} else {
+		out.put(STREAM_RANS);
+		out.putVarint(n);
+		out.putBytes(table.data(), table.size());
+		out.putBytes(payload.data(), payload.size());
+	}
+}
+
+void EntropyCoder::decode(ByteReader& in, std::vector<unsigned char>& data, size_t max_size) {
+	unsigned char mode = in.get();
+	unsigned long long length = in.getVarint();
+	if (length > max_size)
+		THROW_EXCEPTION("Corrupt stream length");
+	size_t n = static_cast<size_t>(length);
+	data.resize(n);
+
+	if (mode == STREAM_RAW) {
+		in.getBytes(data.data(), n);
+	} else if (mode == STREAM_CONSTANT) {
+		memset(data.data(), in.get(), n);
+	} else if (mode == STREAM_RANS) {
+		unsigned char bitmap[32];
+		in.getBytes(bitmap, sizeof(bitmap));
+		//Per slot: symbol (8 bits), frequency (12 bits) and the offset of
+		//the slot within the symbol's range (12 bits), so that a step is
+		//a single table load. Frequencies are below rans_total, since
+		//constant streams are not rANS coded.
+		unsigned int slots[rans_total];
+		unsigned int start = 0;
+		for (unsigned int s=0; s<256; ++s) {
+			if (bitmap[s >> 3] & (1 << (s & 7))) {
+				unsigned int freq = static_cast<unsigned int>(in.getVarint()) + 1;
+				if (freq >= rans_total || start + freq > rans_total)
+					THROW_EXCEPTION("Corrupt frequency table");
+				for (unsigned int k=0; k<freq; ++k)
+					slots[start + k] = s | (freq << 8) | (k << 20);
+				start += freq;
+			}
+		}
+		if (start != rans_total)
+			THROW_EXCEPTION("Corrupt frequency table");
+
+		size_t payload_size = static_cast<size_t>(in.getVarint());
+		if (payload_size < 4)
+			THROW_EXCEPTION("Corrupt rANS stream");
+		const unsigned char* p = in.skip(payload_size);
+		const unsigned char* end = p + payload_size;
+		unsigned int x = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned int>(p[3]) << 24);
+		p += 4;
+
+		unsigned char* out = data.data();
+		for (size_t i=0; i<n; ++i) {
+			unsigned int entry = slots[x & (rans_total - 1)];
+			out[i] = static_cast<unsigned char>(entry);
+			x = ((entry >> 8) & (rans_total - 1)) * (x >> rans_precision) + (entry >> 20);
+			while (x < rans_low) {
+				if (p == end)
+					THROW_EXCEPTION("Truncated rANS stream");
+				x = (x << 8) | *p++;
+			}
+		}
+	} else {
+		THROW_EXCEPTION("Unknown stream mode");
+	}
+}
@@ -0,0 +1,183 @@
+#include "FrameCapture.h"
+#include "GameException.h"
+#include "Timer.h"
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+FrameCapture::FrameCapture(unsigned int width, unsigned int height)
+		: width(width), height(height), write_microseconds(0), writer(1) {
+	screenshot_requested = false;
+	recording = false;
+	frame = 0;
+	screenshots = 0;
+	video_frames = 0;
+	oldest = 0;
+	in_flight = 0;
+}
+
+FrameCapture::~FrameCapture() {
+	writer.wait();
+	for (unsigned int i = 0; i < buffers; ++i)
+		if (readbacks[i].fence != 0)
+			glDeleteSync(readbacks[i].fence);
+}
+
+void FrameCapture::setDirectory(const std::string& directory) {
+	this->directory = directory;
+}
+
+void FrameCapture::screenshot() {
+	screenshot_requested = true;
+}
+
+void FrameCapture::setRecording(bool recording) {
+	this->recording = recording;
+	std::cout << "Video capture: " << (recording ? "recording" : "stopped") << " at frame " << video_frames << std::endl;
+}
+
+void FrameCapture::endFrame() {
+	++frame;
+
+	//Retrieve what the GPU has finished, oldest first, without waiting
+	while (in_flight > 0) {
+		GLenum result = glClientWaitSync(readbacks[oldest].fence, 0, 0);
+		if (result == GL_TIMEOUT_EXPIRED)
+			break;
+		if (result == GL_WAIT_FAILED)
+			THROW_EXCEPTION("glClientWaitSync failed");
+		retrieve(readbacks[oldest]);
+	}
+
+	if (!screenshot_requested && !recording)
+		return;
+
+	if (!readbacks[0].buffer.valid()) {
+		for (unsigned int i = 0; i < buffers; ++i) {
+			readbacks[i].buffer.create(GL_PIXEL_PACK_BUFFER);
+			readbacks[i].buffer.data(width * height * 4, NULL, GL_STREAM_READ);
+			readbacks[i].buffer.unbind();
+		}
+	}
+
+	//Every buffer is in flight, so wait for the oldest
+	if (in_flight == buffers) {
+		++stats.stalls;
+		GLenum result;
+		do {
+			result = glClientWaitSync(readbacks[oldest].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		} while (result == GL_TIMEOUT_EXPIRED);
+		if (result == GL_WAIT_FAILED)
+			THROW_EXCEPTION("glClientWaitSync failed");
+		retrieve(readbacks[oldest]);
+	}
+
+	Timer timer;
+	Readback& readback = readbacks[(oldest + in_flight) % buffers];
+	readback.frame = frame;
+	readback.filenames.clear();
+	if (screenshot_requested) {
+		std::stringstream name;
+		name << directory << "screenshot_" << std::setw(4) << std::setfill('0') << screenshots++ << ".tga";
+		readback.filenames.push_back(name.str());
+	}
+	if (recording) {
+		std::stringstream name;
+		name << directory << "frame_" << std::setw(6) << std::setfill('0') << video_frames++ << ".tga";
+		readback.filenames.push_back(name.str());
+	}
+	screenshot_requested = false;
+
+	//BGRA is what the window usually stores, and what TGA files store
+	readback.buffer.bind();
+	glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+	readback.buffer.unbind();
+	readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	++in_flight;
+	stats.read_time += timer.elapsed();
+}
+
+void FrameCapture::finish() {
+	while (in_flight > 0) {
+		GLenum result;
+		do {
+			result = glClientWaitSync(readbacks[oldest].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		} while (result == GL_TIMEOUT_EXPIRED);
+		if (result == GL_WAIT_FAILED)
+			THROW_EXCEPTION("glClientWaitSync failed");
+		retrieve(readbacks[oldest]);
+	}
+	writer.wait();
+}
+
+void FrameCapture::retrieve(Readback& readback) {
+	Timer timer;
+	size_t bytes = static_cast<size_t>(width) * height * 4;
+	std::shared_ptr<std::vector<unsigned char> > pixels(new std::vector<unsigned char>(bytes));
+	readback.buffer.bind();
+	const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+	if (mapped == NULL)
+		THROW_EXCEPTION("Unable to map the frame capture buffer");
+	memcpy(pixels->data(), mapped, bytes);
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	readback.buffer.unbind();
+
+	glDeleteSync(readback.fence);
+	readback.fence = 0;
+	oldest = (oldest + 1) % buffers;
+	--in_flight;
+	++stats.frames;
+	stats.latency = frame - readback.frame;
+	stats.retrieve_time += timer.elapsed();
+
+	std::vector<std::string> filenames(readback.filenames);
+	unsigned int width = this->width, height = this->height;
+	std::atomic<long long>* write_microseconds = &this->write_microseconds;
+	writer.submit([=]() {
+		Timer write_timer;
+		for (unsigned int i = 0; i < filenames.size(); ++i)
+			writeTga(filenames[i], width, height, *pixels);
+		*write_microseconds += static_cast<long long>(write_timer.elapsed() * 1.0e6);
+	});
+}
+
+void FrameCapture::writeTga(const std::string& filename, unsigned int width, unsigned int height,
+		const std::vector<unsigned char>& pixels) {
+	//Uncompressed true color, with the origin in the lower left corner like OpenGL
+	unsigned char header[18] = { 0 };
+	header[2] = 2;
+	header[12] = width & 0xFF;
+	header[13] = (width >> 8) & 0xFF;
+	header[14] = height & 0xFF;
+	header[15] = (height >> 8) & 0xFF;
+	header[16] = 24;
+
+	//The alpha of the window is not meaningful, so it is dropped
+	std::vector<unsigned char> bgr(static_cast<size_t>(width) * height * 3);
+	for (size_t i = 0, n = static_cast<size_t>(width) * height; i < n; ++i) {
+		bgr[i*3 + 0] = pixels[i*4 + 0];
+		bgr[i*3 + 1] = pixels[i*4 + 1];
+		bgr[i*3 + 2] = pixels[i*4 + 2];
+	}
+
+	std::ofstream file(filename.c_str(), std::ios::binary);
+	file.write(reinterpret_cast<const char*>(header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(bgr.data()), bgr.size());
+	if (!file)
+		std::cout << "Unable to write " << filename << std::endl;
+}
+
+CaptureStats FrameCapture::getStats() const {
+	CaptureStats result = stats;
+	result.write_time = write_microseconds * 1.0e-6;
+	return result;
+}
+
+void FrameCapture::resetStats() {
+	stats = CaptureStats();
+	write_microseconds = 0;
+}
@@ -0,0 +1,106 @@
+#include "FrameLimiter.h"
+
+#include <SDL.h>
+
+#ifdef _WIN32
+#include <mmsystem.h>
+#endif
+
+namespace {
+	// Never trust the OS sleep closer than this to the deadline
+	const double min_sleep_margin = 0.0005;
+	// Frames that are behind by more than this many periods start a new schedule
+	const double max_frames_behind = 2.0;
+	// Timeout for blocking on input when the limiter is disabled
+	const unsigned int idle_wait_ms = 100;
+}
+
+FrameLimiter::FrameLimiter(double fps) {
+#ifdef _WIN32
+	// Raise the scheduler resolution so that Sleep(1) sleeps ~1 ms and not ~15 ms
+	timeBeginPeriod(1);
+#endif
+	sleep_margin = 0.002;
+	work_begin = Timer::getCurrentTime();
+	next_deadline = work_begin;
+	setTargetFrameRate(fps);
+}
+
+FrameLimiter::~FrameLimiter() {
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
+
+void FrameLimiter::setTargetFrameRate(double fps) {
+	target_fps = (fps > 0.0) ? fps : 0.0;
+	frame_period = (target_fps > 0.0) ? 1.0 / target_fps : 0.0;
+	next_deadline = Timer::getCurrentTime() + frame_period;
+}
+
+void FrameLimiter::beginFrame() {
+	++current.frames;
+	work_begin = Timer::getCurrentTime();
+}
+
+void FrameLimiter::endWork() {
+	current.cpu_time += Timer::getCurrentTime() - work_begin;
+}
+
+unsigned int FrameLimiter::getMillisecondsToNextFrame() const {
+	if (frame_period <= 0.0)
+		return idle_wait_ms;
+
+	double remaining = next_deadline - Timer::getCurrentTime();
+	if (remaining <= 0.0)
+		return 0;
+	return static_cast<unsigned int>(remaining * 1000.0);
+}
+
+void FrameLimiter::waitForNextFrame() {
+	if (frame_period <= 0.0)
+		return;
+
+	double now = Timer::getCurrentTime();
+	if (now > next_deadline) {
+		++current.late;
+		//If we are far behind, do not try to catch up by rushing frames
+		if (now - next_deadline > max_frames_behind * frame_period)
+			next_deadline = now;
+	} else {
+		sleepUntil(next_deadline);
+	}
+	next_deadline += frame_period;
+}
+
+bool FrameLimiter::getStats(FrameStats& stats) {
+	double elapsed = stats_timer.elapsed();
+	if (elapsed < 1.0)
+		return false;
+
+	stats = current;
+	stats.elapsed = elapsed;
+	current = FrameStats();
+	stats_timer.restart();
+	return true;
+}
+
+void FrameLimiter::sleepUntil(double deadline) {
+	double remaining = deadline - Timer::getCurrentTime();
+
+	//Coarse sleep, and learn how much the OS oversleeps
+	if (remaining > sleep_margin) {
+		double requested = remaining - sleep_margin;
+		double before = Timer::getCurrentTime();
+		SDL_Delay(static_cast<Uint32>(requested * 1000.0));
+		double overshoot = (Timer::getCurrentTime() - before) - static_cast<Uint32>(requested * 1000.0) / 1000.0;
+
+		//Exponential moving average of the oversleep, with some head room
+		sleep_margin = 0.9 * sleep_margin + 0.1 * (2.0 * overshoot);
+		if (sleep_margin < min_sleep_margin)
+			sleep_margin = min_sleep_margin;
+	}
+
+	//Spin the rest of the way
+	while (Timer::getCurrentTime() < deadline) {}
+}
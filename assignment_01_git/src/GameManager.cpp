@@ -1,9 +1,13 @@
 #include "GameManager.h"
+#include "Parallel.h"
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <sstream>
 #include <vector>
 #include <assert.h>
+#include <cmath>
+#include <random>
 #include <stdexcept>
 
 #include <glm/glm.hpp>
@@ -17,13 +21,105 @@ using std::endl;
 using GLUtils::VBO;
 using GLUtils::Program;
 using GLUtils::readFile;
+using GLUtils::readShader;
 
-GameManager::GameManager(char* argv) {
+namespace {
+	// Time per frame spent uploading streamed chunks, in seconds
+	const double stream_upload_time = 0.004;
+
+	// Time per frame spent uploading a model loaded in the background, in seconds
+	const double model_upload_time = 0.004;
+
+	// Time per frame spent uploading the nodes of the point cloud, in seconds
+	const double point_upload_time = 0.004;
+
+	// GPU memory for buffers and textures, unless set with setGpuBudget
+	const long long default_gpu_budget = 1024LL << 20;
+
+	// First of the three texture units of the clustered light buffers
+	const unsigned int light_texture_unit = 2;
+
+	// Texture unit the dynamic resolution frame is read from when it is upscaled
+	const unsigned int upscale_texture_unit = 5;
+
+	// First of the two texture units of the virtual texture cache and indirection table
+	const unsigned int virtual_texture_unit = 6;
+
+	// Texture unit of the bone matrices of skinned models
+	const unsigned int bone_texture_unit = 8;
+
+	// Pages of the virtual texture uploaded per frame, 74 KiB each
+	const unsigned int virtual_texture_uploads = 16;
+
+	// GPU time per frame the D key holds when the frame rate is not limited, in seconds
+	const double default_resolution_target = 1.0 / 60.0;
+
+	// Lights set with setLightCount orbit inside a box this far out from the origin
+	const float light_extent = 2.5f;
+
+	// Reach of the lights set with setLightCount
+	const float light_radius = 0.6f;
+
+	// Parts picked with the right mouse button are drawn in this color
+	const glm::vec3 selection_color(1.0f, 0.5f, 0.0f);
+
+	// Growth of the lowest driver or process memory use from the first to the second half of the reload test that still counts as flat
+	const long long reload_tolerance = 16 << 20;
+	// Reloads the reload test needs for the lows of driver and process memory to mean anything
+	const unsigned int reload_test_min_iterations = 20;
+	// Vertices along each side of the grid of benchmarkStreaming, 8 MiB per frame
+	const unsigned int stream_grid_side = 512;
+
+	inline bool isStreamFile(const std::string& filename) {
+		return filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".pgs") == 0;
+	}
+
+	/**
+	 * The part with the given index in the order of MeshHit::part, NULL if there is none
+	 */
+	const MeshPart* findPart(const MeshPart& part, unsigned int& index) {
+		if (index == 0)
+			return &part;
+		--index;
+		for (unsigned int i = 0; i < part.children.size(); ++i) {
+			const MeshPart* found = findPart(part.children[i], index);
+			if (found != NULL)
+				return found;
+		}
+		return NULL;
+	}
+}
+
+GameManager::GameManager(char* argv) : dynamic_resolution(window_width, window_height),
+		capture(window_width, window_height) {
 	my_timer.restart();
 	rendermode = RENDERMODE_PHONG;
 	background_color = glm::vec3(0.0f, 0.0f, 0.0f);
 	model_color = glm::vec3(1.0f,1.0f, 1.0f);
 	model_to_load = argv;
+	models.push_back(model_to_load);
+	model_index = 0;
+	main_window = NULL;
+	main_context = NULL;
+	swap_interval = 1;
+	idle_rendering = false;
+	redraw = true;
+	stream_memory_cap = 64 << 20;
+	residency.setBudget(default_gpu_budget);
+	asset_manager.setCacheDirectory("cache/");
+	legacy_model = false;
+	weld_epsilon = 0.0f;
+	weld_normal_epsilon = 0.0f;
+	weld_tex_coord_epsilon = 0.0f;
+	import_profile = IMPORT_BALANCED;
+	skinning_mode = SKINNING_GPU;
+	selected_part = NULL;
+	has_pick = false;
+	software_rendering = false;
+	software_present_time = 0.0;
+	screenshot_frame = 0;
+	software_frames = 0;
+	point_budget = 10000000;
 	std::cout << argv << std::endl;
 }
 
@@ -43,7 +139,7 @@ void GameManager::createOpenGLContext() {
 	SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8); // Use framebuffer with 8 bit for blue
 	SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 8); // Use framebuffer with 8 bit for alpha
 
-	// Initalize video
+	// Create the window
 	main_window = SDL_CreateWindow("NITH - PG612 Example OpenGL Program", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
 		window_width, window_height, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
 	if (!main_window) {
@@ -53,6 +149,7 @@ void GameManager::createOpenGLContext() {
 	//Create OpenGL context
 	main_context = SDL_GL_CreateContext(main_window);
 	trackball.setWindowSize(window_width, window_height);
+	setSwapInterval(swap_interval);
 
 	// Init glew
 	// glewExperimental is required in openGL 3.3
@@ -69,11 +166,6 @@ void GameManager::createOpenGLContext() {
 	// supposed to (setting function pointers for core functionality).
 	// Lets do the ugly thing of swallowing the error....
 	glGetError();
-
-	ilInit();
-	iluInit();
-	ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
-	ilEnable(IL_ORIGIN_SET);
 }
 
 void GameManager::setOpenGLStates() {
@@ -101,12 +193,14 @@ void GameManager::createMatrices() {
 * attributes.
 * */
 void GameManager::createSimpleProgram() {
+	Timer program_timer;
+
 	// PHONG SHADING
-	std::string fs_src = readFile("shaders/phongshader.frag");
-	std::string vs_src = readFile("shaders/phongshader.vert");
+	std::string fs_src = readShader("shaders/phongshader.frag");
+	std::string vs_src = readShader("shaders/phongshader.vert");
 
-	//Compile shaders, attach to program object, and link
-	phong_program.reset(new Program(vs_src, fs_src));
+	//Compile shaders, attach to program object, and link (or load from the cache)
+	phong_program = program_cache.getProgram(vs_src, fs_src);
 
 	//Set uniforms for the program.
 	phong_program->use();
@@ -114,54 +208,352 @@ void GameManager::createSimpleProgram() {
 	phong_program->disuse();
 
 	// FLAT SHADING
-	fs_src = readFile("shaders/flatshader.frag");
-	vs_src = readFile("shaders/flatshader.vert");
+	fs_src = readShader("shaders/flatshader.frag");
+	vs_src = readShader("shaders/flatshader.vert");
 
-	flat_program.reset(new Program(vs_src, fs_src));
+	flat_program = program_cache.getProgram(vs_src, fs_src);
 
 	flat_program->use();
 	glUniformMatrix4fv(flat_program->getUniform("projection_matrix"), 1, 0, glm::value_ptr(projection_matrix));
 	flat_program->disuse();
 
+	// DEPTH PRE-PASS
+	fs_src = readShader("shaders/depthprepass.frag");
+	vs_src = readShader("shaders/depthprepass.vert");
+
+	prepass_program = program_cache.getProgram(vs_src, fs_src);
+
+	// VIRTUAL TEXTURE FEEDBACK
+	fs_src = readShader("shaders/vtfeedback.frag");
+	vs_src = readShader("shaders/vtfeedback.vert");
+
+	feedback_program = program_cache.getProgram(vs_src, fs_src);
+
+	// UPSCALING OF DYNAMIC RESOLUTION FRAMES
+	fs_src = readShader("shaders/upscale.frag");
+	vs_src = readShader("shaders/upscale.vert");
+
+	upscale_program = program_cache.getProgram(vs_src, fs_src);
+
+	// POINT CLOUD SPLATS
+	fs_src = readShader("shaders/pointsplat.frag");
+	vs_src = readShader("shaders/pointsplat.vert");
+
+	points_program = program_cache.getProgram(vs_src, fs_src);
+
 	active_program = flat_program;
+
+	std::cout << "Created shader programs in " << program_timer.elapsed()*1000.0 << " ms ("
+		<< program_cache.getHits() << " from cache, " << program_cache.getMisses() << " compiled"
+		<< (program_cache.isEnabled() ? "" : ", cache disabled") << ")" << std::endl;
 }
 
 void GameManager::createVAO() {
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	//Stream files are drawn while they load, everything else is loaded up front
+	if (isStreamFile(model_to_load))
+		streamingModel.reset(new StreamingModel(model_to_load, stream_memory_cap));
+	else if (legacy_model)
+		model.reset(new Model(model_to_load, 0, MODEL_INDEXED, weld_epsilon, weld_normal_epsilon, weld_tex_coord_epsilon, import_profile));
+	else {
+		modelInterleaved.reset(new ModelInterleavedArray(model_to_load, 0, LOADER_AUTO, import_profile, asset_manager.getCacheDirectory()));
+		residency.insert(model_to_load, modelInterleaved);
+	}
+	bindModel();
+}
+
+void GameManager::bindModel() {
+	selected_part = NULL;
+	has_pick = false;
+	prepass_vao.reset();
+	feedback_vao.reset();
+	vao.create();
+	vao.bind();
 	CHECK_GL_ERROR();
 
-	modelInterleaved.reset(new ModelInterleavedArray("models/lara.obj"));
-	modelInterleaved->getArray()->bind();
-	modelInterleaved->getIndices()->bind();
-	modelInterleaved->bindTextures();
+	std::shared_ptr<VBO> indices;
+	if (streamingModel) {
+		streamingModel->bindTextures();
+		indices = streamingModel->getIndices();
+	} else if (model) {
+		model->bindTextures();
+		indices = model->getIndices();
+	} else {
+		modelInterleaved->bindTextures();
+		indices = modelInterleaved->getIndices();
+		const MaterialTextures& materials = modelInterleaved->getMaterials();
+		std::cout << "Textures: " << materials.getMaterialCount() << " materials in "
+			<< materials.getArrayCount() << " texture arrays"
+			<< (modelInterleaved->getVirtualTexture() ? ", and a virtual texture" : "") << std::endl;
+	}
+	getModelArray()->bind();
+	indices->bind();
 	CHECK_GL_ERROR();
 
-	active_program->setAttributePointer("in_Position", 3 , GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_POSITION);
-	active_program->setAttributePointer("in_Normal", 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_NORMAL);
-	active_program->setAttributePointer("in_Texture_Coords", 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_TEX_COORD);
+	SkinnedMesh* skinned = getSkinnedMesh();
+	if (skinned != NULL)
+		skinned->setMode(skinning_mode);
+	setAttributePointers(active_program);
 	CHECK_GL_ERROR();
 
-	//Unbind VBOs and VAO
-	vertices->unbind(); //Unbinds both vertices and normals
-	glBindVertexArray(0);
+	//Unbind the VAO before the VBOs, so that the VAO keeps its index buffer
+	vao.unbind();
+	getModelArray()->unbind();
+	indices->unbind();
 	CHECK_GL_ERROR();
 }
 
+void GameManager::bindPrepass() {
+	std::shared_ptr<VBO> positions = modelInterleaved->getPositions();
+	std::shared_ptr<VBO> indices = modelInterleaved->getIndices();
+
+	prepass_vao.create();
+	prepass_vao.bind();
+	positions->bind();
+	indices->bind();
+	prepass_program->setAttributePointer("in_Position", 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+	prepass_vao.unbind();
+	positions->unbind();
+	indices->unbind();
+	CHECK_GL_ERROR();
+}
+
+void GameManager::bindFeedback() {
+	std::shared_ptr<VBO> interleaved = modelInterleaved->getArray();
+	std::shared_ptr<VBO> indices = modelInterleaved->getIndices();
+
+	feedback_vao.create();
+	feedback_vao.bind();
+	interleaved->bind();
+	indices->bind();
+	feedback_program->setAttributePointer("in_Position", 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_POSITION);
+	feedback_program->setAttributePointer("in_Texture_Coords", 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_TEX_COORD);
+
+	feedback_vao.unbind();
+	interleaved->unbind();
+	indices->unbind();
+	CHECK_GL_ERROR();
+}
+
+void GameManager::swapModel(const std::string& filename, std::shared_ptr<ModelInterleavedArray> loaded) {
+	vao.reset();
+	prepass_vao.reset();
+	feedback_vao.reset();
+	streamingModel.reset();
+	model.reset();
+	modelInterleaved = loaded;
+	model_to_load = filename;
+	bindModel();
+	redraw = true;
+}
+
+MeshPart& GameManager::getMesh() {
+	if (streamingModel) return streamingModel->getMesh();
+	if (model) return model->getMesh();
+	return modelInterleaved->getMesh();
+}
+
+std::shared_ptr<VBO> GameManager::getModelArray() {
+	if (streamingModel) return streamingModel->getArray();
+	if (model) return model->getArray();
+	return modelInterleaved->getArray();
+}
+
+void GameManager::setAttributePointers(std::shared_ptr<Program>& program) {
+	//Skinned models read their vertices from buffers of their own
+	SkinnedMesh* skinned = getSkinnedMesh();
+	if (skinned != NULL) {
+		skinned->setAttributePointers(*program, *getModelArray());
+		return;
+	}
+
+	//Assumes the VAO and the interleaved array are bound
+	program->setAttributePointer("in_Position", 3 , GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_POSITION);
+	program->setAttributePointer("in_Normal", 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_NORMAL);
+	program->setAttributePointer("in_Texture_Coords", 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_TEX_COORD);
+}
+
+void GameManager::reloadModel() {
+	residency.erase(model_to_load);
+	vao.reset();
+	prepass_vao.reset();
+	feedback_vao.reset();
+	modelInterleaved.reset();
+	streamingModel.reset();
+	model.reset();
+	createVAO();
+	GLUtils::MemoryLedger::get().print();
+	redraw = true;
+}
+
+void GameManager::addModel(const std::string& filename) {
+	models.push_back(filename);
+}
+
+void GameManager::nextModel() {
+	if (models.size() < 2) {
+		std::cout << "Give several models on the command line to switch between them" << std::endl;
+		return;
+	}
+	model_index = (model_index + 1) % models.size();
+	const std::string& filename = models[model_index];
+	if (isStreamFile(filename) || legacy_model) {
+		//Stream files are drawn while they load anyway, and Model only loads synchronously
+		model_to_load = filename;
+		reloadModel();
+	} else {
+		//Models still on the GPU are swapped in right away
+		std::shared_ptr<ModelInterleavedArray> resident = residency.find(filename);
+		if (resident)
+			swapModel(filename, resident);
+		else
+			asset_manager.requestModel(filename);
+	}
+}
+
+/* * *
+* The ledger only knows what our handles told it, so the free video memory
+* of the driver and the private bytes of the process are sampled after
+* every reload as well. Those go up and down by tens of MiB as the heaps of
+* the allocator and the driver grow and shrink (66-91 MiB on llvmpipe, with
+* no trend), while a leak raises the lows, so the lowest use in the first
+* and the second half of the reloads are compared, after the first reload.
+* */
+bool GameManager::reloadTest(unsigned int iterations) {
+	GLUtils::MemoryLedger& ledger = GLUtils::MemoryLedger::get();
+	ledger.print();
+	long long bytes = ledger.getTotalBytes();
+	long long objects[GLUtils::MemoryLedger::LEDGER_TYPES];
+	for (int i=0; i<GLUtils::MemoryLedger::LEDGER_TYPES; ++i)
+		objects[i] = ledger.getObjects(static_cast<GLUtils::MemoryLedger::ObjectType>(i));
+
+	//Lowest use in the first and the second half, -1 if not reported
+	long long driver_used[2] = { -1, -1 };
+	long long process_used[2] = { -1, -1 };
+	unsigned int half = (iterations + 1) / 2;
+	for (unsigned int i=0; i<iterations; ++i) {
+		vao.reset();
+		modelInterleaved.reset();
+		streamingModel.reset();
+		model.reset();
+		createVAO();
+		if (i == 0)
+			continue;
+		glFinish();
+		long long driver_free = GLUtils::MemoryLedger::getDriverFreeBytes();
+		long long process_bytes = GLUtils::MemoryLedger::getProcessBytes();
+		long long& driver = driver_used[i >= half];
+		long long& process = process_used[i >= half];
+		//Less free memory is more use
+		if (driver_free >= 0)
+			driver = (driver < 0) ? -driver_free : std::min(driver, -driver_free);
+		if (process_bytes >= 0)
+			process = (process < 0) ? process_bytes : std::min(process, process_bytes);
+	}
+	glFinish();
+	ledger.print();
+
+	bool flat = (ledger.getTotalBytes() == bytes);
+	for (int i=0; i<GLUtils::MemoryLedger::LEDGER_TYPES; ++i)
+		flat = flat && (objects[i] == ledger.getObjects(static_cast<GLUtils::MemoryLedger::ObjectType>(i)));
+
+	if (iterations < reload_test_min_iterations) {
+		std::cout << "Driver and process memory: not checked, needs at least " << reload_test_min_iterations << " reloads" << std::endl;
+	}
+	else {
+		if (driver_used[0] != -1) {
+			long long growth = driver_used[1] - driver_used[0];
+			std::cout << "Driver video memory grew by " << growth / 1024 << " KiB" << std::endl;
+			flat = flat && (growth <= reload_tolerance);
+		}
+		else {
+			std::cout << "Driver video memory: not reported (no GL_NVX_gpu_memory_info or GL_ATI_meminfo)" << std::endl;
+		}
+		if (process_used[0] != -1) {
+			long long growth = process_used[1] - process_used[0];
+			std::cout << "Process private memory grew by " << growth / 1024 << " KiB (lowest "
+				<< process_used[0] / 1024 << " KiB in the first half)" << std::endl;
+			flat = flat && (growth <= reload_tolerance);
+		}
+	}
+	std::cout << "Reloaded model " << iterations << " times, GPU memory " << (flat ? "flat" : "LEAKED") << std::endl;
+	return flat;
+}
+
+/* * *
+* The model is imported, its textures decoded and its BVH built on a worker
+* thread while the window, the context and the programs are created, and the
+* main thread only waits for it where it has to be uploaded. Stream files
+* and the legacy Model class load on the main thread as before.
+* */
 void GameManager::init() {
-	// Initialize SDL
-	if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
+	//Declared first, so that the worker is joined before they go away on exceptions
+	MeshData data;
+	std::vector<MipChain> images;
+	std::shared_ptr<MeshBVH> bvh;
+	glm::vec3 min_position, max_position;
+	StartupScheduler startup;
+
+	//DevIL needs neither the window nor the context, and decodes on the worker
+	ilInit();
+	iluInit();
+	ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+	ilEnable(IL_ORIGIN_SET);
+
+	bool background = !isStreamFile(model_to_load) && !legacy_model;
+	if (background) {
+		startup.start("import model", [&]() {
+			ModelInterleavedArray::loadMeshData(model_to_load, data, LOADER_AUTO, import_profile);
+			startup.begin("decode textures");
+			images.resize(data.textures.size());
+			parallelFor(static_cast<unsigned int>(images.size()), [&](unsigned int i) {
+				if (!data.textures[i].empty() && !Texture2D::decode(data.textures[i], images[i]))
+					images[i].levels.clear(); //< Drawn white, like a missing texture file
+			});
+			startup.begin("build BVH");
+			bvh = MeshBVH::create(data, asset_manager.getCacheDirectory());
+			ModelInterleavedArray::getBounds(data.vertices, min_position, max_position);
+		});
+	}
+
+	// Initialize SDL, only what we use: events come with video
+	startup.begin("SDL init");
+	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
 		std::stringstream err;
 		err << "Could not initialize SDL: " << SDL_GetError();
 		THROW_EXCEPTION(err.str());
 	}
 	atexit( SDL_Quit);
 
+	startup.begin("window and context");
 	createOpenGLContext();
 	setOpenGLStates();
 	createMatrices();
+	startup.begin("shader programs");
 	createSimpleProgram();
-	createVAO();
+
+	if (background) {
+		startup.join("import model");
+		startup.begin("upload model");
+		modelInterleaved.reset(new ModelInterleavedArray(std::move(data), std::move(images), min_position, max_position, bvh));
+		residency.insert(model_to_load, modelInterleaved);
+		bindModel();
+	} else {
+		startup.begin("load model");
+		createVAO();
+	}
+	if (software_rendering)
+		setSoftwareRendering(true);
+
+	if (!point_file.empty()) {
+		startup.begin("load point cloud");
+		loadPointCloud();
+	}
+
+	startup.begin("shader watcher");
+	shader_watcher.start("shaders/");
+	startup.end();
+	startup.print();
 }
 
 void GameManager::renderMeshRecursive(
@@ -169,37 +561,164 @@ void GameManager::renderMeshRecursive(
 				const std::shared_ptr<Program>& program, 
 				const glm::mat4& view_matrix, 
 				const glm::mat4& model_matrix,
-				glm::vec3 color) {
+				glm::vec3 color,
+				const MaterialTextures* materials,
+				unsigned int array,
+				unsigned int base_vertex,
+				const MeshPart* selected) {
 
 	//Create modelview matrix
 	glm::mat4 meshpart_model_matrix = model_matrix * mesh.transform;
 	glm::mat4 modelview_matrix = view_matrix * meshpart_model_matrix;
+
+	//Parts with their texture in other arrays are drawn in the pass of that array
+	MaterialSlot slot;
+	if (materials != NULL)
+		slot = materials->getSlot(mesh.material);
+	else
+		slot.layer = 0;
+
+	if (slot.array == array) {
+		glUniformMatrix4fv(program->getUniform("modelview_matrix"), 1, 0, glm::value_ptr(modelview_matrix));
+		glUniform1i(program->getUniform("virtual_texture"), slot.paged ? 1 : 0);
+
+		//Create normal matrix, the transpose of the inverse
+		//3x3 leading submatrix of the modelview matrix
+		glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(modelview_matrix)));
+		glUniformMatrix3fv(program->getUniform("normal_matrix"), 1, 0, glm::value_ptr(normal_matrix));
+		glm::vec3 part_color = (&mesh == selected) ? selection_color : color;
+		glUniform3f(program->getUniform("color"), part_color.r, part_color.g, part_color.b);
+		glUniform1f(program->getUniform("texture_layer"), static_cast<float>(slot.layer));
+
+		glDrawElementsBaseVertex( GL_TRIANGLES, 
+								mesh.count, 
+								GL_UNSIGNED_INT, 
+								(void*)(sizeof(unsigned int) * (mesh.first)),
+								mesh.vertexCount + base_vertex );
+	}
+
+	for (unsigned int i = 0; i < mesh.children.size(); ++i)
+		renderMeshRecursive(mesh.children.at(i), program, view_matrix, meshpart_model_matrix, color, materials, array, base_vertex, selected);
+}
+
+/* * *
+* The parts are drawn once per texture array, each pass drawing the parts
+* whose texture is in that array. Most models have one array, which
+* bindModel binds, so they are drawn without binding textures at all.
+* */
+void GameManager::renderMesh(glm::vec3 color) {
+	MaterialTextures* materials = (streamingModel || model) ? NULL : &modelInterleaved->getMaterials();
+
+	//Samplers of different types may not share a unit, so the virtual texture has its own also without one
+	VirtualTexture* virtual_texture = getVirtualTexture();
+	if (virtual_texture != NULL) {
+		virtual_texture->bind(*active_program, virtual_texture_unit);
+	} else {
+		glUniform1i(active_program->getUniform("vt_cache"), virtual_texture_unit);
+		glUniform1i(active_program->getUniform("vt_table"), virtual_texture_unit + 1);
+	}
+
+	//The vertices skinned on the CPU are in this frame's region of the streaming buffer
+	SkinnedMesh* skinned = getSkinnedMesh();
+	unsigned int base_vertex = 0;
+	if (skinned != NULL) {
+		skinned->bind(*active_program, bone_texture_unit);
+		base_vertex = skinned->getBaseVertex();
+	} else {
+		glUniform1i(active_program->getUniform("skinning"), 0);
+		glUniform1i(active_program->getUniform("bone_matrices"), bone_texture_unit);
+	}
+
+	unsigned int arrays = (materials != NULL) ? std::max(1u, materials->getArrayCount()) : 1;
+	for (unsigned int a = 0; a < arrays; ++a) {
+		if (arrays > 1)
+			materials->bind(a);
+		renderMeshRecursive(getMesh(), active_program, getNewViewMatrix(), model_matrix, color, materials, a, base_vertex, selected_part);
+	}
+}
+
+void GameManager::renderDepthRecursive(
+				MeshPart& mesh,
+				const std::shared_ptr<Program>& program,
+				const glm::mat4& view_matrix,
+				const glm::mat4& model_matrix,
+				const MaterialTextures* materials) {
+
+	//The same matrices as renderMeshRecursive, so that the depths are equal
+	glm::mat4 meshpart_model_matrix = model_matrix * mesh.transform;
+	glm::mat4 modelview_matrix = view_matrix * meshpart_model_matrix;
 	glUniformMatrix4fv(program->getUniform("modelview_matrix"), 1, 0, glm::value_ptr(modelview_matrix));
+	if (materials != NULL)
+		glUniform1i(program->getUniform("virtual_texture"), materials->getSlot(mesh.material).paged ? 1 : 0);
 
-	//Create normal matrix, the transpose of the inverse
-	//3x3 leading submatrix of the modelview matrix
-	glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(modelview_matrix)));
-	glUniformMatrix3fv(program->getUniform("normal_matrix"), 1, 0, glm::value_ptr(normal_matrix));
-	glUniform3f(program->getUniform("color"), color.r, color.g, color.b);
-	
-	glDrawElementsBaseVertex( GL_TRIANGLES, 
-							mesh.count, 
-							GL_UNSIGNED_INT, 
+	glDrawElementsBaseVertex( GL_TRIANGLES,
+							mesh.count,
+							GL_UNSIGNED_INT,
 							(void*)(sizeof(unsigned int) * (mesh.first)),
 							mesh.vertexCount );
 
 	for (unsigned int i = 0; i < mesh.children.size(); ++i)
-		renderMeshRecursive(mesh.children.at(i), program, view_matrix, meshpart_model_matrix, color);
+		renderDepthRecursive(mesh.children.at(i), program, view_matrix, meshpart_model_matrix, materials);
+}
+
+VirtualTexture* GameManager::getVirtualTexture() {
+	return modelInterleaved ? modelInterleaved->getVirtualTexture() : NULL;
+}
+
+SkinnedMesh* GameManager::getSkinnedMesh() {
+	return modelInterleaved ? modelInterleaved->getSkinnedMesh() : NULL;
+}
+
+/* * *
+* The feedback is drawn at a fraction of the window with the matrices of
+* the frame, before it, and read back by VirtualTexture::update a few
+* frames later. Parts with other textures are drawn too, as they occlude.
+* */
+void GameManager::renderFeedback(VirtualTexture& virtual_texture) {
+	if (!feedback_vao.valid())
+		bindFeedback();
+	std::shared_ptr<Program> program = active_program;
+	ChangeToProgram(feedback_program);
+	virtual_texture.bindFeedback(*active_program);
+	feedback_vao.bind();
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+	virtual_texture.beginFeedback(window_width, window_height);
+	renderDepthRecursive(getMesh(), active_program, getNewViewMatrix(), model_matrix, &modelInterleaved->getMaterials());
+	virtual_texture.endFeedback();
+
+	glViewport(0, 0, window_width, window_height);
+	feedback_vao.unbind();
+	ChangeToProgram(program);
 }
 
 void GameManager::render() {
+	if (software_rendering) {
+		renderSoftware();
+		return;
+	}
+
+	VirtualTexture* virtual_texture = getVirtualTexture();
+	if (virtual_texture != NULL)
+		renderFeedback(*virtual_texture);
+
+	//One pose per frame, which every pass of the frame draws
+	SkinnedMesh* skinned = getSkinnedMesh();
+	if (skinned != NULL) {
+		skinned->update(animation_timer.elapsedAndRestart());
+		skinned->beginDraw();
+	}
+
+	if (dynamic_resolution.isEnabled())
+		dynamic_resolution.beginFrame();
+
 	//Clear screen, and set the correct program
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	active_program->use();
 
 	//Render geometry
-	glBindVertexArray(vao);
+	vao.bind();
 	switch(rendermode)
 	{
 	case RENDERMODE_WIREFRAME:
@@ -214,27 +733,525 @@ void GameManager::render() {
 	case RENDERMODE_PHONG:
 		renderPhong(model_color);
 		break;
+	case RENDERMODE_POINTS:
+		renderPoints(model_color);
+		break;
+	}
+	vao.unbind();
+	if (skinned != NULL)
+		skinned->endDraw();
+
+	if (dynamic_resolution.isEnabled()) {
+		dynamic_resolution.endFrame(*upscale_program, upscale_texture_unit);
+		active_program->use();
+	}
+	CHECK_GL_ERROR();
+}
+
+void GameManager::setSoftwareRendering(bool enabled) {
+	software_rendering = enabled;
+	if (!main_context)
+		return; //< Set up by init, once the model is loaded
+
+	if (!enabled || !modelInterleaved) {
+		if (enabled)
+			std::cout << "The software rasterizer needs a model loaded with ModelInterleavedArray, rendering with OpenGL" << std::endl;
+		software_rendering = false;
+		rasterizer.reset();
+		software_model.clear();
+		software_framebuffer.reset();
+		software_texture.reset();
+		return;
+	}
+	if (rasterizer)
+		return;
+
+	rasterizer.reset(new SoftwareRasterizer(window_width, window_height));
+
+	//On its own texture unit, so that the model texture stays bound to unit 0
+	glActiveTexture(GL_TEXTURE1);
+	software_texture.create(GL_TEXTURE_2D);
+	software_texture.bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, window_width, window_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	software_texture.setBytes(window_width*window_height*4);
+	glActiveTexture(GL_TEXTURE0);
+
+	software_framebuffer.create();
+	software_framebuffer.bind(GL_READ_FRAMEBUFFER);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, software_texture.name(), 0);
+	if (glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		THROW_EXCEPTION("The software rasterizer framebuffer is incomplete");
+	GLUtils::FramebufferHandle::unbind(GL_READ_FRAMEBUFFER);
+	CHECK_GL_ERROR();
+
+	std::cout << "Rendering with the software rasterizer on " << getThreadCount() << " threads" << std::endl;
+}
+
+void GameManager::updateSoftwareMesh() {
+	if (software_model == model_to_load)
+		return;
+	if (!modelInterleaved) {
+		setSoftwareRendering(true); //< Falls back to OpenGL
+		return;
+	}
+
+	Timer timer;
+	rasterizer->setMesh(modelInterleaved->getMesh(), modelInterleaved->getHostVertices(),
+		modelInterleaved->getHostIndices(), modelInterleaved->getHostImages());
+	software_model = model_to_load;
+	std::cout << "Gave " << model_to_load << " to the software rasterizer in " << timer.elapsed()*1000.0 << " ms" << std::endl;
+}
+
+void GameManager::renderSoftware() {
+	updateSoftwareMesh();
+	if (!rasterizer)
+		return;
+
+	rasterizer->render(projection_matrix, getNewViewMatrix(), model_matrix, rendermode, model_color, background_color);
+
+	Timer timer;
+	glActiveTexture(GL_TEXTURE1);
+	software_texture.bind();
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, window_width, window_height, GL_RGBA, GL_UNSIGNED_BYTE, rasterizer->getColorBuffer());
+	glActiveTexture(GL_TEXTURE0);
+	software_framebuffer.bind(GL_READ_FRAMEBUFFER);
+	glBlitFramebuffer(0, 0, window_width, window_height, 0, 0, window_width, window_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	GLUtils::FramebufferHandle::unbind(GL_READ_FRAMEBUFFER);
+	CHECK_GL_ERROR();
+
+	const RasterStats& stats = rasterizer->getStats();
+	software_stats.transform += stats.transform;
+	software_stats.bin += stats.bin;
+	software_stats.raster += stats.raster;
+	software_stats.triangles += stats.triangles;
+	software_stats.culled += stats.culled;
+	software_stats.clipped += stats.clipped;
+	software_stats.binned += stats.binned;
+	software_stats.fragments += stats.fragments;
+	software_present_time += timer.elapsed();
+	++software_frames;
+}
+
+void GameManager::benchmarkRasterizers(unsigned int frames) {
+	static const char* names[] = { "flat", "phong", "wireframe", "hidden line" };
+	static const RenderMode modes[] = { RENDERMODE_FLAT, RENDERMODE_PHONG, RENDERMODE_WIREFRAME, RENDERMODE_HIDDENLINE };
+	bool was_software = software_rendering;
+	RenderMode was_mode = rendermode;
+
+	//Frames are finished but not swapped, so that vsync does not limit them
+	std::cout << "OpenGL renderer: " << glGetString(GL_RENDERER) << ", software rasterizer: " << getThreadCount() << " threads" << std::endl;
+	for (unsigned int backend = 0; backend < 2; ++backend) {
+		setSoftwareRendering(backend == 1);
+		if (backend == 1 && !software_rendering)
+			break;
+		for (unsigned int m = 0; m < 4; ++m) {
+			rendermode = modes[m];
+			render();
+			glFinish();
+			Timer timer;
+			for (unsigned int i = 0; i < frames; ++i) {
+				render();
+				glFinish();
+			}
+			std::cout << (backend == 0 ? "OpenGL " : "Software ") << names[m] << ": "
+				<< timer.elapsed() / frames * 1000.0 << " ms/frame" << std::endl;
+		}
+	}
+
+	rendermode = was_mode;
+	setSoftwareRendering(was_software);
+	software_stats = RasterStats();
+	software_present_time = 0.0;
+	software_frames = 0;
+}
+
+/* * *
+* A wave runs over the grid, and every frame writes all of its vertices
+* into the region of the frame, on all cores, like a mesh deformed on the
+* CPU. The frames are swapped without vsync and without waiting for the
+* GPU, so the fences only stall if the GPU falls more than two frames behind.
+* * */
+void GameManager::benchmarkStreaming(unsigned int frames) {
+	const unsigned int side = stream_grid_side;
+	const unsigned int vertex_count = side * side;
+	std::vector<unsigned int> grid_indices;
+	grid_indices.reserve((side - 1) * (side - 1) * 6);
+	for (unsigned int y = 0; y + 1 < side; ++y) {
+		for (unsigned int x = 0; x + 1 < side; ++x) {
+			unsigned int i = y * side + x;
+			unsigned int quad[6] = { i, i + 1, i + side, i + 1, i + side + 1, i + side };
+			grid_indices.insert(grid_indices.end(), quad, quad + 6);
+		}
+	}
+
+	GLUtils::DynamicBuffer stream(vertex_count * sizeof(VertexData));
+	VBO grid_buffer(grid_indices.data(), grid_indices.size() * sizeof(unsigned int), GL_ELEMENT_ARRAY_BUFFER);
+	GLUtils::VertexArrayHandle grid_vao;
+	grid_vao.create();
+	grid_vao.bind();
+	stream.bind();
+	grid_buffer.bind();
+	ChangeToProgram(flat_program);
+	active_program->setAttributePointer("in_Position", 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_POSITION);
+	active_program->setAttributePointer("in_Normal", 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_NORMAL);
+	active_program->setAttributePointer("in_Texture_Coords", 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_TEX_COORD);
+	grid_vao.unbind();
+	stream.unbind();
+	grid_buffer.unbind();
+
+	glm::mat4 modelview = getNewViewMatrix() * model_matrix * glm::translate(glm::mat4(1.0f), glm::vec3(-0.5f, -0.5f, 0.0f));
+	glm::mat3 grid_normal_matrix = glm::transpose(glm::inverse(glm::mat3(modelview)));
+	glUniformMatrix4fv(active_program->getUniform("modelview_matrix"), 1, 0, glm::value_ptr(modelview));
+	glUniformMatrix3fv(active_program->getUniform("normal_matrix"), 1, 0, glm::value_ptr(grid_normal_matrix));
+	glUniform3f(active_program->getUniform("color"), model_color.r, model_color.g, model_color.b);
+	glUniform1f(active_program->getUniform("texture_layer"), -1.0f);
+	glUniform1i(active_program->getUniform("virtual_texture"), 0);
+	glUniform1i(active_program->getUniform("vt_cache"), virtual_texture_unit);
+	glUniform1i(active_program->getUniform("vt_table"), virtual_texture_unit + 1);
+	glUniform1i(active_program->getUniform("skinning"), 0);
+	glUniform1i(active_program->getUniform("bone_matrices"), bone_texture_unit);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	glDisable(GL_CULL_FACE);
+	if (main_context)
+		SDL_GL_SetSwapInterval(0);
+
+	std::cout << "OpenGL renderer: " << glGetString(GL_RENDERER) << ", " << (stream.isPersistent() ? "persistently mapped"
+		: "unsynchronized glMapBufferRange") << ", " << vertex_count << " vertices per frame" << std::endl;
+	unsigned long long bytes = 0;
+	unsigned int most_stalls = 0;
+	unsigned int stalls = stream.getStalls();
+	double write_time = 0.0;
+	Timer timer;
+	for (unsigned int f = 0; f < frames; ++f) {
+		Timer write_timer;
+		float phase = 0.1f * f;
+		unsigned int offset;
+		VertexData* destination = static_cast<VertexData*>(stream.map(vertex_count * sizeof(VertexData), offset));
+		parallelFor(side, [&](unsigned int y) {
+			for (unsigned int x = 0; x < side; ++x) {
+				float u = x / static_cast<float>(side - 1);
+				float v = y / static_cast<float>(side - 1);
+				float wave = 12.0f * (u + v) + phase;
+				float slope = 0.05f * 12.0f * std::cos(wave);
+				//One whole vertex at a time, the mapping may be write combined
+				VertexData vertex;
+				vertex.position = glm::vec3(u, v, 0.05f * std::sin(wave));
+				vertex.normal = glm::normalize(glm::vec3(-slope, -slope, 1.0f));
+				vertex.tex_coords = glm::vec2(u, v);
+				destination[y * side + x] = vertex;
+			}
+		});
+		stream.unmap();
+		write_time += write_timer.elapsed();
+
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		grid_vao.bind();
+		glDrawElementsBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(grid_indices.size()), GL_UNSIGNED_INT, NULL,
+			offset / sizeof(VertexData));
+		grid_vao.unbind();
+		stream.endFrame();
+		if (main_window)
+			SDL_GL_SwapWindow(main_window);
+
+		bytes += stream.getLastFrameBytes();
+		most_stalls = std::max(most_stalls, stream.getLastFrameStalls());
 	}
-	glBindVertexArray(0);
+	glFinish();
+	double elapsed = timer.elapsed();
 	CHECK_GL_ERROR();
+
+	double n = std::max(1u, frames);
+	std::cout << "Streaming: " << elapsed / n * 1000.0 << " ms/frame, writing " << write_time / n * 1000.0 << " ms/frame, "
+		<< bytes / n / (1024.0*1024.0) << " MiB/frame (" << bytes / write_time / (1024.0*1024.0*1024.0) << " GiB/s written), "
+		<< stream.getStalls() - stalls << " stalls in " << frames << " frames (at most " << most_stalls << " per frame)" << std::endl;
+
+	glEnable(GL_CULL_FACE);
+	setSwapInterval(swap_interval);
+}
+
+void GameManager::setDynamicResolution(double target, UpscaleFilter filter, float min_scale, float max_scale) {
+	dynamic_resolution.setBounds(min_scale, max_scale);
+	dynamic_resolution.setFilter(filter);
+	dynamic_resolution.setTarget(target);
+	if (target > 0.0)
+		std::cout << "Dynamic resolution: " << target * 1000.0 << " ms GPU time per frame, scale "
+			<< min_scale << " to " << max_scale << ", " << DynamicResolution::getFilterName(filter) << " upscaling" << std::endl;
+	else
+		std::cout << "Dynamic resolution: off" << std::endl;
+}
+
+void GameManager::setDepthPrepass(PrepassMode mode) {
+	prepass.setMode(mode);
+	std::cout << "Depth pre-pass: " << DepthPrepass::getModeName(mode) << std::endl;
+}
+
+void GameManager::setSkinningMode(SkinningMode mode) {
+	skinning_mode = mode;
+	std::cout << "Skinning: " << SkinnedMesh::getModeName(mode) << std::endl;
+	SkinnedMesh* skinned = getSkinnedMesh();
+	if (skinned == NULL || !vao.valid())
+		return; //< Set by bindModel
+
+	skinned->setMode(mode);
+	vao.bind();
+	setAttributePointers(active_program);
+	vao.unbind();
+	redraw = true;
+}
+
+void GameManager::setCaptureDirectory(const std::string& directory) {
+	capture.setDirectory(directory);
+}
+
+void GameManager::setRecording(bool enabled) {
+	capture.setRecording(enabled);
+}
+
+void GameManager::setScreenshotFrame(unsigned int frame) {
+	screenshot_frame = frame;
+}
+
+void GameManager::setPointCloud(const std::string& filename, unsigned long long point_budget) {
+	point_file = filename;
+	this->point_budget = point_budget;
+	if (main_context)
+		loadPointCloud();
+}
+
+void GameManager::loadPointCloud() {
+	std::string filename = point_file;
+	if (!PointOctree::isPointCloudFile(filename)) {
+		//PLY files with faces are meshes, for the model loaders
+		if (!PointReader::isPointFile(filename))
+			THROW_EXCEPTION(filename + " is not a point cloud: a .pgp or .xyz file, or a .ply file without faces");
+		filename = PointOctree::getCachedFile(filename, asset_manager.getCacheDirectory());
+	}
+	point_cloud.reset(new PointCloud(filename, point_budget));
+	rendermode = RENDERMODE_POINTS;
+	redraw = true;
+}
+
+void GameManager::setLightCount(unsigned int count) {
+	//The same lights every run, so that benchmarks can be compared
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> position(-light_extent, light_extent);
+	std::uniform_real_distribution<float> speed(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> hue(0.0f, 6.0f);
+
+	lights.clear();
+	light_origins.clear();
+	light_speeds.clear();
+	for (unsigned int i = 0; i < count; ++i) {
+		PointLight light;
+		light.position = glm::vec3(position(random), position(random), position(random));
+		light.radius = light_radius;
+		float h = hue(random);
+		light.color = glm::vec3(glm::clamp(std::fabs(h - 3.0f) - 1.0f, 0.0f, 1.0f),
+			glm::clamp(2.0f - std::fabs(h - 2.0f), 0.0f, 1.0f),
+			glm::clamp(2.0f - std::fabs(h - 4.0f), 0.0f, 1.0f));
+		light.padding = 0.0f;
+		lights.add(light);
+		light_origins.push_back(light.position);
+		light_speeds.push_back(speed(random));
+	}
+	std::cout << "Lights: " << count << std::endl;
+}
+
+void GameManager::updateLights() {
+	float time = static_cast<float>(my_timer.elapsed());
+	std::vector<PointLight>& point_lights = lights.getLights();
+	for (unsigned int i = 0; i < point_lights.size(); ++i) {
+		float angle = light_speeds[i] * time;
+		float c = std::cos(angle), s = std::sin(angle);
+		const glm::vec3& origin = light_origins[i];
+		point_lights[i].position = glm::vec3(c*origin.x + s*origin.z, origin.y, c*origin.z - s*origin.x);
+	}
+}
+
+void GameManager::benchmarkLights(unsigned int frames) {
+	static const unsigned int counts[] = { 1, 10, 100, 1000, 10000 };
+	bool was_software = software_rendering;
+	RenderMode was_mode = rendermode;
+	unsigned int was_count = static_cast<unsigned int>(light_origins.size());
+	setSoftwareRendering(false);
+	rendermode = RENDERMODE_PHONG;
+
+	//Frames are finished but not swapped, so that vsync does not limit them
+	std::cout << "OpenGL renderer: " << glGetString(GL_RENDERER) << ", " << ClusteredLights::tiles_x << "x"
+		<< ClusteredLights::tiles_y << "x" << ClusteredLights::slices << " clusters" << std::endl;
+	for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		setLightCount(counts[c]);
+		updateLights();
+		render();
+		glFinish();
+
+		double assign = 0.0, upload = 0.0;
+		unsigned long long visible = 0, indices = 0, occupied = 0;
+		unsigned int max_per_cluster = 0;
+		Timer timer;
+		for (unsigned int i = 0; i < frames; ++i) {
+			updateLights();
+			render();
+			glFinish();
+			const ClusterStats& stats = lights.getStats();
+			assign += stats.assign;
+			upload += stats.upload;
+			visible += stats.visible;
+			indices += stats.indices;
+			occupied += stats.occupied;
+			max_per_cluster = std::max(max_per_cluster, stats.max_per_cluster);
+		}
+		double n = frames;
+		std::cout << counts[c] << " lights: " << timer.elapsed() / n * 1000.0 << " ms/frame, assign "
+			<< assign / n * 1000.0 << " ms, upload " << upload / n * 1000.0 << " ms, " << visible / n
+			<< " visible, " << ((occupied > 0) ? indices / static_cast<double>(occupied) : 0.0)
+			<< " lights per occupied cluster (max " << max_per_cluster << ")" << std::endl;
+	}
+
+	setLightCount(was_count);
+	rendermode = was_mode;
+	setSoftwareRendering(was_software);
+}
+
+/* * *
+* Draws with both skinning paths. The GPU draw time of the CPU path is
+* the cost of drawing the skinned vertices, so the GPU path costs the
+* difference on top of it for the skinning in the vertex shaders.
+* */
+void GameManager::benchmarkSkinning(unsigned int frames) {
+	SkinnedMesh* skinned = getSkinnedMesh();
+	if (skinned == NULL) {
+		std::cout << "The model has no bones to skin" << std::endl;
+		return;
+	}
+	bool was_software = software_rendering;
+	SkinningMode was_mode = skinning_mode;
+	setSoftwareRendering(false);
+
+	//Frames are finished but not swapped, so that vsync does not limit them
+	std::cout << "OpenGL renderer: " << glGetString(GL_RENDERER) << ", " << skinned->getVertexCount()
+		<< " skinned vertices, " << getThreadCount() << " threads" << std::endl;
+	static const SkinningMode modes[] = { SKINNING_CPU, SKINNING_GPU };
+	double gpu_per_vertex[2] = { 0.0, 0.0 };
+	for (unsigned int m = 0; m < 2; ++m) {
+		setSkinningMode(modes[m]);
+		render();
+		glFinish();
+		skinned->resetStats();
+
+		Timer timer;
+		for (unsigned int i = 0; i < frames; ++i) {
+			render();
+			glFinish();
+		}
+		double elapsed = timer.elapsed();
+
+		SkinningStats stats = skinned->getStats();
+		double n = frames;
+		std::cout << SkinnedMesh::getModeName(modes[m]) << ": " << elapsed / n * 1000.0 << " ms/frame, animate "
+			<< stats.animate_time / n * 1000.0 << " ms, upload " << stats.upload_time / n * 1000.0 << " ms";
+		if (stats.vertices > 0)
+			std::cout << ", skin " << stats.skin_time / n * 1000.0 << " ms (" << 1.0e9 * stats.skin_time / stats.vertices
+				<< " ns per vertex on the CPU, " << stats.stalls << " stalls)";
+		if (stats.gpu_vertices > 0) {
+			gpu_per_vertex[m] = 1.0e9 * stats.gpu_time / stats.gpu_vertices;
+			std::cout << ", GPU draw " << gpu_per_vertex[m] << " ns per vertex";
+		}
+		std::cout << std::endl;
+	}
+	std::cout << "GPU skinning: " << gpu_per_vertex[1] - gpu_per_vertex[0] << " ns per vertex on the GPU" << std::endl;
+
+	setSkinningMode(was_mode);
+	setSoftwareRendering(was_software);
+}
+
+void GameManager::setSwapInterval(int interval) {
+	swap_interval = interval;
+	if (!main_context)
+		return;
+
+	if (SDL_GL_SetSwapInterval(swap_interval) < 0) {
+		if (swap_interval == -1) {
+			std::cout << "Adaptive vsync not supported, using vsync: " << SDL_GetError() << std::endl;
+			swap_interval = 1;
+			SDL_GL_SetSwapInterval(swap_interval);
+		} else {
+			std::cout << "Unable to set swap interval " << swap_interval << ": " << SDL_GetError() << std::endl;
+		}
+	}
+	std::cout << "Swap interval: " << swap_interval << std::endl;
+}
+
+void GameManager::setTargetFrameRate(double fps) {
+	frame_limiter.setTargetFrameRate(fps);
+	std::cout << "Target frame rate: ";
+	if (fps > 0.0) std::cout << fps << std::endl;
+	else std::cout << "unlimited" << std::endl;
+}
+
+void GameManager::setIdleRendering(bool enabled) {
+	idle_rendering = enabled;
+	redraw = true;
+	std::cout << "Idle rendering: " << (idle_rendering ? "on" : "off") << std::endl;
+}
+
+void GameManager::setProgramCacheEnabled(bool enabled) {
+	program_cache.setEnabled(enabled);
+}
+
+void GameManager::setStreamingMemoryCap(size_t bytes) {
+	stream_memory_cap = bytes;
+}
+
+void GameManager::setLegacyModel(bool enabled, float weld_epsilon, float normal_epsilon, float tex_coord_epsilon) {
+	legacy_model = enabled;
+	this->weld_epsilon = weld_epsilon;
+	weld_normal_epsilon = normal_epsilon;
+	weld_tex_coord_epsilon = tex_coord_epsilon;
+}
+
+void GameManager::setGpuBudget(long long bytes) {
+	residency.setBudget(bytes);
+}
+
+void GameManager::setImportProfile(ImportProfile profile) {
+	import_profile = profile;
+	asset_manager.setImportProfile(profile);
 }
 
 void GameManager::play() {
 	bool doExit = false;
+	unsigned int frames_rendered = 0;
 
 	//SDL main loop
 	while (!doExit) {
+		frame_limiter.beginFrame();
+
 		SDL_Event event;
 		while (SDL_PollEvent(&event)) {// poll for pending events
 			switch (event.type) {
 			case SDL_MOUSEBUTTONDOWN:
-				trackball.rotateBegin(event.motion.x, event.motion.y);
+				if (event.button.button == SDL_BUTTON_RIGHT) {
+					pick(event.button.x, event.button.y);
+					redraw = true;
+				} else {
+					trackball.rotateBegin(event.motion.x, event.motion.y);
+				}
 				break;
 			case SDL_MOUSEBUTTONUP:
-				trackball.rotateEnd(event.motion.x, event.motion.y);
+				if (event.button.button != SDL_BUTTON_RIGHT)
+					trackball.rotateEnd(event.motion.x, event.motion.y);
 				break;
 			case SDL_MOUSEMOTION:
-				trackball_view_matrix = trackball.rotate(event.motion.x, event.motion.y);
+				if (trackball.isRotating()) {
+					trackball_view_matrix = trackball.rotate(event.motion.x, event.motion.y);
+					redraw = true;
+				}
+				break;
+			case SDL_WINDOWEVENT:
+				redraw = true;
 				break;
 			case SDL_MOUSEWHEEL:
 				if(event.wheel.y > 0) {
@@ -264,13 +1281,75 @@ void GameManager::play() {
 				case SDLK_4:
 					rendermode = RENDERMODE_PHONG;
 					break;
+				case SDLK_5:
+					rendermode = RENDERMODE_POINTS;
+					break;
 				case SDLK_PAGEUP:
 					zoom(5.0f);
 					break;
 				case SDLK_PAGEDOWN:
 					zoom(-5.0f);
 					break;
+				case SDLK_v:
+					//Cycle vsync -> adaptive vsync -> immediate
+					if (swap_interval == 1) setSwapInterval(-1);
+					else if (swap_interval == -1) setSwapInterval(0);
+					else setSwapInterval(1);
+					break;
+				case SDLK_f:
+					//Cycle the target frame rate
+					if (frame_limiter.getTargetFrameRate() == 0.0) setTargetFrameRate(30.0);
+					else if (frame_limiter.getTargetFrameRate() <= 30.0) setTargetFrameRate(60.0);
+					else if (frame_limiter.getTargetFrameRate() <= 60.0) setTargetFrameRate(120.0);
+					else setTargetFrameRate(0.0);
+					break;
+				case SDLK_i:
+					setIdleRendering(!idle_rendering);
+					break;
+				case SDLK_r:
+					reloadModel();
+					break;
+				case SDLK_n:
+					nextModel();
+					break;
+				case SDLK_b:
+					setSoftwareRendering(!software_rendering);
+					break;
+				case SDLK_d:
+					//Hold the frame time of the target frame rate
+					if (dynamic_resolution.isEnabled())
+						dynamic_resolution.setTarget(0.0);
+					else if (frame_limiter.getTargetFrameRate() > 0.0)
+						dynamic_resolution.setTarget(1.0 / frame_limiter.getTargetFrameRate());
+					else
+						dynamic_resolution.setTarget(default_resolution_target);
+					std::cout << "Dynamic resolution: " << (dynamic_resolution.isEnabled() ? "on" : "off") << std::endl;
+					break;
+				case SDLK_u:
+					dynamic_resolution.setFilter((dynamic_resolution.getFilter() == UPSCALE_BILINEAR) ? UPSCALE_SHARPEN : UPSCALE_BILINEAR);
+					std::cout << "Upscale filter: " << DynamicResolution::getFilterName(dynamic_resolution.getFilter()) << std::endl;
+					break;
+				case SDLK_p:
+					//Cycle auto -> on -> off
+					if (prepass.getMode() == PREPASS_AUTO) setDepthPrepass(PREPASS_ON);
+					else if (prepass.getMode() == PREPASS_ON) setDepthPrepass(PREPASS_OFF);
+					else setDepthPrepass(PREPASS_AUTO);
+					break;
+				case SDLK_F12:
+					capture.screenshot();
+					break;
+				case SDLK_c:
+					setRecording(!capture.isRecording());
+					break;
+				case SDLK_k:
+					setSkinningMode((skinning_mode == SKINNING_GPU) ? SKINNING_CPU : SKINNING_GPU);
+					break;
+				case SDLK_l:
+					//Cycle 0 -> 16 -> 256 -> 4096 lights
+					setLightCount((light_origins.size() >= 4096) ? 0 : std::max<unsigned int>(16, static_cast<unsigned int>(light_origins.size()) * 16));
+					break;
 				}
+				redraw = true;
 				break;
 			case SDL_QUIT: //e.g., user clicks the upper right x
 				doExit = true;
@@ -278,9 +1357,72 @@ void GameManager::play() {
 			}
 		}
 
-		//Render, and swap front and back buffers
-		render();
-		SDL_GL_SwapWindow(main_window);
+		updateShaderReloads();
+
+		//The lights move, so every frame is different
+		if (!light_origins.empty()) {
+			updateLights();
+			redraw = true;
+		}
+
+		//Animated models move every frame
+		SkinnedMesh* skinned = getSkinnedMesh();
+		if (skinned != NULL && skinned->getAnimator().isAnimated())
+			redraw = true;
+
+		//Videos get every frame, also in idle rendering
+		if (capture.isRecording())
+			redraw = true;
+
+		//Draw the pages of the virtual texture as they arrive, their feedback asks for the next ones
+		VirtualTexture* virtual_texture = getVirtualTexture();
+		if (virtual_texture != NULL && !software_rendering && virtual_texture->update(virtual_texture_uploads))
+			redraw = true;
+
+		//Draw the nodes of the point cloud as they arrive, the next draw asks for more
+		if (point_cloud && rendermode == RENDERMODE_POINTS && !software_rendering && point_cloud->update(point_upload_time))
+			redraw = true;
+
+		//Draw the chunks of a streamed model as they arrive
+		if (streamingModel && !streamingModel->isComplete() && streamingModel->update(stream_upload_time))
+			redraw = true;
+
+		//Swap in a model loaded in the background between two frames
+		std::shared_ptr<ModelInterleavedArray> loaded = asset_manager.update(model_upload_time);
+		if (loaded) {
+			residency.insert(asset_manager.getSwappedFilename(), loaded);
+			swapModel(asset_manager.getSwappedFilename(), loaded);
+		}
+
+		//Frames are counted only when rendered, so keep rendering until the screenshot is taken
+		if (screenshot_frame > 0 && frames_rendered < screenshot_frame)
+			redraw = true;
+
+		if (redraw || !idle_rendering) {
+			//Render, and swap front and back buffers
+			redraw = false;
+			if (screenshot_frame > 0 && ++frames_rendered == screenshot_frame)
+				capture.screenshot();
+			render();
+			capture.endFrame();
+			frame_limiter.endWork();
+			SDL_GL_SwapWindow(main_window);
+			frame_limiter.frameRendered();
+			if (screenshot_frame > 0 && frames_rendered == screenshot_frame)
+				doExit = true;
+		} else {
+			//Nothing changed: block on input until the next frame is due instead of spinning
+			frame_limiter.endWork();
+			frame_limiter.frameSkipped();
+			SDL_WaitEventTimeout(NULL, frame_limiter.getMillisecondsToNextFrame());
+		}
+
+		//Evict models that were not drawn if we are over the GPU memory budget
+		residency.drawn(model_to_load);
+		residency.endFrame();
+
+		frame_limiter.waitForNextFrame();
+		reportStats();
 	}
 	quit();
 }
@@ -290,22 +1432,115 @@ glm::mat4 GameManager::getNewViewMatrix()
 	return view_matrix * trackball_view_matrix;
 }
 
+/* * *
+* The window position is taken back through the matrices the model is
+* drawn with, to where it is on the near and the far plane, and the ray
+* between them is shot into the hierarchy. The ray is not normalized, so
+* the part of the hierarchy between the planes is 0 to 1 along it.
+* * */
+void GameManager::pick(int x, int y) {
+	const MeshBVH* bvh = (streamingModel || model) ? NULL : modelInterleaved->getBVH();
+	if (bvh == NULL) {
+		std::cout << "Picking needs a model loaded with ModelInterleavedArray" << std::endl;
+		return;
+	}
+
+	Timer timer;
+	glm::mat4 inverse = glm::inverse(projection_matrix * getNewViewMatrix() * model_matrix * getMesh().transform);
+	float ndc_x = 2.0f * (x + 0.5f) / window_width - 1.0f;
+	float ndc_y = 1.0f - 2.0f * (y + 0.5f) / window_height;
+	glm::vec4 near_point = inverse * glm::vec4(ndc_x, ndc_y, -1.0f, 1.0f);
+	glm::vec4 far_point = inverse * glm::vec4(ndc_x, ndc_y, 1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(near_point) / near_point.w;
+	glm::vec3 direction = glm::vec3(far_point) / far_point.w - origin;
+
+	MeshHit hit;
+	bool found = bvh->intersect(origin, direction, hit, 1.0f);
+	double pick_time = timer.elapsed();
+	if (!found) {
+		selected_part = NULL;
+		std::cout << "Picked nothing (" << pick_time * 1.0e6 << " us)" << std::endl;
+		return;
+	}
+
+	unsigned int index = hit.part;
+	selected_part = findPart(getMesh(), index);
+	std::cout << "Picked part " << hit.part << ", triangle " << hit.triangle << " at (" << hit.position.x << ", "
+		<< hit.position.y << ", " << hit.position.z << ") in " << pick_time * 1.0e6 << " us";
+	if (has_pick)
+		std::cout << ", " << glm::length(hit.position - last_pick) << " from the last pick";
+	std::cout << std::endl;
+	last_pick = hit.position;
+	has_pick = true;
+}
+
 void GameManager::renderWireframe(glm::vec3 color) {
 	ChangeToProgram(flat_program);
 	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	renderMeshRecursive(modelInterleaved->getMesh(), active_program, getNewViewMatrix(), model_matrix, color);
+	renderMesh(color);
 }
 
+/* * *
+* With the depth pre-pass, the nearest depth of every pixel is written
+* first with a cheap program, and the Phong pass only shades the fragments
+* whose depth is equal to it, so every pixel is shaded once.
+* */
 void GameManager::renderPhong(glm::vec3 color) {
-	ChangeToProgram(phong_program);
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	renderMeshRecursive(modelInterleaved->getMesh(), active_program, getNewViewMatrix(), model_matrix, color);
+	//The pre-pass draws the bind pose, so skinned models go without it
+	bool use_prepass = prepass.beginFrame(modelInterleaved != NULL && getSkinnedMesh() == NULL);
+	if (use_prepass) {
+		if (!prepass_vao.valid())
+			bindPrepass();
+		ChangeToProgram(prepass_program);
+		glUniform1i(active_program->getUniform("skinning"), 0);
+		glUniform1i(active_program->getUniform("bone_matrices"), bone_texture_unit);
+		prepass_vao.bind();
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		prepass.beginDepthPass();
+		renderDepthRecursive(getMesh(), active_program, getNewViewMatrix(), model_matrix);
+		prepass.endDepthPass();
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDepthMask(GL_FALSE);
+		glDepthFunc(GL_EQUAL);
+		vao.bind();
+	}
+
+	ChangeToProgram(phong_program);
+	lights.assign(projection_matrix, getNewViewMatrix());
+	lights.upload();
+	lights.bind(*active_program, light_texture_unit, dynamic_resolution.getWidth(), dynamic_resolution.getHeight());
+	prepass.beginShadingPass();
+	renderMesh(color);
+	prepass.endShadingPass();
+
+	if (use_prepass) {
+		glDepthFunc(GL_LEQUAL);
+		glDepthMask(GL_TRUE);
+	}
 }
 
 void GameManager::renderFlat(glm::vec3 color) {
 	ChangeToProgram(flat_program);
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	renderMeshRecursive(modelInterleaved->getMesh(), active_program, getNewViewMatrix(), model_matrix, color);
+	renderMesh(color);
+}
+
+/* * *
+* The point cloud is drawn in the space of the model matrix, like the
+* models, scaled to the unit cube by its own transform.
+* * */
+void GameManager::renderPoints(glm::vec3 color) {
+	if (!point_cloud) {
+		ChangeToProgram(flat_program);
+		glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
+		renderMesh(color);
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		return;
+	}
+
+	ChangeToProgram(points_program);
+	point_cloud->draw(*active_program, getNewViewMatrix() * model_matrix, projection_matrix);
 }
 
 void GameManager::renderHiddenLine() {
@@ -313,7 +1548,7 @@ void GameManager::renderHiddenLine() {
 	glEnable(GL_POLYGON_OFFSET_FILL);
 	glPolygonOffset(1.0f, 1.0f);
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	renderMeshRecursive(modelInterleaved->getMesh(), active_program, getNewViewMatrix(), model_matrix, background_color);
+	renderMesh(background_color);
 	glDisable(GL_POLYGON_OFFSET_FILL);
 
 	glEnable(GL_POLYGON_OFFSET_LINE);
@@ -323,10 +1558,229 @@ void GameManager::renderHiddenLine() {
 
 }
 
+/* * *
+* Edited shaders are compiled and linked without blocking the frame
+* (with KHR_parallel_shader_compile), and swapped in between two frames
+* once the driver is done. If the new sources do not compile, we keep
+* rendering with the old program. An edited .glsl file reloads the
+* programs that include it, e.g. skinning.glsl the Phong and the pre-pass
+* programs together, so that both passes keep computing the same depths.
+* */
+void GameManager::updateShaderReloads() {
+	//Every program createSimpleProgram builds, by the name of its shaders
+	std::pair<const char*, std::shared_ptr<Program>*> reloadable[] = {
+		std::make_pair("shaders/phongshader", &phong_program),
+		std::make_pair("shaders/flatshader", &flat_program),
+		std::make_pair("shaders/depthprepass", &prepass_program),
+		std::make_pair("shaders/vtfeedback", &feedback_program),
+		std::make_pair("shaders/upscale", &upscale_program),
+		std::make_pair("shaders/pointsplat", &points_program)
+	};
+	const unsigned int n_reloadable = sizeof(reloadable) / sizeof(reloadable[0]);
+
+	std::map<std::string, double> changed = shader_watcher.getChanged();
+	std::map<std::string, double> programs;
+	for (std::map<std::string, double>::iterator it = changed.begin(); it != changed.end(); ++it) {
+		size_t dot = it->first.find_last_of('.');
+		std::string name = it->first.substr(0, dot);
+		bool include = (it->first.compare(dot + 1, std::string::npos, "glsl") == 0);
+		std::string quoted = "\"" + it->first.substr(it->first.find_last_of('/') + 1) + "\"";
+		for (unsigned int p = 0; p < n_reloadable; ++p) {
+			std::string program = reloadable[p].first;
+			try {
+				if (include ? (readFile(program + ".vert").find(quoted) != std::string::npos
+						|| readFile(program + ".frag").find(quoted) != std::string::npos) : (name == program))
+					programs.insert(std::make_pair(program, it->second));
+			} catch (GameException&) {
+			}
+		}
+	}
+
+	for (std::map<std::string, double>::iterator it = programs.begin(); it != programs.end(); ++it) {
+		const std::string& name = it->first;
+
+		//A newer edit replaces a reload in progress
+		for (unsigned int i = 0; i < program_reloads.size(); ++i) {
+			if (program_reloads[i].name == name) {
+				program_reloads.erase(program_reloads.begin() + i);
+				break;
+			}
+		}
+
+		ProgramReload reload;
+		reload.name = name;
+		reload.changed_time = it->second;
+		try {
+			reload.program = Program::createAsync(readShader(name + ".vert"), readShader(name + ".frag"));
+		} catch (GameException&) {
+			continue;
+		}
+		program_reloads.push_back(reload);
+	}
+
+	for (unsigned int i = 0; i < program_reloads.size(); ) {
+		ProgramReload& reload = program_reloads[i];
+		if (!reload.program->isReady()) {
+			++i;
+			continue;
+		}
+
+		double latency = (Timer::getCurrentTime() - reload.changed_time) * 1000.0;
+		try {
+			reload.program->finish();
+
+			std::shared_ptr<Program>* target = NULL;
+			for (unsigned int p = 0; p < n_reloadable; ++p)
+				if (reload.name == reloadable[p].first)
+					target = reloadable[p].second;
+			bool was_active = (active_program == *target);
+			*target = reload.program;
+			if (was_active)
+				active_program = *target;
+
+			//Attribute locations may have moved. The pre-pass and feedback
+			//VAOs are created again when next used, the point cloud and the
+			//upscaling look theirs up every frame.
+			if (target == &phong_program || target == &flat_program) {
+				vao.bind();
+				getModelArray()->bind();
+				setAttributePointers(*target);
+				vao.unbind();
+				getModelArray()->unbind();
+			}
+			else if (target == &prepass_program) {
+				prepass_vao.reset();
+			}
+			else if (target == &feedback_program) {
+				feedback_vao.reset();
+			}
+			redraw = true;
+
+			std::cout << "Reloaded " << reload.name << " in " << latency << " ms" << std::endl;
+		} catch (GameException&) {
+			std::cout << "Reloading " << reload.name << " failed after " << latency << " ms, keeping the old program" << std::endl;
+		}
+		program_reloads.erase(program_reloads.begin() + i);
+	}
+}
+
+void GameManager::reportStats() {
+	FrameStats stats;
+	if (!frame_limiter.getStats(stats))
+		return;
+
+	double frames = (stats.frames > 0) ? stats.frames : 1;
+	std::cout << "FPS: " << stats.rendered / stats.elapsed
+		<< ", CPU: " << 1000.0 * stats.cpu_time / frames << " ms/frame"
+		<< ", skipped: " << stats.skipped
+		<< ", late: " << stats.late;
+
+	const ResidencyStats& residency_stats = residency.getStats();
+	std::cout << ", GPU: " << residency_stats.used / (1024*1024) << " MiB";
+	if (residency_stats.budget > 0)
+		std::cout << " of " << residency_stats.budget / (1024*1024) << " MiB";
+	std::cout << " (" << residency_stats.models << " models resident, " << residency_stats.cached / (1024*1024)
+		<< " MiB not drawn, " << residency_stats.evictions << " evicted, " << residency_stats.hits << " hits, "
+		<< residency_stats.misses << " misses)" << std::endl;
+
+	if (dynamic_resolution.isEnabled() && !software_rendering) {
+		const ResolutionStats& resolution = dynamic_resolution.getStats();
+		std::cout << "Resolution: scale " << resolution.scale << " (" << resolution.width << "x" << resolution.height
+			<< "), GPU " << resolution.gpu_time * 1000.0 << " ms of " << resolution.target * 1000.0 << " ms, "
+			<< resolution.changes << " changes, " << DynamicResolution::getFilterName(dynamic_resolution.getFilter())
+			<< " upscaling" << std::endl;
+	}
+
+	if (rendermode == RENDERMODE_PHONG && !software_rendering) {
+		const OverdrawStats& overdraw = prepass.getStats();
+		std::cout << "Depth pre-pass: " << DepthPrepass::getModeName(prepass.getMode())
+			<< (overdraw.enabled ? " (on)" : " (off)") << ", overdraw ";
+		if (overdraw.depth_samples > 0)
+			std::cout << overdraw.overdraw;
+		else
+			std::cout << "not measured";
+		std::cout << ", " << overdraw.shaded_samples << " fragments shaded, " << overdraw.switches << " switches" << std::endl;
+	}
+
+	if (!light_origins.empty() && rendermode == RENDERMODE_PHONG && !software_rendering) {
+		const ClusterStats& cluster_stats = lights.getStats();
+		std::cout << "Lights: " << cluster_stats.lights << " (" << cluster_stats.visible << " visible), "
+			<< cluster_stats.indices << " in " << cluster_stats.occupied << " clusters (max "
+			<< cluster_stats.max_per_cluster << "), assign " << cluster_stats.assign * 1000.0
+			<< " ms, upload " << cluster_stats.upload * 1000.0 << " ms" << std::endl;
+	}
+
+	VirtualTexture* virtual_texture = getVirtualTexture();
+	if (virtual_texture != NULL && !software_rendering) {
+		const VirtualTextureStats& vt_stats = virtual_texture->getStats();
+		std::cout << "Virtual texture: " << vt_stats.requested << " pages requested (" << vt_stats.missing << " missing), "
+			<< vt_stats.resident << " resident, " << vt_stats.loaded << " loaded, " << vt_stats.evicted << " evicted, "
+			<< vt_stats.dropped << " dropped, feedback " << 1000.0 * vt_stats.feedback_time / frames
+			<< " ms, upload " << 1000.0 * vt_stats.upload_time / frames << " ms, table " << 1000.0 * vt_stats.table_time / frames
+			<< " ms per frame, " << virtual_texture->bytes() / (1024*1024) << " MiB" << std::endl;
+		virtual_texture->resetStats();
+	}
+
+	SkinnedMesh* skinned = getSkinnedMesh();
+	if (skinned != NULL && !software_rendering) {
+		SkinningStats skin_stats = skinned->getStats();
+		const AnimatorStats& keys = skinned->getAnimator().getStats();
+		double n = std::max(1u, skin_stats.frames);
+		std::cout << "Skinning: " << SkinnedMesh::getModeName(skinned->getMode()) << ", " << skinned->getVertexCount()
+			<< " vertices, animate " << 1000.0 * skin_stats.animate_time / n << " ms ("
+			<< ((keys.samples > 0) ? 100.0 * keys.cached / keys.samples : 0.0) << "% keys cached), upload "
+			<< 1000.0 * skin_stats.upload_time / n << " ms per frame";
+		if (skin_stats.vertices > 0)
+			std::cout << ", CPU " << 1.0e9 * skin_stats.skin_time / skin_stats.vertices << " ns per vertex ("
+				<< skin_stats.stalls << " stalls)";
+		if (skin_stats.gpu_vertices > 0)
+			std::cout << ", GPU draw " << 1.0e9 * skin_stats.gpu_time / skin_stats.gpu_vertices << " ns per vertex";
+		std::cout << std::endl;
+		skinned->resetStats();
+		skinned->getAnimator().resetStats();
+	}
+
+	if (point_cloud && rendermode == RENDERMODE_POINTS && !software_rendering) {
+		const PointCloudStats& point_stats = point_cloud->getStats();
+		double n = std::max(1u, point_stats.frames);
+		std::cout << "Points: " << static_cast<unsigned long long>(point_stats.points / n) << " per frame ("
+			<< point_stats.points / stats.elapsed / 1.0e6 << " M points/s) in " << point_stats.nodes << " nodes, "
+			<< point_stats.missing << " missing, " << point_stats.resident << " resident, " << point_stats.loaded
+			<< " loaded, " << point_stats.evicted << " evicted, " << point_stats.dropped << " dropped, traverse "
+			<< 1000.0 * point_stats.traverse_time / n << " ms per draw, upload " << 1000.0 * point_stats.upload_time / frames
+			<< " ms per frame, " << point_cloud->bytes() / (1024*1024) << " MiB" << std::endl;
+		point_cloud->resetStats();
+	}
+
+	CaptureStats capture_stats = capture.getStats();
+	if (capture_stats.frames > 0) {
+		double n = capture_stats.frames;
+		std::cout << "Capture: " << capture_stats.frames << " frames, read " << 1000.0 * capture_stats.read_time / n
+			<< " ms, retrieve " << 1000.0 * capture_stats.retrieve_time / n << " ms, write " << 1000.0 * capture_stats.write_time / n
+			<< " ms (writer thread) per frame, retrieved " << capture_stats.latency << " frames after the read, "
+			<< capture_stats.stalls << " stalls" << std::endl;
+		capture.resetStats();
+	}
+
+	if (software_frames > 0) {
+		double n = software_frames;
+		std::cout << "Software rasterizer: transform " << 1000.0 * software_stats.transform / n
+			<< " ms, bin " << 1000.0 * software_stats.bin / n << " ms, raster " << 1000.0 * software_stats.raster / n
+			<< " ms, present " << 1000.0 * software_present_time / n << " ms per frame, "
+			<< software_stats.triangles / software_frames << " triangles (" << software_stats.culled / software_frames
+			<< " culled, " << software_stats.clipped / software_frames << " clipped), "
+			<< software_stats.fragments / software_frames << " fragments" << std::endl;
+		software_stats = RasterStats();
+		software_present_time = 0.0;
+		software_frames = 0;
+	}
+}
+
 void GameManager::zoom(float factor) {
 	float newFov = fov + factor;
 	if(newFov < 170.0f && newFov >= 5)
 		fov = newFov;
+	redraw = true;
 
 	projection_matrix = glm::perspective(fov, window_width / (float) window_height, 1.0f, 10.f);
 	glUniformMatrix4fv(active_program->getUniform("projection_matrix"), 1, 0, glm::value_ptr(projection_matrix));
@@ -339,5 +1793,7 @@ void GameManager::ChangeToProgram(std::shared_ptr<GLUtils::Program>& program) {
 }
 
 void GameManager::quit() {
+	//Screenshots and video frames still in flight
+	capture.finish();
 	std::cout << "Bye bye..." << std::endl;
 }
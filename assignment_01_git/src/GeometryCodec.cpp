@@ -0,0 +1,596 @@
+#include "GeometryCodec.h"
+#include "EntropyCoder.h"
+#include "GameException.h"
+#include "Parallel.h"
+#include "Timer.h"
+#include "VirtualFileSystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CODEC_SSE2
+#endif
+
+namespace {
+
+	const unsigned int magic = 0x4D5A4750; //< "PGZM"
+	const unsigned int version = 2; //< 2 added MeshPart::material
+
+	const unsigned int vertex_block_size = 1 << 14;
+	const unsigned int triangle_block_size = 1 << 14;
+	const unsigned int n_components = 7; //< Position, octahedral normal, texture coordinates
+	const unsigned int edge_fifo_size = 15;
+	const unsigned int no_edge = 15;
+	const unsigned int max_varint_bytes = 10; //< Of a 64 bit value
+
+	struct Header {
+		unsigned int magic;
+		unsigned int version;
+		unsigned int n_vertices;
+		unsigned int n_indices;
+		unsigned int n_vertex_blocks;
+		unsigned int n_triangle_blocks;
+		unsigned int n_textures;
+		unsigned int reserved;
+		float position_min[3];
+		float position_scale[3];
+		float tex_min[2];
+		float tex_scale[2];
+	};
+
+	inline unsigned short zigzag16(short value) {
+		return static_cast<unsigned short>((value << 1) ^ (value >> 15));
+	}
+
+	inline short unzigzag16(unsigned short value) {
+		return static_cast<short>((value >> 1) ^ -static_cast<short>(value & 1));
+	}
+
+	inline unsigned long long zigzag64(long long value) {
+		return (static_cast<unsigned long long>(value) << 1) ^ static_cast<unsigned long long>(value >> 63);
+	}
+
+	inline long long unzigzag64(unsigned long long value) {
+		return static_cast<long long>(value >> 1) ^ -static_cast<long long>(value & 1);
+	}
+
+	inline unsigned short quantize(float value, float min, float scale) {
+		float q = (value - min) / scale * 65535.0f + 0.5f;
+		return static_cast<unsigned short>(std::max(0.0f, std::min(65535.0f, q)));
+	}
+
+	/**
+	 * Octahedral mapping of a unit vector to two components in [0, 65535]
+	 */
+	inline void encodeNormal(const glm::vec3& n, unsigned short& u, unsigned short& v) {
+		float sum = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+		float x = (sum > 0.0f) ? n.x / sum : 0.0f;
+		float y = (sum > 0.0f) ? n.y / sum : 0.0f;
+		if (n.z < 0.0f) {
+			float ox = x;
+			x = (1.0f - std::fabs(y)) * ((ox >= 0.0f) ? 1.0f : -1.0f);
+			y = (1.0f - std::fabs(ox)) * ((y >= 0.0f) ? 1.0f : -1.0f);
+		}
+		u = quantize(x, -1.0f, 2.0f);
+		v = quantize(y, -1.0f, 2.0f);
+	}
+
+	inline glm::vec3 decodeNormal(unsigned short u, unsigned short v) {
+		float x = u * (2.0f / 65535.0f) - 1.0f;
+		float y = v * (2.0f / 65535.0f) - 1.0f;
+		float z = 1.0f - std::fabs(x) - std::fabs(y);
+		if (z < 0.0f) {
+			float ox = x;
+			x = (1.0f - std::fabs(y)) * ((ox >= 0.0f) ? 1.0f : -1.0f);
+			y = (1.0f - std::fabs(ox)) * ((y >= 0.0f) ? 1.0f : -1.0f);
+		}
+		float length = std::sqrt(x*x + y*y + z*z);
+		return glm::vec3(x / length, y / length, z / length);
+	}
+
+	void quantizeVertex(const Header& header, const VertexData& vertex, unsigned short q[n_components]) {
+		for (unsigned int c=0; c<3; ++c)
+			q[c] = quantize(vertex.position[c], header.position_min[c], header.position_scale[c]);
+		encodeNormal(vertex.normal, q[3], q[4]);
+		for (unsigned int c=0; c<2; ++c)
+			q[5+c] = quantize(vertex.tex_coords[c], header.tex_min[c], header.tex_scale[c]);
+	}
+
+	void encodeVertexBlock(const Header& header, const VertexData* vertices, unsigned int n, std::vector<unsigned char>& out) {
+		std::vector<unsigned short> q(n_components * n);
+		for (unsigned int i=0; i<n; ++i) {
+			unsigned short vq[n_components];
+			quantizeVertex(header, vertices[i], vq);
+			for (unsigned int c=0; c<n_components; ++c)
+				q[c*n + i] = vq[c];
+		}
+
+		ByteWriter writer(out);
+		std::vector<unsigned char> low(n), high(n);
+		for (unsigned int c=0; c<n_components; ++c) {
+			unsigned short prev = 0;
+			for (unsigned int i=0; i<n; ++i) {
+				unsigned short value = q[c*n + i];
+				unsigned short z = zigzag16(static_cast<short>(value - prev));
+				low[i] = static_cast<unsigned char>(z & 0xFF);
+				high[i] = static_cast<unsigned char>(z >> 8);
+				prev = value;
+			}
+			EntropyCoder::encode(low, writer);
+			EntropyCoder::encode(high, writer);
+		}
+	}
+
+	/**
+	 * Undoes the zigzag delta coding of one component: value[i] is the
+	 * running sum of the deltas. The SSE2 path does a prefix sum over
+	 * eight 16 bit lanes and carries the last lane into the next group.
+	 */
+	void decodeDeltas(const unsigned char* low, const unsigned char* high, unsigned short* dst, unsigned int n) {
+		unsigned int i = 0;
+		unsigned short value = 0;
+#ifdef CODEC_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i one = _mm_set1_epi16(1);
+		__m128i carry = zero;
+		for (; i+8<=n; i+=8) {
+			__m128i z = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(low + i)),
+				_mm_loadl_epi64(reinterpret_cast<const __m128i*>(high + i)));
+			__m128i d = _mm_xor_si128(_mm_srli_epi16(z, 1), _mm_sub_epi16(zero, _mm_and_si128(z, one)));
+			d = _mm_add_epi16(d, _mm_slli_si128(d, 2));
+			d = _mm_add_epi16(d, _mm_slli_si128(d, 4));
+			d = _mm_add_epi16(d, _mm_slli_si128(d, 8));
+			d = _mm_add_epi16(d, carry);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), d);
+			carry = _mm_shuffle_epi32(_mm_shufflehi_epi16(d, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		}
+		value = static_cast<unsigned short>(_mm_cvtsi128_si32(carry));
+#endif
+		for (; i<n; ++i) {
+			value += unzigzag16(static_cast<unsigned short>(low[i] | (high[i] << 8)));
+			dst[i] = value;
+		}
+	}
+
+#ifdef CODEC_SSE2
+	inline __m128 loadQuantized(const unsigned short* q) {
+		__m128i words = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(q));
+		return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, _mm_setzero_si128()));
+	}
+
+	/**
+	 * decodeNormal for four vertices, with the same operations in the
+	 * same order so that both paths give identical results
+	 */
+	inline void decodeNormals(__m128 u, __m128 v, __m128& x, __m128& y, __m128& z) {
+		const __m128 sign = _mm_set1_ps(-0.0f);
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 step = _mm_set1_ps(2.0f / 65535.0f);
+		x = _mm_sub_ps(_mm_mul_ps(u, step), one);
+		y = _mm_sub_ps(_mm_mul_ps(v, step), one);
+		__m128 abs_x = _mm_andnot_ps(sign, x);
+		__m128 abs_y = _mm_andnot_ps(sign, y);
+		z = _mm_sub_ps(_mm_sub_ps(one, abs_x), abs_y);
+
+		__m128 fold = _mm_cmplt_ps(z, _mm_setzero_ps());
+		__m128 sign_x = _mm_or_ps(one, _mm_and_ps(_mm_cmplt_ps(x, _mm_setzero_ps()), sign));
+		__m128 sign_y = _mm_or_ps(one, _mm_and_ps(_mm_cmplt_ps(y, _mm_setzero_ps()), sign));
+		__m128 folded_x = _mm_mul_ps(_mm_sub_ps(one, abs_y), sign_x);
+		__m128 folded_y = _mm_mul_ps(_mm_sub_ps(one, abs_x), sign_y);
+		x = _mm_or_ps(_mm_and_ps(fold, folded_x), _mm_andnot_ps(fold, x));
+		y = _mm_or_ps(_mm_and_ps(fold, folded_y), _mm_andnot_ps(fold, y));
+
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+		x = _mm_div_ps(x, length);
+		y = _mm_div_ps(y, length);
+		z = _mm_div_ps(z, length);
+	}
+#endif
+
+	void decodeVertexBlock(const Header& header, ByteReader& in, VertexData* vertices, unsigned int n) {
+		std::vector<unsigned short> q(n_components * n);
+		std::vector<unsigned char> low, high;
+		for (unsigned int c=0; c<n_components; ++c) {
+			EntropyCoder::decode(in, low, n);
+			EntropyCoder::decode(in, high, n);
+			if (low.size() != n || high.size() != n)
+				THROW_EXCEPTION("Wrong vertex count in geometry file");
+			decodeDeltas(low.data(), high.data(), &q[c*n], n);
+		}
+
+		float position_step[3], tex_step[2];
+		for (unsigned int c=0; c<3; ++c)
+			position_step[c] = header.position_scale[c] / 65535.0f;
+		for (unsigned int c=0; c<2; ++c)
+			tex_step[c] = header.tex_scale[c] / 65535.0f;
+
+		unsigned int i = 0;
+#ifdef CODEC_SSE2
+		//Four vertices at a time, transposed from planes to two rows of
+		//four floats per vertex: position and normal.x, normal.yz and uv
+		static_assert(sizeof(VertexData) == 8*sizeof(float), "VertexData must be eight packed floats");
+		for (; i+4<=n; i+=4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps(header.position_min[0]), _mm_mul_ps(loadQuantized(&q[i]), _mm_set1_ps(position_step[0])));
+			__m128 py = _mm_add_ps(_mm_set1_ps(header.position_min[1]), _mm_mul_ps(loadQuantized(&q[n + i]), _mm_set1_ps(position_step[1])));
+			__m128 pz = _mm_add_ps(_mm_set1_ps(header.position_min[2]), _mm_mul_ps(loadQuantized(&q[2*n + i]), _mm_set1_ps(position_step[2])));
+			__m128 nx, ny, nz;
+			decodeNormals(loadQuantized(&q[3*n + i]), loadQuantized(&q[4*n + i]), nx, ny, nz);
+			__m128 tu = _mm_add_ps(_mm_set1_ps(header.tex_min[0]), _mm_mul_ps(loadQuantized(&q[5*n + i]), _mm_set1_ps(tex_step[0])));
+			__m128 tv = _mm_add_ps(_mm_set1_ps(header.tex_min[1]), _mm_mul_ps(loadQuantized(&q[6*n + i]), _mm_set1_ps(tex_step[1])));
+			_MM_TRANSPOSE4_PS(px, py, pz, nx);
+			_MM_TRANSPOSE4_PS(ny, nz, tu, tv);
+			float* out = reinterpret_cast<float*>(vertices + i);
+			_mm_storeu_ps(out, px);
+			_mm_storeu_ps(out + 4, ny);
+			_mm_storeu_ps(out + 8, py);
+			_mm_storeu_ps(out + 12, nz);
+			_mm_storeu_ps(out + 16, pz);
+			_mm_storeu_ps(out + 20, tu);
+			_mm_storeu_ps(out + 24, nx);
+			_mm_storeu_ps(out + 28, tv);
+		}
+#endif
+		for (; i<n; ++i) {
+			VertexData& vertex = vertices[i];
+			vertex.position = glm::vec3(header.position_min[0] + q[i] * position_step[0],
+				header.position_min[1] + q[n + i] * position_step[1],
+				header.position_min[2] + q[2*n + i] * position_step[2]);
+			vertex.normal = decodeNormal(q[3*n + i], q[4*n + i]);
+			vertex.tex_coords = glm::vec2(header.tex_min[0] + q[5*n + i] * tex_step[0],
+				header.tex_min[1] + q[6*n + i] * tex_step[1]);
+		}
+	}
+
+	/**
+	 * Recently seen directed edges. A triangle that shares an edge with a
+	 * recent triangle has that edge in the opposite direction.
+	 */
+	struct EdgeFifo {
+		EdgeFifo() : head(0), count(0) {}
+
+		inline void push(unsigned int a, unsigned int b) {
+			edges[head][0] = a;
+			edges[head][1] = b;
+			head = (head + 1) % edge_fifo_size;
+			if (count < edge_fifo_size) ++count;
+		}
+
+		// Slot 0 is the most recent edge
+		inline const unsigned int* get(unsigned int slot) const {
+			return edges[(head + edge_fifo_size - 1 - slot) % edge_fifo_size];
+		}
+
+		unsigned int edges[edge_fifo_size][2];
+		unsigned int head;
+		unsigned int count;
+	};
+
+	/**
+	 * Per triangle, a code byte: edge slot (4 bits), whether the third
+	 * vertex is the next unused vertex (1 bit), and the rotation of the
+	 * triangle (2 bits). Vertices that are not implied by the code are
+	 * stored as zigzag varints relative to the next unused vertex.
+	 */
+	void encodeTriangleBlock(const unsigned int* indices, unsigned int n_triangles, std::vector<unsigned char>& out) {
+		std::vector<unsigned char> codes(n_triangles);
+		std::vector<unsigned char> vertices;
+		ByteWriter vertex_writer(vertices);
+		EdgeFifo fifo;
+		unsigned int next = 0;
+
+		for (unsigned int t=0; t<n_triangles; ++t) {
+			const unsigned int* tri = indices + 3*t;
+			unsigned int rotation = 0;
+			unsigned int slot = no_edge;
+			for (unsigned int r=0; r<3 && slot == no_edge; ++r) {
+				unsigned int p = tri[r];
+				unsigned int q = tri[(r+1)%3];
+				for (unsigned int k=0; k<fifo.count; ++k) {
+					const unsigned int* edge = fifo.get(k);
+					if (edge[0] == q && edge[1] == p) {
+						slot = k;
+						rotation = r;
+						break;
+					}
+				}
+			}
+
+			if (slot != no_edge) {
+				unsigned int s = tri[(rotation+2)%3];
+				bool is_next = (s == next);
+				codes[t] = static_cast<unsigned char>((slot << 4) | (is_next ? 4 : 0) | rotation);
+				if (!is_next)
+					vertex_writer.putVarint(zigzag64(static_cast<long long>(s) - next));
+				next = std::max(next, s + 1);
+			} else {
+				codes[t] = static_cast<unsigned char>(no_edge << 4);
+				for (unsigned int k=0; k<3; ++k) {
+					vertex_writer.putVarint(zigzag64(static_cast<long long>(tri[k]) - next));
+					next = std::max(next, tri[k] + 1);
+				}
+			}
+
+			fifo.push(tri[0], tri[1]);
+			fifo.push(tri[1], tri[2]);
+			fifo.push(tri[2], tri[0]);
+		}
+
+		ByteWriter writer(out);
+		EntropyCoder::encode(codes, writer);
+		EntropyCoder::encode(vertices, writer);
+	}
+
+	void decodeTriangleBlock(ByteReader& in, unsigned int* indices, unsigned int n_triangles) {
+		std::vector<unsigned char> codes, vertices;
+		EntropyCoder::decode(in, codes, n_triangles);
+		EntropyCoder::decode(in, vertices, max_varint_bytes * 3 * static_cast<size_t>(n_triangles));
+		if (codes.size() != n_triangles)
+			THROW_EXCEPTION("Wrong triangle count in geometry file");
+
+		ByteReader vertex_reader(vertices.data(), vertices.data() + vertices.size());
+		EdgeFifo fifo;
+		unsigned int next = 0;
+
+		for (unsigned int t=0; t<n_triangles; ++t) {
+			unsigned int* tri = indices + 3*t;
+			unsigned int slot = codes[t] >> 4;
+			if (slot != no_edge) {
+				unsigned int rotation = codes[t] & 3;
+				if (slot >= fifo.count || rotation > 2)
+					THROW_EXCEPTION("Corrupt triangle code in geometry file");
+				const unsigned int* edge = fifo.get(slot);
+				unsigned int s = (codes[t] & 4) ? next : static_cast<unsigned int>(next + unzigzag64(vertex_reader.getVarint()));
+				tri[rotation] = edge[1];
+				tri[(rotation+1)%3] = edge[0];
+				tri[(rotation+2)%3] = s;
+				next = std::max(next, s + 1);
+			} else {
+				for (unsigned int k=0; k<3; ++k) {
+					tri[k] = static_cast<unsigned int>(next + unzigzag64(vertex_reader.getVarint()));
+					next = std::max(next, tri[k] + 1);
+				}
+			}
+
+			fifo.push(tri[0], tri[1]);
+			fifo.push(tri[1], tri[2]);
+			fifo.push(tri[2], tri[0]);
+		}
+	}
+
+	void writePart(ByteWriter& out, const MeshPart& part) {
+		float transform[16];
+		for (int j=0; j<4; ++j)
+			for (int i=0; i<4; ++i)
+				transform[j*4+i] = part.transform[j][i];
+		out.putBytes(transform, sizeof(transform));
+		out.putVarint(part.first);
+		out.putVarint(part.count);
+		out.putVarint(part.vertexCount);
+		out.putVarint(part.material);
+		out.putVarint(part.children.size());
+		for (unsigned int i=0; i<part.children.size(); ++i)
+			writePart(out, part.children[i]);
+	}
+
+	/**
+	 * Throws unless every index of part and its children, offset by the
+	 * vertexCount of its part, is a vertex of the file
+	 */
+	void checkPartIndices(const MeshPart& part, const std::vector<unsigned int>& indices, unsigned int n_vertices) {
+		if (part.count > 0) {
+			if (part.vertexCount >= n_vertices)
+				THROW_EXCEPTION("Corrupt mesh part in geometry file");
+			unsigned int limit = n_vertices - part.vertexCount;
+			unsigned int blocks = (part.count + triangle_block_size - 1) / triangle_block_size;
+			parallelFor(blocks, [&](unsigned int b) {
+				unsigned int end = part.first + std::min(part.count, (b+1)*triangle_block_size);
+				for (unsigned int i=part.first + b*triangle_block_size; i<end; ++i)
+					if (indices[i] >= limit)
+						THROW_EXCEPTION("Vertex index out of range in geometry file");
+			});
+		}
+		for (unsigned int i=0; i<part.children.size(); ++i)
+			checkPartIndices(part.children[i], indices, n_vertices);
+	}
+
+	void readPart(ByteReader& in, MeshPart& part, const Header& header) {
+		float transform[16];
+		in.getBytes(transform, sizeof(transform));
+		for (int j=0; j<4; ++j)
+			for (int i=0; i<4; ++i)
+				part.transform[j][i] = transform[j*4+i];
+		part.first = static_cast<unsigned int>(in.getVarint());
+		part.count = static_cast<unsigned int>(in.getVarint());
+		part.vertexCount = static_cast<unsigned int>(in.getVarint());
+		part.material = (header.version >= 2) ? static_cast<unsigned int>(in.getVarint()) : 0;
+		if (static_cast<unsigned long long>(part.first) + part.count > header.n_indices)
+			THROW_EXCEPTION("Corrupt mesh part in geometry file");
+		unsigned long long children = in.getVarint();
+		if (children > header.n_indices + 1)
+			THROW_EXCEPTION("Corrupt mesh part in geometry file");
+		part.children.resize(static_cast<size_t>(children));
+		for (unsigned int i=0; i<part.children.size(); ++i)
+			readPart(in, part.children[i], header);
+	}
+}
+
+void GeometryCodec::encode(const MeshData& data, std::vector<unsigned char>& out) {
+	if (data.indices.size() % 3 != 0)
+		THROW_EXCEPTION("Only triangle meshes can be compressed");
+
+	Header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = magic;
+	header.version = version;
+	header.n_vertices = static_cast<unsigned int>(data.vertices.size());
+	header.n_indices = static_cast<unsigned int>(data.indices.size());
+	header.n_vertex_blocks = (header.n_vertices + vertex_block_size - 1) / vertex_block_size;
+	header.n_triangle_blocks = (header.n_indices/3 + triangle_block_size - 1) / triangle_block_size;
+	header.n_textures = static_cast<unsigned int>(data.textures.size());
+
+	//Quantization ranges
+	glm::vec3 min_position(std::numeric_limits<float>::max()), max_position(-std::numeric_limits<float>::max());
+	glm::vec2 min_tex(std::numeric_limits<float>::max()), max_tex(-std::numeric_limits<float>::max());
+	for (size_t i=0; i<data.vertices.size(); ++i) {
+		for (unsigned int c=0; c<3; ++c) {
+			min_position[c] = std::min(min_position[c], data.vertices[i].position[c]);
+			max_position[c] = std::max(max_position[c], data.vertices[i].position[c]);
+		}
+		for (unsigned int c=0; c<2; ++c) {
+			min_tex[c] = std::min(min_tex[c], data.vertices[i].tex_coords[c]);
+			max_tex[c] = std::max(max_tex[c], data.vertices[i].tex_coords[c]);
+		}
+	}
+	for (unsigned int c=0; c<3; ++c) {
+		header.position_min[c] = data.vertices.empty() ? 0.0f : min_position[c];
+		header.position_scale[c] = (max_position[c] > min_position[c]) ? max_position[c] - min_position[c] : 1.0f;
+	}
+	for (unsigned int c=0; c<2; ++c) {
+		header.tex_min[c] = data.vertices.empty() ? 0.0f : min_tex[c];
+		header.tex_scale[c] = (max_tex[c] > min_tex[c]) ? max_tex[c] - min_tex[c] : 1.0f;
+	}
+
+	std::vector<std::vector<unsigned char> > blocks(header.n_vertex_blocks + header.n_triangle_blocks);
+	parallelFor(static_cast<unsigned int>(blocks.size()), [&](unsigned int b) {
+		if (b < header.n_vertex_blocks) {
+			unsigned int first = b * vertex_block_size;
+			unsigned int n = std::min(vertex_block_size, header.n_vertices - first);
+			encodeVertexBlock(header, &data.vertices[first], n, blocks[b]);
+		} else {
+			unsigned int first = (b - header.n_vertex_blocks) * triangle_block_size;
+			unsigned int n = std::min(triangle_block_size, header.n_indices/3 - first);
+			encodeTriangleBlock(&data.indices[3*first], n, blocks[b]);
+		}
+	});
+
+	ByteWriter writer(out);
+	writer.putBytes(&header, sizeof(header));
+	writePart(writer, data.root);
+	for (unsigned int i=0; i<data.textures.size(); ++i) {
+		writer.putVarint(data.textures[i].size());
+		writer.putBytes(data.textures[i].data(), data.textures[i].size());
+	}
+	for (unsigned int b=0; b<blocks.size(); ++b)
+		writer.putVarint(blocks[b].size());
+	for (unsigned int b=0; b<blocks.size(); ++b)
+		writer.putBytes(blocks[b].data(), blocks[b].size());
+}
+
+void GeometryCodec::decode(const unsigned char* data, size_t size, MeshData& out) {
+	ByteReader reader(data, data + size);
+	Header header;
+	reader.getBytes(&header, sizeof(header));
+	if (header.magic != magic || header.version < 1 || header.version > version)
+		THROW_EXCEPTION("Not a compressed geometry file");
+	if (header.n_indices % 3 != 0
+			|| header.n_vertex_blocks != (header.n_vertices + vertex_block_size - 1) / vertex_block_size
+			|| header.n_triangle_blocks != (header.n_indices/3 + triangle_block_size - 1) / triangle_block_size)
+		THROW_EXCEPTION("Corrupt geometry file header");
+
+	out = MeshData();
+	readPart(reader, out.root, header);
+	if (header.n_textures > size)
+		THROW_EXCEPTION("Corrupt geometry file header");
+	out.textures.resize(header.n_textures);
+	for (unsigned int i=0; i<header.n_textures; ++i) {
+		size_t length = static_cast<size_t>(reader.getVarint());
+		const unsigned char* str = reader.skip(length);
+		out.textures[i].assign(reinterpret_cast<const char*>(str), length);
+	}
+
+	unsigned int n_blocks = header.n_vertex_blocks + header.n_triangle_blocks;
+	std::vector<size_t> block_sizes(n_blocks);
+	for (unsigned int b=0; b<n_blocks; ++b)
+		block_sizes[b] = static_cast<size_t>(reader.getVarint());
+	std::vector<const unsigned char*> blocks(n_blocks);
+	for (unsigned int b=0; b<n_blocks; ++b)
+		blocks[b] = reader.skip(block_sizes[b]);
+
+	out.vertices.resize(header.n_vertices);
+	out.indices.resize(header.n_indices);
+	parallelFor(n_blocks, [&](unsigned int b) {
+		ByteReader block_reader(blocks[b], blocks[b] + block_sizes[b]);
+		if (b < header.n_vertex_blocks) {
+			unsigned int first = b * vertex_block_size;
+			unsigned int n = std::min(vertex_block_size, header.n_vertices - first);
+			decodeVertexBlock(header, block_reader, &out.vertices[first], n);
+		} else {
+			unsigned int first = (b - header.n_vertex_blocks) * triangle_block_size;
+			unsigned int n = std::min(triangle_block_size, header.n_indices/3 - first);
+			decodeTriangleBlock(block_reader, &out.indices[3*first], n);
+		}
+	});
+	checkPartIndices(out.root, out.indices, header.n_vertices);
+}
+
+void GeometryCodec::write(const MeshData& data, const std::string& filename) {
+	Timer timer;
+	std::vector<unsigned char> encoded;
+	encode(data, encoded);
+
+	std::ofstream os(filename.c_str(), std::ios::binary);
+	os.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+	if (!os.good())
+		THROW_EXCEPTION("Unable to write " + filename);
+
+	size_t raw = data.vertices.size()*sizeof(VertexData) + data.indices.size()*sizeof(unsigned int);
+	std::cout << "Wrote " << filename << ": " << raw << " bytes compressed to " << encoded.size() << " bytes ("
+		<< static_cast<double>(raw) / std::max<size_t>(encoded.size(), 1) << ":1) in " << timer.elapsed()*1000.0 << " ms" << std::endl;
+}
+
+void GeometryCodec::read(const std::string& filename, MeshData& out) {
+	Timer timer;
+	std::shared_ptr<VirtualFile> file = VirtualFileSystem::open(filename);
+	decode(reinterpret_cast<const unsigned char*>(file->data()), file->size(), out);
+	std::cout << "Decoded " << filename << ": " << out.vertices.size() << " vertices, " << out.indices.size()/3
+		<< " triangles in " << timer.elapsed()*1000.0 << " ms" << std::endl;
+}
+
+bool GeometryCodec::isCompressedFile(const std::string& filename) {
+	return filename.size() > 4 && (filename.compare(filename.size() - 4, 4, ".pgz") == 0
+		|| filename.compare(filename.size() - 4, 4, ".PGZ") == 0);
+}
+
+void GeometryCodec::benchmark(const MeshData& data, unsigned int iterations) {
+	Timer timer;
+	std::vector<unsigned char> encoded;
+	encode(data, encoded);
+	double encode_time = timer.elapsed();
+
+	double best = std::numeric_limits<double>::max();
+	MeshData decoded;
+	for (unsigned int i=0; i<iterations; ++i) {
+		timer.restart();
+		decode(encoded.data(), encoded.size(), decoded);
+		best = std::min(best, timer.elapsed());
+	}
+
+	//Indices are lossless, vertices are quantized
+	if (decoded.indices != data.indices)
+		std::cout << "Decoded indices DIFFER from the original" << std::endl;
+	float position_error = 0.0f;
+	float normal_error = 0.0f;
+	for (size_t i=0; i<data.vertices.size(); ++i) {
+		for (unsigned int c=0; c<3; ++c)
+			position_error = std::max(position_error, std::fabs(decoded.vertices[i].position[c] - data.vertices[i].position[c]));
+		float length = glm::length(data.vertices[i].normal);
+		if (length > 0.0f)
+			normal_error = std::max(normal_error, glm::length(decoded.vertices[i].normal - data.vertices[i].normal / length));
+	}
+
+	size_t raw = data.vertices.size()*sizeof(VertexData) + data.indices.size()*sizeof(unsigned int);
+	std::cout << "Geometry codec: " << data.vertices.size() << " vertices, " << data.indices.size()/3 << " triangles, "
+		<< getThreadCount() << " threads" << std::endl;
+	std::cout << "  Size: " << raw << " -> " << encoded.size() << " bytes (" << static_cast<double>(raw) / encoded.size() << ":1, "
+		<< 8.0 * encoded.size() / std::max<size_t>(data.indices.size()/3, 1) << " bits/triangle)" << std::endl;
+	std::cout << "  Encode: " << encode_time*1000.0 << " ms" << std::endl;
+	std::cout << "  Decode: " << best*1000.0 << " ms (best of " << iterations << "), "
+		<< raw / (best * 1024.0 * 1024.0 * 1024.0) << " GiB/s output" << std::endl;
+	std::cout << "  Max error: position " << position_error << ", normal " << normal_error << std::endl;
+}
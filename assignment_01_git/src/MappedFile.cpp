@@ -0,0 +1,63 @@
+#include "MappedFile.h"
+#include "GameException.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& filename) {
+	ptr = NULL;
+	length = 0;
+#ifdef _WIN32
+	mapping = NULL;
+	file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		THROW_EXCEPTION("Could not open " + filename);
+
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file, &file_size);
+	length = static_cast<size_t>(file_size.QuadPart);
+	if (length == 0)
+		return;
+
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping != NULL)
+		ptr = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (ptr == NULL) {
+		if (mapping != NULL) CloseHandle(mapping);
+		CloseHandle(file);
+		THROW_EXCEPTION("Could not map " + filename);
+	}
+#else
+	fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		THROW_EXCEPTION("Could not open " + filename);
+
+	struct stat st;
+	fstat(fd, &st);
+	length = static_cast<size_t>(st.st_size);
+	if (length == 0)
+		return;
+
+	void* p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		THROW_EXCEPTION("Could not map " + filename);
+	}
+	ptr = static_cast<const char*>(p);
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+	if (ptr != NULL) UnmapViewOfFile(ptr);
+	if (mapping != NULL) CloseHandle(mapping);
+	CloseHandle(file);
+#else
+	if (ptr != NULL) munmap(const_cast<char*>(ptr), length);
+	close(fd);
+#endif
+}
@@ -0,0 +1,60 @@
+#include "MaterialTextures.h"
+
+MaterialTextures::MaterialTextures(const std::vector<MipChain>& images) {
+	GLint max_layers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+
+	//The first image of every array gives its size, then fill arrays up to max_layers
+	std::vector<const MipChain*> formats;
+	std::vector<unsigned int> layers;
+	slots.resize(images.size());
+	for (unsigned int i = 0; i < images.size(); ++i) {
+		const MipChain& image = images[i];
+		if (image.levels.empty())
+			continue;
+
+		unsigned int array = 0;
+		while (array < formats.size() && !(formats[array]->width == image.width && formats[array]->height == image.height
+				&& formats[array]->levels.size() == image.levels.size() && layers[array] < static_cast<unsigned int>(max_layers)))
+			++array;
+		if (array == formats.size()) {
+			formats.push_back(&image);
+			layers.push_back(0);
+		}
+		slots[i].array = array;
+		slots[i].layer = static_cast<int>(layers[array]++);
+	}
+
+	for (unsigned int i = 0; i < formats.size(); ++i)
+		arrays.push_back(Texture2D(formats[i]->width, formats[i]->height, static_cast<unsigned int>(formats[i]->levels.size()), layers[i]));
+}
+
+void MaterialTextures::uploadRows(unsigned int material, unsigned int level, unsigned int first_row, unsigned int rows, const void* pixels) {
+	const MaterialSlot& slot = getSlot(material);
+	if (slot.layer < 0)
+		return;
+	arrays[slot.array].uploadRows(level, first_row, rows, pixels, static_cast<unsigned int>(slot.layer));
+}
+
+void MaterialTextures::setPaged(unsigned int material) {
+	if (material < slots.size())
+		slots[material].paged = true;
+}
+
+void MaterialTextures::upload(const std::vector<MipChain>& images) {
+	for (unsigned int i = 0; i < images.size(); ++i)
+		for (unsigned int l = 0; l < images[i].levels.size(); ++l)
+			uploadRows(i, l, 0, images[i].getLevelHeight(l), images[i].levels[l].data());
+}
+
+void MaterialTextures::bind(unsigned int array) {
+	if (array < arrays.size())
+		arrays[array].bind();
+}
+
+long long MaterialTextures::bytes() const {
+	long long bytes = 0;
+	for (unsigned int i = 0; i < arrays.size(); ++i)
+		bytes += arrays[i].bytes();
+	return bytes;
+}
@@ -0,0 +1,1075 @@
+#include "MeshBVH.h"
+#include "GameException.h"
+#include "Parallel.h"
+#include "Timer.h"
+#include "VirtualFileSystem.h"
+#include "GLUtils/Hash.hpp"
+#include "GLUtils/ProgramCache.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define BVH_SSE
+#endif
+
+namespace {
+
+	const char magic[4] = { 'P', 'G', 'B', 'V' };
+	const unsigned int version = 1;
+
+	struct BVHHeader {
+		char magic[4];
+		unsigned int version;
+		unsigned long long key; //< Of the mesh it was built from
+		unsigned int triangles;
+		unsigned int nodes;
+		unsigned int blocks;
+		unsigned int reserved;
+	};
+
+	// Subtrees smaller than this are built by one worker
+	const unsigned int min_task_triangles = 4096;
+
+	// Subtrees per thread, so that uneven ones are balanced
+	const unsigned int tasks_per_thread = 8;
+
+	// Below this depth nodes are split at the median, which bounds the depth of degenerate meshes
+	const unsigned int max_heuristic_depth = 48;
+
+	// Nodes a query may have to come back to, more than the depth of any tree we build
+	const unsigned int max_stack = 128;
+
+	// Queries checked against every triangle by the benchmark
+	const unsigned int benchmark_checks = 100;
+
+	inline float halfArea(const glm::vec3& min, const glm::vec3& max) {
+		glm::vec3 d = max - min;
+		return d.x*d.y + d.y*d.z + d.z*d.x;
+	}
+
+	inline unsigned int getBin(float centroid, float min, float scale) {
+		return std::min(MeshBVH::bins - 1, static_cast<unsigned int>((centroid - min) * scale));
+	}
+
+	unsigned long long hashParts(const MeshPart& part, unsigned long long hash) {
+		hash = GLUtils::hashBytes(glm::value_ptr(part.transform), sizeof(part.transform), hash);
+		hash = GLUtils::hashBytes(&part.first, sizeof(part.first), hash);
+		hash = GLUtils::hashBytes(&part.count, sizeof(part.count), hash);
+		hash = GLUtils::hashBytes(&part.vertexCount, sizeof(part.vertexCount), hash);
+		for (unsigned int i = 0; i < part.children.size(); ++i)
+			hash = hashParts(part.children[i], hash);
+		return hash;
+	}
+
+	/**
+	 * Moller-Trumbore, t of the hit or a negative number
+	 */
+	inline float intersectTriangle(const glm::vec3& origin, const glm::vec3& direction,
+			const glm::vec3& v0, const glm::vec3& e1, const glm::vec3& e2) {
+		glm::vec3 p = glm::cross(direction, e2);
+		float det = glm::dot(e1, p);
+		if (det == 0.0f)
+			return -1.0f;
+		float inv_det = 1.0f / det;
+		glm::vec3 s = origin - v0;
+		float u = glm::dot(s, p) * inv_det;
+		if (u < 0.0f || u > 1.0f)
+			return -1.0f;
+		glm::vec3 q = glm::cross(s, e1);
+		float v = glm::dot(direction, q) * inv_det;
+		if (v < 0.0f || u + v > 1.0f)
+			return -1.0f;
+		return glm::dot(e2, q) * inv_det;
+	}
+
+	/**
+	 * From Ericson, Real-Time Collision Detection, 5.1.5
+	 */
+	glm::vec3 closestOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+		glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+		float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+		if (d1 <= 0.0f && d2 <= 0.0f)
+			return a;
+		glm::vec3 bp = p - b;
+		float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+		if (d3 >= 0.0f && d4 <= d3)
+			return b;
+		float vc = d1*d4 - d3*d2;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+			return a + ab * (d1 / (d1 - d3));
+		glm::vec3 cp = p - c;
+		float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+		if (d6 >= 0.0f && d5 <= d6)
+			return c;
+		float vb = d5*d2 - d1*d6;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+			return a + ac * (d2 / (d2 - d6));
+		float va = d3*d6 - d5*d4;
+		if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+			return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+		float sum = va + vb + vc;
+		if (sum <= 0.0f)
+			return a; //< Degenerate triangle
+		return a + ab * (vb / sum) + ac * (vc / sum);
+	}
+
+	inline float boxDistance2(const glm::vec3& min, const glm::vec3& max, const glm::vec3& p) {
+		glm::vec3 d = glm::max(glm::max(min - p, p - max), glm::vec3(0.0f));
+		return glm::dot(d, d);
+	}
+
+	/**
+	 * 0 if the box is outside one of the planes, 2 if it is inside all of them, 1 otherwise
+	 */
+	inline int classifyBox(const glm::vec3& min, const glm::vec3& max, const glm::vec4* planes) {
+		int result = 2;
+		for (int i = 0; i < 6; ++i) {
+			const glm::vec4& plane = planes[i];
+			glm::vec3 far_corner(plane.x > 0.0f ? max.x : min.x, plane.y > 0.0f ? max.y : min.y, plane.z > 0.0f ? max.z : min.z);
+			glm::vec3 near_corner(plane.x > 0.0f ? min.x : max.x, plane.y > 0.0f ? min.y : max.y, plane.z > 0.0f ? min.z : max.z);
+			if (glm::dot(glm::vec3(plane), far_corner) + plane.w < 0.0f)
+				return 0;
+			if (glm::dot(glm::vec3(plane), near_corner) + plane.w < 0.0f)
+				result = 1;
+		}
+		return result;
+	}
+
+	/**
+	 * The ray, set up once per query
+	 */
+	struct Ray {
+		Ray(const glm::vec3& origin, const glm::vec3& direction) : origin(origin), direction(direction) {
+			//Tiny instead of zero components, so that no slab gives 0 * infinity
+			for (int c = 0; c < 3; ++c) {
+				float d = direction[c];
+				if (std::fabs(d) < 1e-30f)
+					d = (d < 0.0f) ? -1e-30f : 1e-30f;
+				inv_direction[c] = 1.0f / d;
+			}
+#ifdef BVH_SSE
+			o = _mm_set_ps(0.0f, origin.z, origin.y, origin.x);
+			inv = _mm_set_ps(0.0f, inv_direction.z, inv_direction.y, inv_direction.x);
+#endif
+		}
+
+		glm::vec3 origin;
+		glm::vec3 direction;
+		glm::vec3 inv_direction;
+#ifdef BVH_SSE
+		__m128 o, inv;
+#endif
+	};
+
+	/**
+	 * Slab test of the box min, max (three floats each) against the ray,
+	 * t of where it enters the box
+	 */
+	inline bool hitBox(const float* min, const float* max, const Ray& ray, float max_t, float& t) {
+#ifdef BVH_SSE
+		//The fourth lane is the next member of the node, and ignored
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(min), ray.o), ray.inv);
+		__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(max), ray.o), ray.inv);
+		__m128 near4 = _mm_min_ps(t1, t2);
+		__m128 far4 = _mm_max_ps(t1, t2);
+		__m128 near1 = _mm_max_ps(near4, _mm_shuffle_ps(near4, near4, _MM_SHUFFLE(3, 0, 2, 1)));
+		__m128 far1 = _mm_min_ps(far4, _mm_shuffle_ps(far4, far4, _MM_SHUFFLE(3, 0, 2, 1)));
+		near1 = _mm_max_ss(near1, _mm_movehl_ps(near4, near4));
+		far1 = _mm_min_ss(far1, _mm_movehl_ps(far4, far4));
+		float t_near, t_far;
+		_mm_store_ss(&t_near, near1);
+		_mm_store_ss(&t_far, far1);
+#else
+		float t_near = -std::numeric_limits<float>::max();
+		float t_far = std::numeric_limits<float>::max();
+		for (int c = 0; c < 3; ++c) {
+			float t1 = (min[c] - ray.origin[c]) * ray.inv_direction[c];
+			float t2 = (max[c] - ray.origin[c]) * ray.inv_direction[c];
+			t_near = std::max(t_near, std::min(t1, t2));
+			t_far = std::min(t_far, std::max(t1, t2));
+		}
+#endif
+		t = t_near;
+		return t_far >= std::max(t_near, 0.0f) && t_near <= max_t;
+	}
+
+	/**
+	 * Tests the ray against the four triangles of a block. Returns a bit
+	 * per lane that was hit before max_t, with the hits in t.
+	 */
+	inline int hitTriangles(const float (*v0)[4], const float (*e1)[4], const float (*e2)[4],
+			const Ray& ray, float max_t, float* t) {
+#ifdef BVH_SSE
+		__m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+		__m128 e1x = _mm_loadu_ps(e1[0]), e1y = _mm_loadu_ps(e1[1]), e1z = _mm_loadu_ps(e1[2]);
+		__m128 e2x = _mm_loadu_ps(e2[0]), e2y = _mm_loadu_ps(e2[1]), e2z = _mm_loadu_ps(e2[2]);
+
+		//p = direction x e2
+		__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 zero = _mm_setzero_ps();
+		__m128 valid = _mm_cmpneq_ps(det, zero);
+		__m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), _mm_or_ps(_mm_andnot_ps(valid, _mm_set1_ps(1.0f)), _mm_and_ps(valid, det)));
+
+		//s = origin - v0
+		__m128 sx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_loadu_ps(v0[0]));
+		__m128 sy = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_loadu_ps(v0[1]));
+		__m128 sz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_loadu_ps(v0[2]));
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv_det);
+
+		//q = s x e1
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+		__m128 hit_t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+		valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+		valid = _mm_and_ps(valid, _mm_cmpgt_ps(hit_t, zero));
+		valid = _mm_and_ps(valid, _mm_cmple_ps(hit_t, _mm_set1_ps(max_t)));
+		_mm_storeu_ps(t, hit_t);
+		return _mm_movemask_ps(valid);
+#else
+		int mask = 0;
+		for (int l = 0; l < 4; ++l) {
+			t[l] = intersectTriangle(ray.origin, ray.direction, glm::vec3(v0[0][l], v0[1][l], v0[2][l]),
+				glm::vec3(e1[0][l], e1[1][l], e1[2][l]), glm::vec3(e2[0][l], e2[1][l], e2[2][l]));
+			if (t[l] > 0.0f && t[l] <= max_t)
+				mask |= 1 << l;
+		}
+		return mask;
+#endif
+	}
+
+#ifdef BVH_SSE
+	/**
+	 * a where mask is set, b elsewhere
+	 */
+	inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	inline __m128 dot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+	}
+#endif
+
+	/**
+	 * closestOnTriangle for the four triangles of a block. The closest
+	 * points go to closest, their squared distances to point to distance2.
+	 */
+	inline void closestTriangles(const float (*v0)[4], const float (*e1)[4], const float (*e2)[4],
+			const glm::vec3& point, float (*closest)[4], float* distance2) {
+#ifdef BVH_SSE
+		//Every region of Ericson's test for all lanes, the first one that applies is kept
+		__m128 zero = _mm_setzero_ps();
+		__m128 px = _mm_set1_ps(point.x), py = _mm_set1_ps(point.y), pz = _mm_set1_ps(point.z);
+		__m128 ax = _mm_loadu_ps(v0[0]), ay = _mm_loadu_ps(v0[1]), az = _mm_loadu_ps(v0[2]);
+		__m128 abx = _mm_loadu_ps(e1[0]), aby = _mm_loadu_ps(e1[1]), abz = _mm_loadu_ps(e1[2]);
+		__m128 acx = _mm_loadu_ps(e2[0]), acy = _mm_loadu_ps(e2[1]), acz = _mm_loadu_ps(e2[2]);
+		__m128 bx = _mm_add_ps(ax, abx), by = _mm_add_ps(ay, aby), bz = _mm_add_ps(az, abz);
+		__m128 cx = _mm_add_ps(ax, acx), cy = _mm_add_ps(ay, acy), cz = _mm_add_ps(az, acz);
+
+		__m128 apx = _mm_sub_ps(px, ax), apy = _mm_sub_ps(py, ay), apz = _mm_sub_ps(pz, az);
+		__m128 d1 = dot(abx, aby, abz, apx, apy, apz);
+		__m128 d2 = dot(acx, acy, acz, apx, apy, apz);
+		__m128 bpx = _mm_sub_ps(px, bx), bpy = _mm_sub_ps(py, by), bpz = _mm_sub_ps(pz, bz);
+		__m128 d3 = dot(abx, aby, abz, bpx, bpy, bpz);
+		__m128 d4 = dot(acx, acy, acz, bpx, bpy, bpz);
+		__m128 cpx = _mm_sub_ps(px, cx), cpy = _mm_sub_ps(py, cy), cpz = _mm_sub_ps(pz, cz);
+		__m128 d5 = dot(abx, aby, abz, cpx, cpy, cpz);
+		__m128 d6 = dot(acx, acy, acz, cpx, cpy, cpz);
+		__m128 vc = _mm_sub_ps(_mm_mul_ps(d1, d4), _mm_mul_ps(d3, d2));
+		__m128 vb = _mm_sub_ps(_mm_mul_ps(d5, d2), _mm_mul_ps(d1, d6));
+		__m128 va = _mm_sub_ps(_mm_mul_ps(d3, d6), _mm_mul_ps(d5, d4));
+
+		//Inside the triangle, the divisions of the lanes that are not are dropped by the masks below
+		__m128 sum = _mm_add_ps(_mm_add_ps(va, vb), vc);
+		__m128 v = _mm_div_ps(vb, sum), w = _mm_div_ps(vc, sum);
+		__m128 rx = _mm_add_ps(_mm_add_ps(ax, _mm_mul_ps(abx, v)), _mm_mul_ps(acx, w));
+		__m128 ry = _mm_add_ps(_mm_add_ps(ay, _mm_mul_ps(aby, v)), _mm_mul_ps(acy, w));
+		__m128 rz = _mm_add_ps(_mm_add_ps(az, _mm_mul_ps(abz, v)), _mm_mul_ps(acz, w));
+		__m128 mask = _mm_cmple_ps(sum, zero);
+		rx = select(mask, ax, rx);
+		ry = select(mask, ay, ry);
+		rz = select(mask, az, rz);
+
+		//Edge bc
+		__m128 d43 = _mm_sub_ps(d4, d3), d56 = _mm_sub_ps(d5, d6);
+		mask = _mm_and_ps(_mm_cmple_ps(va, zero), _mm_and_ps(_mm_cmpge_ps(d43, zero), _mm_cmpge_ps(d56, zero)));
+		__m128 t = _mm_div_ps(d43, _mm_add_ps(d43, d56));
+		rx = select(mask, _mm_add_ps(bx, _mm_mul_ps(_mm_sub_ps(cx, bx), t)), rx);
+		ry = select(mask, _mm_add_ps(by, _mm_mul_ps(_mm_sub_ps(cy, by), t)), ry);
+		rz = select(mask, _mm_add_ps(bz, _mm_mul_ps(_mm_sub_ps(cz, bz), t)), rz);
+
+		//Edge ac
+		mask = _mm_and_ps(_mm_cmple_ps(vb, zero), _mm_and_ps(_mm_cmpge_ps(d2, zero), _mm_cmple_ps(d6, zero)));
+		t = _mm_div_ps(d2, _mm_sub_ps(d2, d6));
+		rx = select(mask, _mm_add_ps(ax, _mm_mul_ps(acx, t)), rx);
+		ry = select(mask, _mm_add_ps(ay, _mm_mul_ps(acy, t)), ry);
+		rz = select(mask, _mm_add_ps(az, _mm_mul_ps(acz, t)), rz);
+
+		//Vertex c
+		mask = _mm_and_ps(_mm_cmpge_ps(d6, zero), _mm_cmple_ps(d5, d6));
+		rx = select(mask, cx, rx);
+		ry = select(mask, cy, ry);
+		rz = select(mask, cz, rz);
+
+		//Edge ab
+		mask = _mm_and_ps(_mm_cmple_ps(vc, zero), _mm_and_ps(_mm_cmpge_ps(d1, zero), _mm_cmple_ps(d3, zero)));
+		t = _mm_div_ps(d1, _mm_sub_ps(d1, d3));
+		rx = select(mask, _mm_add_ps(ax, _mm_mul_ps(abx, t)), rx);
+		ry = select(mask, _mm_add_ps(ay, _mm_mul_ps(aby, t)), ry);
+		rz = select(mask, _mm_add_ps(az, _mm_mul_ps(abz, t)), rz);
+
+		//Vertex b
+		mask = _mm_and_ps(_mm_cmpge_ps(d3, zero), _mm_cmple_ps(d4, d3));
+		rx = select(mask, bx, rx);
+		ry = select(mask, by, ry);
+		rz = select(mask, bz, rz);
+
+		//Vertex a
+		mask = _mm_and_ps(_mm_cmple_ps(d1, zero), _mm_cmple_ps(d2, zero));
+		rx = select(mask, ax, rx);
+		ry = select(mask, ay, ry);
+		rz = select(mask, az, rz);
+
+		__m128 dx = _mm_sub_ps(rx, px), dy = _mm_sub_ps(ry, py), dz = _mm_sub_ps(rz, pz);
+		_mm_storeu_ps(closest[0], rx);
+		_mm_storeu_ps(closest[1], ry);
+		_mm_storeu_ps(closest[2], rz);
+		_mm_storeu_ps(distance2, dot(dx, dy, dz, dx, dy, dz));
+#else
+		for (int l = 0; l < 4; ++l) {
+			glm::vec3 a(v0[0][l], v0[1][l], v0[2][l]);
+			glm::vec3 c = closestOnTriangle(point, a, a + glm::vec3(e1[0][l], e1[1][l], e1[2][l]),
+				a + glm::vec3(e2[0][l], e2[1][l], e2[2][l]));
+			glm::vec3 d = c - point;
+			closest[0][l] = c.x;
+			closest[1][l] = c.y;
+			closest[2][l] = c.z;
+			distance2[l] = glm::dot(d, d);
+		}
+#endif
+	}
+
+	/**
+	 * The planes of a frustum, set up once per query
+	 */
+	struct Frustum {
+		Frustum(const glm::mat4& view_projection) {
+			//Rows of the matrix, added and subtracted, are the planes, with the inside positive
+			for (int i = 0; i < 3; ++i) {
+				glm::vec4 row(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+				glm::vec4 w(view_projection[0][3], view_projection[1][3], view_projection[2][3], view_projection[3][3]);
+				planes[2*i] = w + row;
+				planes[2*i + 1] = w - row;
+			}
+#ifdef BVH_SSE
+			for (int i = 0; i < 6; ++i) {
+				for (int c = 0; c < 4; ++c)
+					plane[i][c] = _mm_set1_ps(planes[i][c]);
+			}
+#endif
+		}
+
+		glm::vec4 planes[6];
+#ifdef BVH_SSE
+		__m128 plane[6][4]; //< Every component in all lanes
+#endif
+	};
+
+	/**
+	 * classifyBox for the bounds of the four triangles of a block. Returns
+	 * a bit per lane that is not outside one of the planes.
+	 */
+	inline int frustumTriangles(const float (*v0)[4], const float (*e1)[4], const float (*e2)[4], const Frustum& frustum) {
+#ifdef BVH_SSE
+		__m128 min[3], max[3];
+		for (int c = 0; c < 3; ++c) {
+			__m128 a = _mm_loadu_ps(v0[c]);
+			__m128 b = _mm_add_ps(a, _mm_loadu_ps(e1[c]));
+			__m128 d = _mm_add_ps(a, _mm_loadu_ps(e2[c]));
+			min[c] = _mm_min_ps(a, _mm_min_ps(b, d));
+			max[c] = _mm_max_ps(a, _mm_max_ps(b, d));
+		}
+		__m128 zero = _mm_setzero_ps();
+		__m128 outside = zero;
+		for (int i = 0; i < 6; ++i) {
+			const glm::vec4& p = frustum.planes[i];
+			const __m128* plane = frustum.plane[i];
+			__m128 distance = dot(plane[0], plane[1], plane[2],
+				(p.x > 0.0f) ? max[0] : min[0], (p.y > 0.0f) ? max[1] : min[1], (p.z > 0.0f) ? max[2] : min[2]);
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, plane[3]), zero));
+		}
+		return ~_mm_movemask_ps(outside) & 15;
+#else
+		int mask = 0;
+		for (int l = 0; l < 4; ++l) {
+			glm::vec3 a(v0[0][l], v0[1][l], v0[2][l]);
+			glm::vec3 b = a + glm::vec3(e1[0][l], e1[1][l], e1[2][l]);
+			glm::vec3 c = a + glm::vec3(e2[0][l], e2[1][l], e2[2][l]);
+			if (classifyBox(glm::min(a, glm::min(b, c)), glm::max(a, glm::max(b, c)), frustum.planes) != 0)
+				mask |= 1 << l;
+		}
+		return mask;
+#endif
+	}
+}
+
+MeshBVH::MeshBVH() : n_triangles(0), build_time(0.0) {
+}
+
+MeshBVH::MeshBVH(const MeshData& data) : n_triangles(0), build_time(0.0) {
+	Timer timer;
+	BuildInput input;
+	unsigned int part_index = 0;
+	addParts(data.root, glm::mat4(1.0f), data.vertices, data.indices, input, part_index);
+	build(input);
+	build_time = timer.elapsed();
+}
+
+void MeshBVH::addParts(const MeshPart& part, const glm::mat4& transform, const std::vector<VertexData>& vertices,
+		const std::vector<unsigned int>& indices, BuildInput& input, unsigned int& part_index) {
+	unsigned int index = part_index++;
+	unsigned int count = part.count - part.count % 3;
+	for (unsigned int i = 0; i < count; ++i) {
+		const glm::vec3& position = vertices[indices[part.first + i] + part.vertexCount].position;
+		input.vertices.push_back(glm::vec3(transform * glm::vec4(position, 1.0f)));
+	}
+	parts.insert(parts.end(), count / 3, index);
+
+	for (unsigned int i = 0; i < part.children.size(); ++i)
+		addParts(part.children[i], transform * part.children[i].transform, vertices, indices, input, part_index);
+}
+
+/* * *
+* The top of the tree is split on this thread until the ranges are small
+* enough to balance over the threads, and each of those is then built
+* into a tree of its own in parallel. Their nodes are appended after the
+* top, moving the children indices by where they end up.
+* * */
+void MeshBVH::build(BuildInput& input) {
+	n_triangles = static_cast<unsigned int>(parts.size());
+	nodes.clear();
+	blocks.clear();
+	if (n_triangles == 0)
+		return;
+
+	input.min.resize(n_triangles);
+	input.max.resize(n_triangles);
+	input.centroid.resize(n_triangles);
+	input.order.resize(n_triangles);
+	unsigned int chunks = (n_triangles + min_task_triangles - 1) / min_task_triangles;
+	parallelFor(chunks, [&](unsigned int chunk) {
+		unsigned int end = std::min(n_triangles, (chunk + 1) * min_task_triangles);
+		for (unsigned int t = chunk * min_task_triangles; t < end; ++t) {
+			const glm::vec3* v = &input.vertices[t*3];
+			input.min[t] = glm::min(v[0], glm::min(v[1], v[2]));
+			input.max[t] = glm::max(v[0], glm::max(v[1], v[2]));
+			input.centroid[t] = (input.min[t] + input.max[t]) * 0.5f;
+			input.order[t] = t;
+		}
+	});
+
+	unsigned int task_size = std::max(min_task_triangles, n_triangles / (getThreadCount() * tasks_per_thread));
+	std::vector<BuildTask> tasks;
+	BuildTask root;
+	root.node = 0;
+	root.begin = 0;
+	root.end = n_triangles;
+	root.depth = 0;
+	nodes.resize(1);
+	buildRange(input, nodes, root, &tasks, task_size);
+
+	std::vector<std::vector<Node> > subtrees(tasks.size());
+	parallelFor(static_cast<unsigned int>(tasks.size()), [&](unsigned int i) {
+		BuildTask task = tasks[i];
+		task.node = 0;
+		subtrees[i].resize(1);
+		buildRange(input, subtrees[i], task, NULL, 0);
+	});
+	for (unsigned int i = 0; i < subtrees.size(); ++i) {
+		//Node 1 of the subtree goes where nodes ends now
+		unsigned int base = static_cast<unsigned int>(nodes.size()) - 1;
+		for (unsigned int j = 0; j < subtrees[i].size(); ++j) {
+			Node node = subtrees[i][j];
+			if (node.count == 0)
+				node.first += base;
+			if (j == 0)
+				nodes[tasks[i].node] = node;
+			else
+				nodes.push_back(node);
+		}
+	}
+
+	//Leaves refer to their range of input.order until they get their block
+	for (unsigned int i = 0; i < nodes.size(); ++i) {
+		Node& node = nodes[i];
+		if (node.count == 0)
+			continue;
+		Block block;
+		memset(&block, 0, sizeof(block));
+		for (unsigned int l = 0; l < 4; ++l) {
+			if (l >= node.count) {
+				block.triangles[l] = MeshHit::invalid;
+				continue;
+			}
+			unsigned int t = input.order[node.first + l];
+			const glm::vec3* v = &input.vertices[t*3];
+			for (int c = 0; c < 3; ++c) {
+				block.v0[c][l] = v[0][c];
+				block.e1[c][l] = v[1][c] - v[0][c];
+				block.e2[c][l] = v[2][c] - v[0][c];
+			}
+			block.triangles[l] = t;
+		}
+		node.first = static_cast<unsigned int>(blocks.size());
+		blocks.push_back(block);
+	}
+}
+
+void MeshBVH::buildRange(BuildInput& input, std::vector<Node>& out, const BuildTask& root,
+		std::vector<BuildTask>* tasks, unsigned int task_size) {
+	std::vector<BuildTask> stack(1, root);
+	while (!stack.empty()) {
+		BuildTask range = stack.back();
+		stack.pop_back();
+
+		glm::vec3 min(std::numeric_limits<float>::max()), max(-std::numeric_limits<float>::max());
+		glm::vec3 centroid_min = min, centroid_max = max;
+		for (unsigned int i = range.begin; i < range.end; ++i) {
+			unsigned int t = input.order[i];
+			min = glm::min(min, input.min[t]);
+			max = glm::max(max, input.max[t]);
+			centroid_min = glm::min(centroid_min, input.centroid[t]);
+			centroid_max = glm::max(centroid_max, input.centroid[t]);
+		}
+		out[range.node].min = min;
+		out[range.node].max = max;
+
+		unsigned int count = range.end - range.begin;
+		if (count <= leaf_triangles) {
+			out[range.node].first = range.begin;
+			out[range.node].count = count;
+			continue;
+		}
+		out[range.node].first = 0;
+		out[range.node].count = 0;
+		if (tasks != NULL && count < task_size) {
+			tasks->push_back(range);
+			continue;
+		}
+
+		unsigned int middle = split(input, range.begin, range.end, centroid_min, centroid_max, range.depth < max_heuristic_depth);
+		unsigned int children = static_cast<unsigned int>(out.size());
+		out.resize(children + 2);
+		out[range.node].first = children;
+
+		BuildTask left = { children, range.begin, middle, range.depth + 1 };
+		BuildTask right = { children + 1, middle, range.end, range.depth + 1 };
+		stack.push_back(right);
+		stack.push_back(left);
+	}
+}
+
+unsigned int MeshBVH::split(BuildInput& input, unsigned int begin, unsigned int end,
+		const glm::vec3& centroid_min, const glm::vec3& centroid_max, bool heuristic) {
+	glm::vec3 extent = centroid_max - centroid_min;
+	int longest = (extent.x > extent.y) ? ((extent.x > extent.z) ? 0 : 2) : ((extent.y > extent.z) ? 1 : 2);
+	if (extent[longest] <= 0.0f)
+		return begin + (end - begin) / 2; //< All at one point, any split will do
+
+	if (heuristic) {
+		//Cost of a split after bin b: area times triangles of both sides, the cost of the node itself is the same for all
+		float best_cost = std::numeric_limits<float>::max();
+		int best_axis = -1;
+		unsigned int best_bin = 0;
+		for (int axis = 0; axis < 3; ++axis) {
+			if (extent[axis] <= 0.0f)
+				continue;
+			float scale = bins / extent[axis];
+			unsigned int counts[bins];
+			glm::vec3 bin_min[bins], bin_max[bins];
+			for (unsigned int b = 0; b < bins; ++b) {
+				counts[b] = 0;
+				bin_min[b] = glm::vec3(std::numeric_limits<float>::max());
+				bin_max[b] = glm::vec3(-std::numeric_limits<float>::max());
+			}
+			for (unsigned int i = begin; i < end; ++i) {
+				unsigned int t = input.order[i];
+				unsigned int b = getBin(input.centroid[t][axis], centroid_min[axis], scale);
+				++counts[b];
+				bin_min[b] = glm::min(bin_min[b], input.min[t]);
+				bin_max[b] = glm::max(bin_max[b], input.max[t]);
+			}
+
+			float right_area[bins];
+			unsigned int right_count[bins];
+			glm::vec3 min = bin_min[bins - 1], max = bin_max[bins - 1];
+			unsigned int count = 0;
+			for (unsigned int b = bins - 1; b > 0; --b) {
+				min = glm::min(min, bin_min[b]);
+				max = glm::max(max, bin_max[b]);
+				count += counts[b];
+				right_count[b] = count;
+				right_area[b] = (count > 0) ? halfArea(min, max) : 0.0f;
+			}
+			min = bin_min[0];
+			max = bin_max[0];
+			count = 0;
+			for (unsigned int b = 0; b + 1 < bins; ++b) {
+				min = glm::min(min, bin_min[b]);
+				max = glm::max(max, bin_max[b]);
+				count += counts[b];
+				if (count == 0 || right_count[b + 1] == 0)
+					continue;
+				float cost = halfArea(min, max) * count + right_area[b + 1] * right_count[b + 1];
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_axis = axis;
+					best_bin = b + 1;
+				}
+			}
+		}
+
+		if (best_axis >= 0) {
+			float min = centroid_min[best_axis];
+			float scale = bins / extent[best_axis];
+			const std::vector<glm::vec3>& centroid = input.centroid;
+			std::vector<unsigned int>::iterator middle = std::partition(input.order.begin() + begin, input.order.begin() + end,
+				[&](unsigned int t) { return getBin(centroid[t][best_axis], min, scale) < best_bin; });
+			unsigned int result = static_cast<unsigned int>(middle - input.order.begin());
+			if (result > begin && result < end)
+				return result;
+		}
+	}
+
+	unsigned int middle = begin + (end - begin) / 2;
+	const std::vector<glm::vec3>& centroid = input.centroid;
+	std::nth_element(input.order.begin() + begin, input.order.begin() + middle, input.order.begin() + end,
+		[&](unsigned int a, unsigned int b) { return centroid[a][longest] < centroid[b][longest]; });
+	return middle;
+}
+
+bool MeshBVH::intersect(const glm::vec3& origin, const glm::vec3& direction, MeshHit& hit, float max_distance) const {
+	if (nodes.empty())
+		return false;
+	Ray ray(origin, direction);
+	float best = max_distance;
+	unsigned int best_triangle = MeshHit::invalid;
+
+	struct Entry {
+		const Node* node;
+		float t;
+	};
+	Entry stack[max_stack];
+	unsigned int top = 0;
+
+	float t;
+	if (!hitBox(&nodes[0].min.x, &nodes[0].max.x, ray, best, t))
+		return false;
+	stack[top].node = &nodes[0];
+	stack[top++].t = t;
+
+	while (top > 0) {
+		Entry entry = stack[--top];
+		if (entry.t > best)
+			continue; //< A nearer hit was found since it was pushed
+		const Node* node = entry.node;
+
+		//Down the nearer child, keeping the farther one for later
+		while (node->count == 0) {
+			const Node* a = &nodes[node->first];
+			const Node* b = a + 1;
+			float ta, tb;
+			bool hit_a = hitBox(&a->min.x, &a->max.x, ray, best, ta);
+			bool hit_b = hitBox(&b->min.x, &b->max.x, ray, best, tb);
+			if (hit_a && hit_b) {
+				if (tb < ta) {
+					std::swap(a, b);
+					std::swap(ta, tb);
+				}
+				stack[top].node = b;
+				stack[top++].t = tb;
+				node = a;
+			} else if (hit_a) {
+				node = a;
+			} else if (hit_b) {
+				node = b;
+			} else {
+				node = NULL;
+				break;
+			}
+		}
+		if (node == NULL)
+			continue;
+
+		const Block& block = blocks[node->first];
+		float hits[4];
+		int mask = hitTriangles(block.v0, block.e1, block.e2, ray, best, hits);
+		for (unsigned int l = 0; l < node->count; ++l) {
+			if ((mask & (1 << l)) && hits[l] <= best) {
+				best = hits[l];
+				best_triangle = block.triangles[l];
+			}
+		}
+	}
+
+	if (best_triangle == MeshHit::invalid)
+		return false;
+	hit.triangle = best_triangle;
+	hit.part = parts[best_triangle];
+	hit.distance = best;
+	hit.position = origin + direction * best;
+	return true;
+}
+
+bool MeshBVH::closestPoint(const glm::vec3& point, MeshHit& hit, float max_distance) const {
+	if (nodes.empty())
+		return false;
+	float best = (max_distance < std::sqrt(std::numeric_limits<float>::max())) ? max_distance * max_distance : std::numeric_limits<float>::max();
+	unsigned int best_triangle = MeshHit::invalid;
+	glm::vec3 best_point;
+
+	struct Entry {
+		const Node* node;
+		float distance2;
+	};
+	Entry stack[max_stack];
+	unsigned int top = 0;
+	stack[top].node = &nodes[0];
+	stack[top++].distance2 = boxDistance2(nodes[0].min, nodes[0].max, point);
+
+	while (top > 0) {
+		Entry entry = stack[--top];
+		if (entry.distance2 > best)
+			continue;
+		const Node* node = entry.node;
+
+		if (node->count == 0) {
+			//The nearer child is popped first
+			const Node* a = &nodes[node->first];
+			const Node* b = a + 1;
+			float da = boxDistance2(a->min, a->max, point);
+			float db = boxDistance2(b->min, b->max, point);
+			if (da < db) {
+				std::swap(a, b);
+				std::swap(da, db);
+			}
+			if (da <= best) {
+				stack[top].node = a;
+				stack[top++].distance2 = da;
+			}
+			if (db <= best) {
+				stack[top].node = b;
+				stack[top++].distance2 = db;
+			}
+			continue;
+		}
+
+		const Block& block = blocks[node->first];
+		float closest[3][4], distance2[4];
+		closestTriangles(block.v0, block.e1, block.e2, point, closest, distance2);
+		for (unsigned int l = 0; l < node->count; ++l) {
+			if (distance2[l] <= best) {
+				best = distance2[l];
+				best_triangle = block.triangles[l];
+				best_point = glm::vec3(closest[0][l], closest[1][l], closest[2][l]);
+			}
+		}
+	}
+
+	if (best_triangle == MeshHit::invalid)
+		return false;
+	hit.triangle = best_triangle;
+	hit.part = parts[best_triangle];
+	hit.distance = std::sqrt(best);
+	hit.position = best_point;
+	return true;
+}
+
+unsigned int MeshBVH::frustum(const glm::mat4& view_projection, std::vector<unsigned int>* triangles) const {
+	if (nodes.empty())
+		return 0;
+
+	Frustum planes(view_projection);
+
+	struct Entry {
+		const Node* node;
+		bool inside; //< All of it, so the planes are not tested any more
+	};
+	Entry stack[max_stack];
+	unsigned int top = 0;
+	stack[top].node = &nodes[0];
+	stack[top++].inside = false;
+
+	unsigned int count = 0;
+	while (top > 0) {
+		Entry entry = stack[--top];
+		const Node* node = entry.node;
+		bool inside = entry.inside;
+		if (!inside) {
+			int side = classifyBox(node->min, node->max, planes.planes);
+			if (side == 0)
+				continue;
+			inside = (side == 2);
+		}
+
+		if (node->count == 0) {
+			stack[top].node = &nodes[node->first];
+			stack[top++].inside = inside;
+			stack[top].node = &nodes[node->first + 1];
+			stack[top++].inside = inside;
+			continue;
+		}
+
+		const Block& block = blocks[node->first];
+		int mask = inside ? 15 : frustumTriangles(block.v0, block.e1, block.e2, planes);
+		for (unsigned int l = 0; l < node->count; ++l) {
+			if (!(mask & (1 << l)))
+				continue;
+			++count;
+			if (triangles != NULL)
+				triangles->push_back(block.triangles[l]);
+		}
+	}
+	return count;
+}
+
+long long MeshBVH::bytes() const {
+	return static_cast<long long>(nodes.size()) * sizeof(Node) + static_cast<long long>(blocks.size()) * sizeof(Block)
+		+ static_cast<long long>(parts.size()) * sizeof(unsigned int);
+}
+
+unsigned long long MeshBVH::getKey(const MeshData& data) {
+	unsigned long long hash = GLUtils::hashBytes(data.vertices.data(), data.vertices.size() * sizeof(VertexData));
+	hash = GLUtils::hashBytes(data.indices.data(), data.indices.size() * sizeof(unsigned int), hash);
+	return hashParts(data.root, hash);
+}
+
+std::shared_ptr<MeshBVH> MeshBVH::create(const MeshData& data, const std::string& cache_directory) {
+	std::shared_ptr<MeshBVH> bvh;
+	std::string filename;
+	unsigned long long key = 0;
+	if (!cache_directory.empty()) {
+		key = getKey(data);
+		std::stringstream ss;
+		ss << cache_directory << std::hex << std::setw(16) << std::setfill('0') << key << ".bvh";
+		filename = ss.str();
+		if (VirtualFileSystem::exists(filename)) {
+			try {
+				bvh = read(filename, key);
+			} catch (GameException&) {
+				std::cout << "Building the BVH again, " << filename << " is not usable" << std::endl;
+			}
+		}
+	}
+
+	if (!bvh) {
+		bvh.reset(new MeshBVH(data));
+		if (!filename.empty()) {
+			try {
+				GLUtils::createDirectory(cache_directory);
+				bvh->write(filename, key);
+			} catch (GameException&) {
+				std::cout << "Unable to write the BVH to " << filename << std::endl;
+			}
+		}
+	}
+
+	std::cout << "BVH: " << bvh->n_triangles << " triangles, " << bvh->nodes.size() << " nodes, ";
+	if (bvh->build_time > 0.0)
+		std::cout << "built in " << bvh->build_time * 1000.0 << " ms" << std::endl;
+	else
+		std::cout << "read from " << filename << std::endl;
+	return bvh;
+}
+
+void MeshBVH::write(const std::string& filename, unsigned long long key) const {
+	BVHHeader header;
+	memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.key = key;
+	header.triangles = n_triangles;
+	header.nodes = static_cast<unsigned int>(nodes.size());
+	header.blocks = static_cast<unsigned int>(blocks.size());
+	header.reserved = 0;
+
+	std::ofstream file(filename.c_str(), std::ios::binary);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(Node));
+	file.write(reinterpret_cast<const char*>(blocks.data()), blocks.size() * sizeof(Block));
+	file.write(reinterpret_cast<const char*>(parts.data()), parts.size() * sizeof(unsigned int));
+	if (!file.good())
+		THROW_EXCEPTION("Could not write " + filename);
+}
+
+std::shared_ptr<MeshBVH> MeshBVH::read(const std::string& filename, unsigned long long key) {
+	std::shared_ptr<VirtualFile> file = VirtualFileSystem::open(filename);
+	const char* data = file->data();
+	BVHHeader header;
+	if (file->size() < sizeof(header))
+		THROW_EXCEPTION("Not a BVH file");
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version || header.key != key)
+		THROW_EXCEPTION("Not a BVH file of this mesh, or the wrong version");
+	size_t node_bytes = static_cast<size_t>(header.nodes) * sizeof(Node);
+	size_t block_bytes = static_cast<size_t>(header.blocks) * sizeof(Block);
+	size_t part_bytes = static_cast<size_t>(header.triangles) * sizeof(unsigned int);
+	if (file->size() != sizeof(header) + node_bytes + block_bytes + part_bytes)
+		THROW_EXCEPTION("Truncated BVH file");
+
+	std::shared_ptr<MeshBVH> bvh(new MeshBVH());
+	bvh->n_triangles = header.triangles;
+	bvh->nodes.resize(header.nodes);
+	bvh->blocks.resize(header.blocks);
+	bvh->parts.resize(header.triangles);
+	data += sizeof(header);
+	memcpy(bvh->nodes.data(), data, node_bytes);
+	memcpy(bvh->blocks.data(), data + node_bytes, block_bytes);
+	memcpy(bvh->parts.data(), data + node_bytes + block_bytes, part_bytes);
+
+	//Children come after their node, so no query loops, and no deeper than the stacks of the queries
+	std::vector<unsigned int> depth(header.nodes, 0);
+	for (unsigned int i = 0; i < header.nodes; ++i) {
+		const Node& node = bvh->nodes[i];
+		if (node.count == 0) {
+			if (node.first <= i || node.first >= header.nodes - 1 || depth[i] + 2 >= max_stack)
+				THROW_EXCEPTION("Corrupt BVH node in " + filename);
+			depth[node.first] = std::max(depth[node.first], depth[i] + 1);
+			depth[node.first + 1] = std::max(depth[node.first + 1], depth[i] + 1);
+			continue;
+		}
+		if (node.count > leaf_triangles || node.first >= header.blocks)
+			THROW_EXCEPTION("Corrupt BVH leaf in " + filename);
+		const Block& block = bvh->blocks[node.first];
+		for (unsigned int l = 0; l < node.count; ++l) {
+			if (block.triangles[l] >= header.triangles)
+				THROW_EXCEPTION("Corrupt BVH triangle in " + filename);
+		}
+	}
+	return bvh;
+}
+
+void MeshBVH::benchmark(const MeshData& data, unsigned int queries) {
+	MeshBVH bvh(data);
+	std::cout << "BVH: " << bvh.n_triangles << " triangles, " << getThreadCount() << " threads" << std::endl;
+	std::cout << "  Build: " << bvh.build_time * 1000.0 << " ms, " << bvh.nodes.size() << " nodes, "
+		<< bvh.blocks.size() << " leaves, " << bvh.bytes() / (1024*1024) << " MiB" << std::endl;
+	if (bvh.n_triangles == 0 || queries == 0)
+		return;
+
+	//Rays from a sphere around the mesh to points inside its bounds, and points around it
+	glm::vec3 min = bvh.getMin(), max = bvh.getMax();
+	glm::vec3 center = (min + max) * 0.5f, half = (max - min) * 0.5f;
+	float radius = std::max(glm::length(half), 1e-6f);
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::vector<glm::vec3> origins(queries), directions(queries), points(queries);
+	for (unsigned int q = 0; q < queries; ++q) {
+		glm::vec3 s(unit(random), unit(random), unit(random));
+		s = (glm::length(s) > 1e-3f) ? glm::normalize(s) : glm::vec3(0.0f, 0.0f, 1.0f);
+		origins[q] = center + s * radius * 2.0f;
+		glm::vec3 target = center + half * glm::vec3(unit(random), unit(random), unit(random));
+		directions[q] = target - origins[q];
+		points[q] = center + half * 1.2f * glm::vec3(unit(random), unit(random), unit(random));
+	}
+
+	Timer timer;
+	unsigned int hits = 0;
+	for (unsigned int q = 0; q < queries; ++q) {
+		MeshHit hit;
+		if (bvh.intersect(origins[q], directions[q], hit))
+			++hits;
+	}
+	double ray_time = timer.elapsedAndRestart();
+
+	unsigned int blocks = (queries + min_task_triangles - 1) / min_task_triangles;
+	std::vector<unsigned int> block_hits(blocks, 0);
+	parallelFor(blocks, [&](unsigned int b) {
+		unsigned int end = std::min(queries, (b + 1) * min_task_triangles);
+		for (unsigned int q = b * min_task_triangles; q < end; ++q) {
+			MeshHit hit;
+			if (bvh.intersect(origins[q], directions[q], hit))
+				++block_hits[b];
+		}
+	});
+	double parallel_time = timer.elapsedAndRestart();
+
+	double distance_sum = 0.0;
+	for (unsigned int q = 0; q < queries; ++q) {
+		MeshHit hit;
+		if (bvh.closestPoint(points[q], hit))
+			distance_sum += hit.distance;
+	}
+	double point_time = timer.elapsedAndRestart();
+
+	//Perspective views of the mesh from around it, fewer as they return many triangles
+	unsigned int frusta = std::max(1u, queries / 1000);
+	unsigned long long frustum_triangles = 0;
+	std::vector<glm::mat4> views(frusta);
+	for (unsigned int f = 0; f < frusta; ++f) {
+		glm::vec3 eye = origins[f % queries] * 1.5f - center * 0.5f;
+		glm::vec3 forward = glm::normalize(center - eye);
+		glm::vec3 up = (std::fabs(forward.y) > 0.99f) ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		glm::vec3 look_at = center + half * 0.5f * glm::vec3(unit(random), unit(random), unit(random));
+		float fov = 20.0f + 40.0f * (unit(random) + 1.0f) * 0.5f;
+		views[f] = glm::perspective(fov, 4.0f / 3.0f, radius * 0.1f, radius * 10.0f) * glm::lookAt(eye, look_at, up);
+	}
+	timer.restart();
+	for (unsigned int f = 0; f < frusta; ++f)
+		frustum_triangles += bvh.frustum(views[f], NULL);
+	double frustum_time = timer.elapsed();
+
+	//Some of them again, testing every triangle
+	unsigned int checks = std::min(queries, benchmark_checks);
+	unsigned int mismatches = 0;
+	for (unsigned int q = 0; q < checks; ++q) {
+		float nearest = std::numeric_limits<float>::max();
+		float closest = std::numeric_limits<float>::max();
+		for (unsigned int b = 0; b < bvh.blocks.size(); ++b) {
+			const Block& block = bvh.blocks[b];
+			for (unsigned int l = 0; l < 4 && block.triangles[l] != MeshHit::invalid; ++l) {
+				glm::vec3 v0(block.v0[0][l], block.v0[1][l], block.v0[2][l]);
+				glm::vec3 e1(block.e1[0][l], block.e1[1][l], block.e1[2][l]);
+				glm::vec3 e2(block.e2[0][l], block.e2[1][l], block.e2[2][l]);
+				float t = intersectTriangle(origins[q], directions[q], v0, e1, e2);
+				if (t > 0.0f)
+					nearest = std::min(nearest, t);
+				closest = std::min(closest, glm::length(closestOnTriangle(points[q], v0, v0 + e1, v0 + e2) - points[q]));
+			}
+		}
+		MeshHit ray_hit, point_hit;
+		bool found = bvh.intersect(origins[q], directions[q], ray_hit);
+		bvh.closestPoint(points[q], point_hit);
+		if (found != (nearest < std::numeric_limits<float>::max()) || (found && std::fabs(ray_hit.distance - nearest) > 1e-4f * nearest))
+			++mismatches;
+		if (std::fabs(point_hit.distance - closest) > 1e-4f * radius)
+			++mismatches;
+	}
+
+	double n = queries;
+	std::cout << "  Rays: " << ray_time / n * 1.0e9 << " ns per query, " << 100.0 * hits / n << "% hit, "
+		<< n / parallel_time / 1.0e6 << " million per second on all threads" << std::endl;
+	std::cout << "  Closest points: " << point_time / n * 1.0e9 << " ns per query, mean distance "
+		<< distance_sum / n << std::endl;
+	std::cout << "  Frusta: " << frustum_time / frusta * 1.0e6 << " us per query, "
+		<< frustum_triangles / frusta << " triangles on average" << std::endl;
+	std::cout << "  Checked " << checks << " rays and points against every triangle: " << mismatches << " mismatches" << std::endl;
+}
@@ -0,0 +1,393 @@
+#include "MeshProcessing.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+
+namespace {
+
+	// Faces or vertices per task
+	const unsigned int block_size = 1 << 14;
+
+	inline unsigned int getBlockCount(size_t count) {
+		return static_cast<unsigned int>((count + block_size - 1) / block_size);
+	}
+
+	struct Point2D {
+		float x, y;
+	};
+
+	inline float cross2D(const Point2D& a, const Point2D& b, const Point2D& c) {
+		return (b.x - a.x)*(c.y - a.y) - (b.y - a.y)*(c.x - a.x);
+	}
+
+	inline bool insideTriangle(const Point2D& p, const Point2D& a, const Point2D& b, const Point2D& c) {
+		return cross2D(a, b, p) >= 0.0f && cross2D(b, c, p) >= 0.0f && cross2D(c, a, p) >= 0.0f;
+	}
+
+	void triangulateFan(const unsigned int* polygon, unsigned int n, unsigned int* out) {
+		for (unsigned int i=1; i+1<n; ++i) {
+			*out++ = polygon[0];
+			*out++ = polygon[i];
+			*out++ = polygon[i+1];
+		}
+	}
+
+	/**
+	 * Projects the polygon onto the axis plane closest to its own plane
+	 * (using the Newell normal), and cuts off ears until a triangle is
+	 * left. Falls back to a fan for degenerate polygons.
+	 */
+	void triangulateEarClipping(const VertexData* vertices, const unsigned int* polygon, unsigned int n, unsigned int* out) {
+		float normal[3] = { 0.0f, 0.0f, 0.0f };
+		for (unsigned int i=0; i<n; ++i) {
+			const glm::vec3& a = vertices[polygon[i]].position;
+			const glm::vec3& b = vertices[polygon[(i+1)%n]].position;
+			normal[0] += (a.y - b.y)*(a.z + b.z);
+			normal[1] += (a.z - b.z)*(a.x + b.x);
+			normal[2] += (a.x - b.x)*(a.y + b.y);
+		}
+		unsigned int axis = 0;
+		for (unsigned int i=1; i<3; ++i)
+			if (std::fabs(normal[i]) > std::fabs(normal[axis]))
+				axis = i;
+
+		//Drop the dominant axis, and mirror so that the polygon is counter clockwise
+		unsigned int u = (axis + 1) % 3;
+		unsigned int v = (axis + 2) % 3;
+		float sign = (normal[axis] < 0.0f) ? -1.0f : 1.0f;
+		std::vector<Point2D> points(n);
+		for (unsigned int i=0; i<n; ++i) {
+			const glm::vec3& p = vertices[polygon[i]].position;
+			points[i].x = p[u];
+			points[i].y = p[v] * sign;
+		}
+
+		std::vector<unsigned int> ring(n);
+		for (unsigned int i=0; i<n; ++i)
+			ring[i] = i;
+
+		while (ring.size() > 3) {
+			unsigned int m = static_cast<unsigned int>(ring.size());
+			bool found = false;
+			for (unsigned int i=0; i<m && !found; ++i) {
+				unsigned int prev = ring[(i+m-1)%m];
+				unsigned int cur = ring[i];
+				unsigned int next = ring[(i+1)%m];
+				if (cross2D(points[prev], points[cur], points[next]) <= 0.0f)
+					continue; //< Reflex or degenerate corner
+
+				bool ear = true;
+				for (unsigned int j=0; j<m && ear; ++j) {
+					unsigned int other = ring[j];
+					if (other != prev && other != cur && other != next
+							&& insideTriangle(points[other], points[prev], points[cur], points[next]))
+						ear = false;
+				}
+				if (!ear)
+					continue;
+
+				*out++ = polygon[prev];
+				*out++ = polygon[cur];
+				*out++ = polygon[next];
+				ring.erase(ring.begin() + i);
+				found = true;
+			}
+
+			if (!found) {
+				std::vector<unsigned int> rest(m);
+				for (unsigned int i=0; i<m; ++i)
+					rest[i] = polygon[ring[i]];
+				triangulateFan(rest.data(), m, out);
+				return;
+			}
+		}
+		*out++ = polygon[ring[0]];
+		*out++ = polygon[ring[1]];
+		*out++ = polygon[ring[2]];
+	}
+
+	struct PositionKey {
+		unsigned int bits[3];
+		bool operator==(const PositionKey& other) const {
+			return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+		}
+	};
+
+	struct PositionKeyHash {
+		size_t operator()(const PositionKey& key) const {
+			return (key.bits[0] * 73856093u) ^ (key.bits[1] * 19349663u) ^ (key.bits[2] * 83492791u);
+		}
+	};
+
+	inline float cornerAngle(const glm::vec3& corner, const glm::vec3& a, const glm::vec3& b) {
+		glm::vec3 e0 = a - corner;
+		glm::vec3 e1 = b - corner;
+		float lengths = glm::length(e0) * glm::length(e1);
+		if (lengths <= 0.0f)
+			return 0.0f;
+		return std::acos(std::max(-1.0f, std::min(1.0f, glm::dot(e0, e1) / lengths)));
+	}
+
+	void collectParts(MeshPart& part, std::vector<MeshPart*>& parts) {
+		if (part.count > 0)
+			parts.push_back(&part);
+		for (unsigned int i=0; i<part.children.size(); ++i)
+			collectParts(part.children[i], parts);
+	}
+
+	/**
+	 * The next vertex to fan around in Tipsify: the candidate that stays
+	 * in the cache longest after its remaining triangles are emitted,
+	 * or else a dead end from the stack, or else the next live vertex
+	 */
+	int getNextVertex(const std::vector<unsigned int>& candidates,
+			const std::vector<unsigned int>& live,
+			const std::vector<unsigned int>& cache_time,
+			unsigned int timestamp, unsigned int cache_size,
+			std::vector<unsigned int>& dead_ends, unsigned int& cursor) {
+		int best = -1;
+		unsigned int best_priority = 0;
+		for (unsigned int i=0; i<candidates.size(); ++i) {
+			unsigned int v = candidates[i];
+			if (live[v] == 0)
+				continue;
+			unsigned int priority = 0;
+			if (timestamp - cache_time[v] + 2*live[v] <= cache_size)
+				priority = timestamp - cache_time[v];
+			if (priority > best_priority) {
+				best_priority = priority;
+				best = v;
+			}
+		}
+		if (best >= 0)
+			return best;
+
+		while (!dead_ends.empty()) {
+			unsigned int v = dead_ends.back();
+			dead_ends.pop_back();
+			if (live[v] > 0)
+				return v;
+		}
+		while (cursor < live.size()) {
+			if (live[cursor] > 0)
+				return cursor;
+			++cursor;
+		}
+		return -1;
+	}
+}
+
+void MeshProcessing::triangulate(const VertexData* vertices,
+		const std::vector<unsigned int>& face_sizes,
+		const std::vector<unsigned int>& polygons,
+		std::vector<unsigned int>& triangles,
+		bool ear_clipping) {
+	//Where each face starts in the input, and its triangles in the output
+	size_t n_faces = face_sizes.size();
+	std::vector<size_t> face_first(n_faces);
+	std::vector<size_t> triangle_first(n_faces);
+	size_t corners = 0;
+	size_t output = 0;
+	for (size_t f=0; f<n_faces; ++f) {
+		face_first[f] = corners;
+		triangle_first[f] = output;
+		corners += face_sizes[f];
+		if (face_sizes[f] >= 3)
+			output += (face_sizes[f] - 2) * 3;
+	}
+	triangles.resize(output);
+
+	parallelFor(getBlockCount(n_faces), [&](unsigned int b) {
+		size_t end = std::min(n_faces, static_cast<size_t>(b+1)*block_size);
+		for (size_t f=static_cast<size_t>(b)*block_size; f<end; ++f) {
+			unsigned int n = face_sizes[f];
+			const unsigned int* polygon = &polygons[face_first[f]];
+			unsigned int* out = triangles.data() + triangle_first[f];
+			if (n < 3)
+				continue;
+			else if (n == 3 || !ear_clipping)
+				triangulateFan(polygon, n, out);
+			else
+				triangulateEarClipping(vertices, polygon, n, out);
+		}
+	});
+}
+
+void MeshProcessing::generateNormals(VertexData* vertices, unsigned int n_vertices,
+		const unsigned int* indices, unsigned int n_indices,
+		bool angle_weighted) {
+	//Weighted face normal for every corner
+	unsigned int n_triangles = n_indices / 3;
+	std::vector<glm::vec3> corner_normals(n_triangles * 3);
+	parallelFor(getBlockCount(n_triangles), [&](unsigned int b) {
+		unsigned int end = std::min(n_triangles, (b+1)*block_size);
+		for (unsigned int t=b*block_size; t<end; ++t) {
+			const glm::vec3& p0 = vertices[indices[3*t]].position;
+			const glm::vec3& p1 = vertices[indices[3*t+1]].position;
+			const glm::vec3& p2 = vertices[indices[3*t+2]].position;
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0); //< Length is twice the area
+			if (angle_weighted) {
+				float length = glm::length(normal);
+				if (length > 0.0f)
+					normal /= length;
+				corner_normals[3*t] = normal * cornerAngle(p0, p1, p2);
+				corner_normals[3*t+1] = normal * cornerAngle(p1, p2, p0);
+				corner_normals[3*t+2] = normal * cornerAngle(p2, p0, p1);
+			} else {
+				corner_normals[3*t] = normal;
+				corner_normals[3*t+1] = normal;
+				corner_normals[3*t+2] = normal;
+			}
+		}
+	});
+
+	//Vertices at the same position are smoothed together. As in
+	//VertexWelder, each thread owns the positions whose hash falls in its
+	//partition, and groups them under the first vertex at that position.
+	std::vector<PositionKey> keys(n_vertices);
+	std::vector<unsigned int> partition(n_vertices);
+	unsigned int partitions = getThreadCount();
+	parallelFor(getBlockCount(n_vertices), [&](unsigned int b) {
+		unsigned int end = std::min(n_vertices, (b+1)*block_size);
+		for (unsigned int i=b*block_size; i<end; ++i) {
+			glm::vec3 position = vertices[i].position + glm::vec3(0.0f); //< -0 and +0 are the same position
+			memcpy(keys[i].bits, &position[0], sizeof(keys[i].bits));
+			size_t hash = PositionKeyHash()(keys[i]);
+			partition[i] = static_cast<unsigned int>((hash ^ (hash >> 15)) % partitions);
+		}
+	});
+	std::vector<unsigned int> group(n_vertices);
+	parallelFor(partitions, [&](unsigned int p) {
+		std::unordered_map<PositionKey, unsigned int, PositionKeyHash> groups;
+		groups.reserve(n_vertices / partitions + 1);
+		for (unsigned int i=0; i<n_vertices; ++i)
+			if (partition[i] == p)
+				group[i] = groups.insert(std::make_pair(keys[i], i)).first->second;
+	});
+	std::vector<PositionKey>().swap(keys);
+
+	//The thread of a partition also sums the corners of its groups, in
+	//order, so the normals do not depend on the number of threads
+	std::vector<glm::vec3> sums(n_vertices, glm::vec3(0.0f));
+	parallelFor(partitions, [&](unsigned int p) {
+		for (unsigned int i=0; i<n_triangles*3; ++i) {
+			unsigned int g = group[indices[i]];
+			if (partition[g] == p)
+				sums[g] += corner_normals[i];
+		}
+	});
+
+	parallelFor(getBlockCount(n_vertices), [&](unsigned int b) {
+		unsigned int end = std::min(n_vertices, (b+1)*block_size);
+		for (unsigned int i=b*block_size; i<end; ++i) {
+			const glm::vec3& sum = sums[group[i]];
+			float length = glm::length(sum);
+			vertices[i].normal = (length > 0.0f) ? sum / length : glm::vec3(0.0f, 0.0f, 1.0f);
+		}
+	});
+}
+
+void MeshProcessing::optimize(MeshData& data, unsigned int cache_size) {
+	std::vector<MeshPart*> parts;
+	collectParts(data.root, parts);
+
+	parallelFor(static_cast<unsigned int>(parts.size()), [&](unsigned int p) {
+		const MeshPart& part = *parts[p];
+		unsigned int* indices = &data.indices[part.first];
+		unsigned int n_vertices = 0;
+		for (unsigned int i=0; i<part.count; ++i)
+			n_vertices = std::max(n_vertices, indices[i] + 1);
+		optimizeVertexCache(indices, part.count, n_vertices, cache_size);
+		optimizeVertexFetch(&data.vertices[part.vertexCount], n_vertices, indices, part.count);
+	});
+}
+
+float MeshProcessing::getACMR(const unsigned int* indices, size_t n_indices, unsigned int cache_size) {
+	if (n_indices < 3)
+		return 0.0f;
+	std::deque<unsigned int> cache;
+	size_t misses = 0;
+	for (size_t i=0; i<n_indices; ++i) {
+		if (std::find(cache.begin(), cache.end(), indices[i]) != cache.end())
+			continue;
+		++misses;
+		cache.push_back(indices[i]);
+		if (cache.size() > cache_size)
+			cache.pop_front();
+	}
+	return static_cast<float>(misses) / static_cast<float>(n_indices / 3);
+}
+
+void MeshProcessing::optimizeVertexCache(unsigned int* indices, size_t n_indices, unsigned int n_vertices, unsigned int cache_size) {
+	unsigned int n_triangles = static_cast<unsigned int>(n_indices / 3);
+	if (n_triangles == 0)
+		return;
+
+	//Triangles around each vertex
+	std::vector<unsigned int> live(n_vertices, 0);
+	for (unsigned int i=0; i<n_triangles*3; ++i)
+		++live[indices[i]];
+	std::vector<unsigned int> first(n_vertices + 1, 0);
+	for (unsigned int v=0; v<n_vertices; ++v)
+		first[v+1] = first[v] + live[v];
+	std::vector<unsigned int> adjacency(n_triangles*3);
+	std::vector<unsigned int> fill(first.begin(), first.end() - 1);
+	for (unsigned int i=0; i<n_triangles*3; ++i)
+		adjacency[fill[indices[i]]++] = i / 3;
+
+	std::vector<unsigned int> cache_time(n_vertices, 0);
+	std::vector<bool> emitted(n_triangles, false);
+	std::vector<unsigned int> dead_ends;
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> output;
+	output.reserve(n_triangles*3);
+	unsigned int timestamp = cache_size + 1;
+	unsigned int cursor = 0;
+
+	int fan = indices[0];
+	while (fan >= 0) {
+		candidates.clear();
+		for (unsigned int a=first[fan]; a<first[fan+1]; ++a) {
+			unsigned int t = adjacency[a];
+			if (emitted[t])
+				continue;
+			for (unsigned int k=0; k<3; ++k) {
+				unsigned int v = indices[3*t+k];
+				output.push_back(v);
+				dead_ends.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+				if (timestamp - cache_time[v] > cache_size)
+					cache_time[v] = timestamp++;
+			}
+			emitted[t] = true;
+		}
+		fan = getNextVertex(candidates, live, cache_time, timestamp, cache_size, dead_ends, cursor);
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+void MeshProcessing::optimizeVertexFetch(VertexData* vertices, unsigned int n_vertices, unsigned int* indices, size_t n_indices) {
+	const unsigned int unused = 0xFFFFFFFFu;
+	std::vector<unsigned int> remap(n_vertices, unused);
+	unsigned int next = 0;
+	for (size_t i=0; i<n_indices; ++i) {
+		unsigned int& target = remap[indices[i]];
+		if (target == unused)
+			target = next++;
+		indices[i] = target;
+	}
+	for (unsigned int v=0; v<n_vertices; ++v)
+		if (remap[v] == unused)
+			remap[v] = next++;
+
+	std::vector<VertexData> reordered(n_vertices);
+	for (unsigned int v=0; v<n_vertices; ++v)
+		reordered[remap[v]] = vertices[v];
+	std::copy(reordered.begin(), reordered.end(), vertices);
+}
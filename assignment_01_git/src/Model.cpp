@@ -1,29 +1,92 @@
 #include "Model.h"
 
 #include "GameException.h"
+#include "GeometryCodec.h"
+#include "Timer.h"
+#include "VertexWelder.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
 #include <glm/gtc/matrix_transform.hpp>
 
-Model::Model(std::string filename, bool invert) {
+Model::Model(std::string filename, bool invert, ModelMode mode, float weld_epsilon,
+		float normal_epsilon, float tex_coord_epsilon, ImportProfile profile) {
+	this->mode = mode;
 	min_dim = glm::vec3(std::numeric_limits<float>::min());
 	max_dim = glm::vec3(std::numeric_limits<float>::max());
 	std::vector<float> vertex_data, normal_data;
 	aiMatrix4x4 trafo;
 	aiIdentityMatrix4(&trafo);
 
-	scene = aiImportFile(filename.c_str(), aiProcessPreset_TargetRealtime_Quality);// | aiProcess_FlipWindingOrder);
-	if (!scene) {
-		std::string log = "Unable to load mesh from ";
-		log.append(filename);
-		THROW_EXCEPTION(log);
+	if (mode == MODEL_INDEXED) {
+		MeshData data;
+		if (GeometryCodec::isCompressedFile(filename))
+			GeometryCodec::read(filename, data);
+		else
+			AssimpLoader::load(filename, data, profile);
+		scene = NULL;
+
+		if (invert) {
+			for (size_t i=0; i<data.vertices.size(); ++i)
+				data.vertices[i].normal = -data.vertices[i].normal;
+			for (size_t i=0; i+2<data.indices.size(); i+=3)
+				std::swap(data.indices[i+1], data.indices[i+2]);
+		}
+
+		size_t imported = data.vertices.size();
+		Timer weld_timer;
+		bool weld = profile == IMPORT_FAST || weld_epsilon > 0.0f || normal_epsilon > 0.0f || tex_coord_epsilon > 0.0f;
+		if (weld)
+			VertexWelder::weld(data, weld_epsilon, normal_epsilon, tex_coord_epsilon);
+		double weld_time = weld_timer.elapsed();
+
+		root = data.root;
+		std::pair<glm::vec3, glm::vec3> translateVectors = getTranslateVectors(
+			reinterpret_cast<const float*>(data.vertices.data()), data.vertices.size(), sizeof(VertexData) / sizeof(float));
+		root.transform = glm::scale(root.transform, translateVectors.first);
+		root.transform = glm::translate(root.transform, translateVectors.second);
+
+		n_vertices = data.vertices.size();
+		interleaved.reset(new GLUtils::VBO(data.vertices.data(), n_vertices*sizeof(VertexData), GL_ARRAY_BUFFER));
+		indices.reset(new GLUtils::VBO(data.indices.data(), data.indices.size()*sizeof(unsigned int), GL_ELEMENT_ARRAY_BUFFER));
+
+		//The expanded mode stores a position and a normal per corner
+		size_t expanded_bytes = data.indices.size() * 6 * sizeof(float);
+		size_t indexed_bytes = n_vertices*sizeof(VertexData) + data.indices.size()*sizeof(unsigned int);
+		//Otherwise the importer already welded, or the codec stored welded vertices
+		if (weld) {
+			std::cout << "Welded " << imported << " imported vertices to " << n_vertices << " (";
+			if (weld_epsilon > 0.0f || normal_epsilon > 0.0f || tex_coord_epsilon > 0.0f)
+				std::cout << "epsilon " << weld_epsilon << ", normals " << normal_epsilon << ", texture coordinates " << tex_coord_epsilon;
+			else std::cout << "exact";
+			std::cout << ") in " << weld_time*1000.0 << " ms, ";
+		}
+		else std::cout << "Imported " << n_vertices << " vertices, ";
+		std::cout << "GPU memory " << expanded_bytes << " bytes expanded, "
+			<< indexed_bytes << " bytes indexed (" << 100.0 * indexed_bytes / std::max<size_t>(expanded_bytes, 1) << "%)" << std::endl;
+		return;
 	}
 
-	//Load the model recursively into data
-	loadRecursive(root, invert, vertex_data, normal_data, scene, scene->mRootNode);
+	if (GeometryCodec::isCompressedFile(filename)) {
+		MeshData data;
+		GeometryCodec::read(filename, data);
+		root = data.root;
+		expandRecursive(root, data, vertex_data, normal_data);
+		scene = NULL;
+	} else {
+		//The expanded layout needs triangles and normals from Assimp
+		scene = AssimpLoader::importFile(filename, AssimpLoader::getAssimpFlags(profile) | aiProcess_Triangulate | aiProcess_GenSmoothNormals);// | aiProcess_FlipWindingOrder);
+
+		//Load the model recursively into data
+		loadRecursive(root, invert, vertex_data, normal_data, scene, scene->mRootNode);
+		aiReleaseImport(scene);
+		scene = NULL;
+	}
 	
 	// Scale first, Translate center second!
-	std::pair<glm::vec3, glm::vec3> translateVectors = getTranslateVectors(vertex_data);
+	std::pair<glm::vec3, glm::vec3> translateVectors = getTranslateVectors(vertex_data.data(), vertex_data.size() / 3, 3);
 	root.transform = glm::scale(root.transform, translateVectors.first);
 	root.transform = glm::translate(root.transform, translateVectors.second);
 
@@ -42,6 +105,10 @@ Model::~Model() {
 
 }
 
+void Model::bindTextures() {
+	texture.bind();
+}
+
 void Model::loadRecursive(MeshPart& part, bool invert,
 			std::vector<float>& vertex_data, std::vector<float>& normal_data, const aiScene* scene, const aiNode* node) {
 	//update transform matrix. notice that we also transpose it
@@ -89,9 +156,27 @@ void Model::loadRecursive(MeshPart& part, bool invert,
 	}
 }
 
-std::pair<glm::vec3, glm::vec3> Model::getTranslateVectors(const std::vector<float>& vertex_data)
+void Model::expandRecursive(MeshPart& part, const MeshData& data,
+			std::vector<float>& vertex_data, std::vector<float>& normal_data) {
+	//One position and normal per corner, as loadRecursive produces
+	unsigned int first = vertex_data.size()/3;
+	for (unsigned int i = part.first; i < part.first + part.count; ++i) {
+		const VertexData& vertex = data.vertices[part.vertexCount + data.indices[i]];
+		for (int c = 0; c < 3; ++c) {
+			vertex_data.push_back(vertex.position[c]);
+			normal_data.push_back(vertex.normal[c]);
+		}
+	}
+	part.first = first;
+	part.vertexCount = 0;
+
+	for (unsigned int n = 0; n < part.children.size(); ++n)
+		expandRecursive(part.children[n], data, vertex_data, normal_data);
+}
+
+std::pair<glm::vec3, glm::vec3> Model::getTranslateVectors(const float* vertex_data, size_t count, size_t stride)
 {
-	for(unsigned int i = 0; i < vertex_data.size(); i += 3) {
+	for(size_t i = 0; i < count*stride; i += stride) {
 		if(min_dim.x < vertex_data[i])
 			min_dim.x = vertex_data[i];
 		if(min_dim.y < vertex_data[i + 1])
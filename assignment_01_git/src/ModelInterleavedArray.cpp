@@ -1,142 +1,195 @@
 #include "ModelInterleavedArray.h"
 #include "GameException.h"
+#include "GeometryCodec.h"
+#include "ObjLoader.h"
+#include "Timer.h"
+#include <cmath>
 #include <iostream>
+#include <sstream>
+#include <limits>
 #include <glm/gtc/matrix_transform.hpp>
 
-ModelInterleavedArray::ModelInterleavedArray(std::string filename, bool invert) {
+ModelInterleavedArray::ModelInterleavedArray(std::string filename, bool invert, ModelLoader loader, ImportProfile profile,
+		const std::string& cache_directory) {
 	std::cout << "Loading model: " << filename << "... Please Wait..." << std::endl;
-	std::vector<VertexData> array_data;
-	std::vector<unsigned int> indices_data;
-	
-	aiMatrix4x4 trafo;
-	aiIdentityMatrix4(&trafo);
-
-	scene = aiImportFile(filename.c_str(), aiProcessPreset_TargetRealtime_Quality);
-	if(!scene) {
-		std::string log = "Unable to load mesh from ";
-		log.append(filename);
-		THROW_EXCEPTION(log);
+	Timer load_timer;
+	MeshData data;
+
+	loadMeshData(filename, data, loader, profile);
+	double parse_time = load_timer.elapsedAndRestart();
+
+	glm::vec3 min_position, max_position;
+	getBounds(data.vertices, min_position, max_position);
+	setMesh(data, min_position, max_position);
+	interleaved.reset(new GLUtils::VBO(data.vertices.data(), n_vertices * sizeof(VertexData), GL_ARRAY_BUFFER));
+	indices.reset(new GLUtils::VBO(data.indices.data(), n_indices * sizeof(unsigned int), GL_ELEMENT_ARRAY_BUFFER));
+	createPositions(data.vertices);
+
+	//Missing or unreadable textures have no levels, and are drawn white
+	std::vector<MipChain> images(data.textures.size());
+	for(unsigned int i = 0; i < data.textures.size(); i++) {
+		if(!data.textures[i].empty() && !Texture2D::decode(data.textures[i], images[i]))
+			images[i] = MipChain();
 	}
+	materials.reset(new MaterialTextures(images));
+	materials->upload(images);
+	createVirtualTexture(data);
+	createSkinnedMesh(data);
+	bvh = MeshBVH::create(data, cache_directory);
+	keepHostCopy(data, images);
+
+	std::cout << "Model Loaded Successfully (parsed in " << parse_time*1000.0 << " ms, uploaded in "
+		<< load_timer.elapsed()*1000.0 << " ms)" << std::endl;
+}
 
-	loadRecursive(root, invert, array_data, indices_data, textures, scene, scene->mRootNode);
-
-	// Scale first, Translate center second!
-	std::pair<glm::vec3, glm::vec3> translateVectors = getTranslateVectors(array_data);
-	root.transform = glm::scale(root.transform, translateVectors.first);
-	root.transform = glm::translate(root.transform, translateVectors.second);
+ModelInterleavedArray::ModelInterleavedArray(MeshData&& data, std::vector<MipChain>&& images,
+		const glm::vec3& min_position, const glm::vec3& max_position,
+		std::shared_ptr<GLUtils::VBO> interleaved, std::shared_ptr<GLUtils::VBO> indices,
+		std::shared_ptr<GLUtils::VBO> positions, std::shared_ptr<MaterialTextures> materials,
+		std::shared_ptr<MeshBVH> bvh)
+		: interleaved(interleaved), indices(indices), positions(positions), materials(materials), bvh(bvh) {
+	setMesh(data, min_position, max_position);
+	createVirtualTexture(data);
+	createSkinnedMesh(data);
+	keepHostCopy(data, images);
+}
 
-	n_vertices = array_data.size();
-	n_indices = indices_data.size();
-	
-	if(fmod(static_cast<float>(n_indices), 3.0f) < 0.000001f) {
-		interleaved.reset(new GLUtils::VBO(array_data.data(), n_vertices * sizeof(VertexData), GL_ARRAY_BUFFER));
-		indices.reset(new GLUtils::VBO(indices_data.data(), n_indices * sizeof(unsigned int), GL_ELEMENT_ARRAY_BUFFER));
-		std::cout << "Model Loaded Successfully" << std::endl;
-	} else {
-		THROW_EXCEPTION("The number of vertices in the mesh is wrong");
-	}
+ModelInterleavedArray::ModelInterleavedArray(MeshData&& data, std::vector<MipChain>&& images,
+		const glm::vec3& min_position, const glm::vec3& max_position, std::shared_ptr<MeshBVH> bvh) : bvh(bvh) {
+	Timer load_timer;
+	setMesh(data, min_position, max_position);
+	interleaved.reset(new GLUtils::VBO(data.vertices.data(), n_vertices * sizeof(VertexData), GL_ARRAY_BUFFER));
+	indices.reset(new GLUtils::VBO(data.indices.data(), n_indices * sizeof(unsigned int), GL_ELEMENT_ARRAY_BUFFER));
+	createPositions(data.vertices);
+
+	materials.reset(new MaterialTextures(images));
+	materials->upload(images);
+	createVirtualTexture(data);
+	createSkinnedMesh(data);
+	keepHostCopy(data, images);
+
+	std::cout << "Model Loaded Successfully (uploaded in " << load_timer.elapsed()*1000.0 << " ms)" << std::endl;
 }
 
 ModelInterleavedArray::~ModelInterleavedArray() {
 
 }
 
-void ModelInterleavedArray::loadRecursive(
-	MeshPart& part, 
-	bool invert, 
-	std::vector<VertexData>& array_data, 
-	std::vector<unsigned int>& indices_data,
-	std::vector<Texture2D>& textures,
-	const aiScene* scene, 
-	const aiNode* node) {
-	
+long long ModelInterleavedArray::getBytes() const {
+	long long bytes = interleaved->bytes() + indices->bytes() + positions->bytes();
+	if (virtual_texture)
+		bytes += virtual_texture->bytes();
+	if (skinned)
+		bytes += skinned->bytes();
+	return bytes + materials->bytes();
+}
 
-	aiMatrix4x4 m = node->mTransformation;
-	for (int j=0; j<4; ++j)
-		for (int i=0; i<4; ++i)
-			part.transform[j][i] = m[i][j];
-
-	for(unsigned int n=0; n < node->mNumMeshes; ++n) {
-		const struct aiMesh* mesh = scene->mMeshes[node->mMeshes[n]];
-
-		part.first = indices_data.size();
-		part.count = mesh->mNumFaces*3;
-		part.vertexCount = array_data.size();
-
-		indices_data.reserve(indices_data.size() + part.count*3);
-
-		for(unsigned int i = 0; i < mesh->mNumVertices; i++) {
-			VertexData tmp;
-			tmp.position.x = mesh->mVertices[i].x;
-			tmp.position.y = mesh->mVertices[i].y;
-			tmp.position.z = mesh->mVertices[i].z;
-
-			if(mesh->HasNormals()) {
-				tmp.normal.x = mesh->mNormals[i].x;
-				tmp.normal.y = mesh->mNormals[i].y;
-				tmp.normal.z = mesh->mNormals[i].z;
-			}
-			
-			if(mesh->HasTextureCoords(0)) {
-				tmp.tex_coords.x = mesh->mTextureCoords[0][i].x;
-				tmp.tex_coords.y = mesh->mTextureCoords[0][i].y;
-			}
-			array_data.push_back(tmp);
+void ModelInterleavedArray::createVirtualTexture(const MeshData& data) {
+	//One virtual texture per model, materials with other page files are drawn white
+	for (unsigned int i = 0; i < data.textures.size(); ++i) {
+		if (!VirtualTexture::isPageFile(data.textures[i]))
+			continue;
+		if (!virtual_texture) {
+			virtual_texture.reset(new VirtualTexture(data.textures[i]));
+			virtual_texture_file = data.textures[i];
 		}
+		if (data.textures[i] == virtual_texture_file)
+			materials->setPaged(i);
+		else
+			std::cout << "Only one virtual texture per model, drawing " << data.textures[i] << " white" << std::endl;
+	}
+}
 
-		for (unsigned int t = 0; t < mesh->mNumFaces; ++t) {
-			const struct aiFace* face = &mesh->mFaces[t];
+void ModelInterleavedArray::createSkinnedMesh(const MeshData& data) {
+	if (data.weights.empty())
+		return;
+	skinned.reset(new SkinnedMesh(data));
+}
 
-			if(face->mNumIndices != 3)
-				THROW_EXCEPTION("Only triangle meshes are supported");
+void ModelInterleavedArray::keepHostCopy(MeshData& data, std::vector<MipChain>& images) {
+	host_vertices.swap(data.vertices);
+	host_indices.swap(data.indices);
+	host_images.swap(images);
+	for (unsigned int i = 0; i < host_images.size(); ++i) {
+		if (host_images[i].levels.size() > 1)
+			host_images[i].levels.resize(1);
+	}
+}
 
-			for(unsigned int i = 0; i < face->mNumIndices; i++) 
-				indices_data.push_back(face->mIndices[i]);			
-		}
-	
-		if(scene->HasMaterials()) {
-			aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-			for(unsigned int i = 0; i < material->GetTextureCount(aiTextureType_DIFFUSE); i++) {
-				aiString str;
-				material->GetTexture(aiTextureType_DIFFUSE, i, &str);
-				std::stringstream ss;
-				ss << "models/" << str.C_Str();
-				Texture2D tex = Texture2D(ss.str());
-				textures.push_back(tex);
-			}
-
-			if(material->GetTextureCount(aiTextureType_DIFFUSE) <= 0) {
-				textures.push_back(Texture2D());
-			}
-		} else {
-			textures.push_back(Texture2D());
+void ModelInterleavedArray::createPositions(const std::vector<VertexData>& vertices) {
+	std::vector<glm::vec3> packed;
+	packPositions(vertices, packed);
+	positions.reset(new GLUtils::VBO(packed.data(), packed.size() * sizeof(glm::vec3), GL_ARRAY_BUFFER));
+}
+
+void ModelInterleavedArray::loadMeshData(const std::string& filename, MeshData& data, ModelLoader loader, ImportProfile profile) {
+	bool obj = filename.size() > 4 && (filename.compare(filename.size() - 4, 4, ".obj") == 0 || filename.compare(filename.size() - 4, 4, ".OBJ") == 0);
+	if (GeometryCodec::isCompressedFile(filename))
+		GeometryCodec::read(filename, data);
+	else if (loader == LOADER_NATIVE || (loader == LOADER_AUTO && obj))
+		ObjLoader::load(filename, data);
+	else
+		AssimpLoader::load(filename, data, profile);
+}
+
+void ModelInterleavedArray::benchmarkLoaders(const std::string& filename, unsigned int iterations) {
+	const char* names[2] = { "Assimp", "Native" };
+	double best[2] = { 1e30, 1e30 };
+	MeshData data[2];
+
+	for (unsigned int i = 0; i < iterations; ++i) {
+		for (unsigned int l = 0; l < 2; ++l) {
+			data[l] = MeshData();
+			Timer timer;
+			if (l == 0) AssimpLoader::load(filename, data[l]);
+			else ObjLoader::load(filename, data[l]);
+			double time = timer.elapsed();
+			if (time < best[l]) best[l] = time;
 		}
 	}
 
-	//Load children
-	for(unsigned int n = 0; n < node->mNumChildren; ++n) {
-		part.children.push_back(MeshPart());
-		loadRecursive(part.children.back(), invert, array_data, indices_data, textures, scene, node->mChildren[n]);
+	for (unsigned int l = 0; l < 2; ++l) {
+		std::cout << names[l] << ": " << best[l]*1000.0 << " ms (best of " << iterations << "), "
+			<< data[l].vertices.size() << " vertices, " << data[l].indices.size()/3 << " triangles, "
+			<< data[l].vertices.size()*sizeof(VertexData) + data[l].indices.size()*sizeof(unsigned int) << " bytes" << std::endl;
 	}
+	std::cout << "Native loader speedup: " << best[0] / best[1] << "x" << std::endl;
 }
 
-std::pair<glm::vec3, glm::vec3> ModelInterleavedArray::getTranslateVectors(const std::vector<VertexData>& array_data) {
-	min_dim = -glm::vec3(std::numeric_limits<float>::max());
-	max_dim = glm::vec3(std::numeric_limits<float>::max());
-
-	for(unsigned int i = 0; i < array_data.size(); i++) {
-		float x = array_data[i].position.x;
-		float y = array_data[i].position.y;
-		float z = array_data[i].position.z;
-		if(min_dim.x < x) min_dim.x = x;
-		if(min_dim.y < y) min_dim.y = y;
-		if(min_dim.z < z) min_dim.z = z;
-		if(max_dim.x > x) max_dim.x = x;
-		if(max_dim.y > y) max_dim.y = y;
-		if(max_dim.z > z) max_dim.z = z;
+void ModelInterleavedArray::getBounds(const std::vector<VertexData>& vertices, glm::vec3& min_position, glm::vec3& max_position) {
+	min_position = glm::vec3(std::numeric_limits<float>::max());
+	max_position = -glm::vec3(std::numeric_limits<float>::max());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		min_position = glm::min(min_position, vertices[i].position);
+		max_position = glm::max(max_position, vertices[i].position);
 	}
+}
+
+void ModelInterleavedArray::packPositions(const std::vector<VertexData>& vertices, std::vector<glm::vec3>& positions) {
+	positions.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+		positions[i] = vertices[i].position;
+}
+
+void ModelInterleavedArray::setMesh(const MeshData& data, const glm::vec3& min_position, const glm::vec3& max_position) {
+	root = data.root;
+
+	// Scale first, Translate center second!
+	std::pair<glm::vec3, glm::vec3> translateVectors = getTranslateVectors(min_position, max_position);
+	root.transform = glm::scale(root.transform, translateVectors.first);
+	root.transform = glm::translate(root.transform, translateVectors.second);
+
+	n_vertices = data.vertices.size();
+	n_indices = data.indices.size();
+	if(fmod(static_cast<float>(n_indices), 3.0f) >= 0.000001f)
+		THROW_EXCEPTION("The number of vertices in the mesh is wrong");
+}
+
+std::pair<glm::vec3, glm::vec3> ModelInterleavedArray::getTranslateVectors(const glm::vec3& min_position, const glm::vec3& max_position) {
+	min_dim = min_position;
+	max_dim = max_position;
 
-	glm::vec3 displacement = min_dim - max_dim;
+	glm::vec3 displacement = max_dim - min_dim;
 	float scalefactor = 0.0f;
 	if(displacement.x > displacement.y)
 		scalefactor = displacement.x;
@@ -152,6 +205,5 @@ std::pair<glm::vec3, glm::vec3> ModelInterleavedArray::getTranslateVectors(const
 
 void ModelInterleavedArray::bindTextures()
 {
-	//if(textures.size() > 0)
-		textures[0].bind();
+	materials->bind(0);
 }
\ No newline at end of file
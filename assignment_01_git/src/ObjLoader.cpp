@@ -0,0 +1,730 @@
+#include "ObjLoader.h"
+#include "GameException.h"
+#include "Parallel.h"
+#include "Timer.h"
+#include "VirtualFileSystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+
+	// No chunks smaller than this, so small files are parsed by one thread
+	const size_t min_chunk_size = 1 << 20;
+	const unsigned int no_index = ObjLoader::no_index;
+
+	enum CornerFlags {
+		RELATIVE_V = 1,
+		RELATIVE_T = 2,
+		RELATIVE_N = 4
+	};
+
+	// Indices of one face corner. Negative (relative) indices are
+	// resolved against the counts of the chunk, and flagged so that the
+	// chunk's base can be added once all chunks are parsed.
+	struct Corner {
+		int v, t, n;
+		unsigned char flags;
+	};
+
+	enum EventType {
+		EVENT_OBJECT,
+		EVENT_MATERIAL
+	};
+
+	// An o, g or usemtl statement, which applies from face on
+	struct Event {
+		unsigned int face;
+		EventType type;
+		std::string name;
+	};
+
+	struct Chunk {
+		const char* begin;
+		const char* end;
+
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec3> normals;
+		std::vector<glm::vec2> tex_coords;
+		std::vector<Corner> corners;
+		std::vector<unsigned int> face_sizes;
+		std::vector<unsigned int> face_first; //< Index of the first corner of each face
+		std::vector<Event> events;
+		std::vector<std::string> mtllibs;
+
+		unsigned int v_base, t_base, n_base;
+	};
+
+	struct Segment {
+		unsigned int chunk;
+		unsigned int face_begin;
+		unsigned int face_end;
+	};
+
+	// All faces with the same object and material become one mesh
+	struct Group {
+		std::string object;
+		std::string material;
+		std::vector<Segment> segments;
+
+		std::vector<VertexData> vertices;
+		std::vector<unsigned int> indices;
+	};
+
+	struct CornerKey {
+		unsigned int v, t, n;
+		bool operator==(const CornerKey& other) const {
+			return v == other.v && t == other.t && n == other.n;
+		}
+	};
+
+	struct CornerKeyHash {
+		size_t operator()(const CornerKey& key) const {
+			return (key.v * 73856093u) ^ (key.t * 19349663u) ^ (key.n * 83492791u);
+		}
+	};
+
+	const double pow10_table[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	inline bool isSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	inline bool isDigit(char c) {
+		return c >= '0' && c <= '9';
+	}
+
+	inline const char* skipSpace(const char* p, const char* end) {
+		while (p < end && isSpace(*p)) ++p;
+		return p;
+	}
+
+	/**
+	 * Parses a decimal floating point number. Accumulates up to 19
+	 * significant digits in an integer and scales by a power of ten
+	 * once, which is exact enough for float and much faster than strtod.
+	 */
+	const char* parseFloat(const char* p, const char* end, float& out) {
+		p = skipSpace(p, end);
+		const char* start = p;
+
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative = (*p == '-');
+			++p;
+		}
+
+		unsigned long long mantissa = 0;
+		int exponent = 0;
+		int digits = 0;
+		bool any = false;
+		for (; p < end && isDigit(*p); ++p) {
+			any = true;
+			if (digits < 19) {
+				mantissa = mantissa*10 + (*p - '0');
+				if (mantissa > 0) ++digits;
+			} else {
+				++exponent;
+			}
+		}
+		if (p < end && *p == '.') {
+			for (++p; p < end && isDigit(*p); ++p) {
+				any = true;
+				if (digits < 19) {
+					mantissa = mantissa*10 + (*p - '0');
+					if (mantissa > 0) ++digits;
+					--exponent;
+				}
+			}
+		}
+
+		if (!any) {
+			//nan, inf and other oddities
+			char buffer[64];
+			size_t length = 0;
+			for (p = start; p < end && !isSpace(*p) && length < sizeof(buffer)-1; ++p)
+				buffer[length++] = *p;
+			buffer[length] = '\0';
+			out = static_cast<float>(strtod(buffer, NULL));
+			return p;
+		}
+
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			++p;
+			bool negative_exponent = false;
+			if (p < end && (*p == '-' || *p == '+')) {
+				negative_exponent = (*p == '-');
+				++p;
+			}
+			int e = 0;
+			for (; p < end && isDigit(*p); ++p)
+				if (e < 10000) e = e*10 + (*p - '0');
+			exponent += negative_exponent ? -e : e;
+		}
+
+		double value = static_cast<double>(mantissa);
+		if (exponent < 0 && exponent >= -22)
+			value /= pow10_table[-exponent];
+		else if (exponent > 0 && exponent <= 22)
+			value *= pow10_table[exponent];
+		else if (exponent != 0)
+			value *= std::pow(10.0, exponent);
+
+		out = static_cast<float>(negative ? -value : value);
+		return p;
+	}
+
+	inline const char* parseInt(const char* p, const char* end, int& out) {
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative = (*p == '-');
+			++p;
+		}
+		int value = 0;
+		for (; p < end && isDigit(*p); ++p)
+			value = value*10 + (*p - '0');
+		out = negative ? -value : value;
+		return p;
+	}
+
+	/**
+	 * Converts an OBJ index (1 based, or negative and relative to the
+	 * current count) to a 0 based index, and flags relative indices
+	 */
+	inline int resolveIndex(int index, size_t count, unsigned char flag, unsigned char& flags) {
+		if (index > 0)
+			return index - 1;
+		if (index < 0) {
+			flags |= flag;
+			return static_cast<int>(count) + index;
+		}
+		return -1;
+	}
+
+	inline bool startsWith(const char* p, const char* end, const char* word) {
+		size_t length = strlen(word);
+		return static_cast<size_t>(end - p) > length && strncmp(p, word, length) == 0 && isSpace(p[length]);
+	}
+
+	inline std::string restOfLine(const char* p, const char* end) {
+		p = skipSpace(p, end);
+		while (end > p && isSpace(end[-1])) --end;
+		return std::string(p, end);
+	}
+
+	void parseFace(Chunk& chunk, const char* p, const char* end) {
+		unsigned int size = 0;
+		chunk.face_first.push_back(static_cast<unsigned int>(chunk.corners.size()));
+		for (;;) {
+			p = skipSpace(p, end);
+			if (p >= end || !(isDigit(*p) || *p == '-'))
+				break;
+
+			int v = 0, t = 0, n = 0;
+			p = parseInt(p, end, v);
+			if (p < end && *p == '/') {
+				++p;
+				if (p < end && *p != '/')
+					p = parseInt(p, end, t);
+				if (p < end && *p == '/')
+					p = parseInt(p + 1, end, n);
+			}
+
+			Corner corner;
+			corner.flags = 0;
+			corner.v = resolveIndex(v, chunk.positions.size(), RELATIVE_V, corner.flags);
+			corner.t = resolveIndex(t, chunk.tex_coords.size(), RELATIVE_T, corner.flags);
+			corner.n = resolveIndex(n, chunk.normals.size(), RELATIVE_N, corner.flags);
+			if (v == 0)
+				THROW_EXCEPTION("Invalid face in OBJ file");
+			chunk.corners.push_back(corner);
+			++size;
+		}
+		if (size < 3) {
+			//Points and lines are not supported, drop them
+			chunk.corners.resize(chunk.face_first.back());
+			chunk.face_first.pop_back();
+			return;
+		}
+		chunk.face_sizes.push_back(size);
+	}
+
+	void parseLine(Chunk& chunk, const char* p, const char* end) {
+		p = skipSpace(p, end);
+		if (p + 1 >= end)
+			return;
+
+		switch (*p) {
+		case 'v':
+			if (isSpace(p[1])) {
+				glm::vec3 v;
+				p = parseFloat(p + 1, end, v.x);
+				p = parseFloat(p, end, v.y);
+				p = parseFloat(p, end, v.z);
+				chunk.positions.push_back(v);
+			} else if (p[1] == 'n' && p + 2 < end && isSpace(p[2])) {
+				glm::vec3 n;
+				p = parseFloat(p + 2, end, n.x);
+				p = parseFloat(p, end, n.y);
+				p = parseFloat(p, end, n.z);
+				chunk.normals.push_back(n);
+			} else if (p[1] == 't' && p + 2 < end && isSpace(p[2])) {
+				glm::vec2 t;
+				p = parseFloat(p + 2, end, t.x);
+				p = parseFloat(p, end, t.y);
+				chunk.tex_coords.push_back(t);
+			}
+			break;
+		case 'f':
+			if (isSpace(p[1]))
+				parseFace(chunk, p + 1, end);
+			break;
+		case 'o':
+		case 'g':
+			if (isSpace(p[1])) {
+				Event event = { static_cast<unsigned int>(chunk.face_sizes.size()), EVENT_OBJECT, restOfLine(p + 1, end) };
+				chunk.events.push_back(event);
+			}
+			break;
+		case 'u':
+			if (startsWith(p, end, "usemtl")) {
+				Event event = { static_cast<unsigned int>(chunk.face_sizes.size()), EVENT_MATERIAL, restOfLine(p + 6, end) };
+				chunk.events.push_back(event);
+			}
+			break;
+		case 'm':
+			if (startsWith(p, end, "mtllib")) {
+				std::stringstream names(restOfLine(p + 6, end));
+				std::string name;
+				while (names >> name)
+					chunk.mtllibs.push_back(name);
+			}
+			break;
+		}
+	}
+
+	void parseChunk(Chunk& chunk) {
+		const char* p = chunk.begin;
+		while (p < chunk.end) {
+			const char* line_end = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+			if (line_end == NULL)
+				line_end = chunk.end;
+			parseLine(chunk, p, line_end);
+			p = line_end + 1;
+		}
+	}
+
+	/**
+	 * Reads the diffuse texture of every material in an MTL file
+	 */
+	void parseMaterials(const std::string& filename, std::map<std::string, std::string>& textures) {
+		std::shared_ptr<VirtualFile> file = VirtualFileSystem::open(filename);
+		const char* p = file->data();
+		const char* end = p + file->size();
+		std::string material;
+		while (p < end) {
+			const char* line_end = static_cast<const char*>(memchr(p, '\n', end - p));
+			if (line_end == NULL)
+				line_end = end;
+
+			const char* q = skipSpace(p, line_end);
+			if (startsWith(q, line_end, "newmtl")) {
+				material = restOfLine(q + 6, line_end);
+			} else if (startsWith(q, line_end, "map_Kd")) {
+				//Options may come before the file name, which is last
+				std::stringstream words(restOfLine(q + 6, line_end));
+				std::string word;
+				while (words >> word)
+					textures[material] = word;
+			}
+			p = line_end + 1;
+		}
+	}
+
+	inline unsigned int resolveGlobal(int index, unsigned char flags, unsigned char flag, unsigned int base, unsigned int count) {
+		if (index < 0 && !(flags & flag))
+			return no_index;
+		unsigned int global = (flags & flag) ? static_cast<unsigned int>(index + static_cast<int>(base)) : static_cast<unsigned int>(index);
+		if (global >= count)
+			THROW_EXCEPTION("OBJ face index out of range");
+		return global;
+	}
+
+	/**
+	 * Triangulates the faces of the group as fans, and welds corners
+	 * that share all three indices into one vertex
+	 */
+	void buildGroup(Group& group, const std::vector<Chunk>& chunks,
+			const std::vector<glm::vec3>& positions,
+			const std::vector<glm::vec3>& normals,
+			const std::vector<glm::vec2>& tex_coords) {
+		std::unordered_map<CornerKey, unsigned int, CornerKeyHash> welded;
+		unsigned int corner_count = 0;
+		for (unsigned int s = 0; s < group.segments.size(); ++s) {
+			const Segment& segment = group.segments[s];
+			const Chunk& chunk = chunks[segment.chunk];
+			for (unsigned int f = segment.face_begin; f < segment.face_end; ++f)
+				corner_count += chunk.face_sizes[f];
+		}
+		welded.reserve(corner_count);
+		group.indices.reserve(corner_count * 2);
+
+		bool missing_normals = false;
+		std::vector<unsigned int> face;
+		for (unsigned int s = 0; s < group.segments.size(); ++s) {
+			const Segment& segment = group.segments[s];
+			const Chunk& chunk = chunks[segment.chunk];
+			for (unsigned int f = segment.face_begin; f < segment.face_end; ++f) {
+				face.clear();
+				for (unsigned int c = 0; c < chunk.face_sizes[f]; ++c) {
+					const Corner& corner = chunk.corners[chunk.face_first[f] + c];
+					CornerKey key;
+					key.v = resolveGlobal(corner.v, corner.flags, RELATIVE_V, chunk.v_base, static_cast<unsigned int>(positions.size()));
+					key.t = resolveGlobal(corner.t, corner.flags, RELATIVE_T, chunk.t_base, static_cast<unsigned int>(tex_coords.size()));
+					key.n = resolveGlobal(corner.n, corner.flags, RELATIVE_N, chunk.n_base, static_cast<unsigned int>(normals.size()));
+
+					std::pair<std::unordered_map<CornerKey, unsigned int, CornerKeyHash>::iterator, bool> inserted =
+						welded.insert(std::make_pair(key, static_cast<unsigned int>(group.vertices.size())));
+					if (inserted.second) {
+						VertexData vertex;
+						vertex.position = positions[key.v];
+						vertex.normal = (key.n != no_index) ? normals[key.n] : glm::vec3(0.0f);
+						vertex.tex_coords = (key.t != no_index) ? tex_coords[key.t] : glm::vec2(0.0f);
+						group.vertices.push_back(vertex);
+						missing_normals = missing_normals || (key.n == no_index);
+					}
+					face.push_back(inserted.first->second);
+				}
+
+				for (unsigned int c = 1; c + 1 < face.size(); ++c) {
+					group.indices.push_back(face[0]);
+					group.indices.push_back(face[c]);
+					group.indices.push_back(face[c+1]);
+				}
+			}
+		}
+
+		if (missing_normals) {
+			//Area weighted smooth normals, shared by all vertices at the same position
+			std::unordered_map<unsigned int, glm::vec3> smooth;
+			std::vector<unsigned int> position_index(group.vertices.size());
+			for (std::unordered_map<CornerKey, unsigned int, CornerKeyHash>::iterator it = welded.begin(); it != welded.end(); ++it)
+				position_index[it->second] = it->first.v;
+
+			for (unsigned int i = 0; i < group.indices.size(); i += 3) {
+				const glm::vec3& a = group.vertices[group.indices[i]].position;
+				const glm::vec3& b = group.vertices[group.indices[i+1]].position;
+				const glm::vec3& c = group.vertices[group.indices[i+2]].position;
+				glm::vec3 n = glm::cross(b - a, c - a);
+				for (unsigned int k = 0; k < 3; ++k)
+					smooth[position_index[group.indices[i+k]]] += n;
+			}
+			for (unsigned int i = 0; i < group.vertices.size(); ++i) {
+				if (glm::dot(group.vertices[i].normal, group.vertices[i].normal) > 0.0f)
+					continue;
+				glm::vec3 n = smooth[position_index[i]];
+				if (glm::dot(n, n) > 0.0f)
+					group.vertices[i].normal = glm::normalize(n);
+			}
+		}
+	}
+
+	/**
+	 * Like resolveGlobal, for stream where the counts are not known yet
+	 */
+	inline unsigned int resolveStreamed(int index, unsigned char flags, unsigned char flag, unsigned int base) {
+		if (index < 0 && !(flags & flag))
+			return no_index;
+		return (flags & flag) ? static_cast<unsigned int>(index + static_cast<int>(base)) : static_cast<unsigned int>(index);
+	}
+
+	std::string getDirectory(const std::string& filename) {
+		size_t slash = filename.find_last_of("/\\");
+		return (slash == std::string::npos) ? std::string() : filename.substr(0, slash + 1);
+	}
+}
+
+void ObjLoader::load(const std::string& filename, MeshData& data) {
+	Timer timer;
+	double parse_time, resolve_time, build_time;
+
+	std::shared_ptr<VirtualFile> file = VirtualFileSystem::open(filename);
+	const char* begin = file->data();
+	const char* end = begin + file->size();
+
+	//Split the file into line aligned chunks
+	unsigned int threads = getThreadCount();
+	size_t chunk_size = file->size() / (threads * 4) + 1;
+	if (chunk_size < min_chunk_size)
+		chunk_size = min_chunk_size;
+
+	std::vector<Chunk> chunks;
+	for (const char* p = begin; p < end; ) {
+		const char* chunk_end = p + chunk_size;
+		if (chunk_end >= end) {
+			chunk_end = end;
+		} else {
+			const char* newline = static_cast<const char*>(memchr(chunk_end, '\n', end - chunk_end));
+			chunk_end = (newline == NULL) ? end : newline + 1;
+		}
+		chunks.push_back(Chunk());
+		chunks.back().begin = p;
+		chunks.back().end = chunk_end;
+		p = chunk_end;
+	}
+
+	parallelFor(static_cast<unsigned int>(chunks.size()), [&](unsigned int i) {
+		parseChunk(chunks[i]);
+	});
+	parse_time = timer.elapsedAndRestart();
+
+	//Concatenate the vertex attributes of all chunks
+	unsigned int n_positions = 0, n_tex_coords = 0, n_normals = 0;
+	for (unsigned int i = 0; i < chunks.size(); ++i) {
+		chunks[i].v_base = n_positions;
+		chunks[i].t_base = n_tex_coords;
+		chunks[i].n_base = n_normals;
+		n_positions += static_cast<unsigned int>(chunks[i].positions.size());
+		n_tex_coords += static_cast<unsigned int>(chunks[i].tex_coords.size());
+		n_normals += static_cast<unsigned int>(chunks[i].normals.size());
+	}
+	std::vector<glm::vec3> positions(n_positions);
+	std::vector<glm::vec2> tex_coords(n_tex_coords);
+	std::vector<glm::vec3> normals(n_normals);
+	parallelFor(static_cast<unsigned int>(chunks.size()), [&](unsigned int i) {
+		Chunk& chunk = chunks[i];
+		std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.v_base);
+		std::copy(chunk.tex_coords.begin(), chunk.tex_coords.end(), tex_coords.begin() + chunk.t_base);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.n_base);
+		std::vector<glm::vec3>().swap(chunk.positions);
+		std::vector<glm::vec2>().swap(chunk.tex_coords);
+		std::vector<glm::vec3>().swap(chunk.normals);
+	});
+
+	//Split the faces into groups by object and material
+	std::vector<Group> groups;
+	std::map<std::string, unsigned int> group_index;
+	std::string object, material;
+	unsigned int current = no_index;
+	std::vector<std::string> mtllibs;
+	for (unsigned int i = 0; i < chunks.size(); ++i) {
+		const Chunk& chunk = chunks[i];
+		mtllibs.insert(mtllibs.end(), chunk.mtllibs.begin(), chunk.mtllibs.end());
+
+		unsigned int face = 0;
+		unsigned int n_faces = static_cast<unsigned int>(chunk.face_sizes.size());
+		for (unsigned int e = 0; e <= chunk.events.size(); ++e) {
+			unsigned int next = (e < chunk.events.size()) ? chunk.events[e].face : n_faces;
+			if (next > face) {
+				if (current == no_index) {
+					std::string key = object + "\n" + material;
+					std::map<std::string, unsigned int>::iterator it = group_index.find(key);
+					if (it == group_index.end()) {
+						current = static_cast<unsigned int>(groups.size());
+						group_index[key] = current;
+						groups.push_back(Group());
+						groups.back().object = object;
+						groups.back().material = material;
+					} else {
+						current = it->second;
+					}
+				}
+				Segment segment = { i, face, next };
+				groups[current].segments.push_back(segment);
+				face = next;
+			}
+			if (e < chunk.events.size()) {
+				if (chunk.events[e].type == EVENT_OBJECT)
+					object = chunk.events[e].name;
+				else
+					material = chunk.events[e].name;
+				current = no_index;
+			}
+		}
+	}
+	resolve_time = timer.elapsedAndRestart();
+
+	if (groups.empty()) {
+		std::string log = "Unable to load mesh from ";
+		log.append(filename);
+		THROW_EXCEPTION(log);
+	}
+
+	parallelFor(static_cast<unsigned int>(groups.size()), [&](unsigned int i) {
+		buildGroup(groups[i], chunks, positions, normals, tex_coords);
+	});
+	build_time = timer.elapsedAndRestart();
+
+	std::map<std::string, std::string> material_textures;
+	std::string directory = getDirectory(filename);
+	for (unsigned int i = 0; i < mtllibs.size(); ++i) {
+		try {
+			parseMaterials(directory + mtllibs[i], material_textures);
+		} catch (GameException&) {
+			//Render without textures, like for a missing texture file
+		}
+	}
+
+	//One child part per group, like the Assimp importer creates
+	unsigned int n_vertices = 0, n_indices = 0;
+	for (unsigned int i = 0; i < groups.size(); ++i) {
+		n_vertices += static_cast<unsigned int>(groups[i].vertices.size());
+		n_indices += static_cast<unsigned int>(groups[i].indices.size());
+	}
+	data.root = MeshPart();
+	data.vertices.clear();
+	data.indices.clear();
+	data.textures.clear();
+	data.vertices.reserve(n_vertices);
+	data.indices.reserve(n_indices);
+	for (unsigned int i = 0; i < groups.size(); ++i) {
+		Group& group = groups[i];
+		if (group.indices.empty())
+			continue;
+
+		MeshPart part;
+		part.first = static_cast<unsigned int>(data.indices.size());
+		part.count = static_cast<unsigned int>(group.indices.size());
+		part.vertexCount = static_cast<unsigned int>(data.vertices.size());
+		part.material = static_cast<unsigned int>(data.textures.size());
+		data.root.children.push_back(part);
+
+		data.vertices.insert(data.vertices.end(), group.vertices.begin(), group.vertices.end());
+		data.indices.insert(data.indices.end(), group.indices.begin(), group.indices.end());
+
+		std::map<std::string, std::string>::iterator texture = material_textures.find(group.material);
+		data.textures.push_back((texture != material_textures.end()) ? directory + texture->second : std::string());
+	}
+
+	std::cout << "OBJ loader: " << filename << " parsed in " << parse_time*1000.0 << " ms ("
+		<< chunks.size() << " chunks), grouped in " << resolve_time*1000.0 << " ms, welded in "
+		<< build_time*1000.0 << " ms (" << data.vertices.size() << " vertices, "
+		<< data.indices.size()/3 << " triangles, " << data.root.children.size() << " parts)" << std::endl;
+}
+
+/* * *
+* The text is read into one buffer of block_bytes per thread, cut at the
+* last newline, and split into line aligned chunks that are parsed in
+* parallel as in load. The partial line at the end is moved to the front
+* of the buffer for the next round. Object and material are tracked
+* across blocks as in load, so the groups are the parts load would make.
+* * */
+unsigned int ObjLoader::stream(const std::string& filename, size_t block_bytes,
+		const std::function<void(ObjBlock&)>& consume) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in.good())
+		THROW_EXCEPTION("Unable to open " + filename);
+
+	unsigned int threads = getThreadCount();
+	std::vector<char> buffer;
+	size_t carry = 0;
+	unsigned int v_base = 0, t_base = 0, n_base = 0;
+	std::map<std::string, unsigned int> group_index;
+	std::string object, material;
+	unsigned int current = no_index;
+	ObjBlock block;
+	for (bool done = false; !done; ) {
+		buffer.resize(carry + threads * block_bytes);
+		in.read(&buffer[carry], threads * block_bytes);
+		size_t filled = carry + static_cast<size_t>(in.gcount());
+		done = !in.good();
+
+		//Lines longer than the buffer make it grow
+		size_t end = filled;
+		if (!done) {
+			while (end > carry && buffer[end - 1] != '\n')
+				--end;
+			if (end == carry) {
+				carry = filled;
+				continue;
+			}
+		}
+
+		std::vector<Chunk> chunks;
+		for (size_t p = 0; p < end; ) {
+			size_t chunk_end = std::min(p + block_bytes, end);
+			while (chunk_end < end && buffer[chunk_end - 1] != '\n')
+				++chunk_end;
+			chunks.push_back(Chunk());
+			chunks.back().begin = &buffer[p];
+			chunks.back().end = &buffer[0] + chunk_end;
+			p = chunk_end;
+		}
+		parallelFor(static_cast<unsigned int>(chunks.size()), [&](unsigned int i) {
+			parseChunk(chunks[i]);
+		});
+
+		block.bytes = buffer.capacity();
+		for (unsigned int i = 0; i < chunks.size(); ++i) {
+			Chunk& chunk = chunks[i];
+			block.bytes += chunk.positions.capacity()*sizeof(glm::vec3) + chunk.normals.capacity()*sizeof(glm::vec3)
+				+ chunk.tex_coords.capacity()*sizeof(glm::vec2) + chunk.corners.capacity()*sizeof(Corner)
+				+ (chunk.face_sizes.capacity() + chunk.face_first.capacity())*sizeof(unsigned int);
+			block.positions.insert(block.positions.end(), chunk.positions.begin(), chunk.positions.end());
+			block.normals.insert(block.normals.end(), chunk.normals.begin(), chunk.normals.end());
+			block.tex_coords.insert(block.tex_coords.end(), chunk.tex_coords.begin(), chunk.tex_coords.end());
+
+			unsigned int n_faces = static_cast<unsigned int>(chunk.face_sizes.size());
+			unsigned int e = 0;
+			for (unsigned int f = 0; f < n_faces; ++f) {
+				for (; e < chunk.events.size() && chunk.events[e].face <= f; ++e) {
+					if (chunk.events[e].type == EVENT_OBJECT)
+						object = chunk.events[e].name;
+					else
+						material = chunk.events[e].name;
+					current = no_index;
+				}
+				if (current == no_index) {
+					std::string key = object + "\n" + material;
+					std::map<std::string, unsigned int>::iterator it = group_index.find(key);
+					current = (it == group_index.end()) ? static_cast<unsigned int>(group_index.size()) : it->second;
+					group_index[key] = current;
+				}
+
+				const Corner* face = &chunk.corners[chunk.face_first[f]];
+				for (unsigned int c = 1; c + 1 < chunk.face_sizes[f]; ++c) {
+					const Corner* triangle[3] = { &face[0], &face[c], &face[c+1] };
+					for (unsigned int k = 0; k < 3; ++k) {
+						block.corners.push_back(resolveStreamed(triangle[k]->v, triangle[k]->flags, RELATIVE_V, v_base));
+						block.corners.push_back(resolveStreamed(triangle[k]->t, triangle[k]->flags, RELATIVE_T, t_base));
+						block.corners.push_back(resolveStreamed(triangle[k]->n, triangle[k]->flags, RELATIVE_N, n_base));
+					}
+					block.groups.push_back(current);
+				}
+			}
+			for (; e < chunk.events.size(); ++e) {
+				if (chunk.events[e].type == EVENT_OBJECT)
+					object = chunk.events[e].name;
+				else
+					material = chunk.events[e].name;
+				current = no_index;
+			}
+
+			v_base += static_cast<unsigned int>(chunk.positions.size());
+			t_base += static_cast<unsigned int>(chunk.tex_coords.size());
+			n_base += static_cast<unsigned int>(chunk.normals.size());
+		}
+		block.bytes += block.positions.capacity()*sizeof(glm::vec3) + block.normals.capacity()*sizeof(glm::vec3)
+			+ block.tex_coords.capacity()*sizeof(glm::vec2) + (block.corners.capacity() + block.groups.capacity())*sizeof(unsigned int);
+		consume(block);
+		block.positions.clear();
+		block.normals.clear();
+		block.tex_coords.clear();
+		block.corners.clear();
+		block.groups.clear();
+
+		carry = filled - end;
+		std::copy(buffer.begin() + end, buffer.begin() + filled, buffer.begin());
+	}
+	return static_cast<unsigned int>(group_index.size());
+}
@@ -0,0 +1,320 @@
+#include "PointCloud.h"
+#include "GameException.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <limits>
+#include <queue>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+namespace {
+	// Nodes are refined while their points are further apart than this on screen, in pixels
+	const float refine_spacing = 1.0f;
+
+	// GPU memory of the resident nodes, in point budgets
+	const unsigned int cache_budgets = 3;
+
+	// Largest splat, in pixels, for the sparse points of leaves close to the camera
+	const float max_splat_size = 64.0f;
+
+	/**
+	 * A node to visit, larger on screen first
+	 */
+	struct Visit {
+		float priority; //< Size on screen, in pixels
+		unsigned int node;
+		int parent; //< In the draw list
+
+		bool operator<(const Visit& other) const { return priority < other.priority; }
+	};
+
+	/**
+	 * False if the box is outside one of the planes
+	 */
+	inline bool intersectsFrustum(const glm::vec3& min, const glm::vec3& max, const glm::vec4* planes) {
+		for (int i = 0; i < 6; ++i) {
+			const glm::vec4& plane = planes[i];
+			glm::vec3 far_corner(plane.x > 0.0f ? max.x : min.x, plane.y > 0.0f ? max.y : min.y, plane.z > 0.0f ? max.z : min.z);
+			if (glm::dot(glm::vec3(plane), far_corner) + plane.w < 0.0f)
+				return false;
+		}
+		return true;
+	}
+}
+
+PointCloud::PointCloud(const std::string& filename, unsigned long long point_budget)
+		: filename(filename), draws(0), resident_bytes(0), reads(0), reader(1) {
+	file.open(filename.c_str(), std::ios::binary);
+	if (!file.good())
+		THROW_EXCEPTION("Unable to open " + filename);
+	file.seekg(0, std::ios::end);
+	unsigned long long file_size = static_cast<unsigned long long>(file.tellg());
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file.good() || header.magic != PointOctree::magic || header.version != PointOctree::version)
+		THROW_EXCEPTION(filename + " is not a point octree of this version");
+	unsigned long long table_bytes = static_cast<unsigned long long>(header.nodes) * sizeof(PointOctree::Node);
+	if (header.node_table < sizeof(header) || header.node_table > file_size || table_bytes > file_size - header.node_table)
+		THROW_EXCEPTION(filename + " is truncated");
+	nodes.resize(header.nodes);
+	file.seekg(static_cast<std::streamoff>(header.node_table));
+	file.read(reinterpret_cast<char*>(nodes.data()), nodes.size() * sizeof(PointOctree::Node));
+	if (!file.good() || nodes.empty())
+		THROW_EXCEPTION(filename + " is truncated");
+
+	//Children come after their parent, so the traversal ends, and the points of every node are before the table
+	unsigned long long file_points = (header.node_table - sizeof(header)) / sizeof(PointOctree::Point);
+	for (unsigned int i = 0; i < nodes.size(); ++i) {
+		const PointOctree::Node& node = nodes[i];
+		if (node.children > nodes.size() || node.first_child > nodes.size() - node.children
+				|| (node.children > 0 && node.first_child <= i)
+				|| node.offset > file_points || node.count > file_points - node.offset)
+			THROW_EXCEPTION(filename + " has a corrupt node");
+	}
+
+	buffers.resize(nodes.size());
+	node_wanted.assign(nodes.size(), 0);
+	node_loading.assign(nodes.size(), false);
+	node_resident.resize(nodes.size());
+	for (unsigned int i = 0; i < nodes.size(); ++i)
+		node_resident[i] = (nodes[i].count == 0); //< Nothing to draw, but its children are
+	setPointBudget(point_budget);
+	vao.create();
+
+	std::cout << "Point cloud " << filename << ": " << header.points << " points, " << header.nodes << " nodes, "
+		<< point_budget << " points per frame, cache of " << cache_bytes / (1024*1024) << " MiB" << std::endl;
+}
+
+PointCloud::~PointCloud() {
+	reader.wait();
+}
+
+void PointCloud::setPointBudget(unsigned long long points) {
+	point_budget = std::max(1ull, points);
+	cache_bytes = static_cast<long long>(point_budget * cache_budgets * sizeof(PointOctree::Point));
+	while (resident_bytes > cache_bytes && evict());
+}
+
+glm::mat4 PointCloud::getTransform() const {
+	glm::mat4 transform = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f / header.size));
+	return glm::translate(transform, glm::vec3(-0.5f * header.size));
+}
+
+bool PointCloud::evict() {
+	int oldest = -1;
+	for (unsigned int i = 0; i < resident.size(); ++i) {
+		unsigned int node = resident[i];
+		if (node_wanted[node] < draws && (oldest < 0 || node_wanted[node] < node_wanted[resident[oldest]]))
+			oldest = static_cast<int>(i);
+	}
+	if (oldest < 0)
+		return false;
+
+	unsigned int node = resident[oldest];
+	resident[oldest] = resident.back();
+	resident.pop_back();
+	resident_bytes -= buffers[node].bytes();
+	buffers[node].reset();
+	node_resident[node] = false;
+	++stats.evicted;
+	return true;
+}
+
+bool PointCloud::update(double time_budget) {
+	Timer timer;
+	bool uploaded = false;
+	while (timer.elapsed() < time_budget) {
+		std::shared_ptr<LoadedNode> ready;
+		{
+			std::lock_guard<std::mutex> lock(loaded_mutex);
+			if (loaded.empty())
+				break;
+			ready = loaded.front();
+			loaded.pop_front();
+		}
+		unsigned int node = ready->node;
+		--reads;
+		node_loading[node] = false;
+		if (ready->points.size() != nodes[node].count) {
+			//Drawn without its points, rather than read again every frame
+			std::cout << "Unable to read node " << node << " of " << filename << std::endl;
+			node_resident[node] = true;
+			continue;
+		}
+
+		long long node_bytes = static_cast<long long>(ready->points.size() * sizeof(PointOctree::Point));
+		while (resident_bytes + node_bytes > cache_bytes && evict());
+		if (resident_bytes + node_bytes > cache_bytes) {
+			++stats.dropped;
+			continue;
+		}
+		buffers[node].create(GL_ARRAY_BUFFER);
+		buffers[node].data(node_bytes, ready->points.data(), GL_STATIC_DRAW);
+		buffers[node].unbind();
+		resident.push_back(node);
+		resident_bytes += node_bytes;
+		node_resident[node] = true;
+		++stats.loaded;
+		uploaded = true;
+	}
+	stats.resident = static_cast<unsigned int>(resident.size());
+	stats.upload_time += timer.elapsed();
+	return uploaded;
+}
+
+/* * *
+* The points of a node fill the gaps between those of its parent, so a
+* node and the children drawn with it make up one level of detail. The
+* splats of a node are sized by its own spacing, or by the spacing of its
+* children once all of them are drawn, so that the coarse points do not
+* cover the finer ones, and parts still loading are not left with holes.
+* * */
+void PointCloud::draw(GLUtils::Program& program, const glm::mat4& modelview, const glm::mat4& projection) {
+	Timer timer;
+	++draws;
+	++stats.frames;
+
+	glm::mat4 cloud_modelview = modelview * getTransform();
+	glm::mat4 view_projection = projection * cloud_modelview;
+
+	//Rows of the matrix, added and subtracted, are the planes, with the inside positive
+	glm::vec4 planes[6];
+	for (int i = 0; i < 3; ++i) {
+		glm::vec4 row(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+		glm::vec4 w(view_projection[0][3], view_projection[1][3], view_projection[2][3], view_projection[3][3]);
+		planes[2*i] = w + row;
+		planes[2*i + 1] = w - row;
+	}
+
+	//Pixels per unit of the cloud at a distance of one unit of the view
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	float scale = glm::length(glm::vec3(cloud_modelview[0]));
+	float pixels = scale * projection[1][1] * viewport[3] * 0.5f;
+
+	//Size on screen of a length at a node, from the nearest point of its bounding sphere
+	auto getDistance = [&](const PointOctree::Node& node) {
+		glm::vec3 center(node.min[0] + 0.5f * node.size, node.min[1] + 0.5f * node.size, node.min[2] + 0.5f * node.size);
+		glm::vec3 view = glm::vec3(cloud_modelview * glm::vec4(center, 1.0f));
+		return std::max(glm::length(view) - 0.87f * node.size * scale, 1e-4f);
+	};
+
+	draw_list.clear();
+	missing.clear();
+	unsigned long long points = 0;
+	std::priority_queue<Visit> visits;
+	Visit root = { std::numeric_limits<float>::max(), 0, -1 };
+	visits.push(root);
+	while (!visits.empty()) {
+		Visit visit = visits.top();
+		visits.pop();
+		const PointOctree::Node& node = nodes[visit.node];
+		glm::vec3 min(node.min[0], node.min[1], node.min[2]);
+		if (!intersectsFrustum(min, min + glm::vec3(node.size), planes))
+			continue;
+		if (points + node.count > point_budget)
+			break;
+		node_wanted[visit.node] = draws;
+		if (!node_resident[visit.node]) {
+			if (!node_loading[visit.node])
+				missing.push_back(visit.node);
+			continue; //< Its parent is drawn until it arrives
+		}
+
+		DrawNode draw_node = { visit.node, visit.parent, node.spacing, 0 };
+		int index = static_cast<int>(draw_list.size());
+		draw_list.push_back(draw_node);
+		if (visit.parent >= 0)
+			++draw_list[visit.parent].children;
+		points += node.count;
+
+		float distance = getDistance(node);
+		if (node.spacing * pixels / distance <= refine_spacing)
+			continue;
+		for (unsigned int c = 0; c < node.children; ++c) {
+			const PointOctree::Node& child = nodes[node.first_child + c];
+			Visit child_visit = { child.size * pixels / getDistance(child), node.first_child + c, index };
+			visits.push(child_visit);
+		}
+	}
+
+	//Children come after their parents
+	for (size_t i = draw_list.size(); i-- > 0; ) {
+		const DrawNode& draw_node = draw_list[i];
+		if (draw_node.parent < 0)
+			continue;
+		DrawNode& parent = draw_list[draw_node.parent];
+		if (parent.children == nodes[parent.node].children)
+			parent.spacing = std::min(parent.spacing, draw_node.spacing);
+	}
+
+	//The reader takes the last task first, so the most important node is submitted last
+	size_t requests = std::min<size_t>(missing.size(), max_reads - reads);
+	for (size_t i = requests; i-- > 0; ) {
+		unsigned int node = missing[i];
+		node_loading[node] = true;
+		++reads;
+		reader.submit([this, node]() {
+			std::shared_ptr<LoadedNode> loaded_node(new LoadedNode());
+			loaded_node->node = node;
+			loaded_node->points.resize(nodes[node].count);
+			file.seekg(static_cast<std::streamoff>(sizeof(PointOctree::Header) + nodes[node].offset * sizeof(PointOctree::Point)));
+			file.read(reinterpret_cast<char*>(loaded_node->points.data()), loaded_node->points.size() * sizeof(PointOctree::Point));
+			if (!file.good()) {
+				file.clear();
+				loaded_node->points.clear();
+			}
+			std::lock_guard<std::mutex> lock(loaded_mutex);
+			loaded.push_back(loaded_node);
+		});
+	}
+	stats.traverse_time += timer.elapsed();
+	stats.nodes = static_cast<unsigned int>(draw_list.size());
+	stats.missing = static_cast<unsigned int>(missing.size());
+	stats.points += points;
+
+	//Attribute locations are looked up once, not per node
+	GLint position_location = glGetAttribLocation(program.name(), "in_Position");
+	GLint color_location = glGetAttribLocation(program.name(), "in_Color");
+	GLint min_location = program.getUniform("node_min");
+	GLint size_location = program.getUniform("node_size");
+	GLint spacing_location = program.getUniform("spacing");
+	glUniformMatrix4fv(program.getUniform("modelview_matrix"), 1, 0, glm::value_ptr(cloud_modelview));
+	glUniform1f(program.getUniform("splat_scale"), pixels);
+	glUniform1f(program.getUniform("max_splat_size"), max_splat_size);
+
+	vao.bind();
+	glEnableVertexAttribArray(position_location);
+	glEnableVertexAttribArray(color_location);
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	for (unsigned int i = 0; i < draw_list.size(); ++i) {
+		const DrawNode& draw_node = draw_list[i];
+		const PointOctree::Node& node = nodes[draw_node.node];
+		if (!buffers[draw_node.node].valid())
+			continue;
+		buffers[draw_node.node].bind();
+		glVertexAttribPointer(position_location, 4, GL_UNSIGNED_INT_2_10_10_10_REV, GL_TRUE, sizeof(PointOctree::Point), 0);
+		glVertexAttribPointer(color_location, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PointOctree::Point),
+			reinterpret_cast<GLvoid*>(offsetof(PointOctree::Point, color)));
+		glUniform3f(min_location, node.min[0], node.min[1], node.min[2]);
+		glUniform1f(size_location, node.size);
+		glUniform1f(spacing_location, draw_node.spacing);
+		glDrawArrays(GL_POINTS, 0, node.count);
+	}
+	glDisable(GL_PROGRAM_POINT_SIZE);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	vao.unbind();
+	CHECK_GL_ERROR();
+}
+
+void PointCloud::resetStats() {
+	unsigned int nodes_drawn = stats.nodes, nodes_missing = stats.missing;
+	stats = PointCloudStats();
+	stats.nodes = nodes_drawn;
+	stats.missing = nodes_missing;
+	stats.resident = static_cast<unsigned int>(resident.size());
+}
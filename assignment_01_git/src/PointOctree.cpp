@@ -0,0 +1,760 @@
+#include "PointOctree.h"
+#include "GameException.h"
+#include "Parallel.h"
+#include "Timer.h"
+#include "GLUtils/Hash.hpp"
+#include "GLUtils/ProgramCache.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+namespace {
+	// The points are counted in a grid of 2^7 = 128 cells across the cube
+	const unsigned int grid_levels = 7;
+	const unsigned int grid_cells = 1 << (3 * grid_levels);
+
+	// Cells with more points than a chunk are counted again in a grid of 2^4 = 16 cells across them
+	const unsigned int dense_levels = 4;
+	const unsigned int dense_cells = 1 << (3 * dense_levels);
+
+	// Marks the entries of cell_chunk that are a finer grid, not a chunk
+	const unsigned int dense_cell = 0x80000000u;
+
+	// Host memory per point of a chunk while it is built: the point, its
+	// quantized copy, and room for the samples of the nodes above it
+	const unsigned int chunk_point_bytes = 40;
+
+	// Points buffered per chunk before they are written to the temporary file
+	const unsigned int min_chunk_buffer = 256;
+	const unsigned int max_chunk_buffer = 65536;
+
+	// Points of a batch handled by one parallel work item
+	const unsigned int point_block = 65536;
+
+	// Words of a sample bitset, one bit per cell
+	const unsigned int sample_words = PointOctree::sample_grid * PointOctree::sample_grid * PointOctree::sample_grid / 64;
+
+	/**
+	 * Spreads the bits of v apart by two, so that x, y and z interleave
+	 * into a Morton code, in which the cells of every node are contiguous
+	 */
+	inline unsigned int spreadBits(unsigned int v) {
+		v = (v | (v << 16)) & 0x030000FF;
+		v = (v | (v << 8)) & 0x0300F00F;
+		v = (v | (v << 4)) & 0x030C30C3;
+		v = (v | (v << 2)) & 0x09249249;
+		return v;
+	}
+
+	inline unsigned int compactBits(unsigned int v) {
+		v &= 0x09249249;
+		v = (v | (v >> 2)) & 0x030C30C3;
+		v = (v | (v >> 4)) & 0x0300F00F;
+		v = (v | (v >> 8)) & 0x030000FF;
+		v = (v | (v >> 16)) & 0x000003FF;
+		return v;
+	}
+
+	inline unsigned int getCellCoordinate(float position, float min, float scale, unsigned int cells) {
+		float t = (position - min) * scale;
+		if (!(t > 0.0f))
+			return 0;
+		return std::min(cells - 1, static_cast<unsigned int>(t));
+	}
+
+	/**
+	 * The Morton code of the cell of point in a grid of 2^levels cells across
+	 */
+	inline unsigned int getGridCell(const PointRecord& point, const float min[3], float scale, unsigned int levels) {
+		const unsigned int cells = 1 << levels;
+		return spreadBits(getCellCoordinate(point.position[0], min[0], scale, cells))
+			| (spreadBits(getCellCoordinate(point.position[1], min[1], scale, cells)) << 1)
+			| (spreadBits(getCellCoordinate(point.position[2], min[2], scale, cells)) << 2);
+	}
+
+	/**
+	 * The cell of point in the sample grid of the cube min, size
+	 */
+	inline unsigned int getSampleCell(const PointRecord& point, const float min[3], float scale) {
+		const unsigned int cells = PointOctree::sample_grid;
+		return getCellCoordinate(point.position[0], min[0], scale, cells)
+			+ cells * (getCellCoordinate(point.position[1], min[1], scale, cells)
+			+ cells * getCellCoordinate(point.position[2], min[2], scale, cells));
+	}
+
+	/**
+	 * Sets the bit of cell, false if it was set already
+	 */
+	inline bool claimCell(std::vector<unsigned long long>& sample, unsigned int cell) {
+		unsigned long long bit = 1ull << (cell & 63);
+		unsigned long long& word = sample[cell >> 6];
+		if (word & bit)
+			return false;
+		word |= bit;
+		return true;
+	}
+
+	/**
+	 * A node of the final tree, before it is numbered breadth first
+	 */
+	struct TreeNode {
+		PointOctree::Node node;
+		std::vector<unsigned int> children;
+	};
+
+	/**
+	 * A node above the chunks. It samples the points of the chunks below it
+	 * as they are built, and keeps the samples until the end.
+	 */
+	struct UpperNode {
+		float min[3];
+		float size;
+		unsigned int tree_node;
+		std::vector<unsigned long long> sample;
+		std::vector<PointRecord> points;
+	};
+
+	/**
+	 * A subtree that is built in memory, with its points at first in the
+	 * temporary file
+	 */
+	struct Chunk {
+		float min[3];
+		float size;
+		unsigned int depth;
+		unsigned long long first; //< In the temporary file, in points
+		unsigned long long count;
+		unsigned long long written;
+		unsigned int tree_node; //< Of its root, once it is built
+		std::vector<unsigned int> ancestors; //< Upper nodes, from the root down
+		std::vector<PointRecord> buffer;
+	};
+
+	/**
+	 * Points per cell of a grid over a cube of the octree. The first one is
+	 * over the bounding cube, the others over cells of the grid above them
+	 * that have more points than a chunk.
+	 */
+	struct CountGrid {
+		float min[3];
+		float size;
+		float scale; //< Cells per unit
+		unsigned int depth; //< Of the cube in the octree
+		unsigned int levels; //< 2^levels cells across
+		std::vector<std::vector<unsigned long long> > counts; //< By level and Morton code
+		std::vector<unsigned int> cell_chunk; //< By cell of the last level, a chunk or dense_cell | a finer grid
+		int parent; //< Tree node above the cube, -1 for the first grid
+		std::vector<unsigned int> ancestors; //< Upper nodes above the cube, from the root down
+	};
+
+	/**
+	 * Splits the cells of the count grids into chunks and the upper nodes above them
+	 */
+	struct ChunkPlanner {
+		std::vector<CountGrid>& grids;
+		unsigned long long chunk_points;
+		std::vector<TreeNode>& tree;
+		std::vector<UpperNode>& upper;
+		std::vector<Chunk>& chunks;
+
+		ChunkPlanner(std::vector<CountGrid>& grids, unsigned long long chunk_points, std::vector<TreeNode>& tree,
+				std::vector<UpperNode>& upper, std::vector<Chunk>& chunks)
+				: grids(grids), chunk_points(chunk_points), tree(tree), upper(upper), chunks(chunks) {}
+
+		/**
+		 * Plans the cell code at level of grids[g], and adds it to the
+		 * children of parent unless that is -1. Returns its node in the tree,
+		 * or -1 for chunks, which get theirs when they are built, and for
+		 * cells that wait for a finer grid.
+		 */
+		int plan(unsigned int g, unsigned int level, unsigned int code, std::vector<unsigned int>& ancestors, int parent) {
+			unsigned long long count = grids[g].counts[level][code];
+			unsigned int depth = grids[g].depth + level;
+			float cell_size = grids[g].size / static_cast<float>(1 << level);
+			float min[3] = {
+				grids[g].min[0] + cell_size * compactBits(code),
+				grids[g].min[1] + cell_size * compactBits(code >> 1),
+				grids[g].min[2] + cell_size * compactBits(code >> 2)
+			};
+
+			//Too many points for a chunk in a cell of the last level, they are counted again in a grid over it
+			bool last_level = (level == grids[g].levels);
+			if (count > chunk_points && last_level && depth + dense_levels <= PointOctree::max_depth) {
+				CountGrid grid;
+				memcpy(grid.min, min, sizeof(min));
+				grid.size = cell_size;
+				grid.scale = (1 << dense_levels) / cell_size;
+				grid.depth = depth;
+				grid.levels = dense_levels;
+				grid.parent = parent;
+				grid.ancestors = ancestors;
+				grids[g].cell_chunk[code] = dense_cell | static_cast<unsigned int>(grids.size());
+				grids.push_back(grid);
+				return -1;
+			}
+
+			//Cells near max_depth that are still too large stay whole, their points are too close to split
+			if (count <= chunk_points || last_level) {
+				Chunk chunk;
+				memcpy(chunk.min, min, sizeof(min));
+				chunk.size = cell_size;
+				chunk.depth = depth;
+				chunk.first = 0;
+				chunk.count = count;
+				chunk.written = 0;
+				chunk.tree_node = 0;
+				chunk.ancestors = ancestors;
+				std::vector<unsigned int>& cell_chunk = grids[g].cell_chunk;
+				unsigned int shift = 3 * (grids[g].levels - level);
+				std::fill(cell_chunk.begin() + (code << shift), cell_chunk.begin() + ((code + 1) << shift),
+					static_cast<unsigned int>(chunks.size()));
+				if (parent >= 0)
+					chunk_parents.push_back(std::make_pair(static_cast<unsigned int>(chunks.size()), static_cast<unsigned int>(parent)));
+				chunks.push_back(chunk);
+				return -1;
+			}
+
+			TreeNode node;
+			memcpy(node.node.min, min, sizeof(min));
+			node.node.size = cell_size;
+			node.node.offset = 0;
+			node.node.count = 0;
+			node.node.first_child = 0;
+			node.node.children = 0;
+			node.node.spacing = cell_size / PointOctree::sample_grid;
+			unsigned int tree_node = static_cast<unsigned int>(tree.size());
+			tree.push_back(node);
+			if (parent >= 0)
+				tree[parent].children.push_back(tree_node);
+
+			UpperNode upper_node;
+			memcpy(upper_node.min, min, sizeof(min));
+			upper_node.size = cell_size;
+			upper_node.tree_node = tree_node;
+			ancestors.push_back(static_cast<unsigned int>(upper.size()));
+			upper.push_back(upper_node);
+			for (unsigned int octant = 0; octant < 8; ++octant) {
+				unsigned int child = (code << 3) | octant;
+				if (grids[g].counts[level + 1][child] != 0)
+					plan(g, level + 1, child, ancestors, static_cast<int>(tree_node));
+			}
+			ancestors.pop_back();
+			return static_cast<int>(tree_node);
+		}
+
+		/**
+		 * The grid whose last level has the cell of point, and that cell,
+		 * following the cells that have a finer grid
+		 */
+		void locate(const PointRecord& point, unsigned int& g, unsigned int& cell) const {
+			g = 0;
+			for (;;) {
+				const CountGrid& grid = grids[g];
+				cell = getGridCell(point, grid.min, grid.scale, grid.levels);
+				unsigned int entry = grid.cell_chunk[cell];
+				if (!(entry & dense_cell))
+					return;
+				g = entry & ~dense_cell;
+			}
+		}
+
+		std::vector<std::pair<unsigned int, unsigned int> > chunk_parents; //< Chunk, and its parent in the tree
+	};
+
+	void printStats(const PointOctreeStats& stats) {
+		double points = static_cast<double>(stats.points);
+		std::cout << "Point octree: " << stats.points << " points, " << stats.nodes << " nodes, "
+			<< stats.chunks << " chunks, " << getThreadCount() << " threads" << std::endl;
+		std::cout << std::fixed << std::setprecision(2);
+		std::cout << "  Bounds:     " << stats.bounds_time << " s, " << points / std::max(stats.bounds_time, 1e-9) / 1e6 << " M points/s" << std::endl;
+		std::cout << "  Count:      " << stats.count_time << " s, " << points / std::max(stats.count_time, 1e-9) / 1e6 << " M points/s" << std::endl;
+		std::cout << "  Distribute: " << stats.distribute_time << " s, " << points / std::max(stats.distribute_time, 1e-9) / 1e6 << " M points/s" << std::endl;
+		std::cout << "  Build:      " << stats.build_time << " s, " << points / std::max(stats.build_time, 1e-9) / 1e6 << " M points/s" << std::endl;
+		std::cout << "  Total:      " << stats.total_time << " s, " << points / std::max(stats.total_time, 1e-9) / 1e6 << " M points/s, peak memory "
+			<< stats.peak_bytes / (1024*1024) << " MiB, file " << stats.file_bytes / (1024*1024) << " MiB" << std::endl;
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(6);
+	}
+}
+
+bool PointOctree::isPointCloudFile(const std::string& filename) {
+	std::string extension = filename.substr(std::min(filename.size(), filename.find_last_of('.')));
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension == ".pgp";
+}
+
+void PointOctree::split(std::vector<PointRecord>& points, BuildNode& node, std::vector<BuildNode>& out,
+		std::vector<unsigned long long>& sample) {
+	node.first_child = 0;
+	node.children = 0;
+	if (node.end - node.begin <= leaf_points || node.depth >= max_depth) {
+		node.sample_end = node.end;
+		return;
+	}
+
+	//One point per cell of the sample grid stays, in front of the others
+	sample.assign(sample_words, 0);
+	float scale = sample_grid / node.size;
+	size_t kept = node.begin;
+	for (size_t i = node.begin; i < node.end; ++i) {
+		if (claimCell(sample, getSampleCell(points[i], node.min, scale)))
+			std::swap(points[kept++], points[i]);
+	}
+	node.sample_end = kept;
+
+	//The rest are sorted into octants, x in bit 0, y in bit 1 and z in bit 2
+	float half = node.size * 0.5f;
+	size_t bounds[9];
+	bounds[0] = kept;
+	bounds[8] = node.end;
+	PointRecord* first = points.data();
+	for (int axis = 2, step = 4; axis >= 0; --axis, step /= 2) {
+		float center = node.min[axis] + half;
+		for (unsigned int o = 0; o < 8; o += 2 * step) {
+			PointRecord* middle = std::partition(first + bounds[o], first + bounds[o + 2 * step],
+				[&](const PointRecord& p) { return p.position[axis] < center; });
+			bounds[o + step] = static_cast<size_t>(middle - first);
+		}
+	}
+	for (unsigned int o = 0; o < 8; ++o) {
+		if (bounds[o] == bounds[o + 1])
+			continue;
+		BuildNode child;
+		child.min[0] = node.min[0] + ((o & 1) ? half : 0.0f);
+		child.min[1] = node.min[1] + ((o & 2) ? half : 0.0f);
+		child.min[2] = node.min[2] + ((o & 4) ? half : 0.0f);
+		child.size = half;
+		child.depth = node.depth + 1;
+		child.begin = bounds[o];
+		child.sample_end = bounds[o];
+		child.end = bounds[o + 1];
+		child.first_child = 0;
+		child.children = 0;
+		out.push_back(child);
+	}
+}
+
+PointOctreeStats PointOctree::build(PointReader& reader, const std::string& filename, size_t memory_cap) {
+	PointOctreeStats stats;
+	Timer total_timer, timer;
+	long long reader_bytes = PointReader::batch_bytes;
+	std::vector<PointRecord> batch;
+
+	//Bounds, made a cube a little larger than them
+	float min[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+	float max[3] = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+	reader.rewind();
+	while (reader.read(batch)) {
+		unsigned int n = static_cast<unsigned int>(batch.size());
+		unsigned int blocks = (n + point_block - 1) / point_block;
+		std::vector<float> block_bounds(blocks * 6);
+		parallelFor(blocks, [&](unsigned int b) {
+			float* bounds = &block_bounds[b * 6];
+			for (int i = 0; i < 3; ++i) {
+				bounds[i] = std::numeric_limits<float>::max();
+				bounds[3 + i] = -std::numeric_limits<float>::max();
+			}
+			unsigned int end = std::min(n, (b + 1) * point_block);
+			for (unsigned int p = b * point_block; p < end; ++p) {
+				for (int i = 0; i < 3; ++i) {
+					bounds[i] = std::min(bounds[i], batch[p].position[i]);
+					bounds[3 + i] = std::max(bounds[3 + i], batch[p].position[i]);
+				}
+			}
+		});
+		for (unsigned int b = 0; b < blocks; ++b) {
+			for (int i = 0; i < 3; ++i) {
+				min[i] = std::min(min[i], block_bounds[b * 6 + i]);
+				max[i] = std::max(max[i], block_bounds[b * 6 + 3 + i]);
+			}
+		}
+		stats.points += n;
+		stats.peak_bytes = std::max(stats.peak_bytes, reader_bytes + static_cast<long long>(batch.capacity() * sizeof(PointRecord)));
+	}
+	if (stats.points == 0)
+		THROW_EXCEPTION("The point file has no points");
+	if (stats.points >= (1ull << 32) * leaf_points)
+		THROW_EXCEPTION("The point file has too many points");
+	float size = std::max(max[0] - min[0], std::max(max[1] - min[1], max[2] - min[2]));
+	size = (size > 0.0f) ? size * 1.0001f : 1.0f;
+	for (int i = 0; i < 3; ++i)
+		min[i] = (min[i] + max[i]) * 0.5f - size * 0.5f;
+	stats.bounds_time = timer.elapsedAndRestart();
+
+	//Points per grid cell, and per cell of every depth above it
+	std::vector<CountGrid> grids(1);
+	CountGrid& top = grids[0];
+	memcpy(top.min, min, sizeof(min));
+	top.size = size;
+	top.scale = (1 << grid_levels) / size;
+	top.depth = 0;
+	top.levels = grid_levels;
+	top.counts.resize(grid_levels + 1);
+	top.counts[grid_levels].assign(grid_cells, 0);
+	top.cell_chunk.assign(grid_cells, 0);
+	top.parent = -1;
+	std::vector<unsigned int> cells;
+	reader.rewind();
+	while (reader.read(batch)) {
+		unsigned int n = static_cast<unsigned int>(batch.size());
+		cells.resize(n);
+		parallelFor((n + point_block - 1) / point_block, [&](unsigned int b) {
+			unsigned int end = std::min(n, (b + 1) * point_block);
+			for (unsigned int p = b * point_block; p < end; ++p)
+				cells[p] = getGridCell(batch[p], min, top.scale, grid_levels);
+		});
+		std::vector<unsigned long long>& grid = top.counts[grid_levels];
+		for (unsigned int p = 0; p < n; ++p)
+			++grid[cells[p]];
+	}
+	for (int level = grid_levels - 1; level >= 0; --level) {
+		top.counts[level].assign(1u << (3 * level), 0);
+		for (unsigned int code = 0; code < top.counts[level + 1].size(); ++code)
+			top.counts[level][code >> 3] += top.counts[level + 1][code];
+	}
+	long long count_bytes = 0;
+	for (unsigned int level = 0; level <= grid_levels; ++level)
+		count_bytes += top.counts[level].size() * sizeof(unsigned long long);
+	count_bytes += cells.capacity() * sizeof(unsigned int);
+	long long cell_chunk_bytes = grid_cells * sizeof(unsigned int);
+	long long batch_points_bytes = batch.capacity() * sizeof(PointRecord);
+	stats.peak_bytes = std::max(stats.peak_bytes, reader_bytes + count_bytes + cell_chunk_bytes + batch_points_bytes);
+
+	//Chunks that fit the memory cap besides the reader, a batch, the count grids, the chunk of every cell and the write buffers
+	long long buffer_budget = memory_cap / 4;
+	long long fixed_bytes = reader_bytes + batch_points_bytes + count_bytes + cell_chunk_bytes + buffer_budget;
+	long long chunk_bytes = static_cast<long long>(memory_cap) - fixed_bytes;
+	unsigned long long chunk_points = std::max<long long>(leaf_points, chunk_bytes / chunk_point_bytes);
+	std::vector<TreeNode> tree;
+	std::vector<UpperNode> upper;
+	std::vector<Chunk> chunks;
+	std::vector<unsigned int> ancestors;
+	ChunkPlanner planner(grids, chunk_points, tree, upper, chunks);
+	int root = planner.plan(0, 0, 0, ancestors, -1);
+
+	//The cells planned into finer grids are counted in another pass and planned in turn
+	for (unsigned int first_grid = 1; first_grid < grids.size(); ) {
+		unsigned int end_grid = static_cast<unsigned int>(grids.size());
+		for (unsigned int g = first_grid; g < end_grid; ++g) {
+			grids[g].counts.resize(dense_levels + 1);
+			grids[g].counts[dense_levels].assign(dense_cells, 0);
+			grids[g].cell_chunk.assign(dense_cells, 0);
+		}
+		reader.rewind();
+		while (reader.read(batch)) {
+			unsigned int n = static_cast<unsigned int>(batch.size());
+			cells.resize(n);
+			parallelFor((n + point_block - 1) / point_block, [&](unsigned int b) {
+				unsigned int end = std::min(n, (b + 1) * point_block);
+				for (unsigned int p = b * point_block; p < end; ++p) {
+					unsigned int g, cell;
+					planner.locate(batch[p], g, cell);
+					cells[p] = (g >= first_grid) ? ((g - first_grid) << (3 * dense_levels)) | cell : ~0u;
+				}
+			});
+			for (unsigned int p = 0; p < n; ++p) {
+				if (cells[p] != ~0u)
+					++grids[first_grid + (cells[p] >> (3 * dense_levels))].counts[dense_levels][cells[p] & (dense_cells - 1)];
+			}
+		}
+		for (unsigned int g = first_grid; g < end_grid; ++g) {
+			std::vector<std::vector<unsigned long long> >& counts = grids[g].counts;
+			for (int level = dense_levels - 1; level >= 0; --level) {
+				counts[level].assign(1u << (3 * level), 0);
+				for (unsigned int code = 0; code < counts[level + 1].size(); ++code)
+					counts[level][code >> 3] += counts[level + 1][code];
+			}
+			cell_chunk_bytes += dense_cells * sizeof(unsigned int);
+			ancestors = grids[g].ancestors;
+			planner.plan(g, 0, 0, ancestors, grids[g].parent);
+		}
+		first_grid = end_grid;
+	}
+	unsigned long long first = 0;
+	unsigned long long largest_chunk = 0;
+	for (unsigned int c = 0; c < chunks.size(); ++c) {
+		chunks[c].first = first;
+		first += chunks[c].count;
+		largest_chunk = std::max(largest_chunk, chunks[c].count);
+	}
+	stats.chunks = static_cast<unsigned int>(chunks.size());
+	for (unsigned int g = 0; g < grids.size(); ++g)
+		std::vector<std::vector<unsigned long long> >().swap(grids[g].counts);
+	stats.count_time = timer.elapsedAndRestart();
+
+	//Points to their chunks in the temporary file, through a buffer per chunk
+	std::string temp_filename = filename + ".tmp";
+	std::fstream temp(temp_filename.c_str(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!temp.good())
+		THROW_EXCEPTION("Unable to write " + temp_filename);
+	unsigned int buffer_points = static_cast<unsigned int>(std::max<size_t>(min_chunk_buffer,
+		std::min<size_t>(max_chunk_buffer, buffer_budget / sizeof(PointRecord) / chunks.size())));
+	auto flush = [&](Chunk& chunk) {
+		if (chunk.buffer.empty())
+			return;
+		temp.seekp(static_cast<std::streamoff>((chunk.first + chunk.written) * sizeof(PointRecord)));
+		temp.write(reinterpret_cast<const char*>(chunk.buffer.data()), chunk.buffer.size() * sizeof(PointRecord));
+		chunk.written += chunk.buffer.size();
+		chunk.buffer.clear();
+	};
+	reader.rewind();
+	while (reader.read(batch)) {
+		unsigned int n = static_cast<unsigned int>(batch.size());
+		cells.resize(n);
+		parallelFor((n + point_block - 1) / point_block, [&](unsigned int b) {
+			unsigned int end = std::min(n, (b + 1) * point_block);
+			for (unsigned int p = b * point_block; p < end; ++p) {
+				unsigned int g, cell;
+				planner.locate(batch[p], g, cell);
+				cells[p] = grids[g].cell_chunk[cell];
+			}
+		});
+		for (unsigned int p = 0; p < n; ++p) {
+			Chunk& chunk = chunks[cells[p]];
+			if (chunk.buffer.capacity() == 0)
+				chunk.buffer.reserve(static_cast<size_t>(std::min<unsigned long long>(buffer_points, chunk.count)));
+			chunk.buffer.push_back(batch[p]);
+			if (chunk.buffer.size() >= buffer_points)
+				flush(chunk);
+		}
+	}
+	long long buffer_bytes = 0;
+	for (unsigned int c = 0; c < chunks.size(); ++c) {
+		buffer_bytes += chunks[c].buffer.capacity() * sizeof(PointRecord);
+		flush(chunks[c]);
+		std::vector<PointRecord>().swap(chunks[c].buffer);
+		if (chunks[c].written != chunks[c].count)
+			THROW_EXCEPTION("The point file changed while it was read");
+	}
+	temp.flush();
+	if (!temp.good())
+		THROW_EXCEPTION("Unable to write " + temp_filename);
+	stats.peak_bytes = std::max(stats.peak_bytes, reader_bytes + buffer_bytes + cell_chunk_bytes
+		+ static_cast<long long>(cells.capacity() * sizeof(unsigned int) + batch.capacity() * sizeof(PointRecord)));
+	std::vector<PointRecord>().swap(batch);
+	std::vector<unsigned int>().swap(cells);
+	std::vector<CountGrid>().swap(grids);
+	stats.distribute_time = timer.elapsedAndRestart();
+
+	//Every chunk in memory: samples for the nodes above it, then its own nodes
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	Header header;
+	memset(&header, 0, sizeof(header));
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	unsigned long long written = 0;
+	std::vector<PointRecord> points;
+	std::vector<Point> quantized;
+	std::vector<BuildNode> nodes;
+	//Sized once, a vector grown chunk by chunk would double its capacity
+	points.reserve(static_cast<size_t>(largest_chunk));
+	quantized.reserve(static_cast<size_t>(largest_chunk));
+	for (unsigned int c = 0; c < chunks.size(); ++c) {
+		Chunk& chunk = chunks[c];
+		points.resize(static_cast<size_t>(chunk.count));
+		temp.seekg(static_cast<std::streamoff>(chunk.first * sizeof(PointRecord)));
+		temp.read(reinterpret_cast<char*>(points.data()), points.size() * sizeof(PointRecord));
+		if (!temp.good())
+			THROW_EXCEPTION("Unable to read " + temp_filename);
+
+		for (unsigned int a = 0; a < chunk.ancestors.size(); ++a) {
+			UpperNode& node = upper[chunk.ancestors[a]];
+			if (node.sample.empty())
+				node.sample.assign(sample_words, 0);
+			float scale = sample_grid / node.size;
+			size_t kept = 0;
+			for (size_t p = 0; p < points.size(); ++p) {
+				if (claimCell(node.sample, getSampleCell(points[p], node.min, scale)))
+					node.points.push_back(points[p]);
+				else
+					points[kept++] = points[p];
+			}
+			points.resize(kept);
+		}
+
+		//Breadth first, the nodes of a depth on all cores
+		nodes.clear();
+		BuildNode chunk_root;
+		memcpy(chunk_root.min, chunk.min, sizeof(chunk.min));
+		chunk_root.size = chunk.size;
+		chunk_root.depth = chunk.depth;
+		chunk_root.begin = 0;
+		chunk_root.sample_end = 0;
+		chunk_root.end = points.size();
+		chunk_root.first_child = 0;
+		chunk_root.children = 0;
+		nodes.push_back(chunk_root);
+		size_t depth_begin = 0;
+		while (depth_begin < nodes.size()) {
+			size_t depth_end = nodes.size();
+			std::vector<std::vector<BuildNode> > children(depth_end - depth_begin);
+			parallelFor(static_cast<unsigned int>(depth_end - depth_begin), [&](unsigned int i) {
+				std::vector<unsigned long long> sample;
+				split(points, nodes[depth_begin + i], children[i], sample);
+			});
+			for (size_t i = 0; i < children.size(); ++i) {
+				nodes[depth_begin + i].first_child = static_cast<unsigned int>(nodes.size());
+				nodes[depth_begin + i].children = static_cast<unsigned int>(children[i].size());
+				nodes.insert(nodes.end(), children[i].begin(), children[i].end());
+			}
+			depth_begin = depth_end;
+		}
+
+		quantized.resize(points.size());
+		parallelFor(static_cast<unsigned int>(nodes.size()), [&](unsigned int i) {
+			const BuildNode& node = nodes[i];
+			for (size_t p = node.begin; p < node.sample_end; ++p) {
+				quantized[p].position = quantize(points[p].position, node.min, node.size);
+				memcpy(quantized[p].color, points[p].color, 4);
+			}
+		});
+		out.write(reinterpret_cast<const char*>(quantized.data()), quantized.size() * sizeof(Point));
+
+		unsigned int tree_first = static_cast<unsigned int>(tree.size());
+		for (size_t i = 0; i < nodes.size(); ++i) {
+			const BuildNode& node = nodes[i];
+			TreeNode tree_node;
+			memcpy(tree_node.node.min, node.min, sizeof(node.min));
+			tree_node.node.size = node.size;
+			tree_node.node.offset = written + node.begin;
+			tree_node.node.count = static_cast<unsigned int>(node.sample_end - node.begin);
+			tree_node.node.first_child = 0;
+			tree_node.node.children = 0;
+			tree_node.node.spacing = node.size / sample_grid;
+			if (node.children == 0 && tree_node.node.count > 0)
+				tree_node.node.spacing = std::min(tree_node.node.spacing, node.size / std::sqrt(static_cast<float>(tree_node.node.count)));
+			for (unsigned int child = 0; child < node.children; ++child)
+				tree_node.children.push_back(tree_first + node.first_child + child);
+			tree.push_back(tree_node);
+		}
+		written += points.size();
+
+		long long upper_bytes = 0;
+		for (unsigned int u = 0; u < upper.size(); ++u)
+			upper_bytes += upper[u].sample.capacity() * sizeof(unsigned long long) + upper[u].points.capacity() * sizeof(PointRecord);
+		stats.peak_bytes = std::max(stats.peak_bytes, reader_bytes + upper_bytes
+			+ static_cast<long long>(points.capacity() * sizeof(PointRecord) + quantized.capacity() * sizeof(Point)
+			+ nodes.capacity() * sizeof(BuildNode) + getThreadCount() * sample_words * sizeof(unsigned long long)
+			+ tree.capacity() * sizeof(TreeNode)));
+		if (root < 0)
+			root = static_cast<int>(tree_first);
+		chunk.tree_node = tree_first;
+	}
+	for (unsigned int i = 0; i < planner.chunk_parents.size(); ++i)
+		tree[planner.chunk_parents[i].second].children.push_back(chunks[planner.chunk_parents[i].first].tree_node);
+	temp.close();
+	std::remove(temp_filename.c_str());
+	std::vector<PointRecord>().swap(points);
+	std::vector<Point>().swap(quantized);
+
+	//The samples of the upper nodes
+	for (unsigned int u = 0; u < upper.size(); ++u) {
+		UpperNode& node = upper[u];
+		quantized.resize(node.points.size());
+		parallelFor(static_cast<unsigned int>((node.points.size() + point_block - 1) / point_block), [&](unsigned int b) {
+			size_t end = std::min(node.points.size(), static_cast<size_t>(b + 1) * point_block);
+			for (size_t p = static_cast<size_t>(b) * point_block; p < end; ++p) {
+				quantized[p].position = quantize(node.points[p].position, node.min, node.size);
+				memcpy(quantized[p].color, node.points[p].color, 4);
+			}
+		});
+		out.write(reinterpret_cast<const char*>(quantized.data()), quantized.size() * sizeof(Point));
+		tree[node.tree_node].node.offset = written;
+		tree[node.tree_node].node.count = static_cast<unsigned int>(node.points.size());
+		written += node.points.size();
+		std::vector<PointRecord>().swap(node.points);
+		std::vector<unsigned long long>().swap(node.sample);
+	}
+
+	//The node table, breadth first, with node minimums relative to the origin
+	std::vector<unsigned int> order(1, static_cast<unsigned int>(root));
+	std::vector<Node> table;
+	table.reserve(tree.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		const TreeNode& tree_node = tree[order[i]];
+		Node node = tree_node.node;
+		for (int axis = 0; axis < 3; ++axis)
+			node.min[axis] -= min[axis];
+		node.children = static_cast<unsigned int>(tree_node.children.size());
+		node.first_child = (node.children > 0) ? static_cast<unsigned int>(order.size()) : 0;
+		order.insert(order.end(), tree_node.children.begin(), tree_node.children.end());
+		table.push_back(node);
+	}
+
+	header.magic = magic;
+	header.version = version;
+	header.points = written;
+	header.node_table = sizeof(Header) + written * sizeof(Point);
+	header.nodes = static_cast<unsigned int>(table.size());
+	header.colors = reader.hasColors() ? 1 : 0;
+	//The points were read relative to the first one, which keeps the precision of scans far from zero
+	for (int axis = 0; axis < 3; ++axis)
+		header.origin[axis] = reader.getOrigin()[axis] + min[axis];
+	header.size = size;
+	out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(Node));
+	out.seekp(0);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (!out.good())
+		THROW_EXCEPTION("Unable to write " + filename);
+
+	stats.nodes = header.nodes;
+	stats.file_bytes = header.node_table + table.size() * sizeof(Node);
+	stats.build_time = timer.elapsedAndRestart();
+	stats.total_time = total_timer.elapsed();
+	return stats;
+}
+
+void PointOctree::convert(const std::string& in, const std::string& out, size_t memory_cap) {
+	PointReader reader(in);
+	printStats(build(reader, out, memory_cap));
+}
+
+std::string PointOctree::getCachedFile(const std::string& scan, const std::string& cache_directory, size_t memory_cap) {
+	PointReader reader(scan);
+	unsigned long long key = GLUtils::hashString(scan);
+	unsigned long long size = reader.getFileSize();
+	key = GLUtils::hashBytes(&size, sizeof(size), key);
+	std::stringstream ss;
+	ss << cache_directory << std::hex << std::setw(16) << std::setfill('0') << key << ".pgp";
+	std::string filename = ss.str();
+
+	//The header is written last, so conversions that were cut short are done again
+	{
+		std::ifstream cached(filename.c_str(), std::ios::binary);
+		Header header;
+		if (cached.read(reinterpret_cast<char*>(&header), sizeof(header)) && header.magic == magic && header.version == version)
+			return filename;
+	}
+
+	GLUtils::createDirectory(cache_directory);
+	std::cout << "Converting " << scan << " to " << filename << std::endl;
+	printStats(build(reader, filename, memory_cap));
+	return filename;
+}
+
+void PointOctree::benchmark(unsigned int max_millions, const std::string& directory, size_t memory_cap) {
+	std::cout << "Point octree benchmark, " << memory_cap / (1024*1024) << " MiB memory cap, "
+		<< getThreadCount() << " threads" << std::endl;
+	for (unsigned long long millions = 1; millions <= max_millions; millions *= 10) {
+		std::stringstream name;
+		name << directory << "benchmark_" << millions << "m";
+		std::string ply = name.str() + ".ply", pgp = name.str() + ".pgp";
+
+		Timer timer;
+		PointReader::writeSynthetic(ply, millions * 1000000);
+		double write_time = timer.elapsed();
+		std::cout << millions << " M points, " << write_time << " s to write the scan" << std::endl;
+		{
+			PointReader reader(ply);
+			printStats(build(reader, pgp, memory_cap));
+		}
+		std::remove(ply.c_str());
+		std::remove(pgp.c_str());
+	}
+}
@@ -0,0 +1,535 @@
+#include "PointReader.h"
+#include "GameException.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+namespace {
+	// Scalar types of PLY properties
+	enum PlyType {
+		PLY_INT8,
+		PLY_UINT8,
+		PLY_INT16,
+		PLY_UINT16,
+		PLY_INT32,
+		PLY_UINT32,
+		PLY_FLOAT32,
+		PLY_FLOAT64,
+		PLY_INVALID
+	};
+
+	// The PLY header has to be in this many bytes
+	const unsigned int max_header_bytes = 64 << 10;
+
+	// Records of a binary batch decoded by one parallel work item
+	const unsigned int decode_block = 65536;
+
+	// Points per work item and per batch of writeSynthetic
+	const unsigned int synthetic_block = 65536;
+
+	PlyType parseType(const std::string& name) {
+		if (name == "char" || name == "int8") return PLY_INT8;
+		if (name == "uchar" || name == "uint8") return PLY_UINT8;
+		if (name == "short" || name == "int16") return PLY_INT16;
+		if (name == "ushort" || name == "uint16") return PLY_UINT16;
+		if (name == "int" || name == "int32") return PLY_INT32;
+		if (name == "uint" || name == "uint32") return PLY_UINT32;
+		if (name == "float" || name == "float32") return PLY_FLOAT32;
+		if (name == "double" || name == "float64") return PLY_FLOAT64;
+		return PLY_INVALID;
+	}
+
+	unsigned int getTypeSize(int type) {
+		static const unsigned int sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+		return sizes[type];
+	}
+
+	int getTarget(const std::string& name) {
+		if (name == "x") return 0;
+		if (name == "y") return 1;
+		if (name == "z") return 2;
+		if (name == "red" || name == "r" || name == "diffuse_red") return 3;
+		if (name == "green" || name == "g" || name == "diffuse_green") return 4;
+		if (name == "blue" || name == "b" || name == "diffuse_blue") return 5;
+		if (name == "alpha" || name == "a") return 6;
+		return -1;
+	}
+
+	/**
+	 * A color channel from a property of the given type: 8 bit as is,
+	 * 16 bit scaled down, and floats from 0 to 1
+	 */
+	inline unsigned char toChannel(double value, int type) {
+		if (type == PLY_UINT16)
+			value /= 257.0;
+		else if (type == PLY_FLOAT32 || type == PLY_FLOAT64)
+			value *= 255.0;
+		return static_cast<unsigned char>(std::max(0.0, std::min(255.0, value + 0.5)));
+	}
+
+	/**
+	 * Reads a scalar of a little endian record, swapping the bytes of big endian ones
+	 */
+	inline double readScalar(const char* data, int type, bool swap) {
+		char bytes[8];
+		unsigned int size = getTypeSize(type);
+		if (swap) {
+			for (unsigned int i = 0; i < size; ++i)
+				bytes[i] = data[size - 1 - i];
+		} else {
+			memcpy(bytes, data, size);
+		}
+		switch (type) {
+		case PLY_INT8: { signed char v; memcpy(&v, bytes, 1); return v; }
+		case PLY_UINT8: { unsigned char v; memcpy(&v, bytes, 1); return v; }
+		case PLY_INT16: { short v; memcpy(&v, bytes, 2); return v; }
+		case PLY_UINT16: { unsigned short v; memcpy(&v, bytes, 2); return v; }
+		case PLY_INT32: { int v; memcpy(&v, bytes, 4); return v; }
+		case PLY_UINT32: { unsigned int v; memcpy(&v, bytes, 4); return v; }
+		case PLY_FLOAT32: { float v; memcpy(&v, bytes, 4); return v; }
+		default: { double v; memcpy(&v, bytes, 8); return v; }
+		}
+	}
+
+	inline bool isSeparator(char c) {
+		return c == ' ' || c == '\t' || c == ',' || c == '\r';
+	}
+
+	/**
+	 * Parses a decimal number at p, which it moves past it. Much faster
+	 * than strtod, and exact enough for the floats we keep.
+	 */
+	inline bool parseNumber(const char*& p, const char* end, double& value) {
+		const char* start = p;
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = (*p++ == '-');
+		double mantissa = 0.0;
+		int digits = 0;
+		while (p < end && *p >= '0' && *p <= '9') {
+			mantissa = mantissa * 10.0 + (*p++ - '0');
+			++digits;
+		}
+		int exponent = 0;
+		if (p < end && *p == '.') {
+			++p;
+			while (p < end && *p >= '0' && *p <= '9') {
+				mantissa = mantissa * 10.0 + (*p++ - '0');
+				--exponent;
+				++digits;
+			}
+		}
+		if (digits == 0) {
+			p = start;
+			return false;
+		}
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			const char* e = p + 1;
+			bool negative_exponent = false;
+			if (e < end && (*e == '-' || *e == '+'))
+				negative_exponent = (*e++ == '-');
+			int value = 0;
+			bool any = false;
+			while (e < end && *e >= '0' && *e <= '9') {
+				value = std::min(value * 10 + (*e++ - '0'), 1000);
+				any = true;
+			}
+			if (any) {
+				exponent += negative_exponent ? -value : value;
+				p = e;
+			}
+		}
+		if (exponent != 0)
+			mantissa *= std::pow(10.0, exponent);
+		value = negative ? -mantissa : mantissa;
+		return true;
+	}
+}
+
+PointReader::PointReader(const std::string& filename) : filename(filename) {
+	file.open(filename.c_str(), std::ios::binary);
+	if (!file.good())
+		THROW_EXCEPTION("Unable to open " + filename);
+	file.seekg(0, std::ios::end);
+	file_size = static_cast<unsigned long long>(file.tellg());
+	file.seekg(0, std::ios::beg);
+
+	big_endian = false;
+	colors = false;
+	count = 0;
+	record_size = 0;
+	skip_lines = 0;
+	data_start = 0;
+	origin[0] = origin[1] = origin[2] = 0.0;
+	has_origin = false;
+	std::string extension = filename.substr(std::min(filename.size(), filename.find_last_of('.')));
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	if (extension == ".ply") {
+		readHeader(filename);
+	} else {
+		format = FORMAT_XYZ;
+		colors = true; //< Unless every line turns out to have three columns
+	}
+	rewind();
+}
+
+bool PointReader::isPointFile(const std::string& filename) {
+	std::string extension = filename.substr(std::min(filename.size(), filename.find_last_of('.')));
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	if (extension == ".xyz")
+		return true;
+	if (extension != ".ply")
+		return false;
+
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	std::string line;
+	bool vertices = false;
+	while (std::getline(file, line) && file.tellg() < static_cast<std::streamoff>(max_header_bytes)) {
+		std::stringstream ss(line);
+		std::string keyword, name;
+		unsigned long long n = 0;
+		ss >> keyword;
+		if (keyword == "end_header")
+			return vertices;
+		if (keyword != "element")
+			continue;
+		ss >> name >> n;
+		if (name == "vertex" && n > 0)
+			vertices = true;
+		else if (name == "face" && n > 0)
+			return false;
+	}
+	return false;
+}
+
+void PointReader::readHeader(const std::string& filename) {
+	std::string line;
+	std::getline(file, line);
+	if (line.compare(0, 3, "ply") != 0)
+		THROW_EXCEPTION(filename + " is not a PLY file");
+
+	//Elements before the vertices are skipped, after them they are never read
+	bool in_vertex = false, found_vertex = false, has_format = false;
+	unsigned long long element_count = 0, element_size = 0;
+	bool element_list = false;
+	unsigned long long skip_bytes = 0;
+	while (std::getline(file, line)) {
+		if (file.tellg() > static_cast<std::streamoff>(max_header_bytes))
+			break;
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		std::stringstream ss(line);
+		std::string keyword;
+		ss >> keyword;
+		if (keyword == "format") {
+			std::string name;
+			ss >> name;
+			if (name == "ascii")
+				format = FORMAT_PLY_ASCII;
+			else if (name == "binary_little_endian")
+				format = FORMAT_PLY_BINARY;
+			else if (name == "binary_big_endian") {
+				format = FORMAT_PLY_BINARY;
+				big_endian = true;
+			} else
+				THROW_EXCEPTION("Unknown PLY format " + name + " in " + filename);
+			has_format = true;
+		} else if (keyword == "element") {
+			if (!found_vertex && !in_vertex) {
+				//The element that just ended is skipped
+				if (element_list && element_count > 0 && format == FORMAT_PLY_BINARY)
+					THROW_EXCEPTION("Binary elements with lists before the vertices of " + filename + " are not supported");
+				skip_bytes += element_count * element_size;
+				skip_lines += element_count;
+			}
+			if (in_vertex)
+				found_vertex = true;
+			std::string name;
+			ss >> name >> element_count;
+			element_size = 0;
+			element_list = false;
+			in_vertex = !found_vertex && (name == "vertex");
+			if (in_vertex)
+				count = element_count;
+		} else if (keyword == "property") {
+			std::string type_name, name;
+			ss >> type_name;
+			if (type_name == "list") {
+				element_list = true;
+				if (in_vertex)
+					THROW_EXCEPTION("Vertices with list properties in " + filename + " are not supported");
+				continue;
+			}
+			ss >> name;
+			PlyType type = parseType(type_name);
+			if (type == PLY_INVALID)
+				THROW_EXCEPTION("Unknown PLY type " + type_name + " in " + filename);
+			if (in_vertex) {
+				Property property;
+				property.type = type;
+				property.offset = static_cast<unsigned int>(element_size);
+				property.target = getTarget(name);
+				if (property.target >= 3)
+					colors = true;
+				properties.push_back(property);
+			}
+			element_size += getTypeSize(type);
+		} else if (keyword == "end_header") {
+			if (!has_format || properties.empty())
+				THROW_EXCEPTION(filename + " has no vertices");
+			unsigned int targets = 0;
+			for (unsigned int i = 0; i < properties.size(); ++i)
+				if (properties[i].target >= 0 && properties[i].target < 3)
+					++targets;
+			if (targets != 3)
+				THROW_EXCEPTION(filename + " has no x, y and z properties");
+			data_start = static_cast<unsigned long long>(file.tellg());
+			//ASCII elements before the vertices are skipped line by line in rewind
+			if (format == FORMAT_PLY_BINARY)
+				data_start += skip_bytes;
+			return;
+		}
+		if (in_vertex)
+			record_size = static_cast<unsigned int>(element_size);
+	}
+	THROW_EXCEPTION("No end_header in the first 64 KiB of " + filename);
+}
+
+void PointReader::rewind() {
+	file.clear();
+	file.seekg(static_cast<std::streamoff>(data_start), std::ios::beg);
+	if (format == FORMAT_PLY_ASCII) {
+		std::string line;
+		for (unsigned long long i = 0; i < skip_lines && std::getline(file, line); ++i);
+	}
+	points_read = 0;
+	buffered = 0;
+	end_of_file = false;
+}
+
+bool PointReader::read(std::vector<PointRecord>& points) {
+	points.clear();
+
+	if (format == FORMAT_PLY_BINARY) {
+		unsigned long long left = count - points_read;
+		unsigned int n = static_cast<unsigned int>(std::min<unsigned long long>(left, batch_points));
+		if (n == 0)
+			return false;
+		buffer.resize(static_cast<size_t>(n) * record_size);
+		file.read(&buffer[0], buffer.size());
+		n = static_cast<unsigned int>(file.gcount() / record_size);
+		if (n == 0)
+			return false;
+		if (!has_origin) {
+			unsigned char color[4];
+			decodeBinary(&buffer[0], origin, color);
+			has_origin = true;
+		}
+		points.resize(n);
+		unsigned int blocks = (n + decode_block - 1) / decode_block;
+		parallelFor(blocks, [&](unsigned int b) {
+			unsigned int end = std::min(n, (b + 1) * decode_block);
+			for (unsigned int i = b * decode_block; i < end; ++i) {
+				double position[3];
+				decodeBinary(&buffer[static_cast<size_t>(i) * record_size], position, points[i].color);
+				for (int c = 0; c < 3; ++c)
+					points[i].position[c] = static_cast<float>(position[c] - origin[c]);
+			}
+		});
+		points_read += n;
+		return true;
+	}
+
+	//Text: parse the whole lines of the batch, and carry the last partial line over
+	while (points.empty()) {
+		if (end_of_file && buffered == 0)
+			break;
+		if (format == FORMAT_PLY_ASCII && points_read >= count)
+			break;
+		buffer.resize(buffered + batch_bytes);
+		size_t got = 0;
+		if (!end_of_file) {
+			file.read(&buffer[buffered], batch_bytes);
+			got = static_cast<size_t>(file.gcount());
+			end_of_file = (got < batch_bytes);
+		}
+		size_t size = buffered + got;
+		size_t lines_end = size;
+		if (!end_of_file) {
+			while (lines_end > 0 && buffer[lines_end - 1] != '\n')
+				--lines_end;
+			if (lines_end == 0)
+				THROW_EXCEPTION("A line of " + filename + " is longer than a batch");
+		}
+
+		//Pieces of about equal size, each starting at a line
+		unsigned int pieces = std::max(1u, getThreadCount() * 4);
+		std::vector<size_t> starts(pieces + 1, lines_end);
+		starts[0] = 0;
+		for (unsigned int i = 1; i < pieces; ++i) {
+			size_t s = std::max(starts[i - 1], lines_end * i / pieces);
+			while (s < lines_end && s > 0 && buffer[s - 1] != '\n')
+				++s;
+			starts[i] = s;
+		}
+		const char* data = buffer.data();
+		for (const char* p = data; !has_origin && p < data + lines_end; ) {
+			unsigned char color[4];
+			has_origin = parseLine(p, data + lines_end, origin, color);
+		}
+		std::vector<std::vector<PointRecord> > parsed(pieces);
+		parallelFor(pieces, [&](unsigned int i) {
+			parseText(data + starts[i], data + starts[i + 1], parsed[i]);
+		});
+		for (unsigned int i = 0; i < pieces; ++i)
+			points.insert(points.end(), parsed[i].begin(), parsed[i].end());
+
+		buffered = size - lines_end;
+		if (buffered > 0)
+			memmove(&buffer[0], &buffer[lines_end], buffered);
+		if (end_of_file)
+			buffered = 0;
+
+		//Lines after the vertices of ASCII PLY files belong to other elements
+		if (format == FORMAT_PLY_ASCII && points_read + points.size() > count) {
+			points.resize(static_cast<size_t>(count - points_read));
+			end_of_file = true;
+			buffered = 0;
+		}
+		points_read += points.size();
+	}
+
+	if (points.empty() && format == FORMAT_XYZ)
+		count = points_read;
+	return !points.empty();
+}
+
+void PointReader::decodeBinary(const char* record, double position[3], unsigned char color[4]) const {
+	color[0] = color[1] = color[2] = color[3] = 255;
+	for (unsigned int p = 0; p < properties.size(); ++p) {
+		const Property& property = properties[p];
+		if (property.target < 0)
+			continue;
+		double value = readScalar(record + property.offset, property.type, big_endian);
+		if (property.target < 3)
+			position[property.target] = value;
+		else
+			color[property.target - 3] = toChannel(value, property.type);
+	}
+}
+
+bool PointReader::parseLine(const char*& p, const char* end, double position[3], unsigned char color[4]) const {
+	const unsigned int max_columns = 16;
+	double values[max_columns];
+	unsigned int columns = 0;
+	bool number = true;
+	while (p < end && *p != '\n') {
+		while (p < end && isSeparator(*p))
+			++p;
+		if (p >= end || *p == '\n')
+			break;
+		double value;
+		if (number && columns < max_columns && parseNumber(p, end, value)) {
+			values[columns++] = value;
+		} else {
+			//Comments and headers of XYZ files, the rest of the line is not read
+			number = false;
+			while (p < end && *p != '\n' && !isSeparator(*p))
+				++p;
+		}
+	}
+	if (p < end)
+		++p;
+	if (!number || columns < 3)
+		return false;
+
+	color[0] = color[1] = color[2] = color[3] = 255;
+	if (format == FORMAT_PLY_ASCII) {
+		if (columns < properties.size())
+			return false;
+		for (unsigned int i = 0; i < properties.size(); ++i) {
+			const Property& property = properties[i];
+			if (property.target < 0)
+				continue;
+			if (property.target < 3)
+				position[property.target] = values[i];
+			else
+				color[property.target - 3] = toChannel(values[i], property.type);
+		}
+	} else {
+		for (int c = 0; c < 3; ++c)
+			position[c] = values[c];
+		if (columns == 4 || columns == 5) {
+			//Intensity, 0 to 1 or 0 to 255
+			double intensity = (values[3] <= 1.0) ? values[3] * 255.0 : values[3];
+			unsigned char grey = toChannel(intensity, PLY_UINT8);
+			color[0] = color[1] = color[2] = grey;
+		} else if (columns >= 6) {
+			unsigned int first = (columns >= 7) ? 4 : 3;
+			for (int c = 0; c < 3; ++c)
+				color[c] = toChannel(values[first + c], PLY_UINT8);
+		}
+	}
+	return true;
+}
+
+void PointReader::parseText(const char* begin, const char* end, std::vector<PointRecord>& points) const {
+	const char* p = begin;
+	while (p < end) {
+		PointRecord point;
+		double position[3];
+		if (!parseLine(p, end, position, point.color))
+			continue;
+		for (int c = 0; c < 3; ++c)
+			point.position[c] = static_cast<float>(position[c] - origin[c]);
+		points.push_back(point);
+	}
+}
+
+void PointReader::writeSynthetic(const std::string& filename, unsigned long long n) {
+	std::ofstream file(filename.c_str(), std::ios::binary);
+	file << "ply\nformat binary_little_endian 1.0\ncomment synthetic terrain\nelement vertex " << n
+		<< "\nproperty float x\nproperty float y\nproperty float z\n"
+		<< "property uchar red\nproperty uchar green\nproperty uchar blue\nend_header\n";
+
+	//A kilometer of rolling hills, with the points spread evenly over it
+	const unsigned int record = 15;
+	const unsigned int blocks_per_batch = std::max(1u, getThreadCount() * 4);
+	unsigned long long blocks = (n + synthetic_block - 1) / synthetic_block;
+	std::vector<char> batch(static_cast<size_t>(blocks_per_batch) * synthetic_block * record);
+	for (unsigned long long first = 0; first < blocks; first += blocks_per_batch) {
+		unsigned int batch_blocks = static_cast<unsigned int>(std::min<unsigned long long>(blocks_per_batch, blocks - first));
+		std::vector<unsigned int> sizes(batch_blocks);
+		parallelFor(batch_blocks, [&](unsigned int b) {
+			unsigned long long block = first + b;
+			unsigned int size = static_cast<unsigned int>(std::min<unsigned long long>(synthetic_block, n - block * synthetic_block));
+			std::mt19937 random(static_cast<unsigned int>(block * 2654435761u));
+			std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+			char* out = &batch[static_cast<size_t>(b) * synthetic_block * record];
+			for (unsigned int i = 0; i < size; ++i) {
+				float x = unit(random) * 1000.0f, y = unit(random) * 1000.0f;
+				float z = 40.0f * std::sin(x * 0.013f) * std::cos(y * 0.011f) + 6.0f * std::sin(x * 0.11f + y * 0.07f)
+					+ 0.05f * unit(random);
+				float h = std::max(0.0f, std::min(1.0f, (z + 46.0f) / 92.0f));
+				unsigned char color[3] = {
+					static_cast<unsigned char>(60.0f + 180.0f * h),
+					static_cast<unsigned char>(120.0f + 100.0f * h - 60.0f * h * h),
+					static_cast<unsigned char>(40.0f + 200.0f * h * h)
+				};
+				float position[3] = { x, y, z };
+				memcpy(out + i * record, position, 12);
+				memcpy(out + i * record + 12, color, 3);
+			}
+			sizes[b] = size;
+		});
+		for (unsigned int b = 0; b < batch_blocks; ++b)
+			file.write(&batch[static_cast<size_t>(b) * synthetic_block * record], static_cast<std::streamsize>(sizes[b]) * record);
+	}
+	if (!file.good())
+		THROW_EXCEPTION("Unable to write " + filename);
+}
@@ -0,0 +1,97 @@
+#include "ResidencyManager.h"
+#include "GLUtils/MemoryLedger.hpp"
+
+#include <iostream>
+
+ResidencyManager::ResidencyManager(long long budget) {
+	this->budget = budget;
+	frame = 0;
+	over_budget = false;
+	stats.budget = budget;
+}
+
+void ResidencyManager::setBudget(long long bytes) {
+	budget = bytes;
+	stats.budget = bytes;
+}
+
+std::shared_ptr<ModelInterleavedArray> ResidencyManager::find(const std::string& filename) {
+	std::list<Entry>::iterator entry = findEntry(filename);
+	if (entry == entries.end()) {
+		++stats.misses;
+		return std::shared_ptr<ModelInterleavedArray>();
+	}
+	++stats.hits;
+	touch(entry);
+	return entry->model;
+}
+
+void ResidencyManager::insert(const std::string& filename, std::shared_ptr<ModelInterleavedArray> model) {
+	erase(filename);
+	Entry entry;
+	entry.filename = filename;
+	entry.model = model;
+	entry.bytes = model->getBytes();
+	entry.last_drawn = frame;
+	entries.push_front(entry);
+}
+
+void ResidencyManager::erase(const std::string& filename) {
+	std::list<Entry>::iterator entry = findEntry(filename);
+	if (entry != entries.end())
+		entries.erase(entry);
+}
+
+void ResidencyManager::drawn(const std::string& filename) {
+	std::list<Entry>::iterator entry = findEntry(filename);
+	if (entry != entries.end())
+		touch(entry);
+}
+
+void ResidencyManager::endFrame() {
+	stats.frame_evictions = 0;
+	long long used = getUsedBytes();
+
+	//Evict from the back, which is least recently drawn, but not what this frame drew
+	while (budget > 0 && used > budget && !entries.empty() && entries.back().last_drawn < frame) {
+		std::cout << "Evicting " << entries.back().filename << " (" << entries.back().bytes / (1024*1024)
+			<< " MiB) to stay within the GPU memory budget" << std::endl;
+		entries.pop_back();
+		++stats.frame_evictions;
+		++stats.evictions;
+		used = getUsedBytes();
+	}
+
+	bool over = (budget > 0 && used > budget);
+	if (over && !over_budget)
+		std::cout << "GPU memory " << used / (1024*1024) << " MiB is over the budget of "
+			<< budget / (1024*1024) << " MiB, and nothing is left to evict" << std::endl;
+	over_budget = over;
+
+	stats.used = used;
+	stats.cached = 0;
+	for (std::list<Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+		if (it->last_drawn < frame)
+			stats.cached += it->bytes;
+	}
+	stats.models = static_cast<unsigned int>(entries.size());
+	++frame;
+}
+
+std::list<ResidencyManager::Entry>::iterator ResidencyManager::findEntry(const std::string& filename) {
+	for (std::list<Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+		if (it->filename == filename)
+			return it;
+	}
+	return entries.end();
+}
+
+void ResidencyManager::touch(std::list<Entry>::iterator entry) {
+	entry->last_drawn = frame;
+	entries.splice(entries.begin(), entries, entry);
+}
+
+long long ResidencyManager::getUsedBytes() {
+	GLUtils::MemoryLedger& ledger = GLUtils::MemoryLedger::get();
+	return ledger.getBytes(GLUtils::MemoryLedger::LEDGER_BUFFER) + ledger.getBytes(GLUtils::MemoryLedger::LEDGER_TEXTURE);
+}
@@ -0,0 +1,156 @@
+#include "ShaderWatcher.h"
+#include "Timer.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <sys/stat.h>
+#elif defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	// How often the watcher thread checks if it should stop
+	const int poll_timeout_ms = 100;
+}
+
+ShaderWatcher::ShaderWatcher() {
+	running = false;
+}
+
+ShaderWatcher::~ShaderWatcher() {
+	stop();
+}
+
+void ShaderWatcher::start(const std::string& directory) {
+	stop();
+	this->directory = directory;
+	running = true;
+	thread = std::thread(&ShaderWatcher::run, this);
+}
+
+void ShaderWatcher::stop() {
+	running = false;
+	if (thread.joinable())
+		thread.join();
+}
+
+std::map<std::string, double> ShaderWatcher::getChanged() {
+	std::map<std::string, double> result;
+	std::lock_guard<std::mutex> lock(mutex);
+	result.swap(changed);
+	return result;
+}
+
+void ShaderWatcher::fileChanged(const std::string& filename) {
+	std::lock_guard<std::mutex> lock(mutex);
+	//Editors often write a file several times, keep the first time we saw it
+	if (changed.find(filename) == changed.end())
+		changed[filename] = Timer::getCurrentTime();
+}
+
+#if defined(__linux__)
+
+void ShaderWatcher::run() {
+	int fd = inotify_init1(IN_NONBLOCK);
+	if (fd < 0) {
+		std::cout << "Unable to watch " << directory << ": inotify_init1 failed" << std::endl;
+		return;
+	}
+	//Editors either write in place, or write a new file and move it over the old one
+	if (inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		std::cout << "Unable to watch " << directory << std::endl;
+		close(fd);
+		return;
+	}
+
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	while (running) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, poll_timeout_ms) <= 0)
+			continue;
+
+		ssize_t length;
+		while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+			for (char* p = buffer; p < buffer + length; ) {
+				const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+				if (event->len > 0)
+					fileChanged(directory + event->name);
+				p += sizeof(struct inotify_event) + event->len;
+			}
+		}
+	}
+	close(fd);
+}
+
+#else
+
+void ShaderWatcher::scan(bool report) {
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((directory + "*").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+	do {
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		std::string filename = directory + data.cFileName;
+		long long mtime = (static_cast<long long>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (dir == NULL)
+		return;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		std::string filename = directory + entry->d_name;
+		struct stat st;
+		if (stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		long long mtime = st.st_mtime;
+#endif
+		std::map<std::string, long long>::iterator it = mtimes.find(filename);
+		if (it == mtimes.end() || it->second != mtime) {
+			if (report) fileChanged(filename);
+			mtimes[filename] = mtime;
+		}
+#ifdef _WIN32
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	}
+	closedir(dir);
+#endif
+}
+
+void ShaderWatcher::run() {
+	scan(false);
+#ifdef _WIN32
+	HANDLE notification = FindFirstChangeNotificationA(directory.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE);
+	if (notification == INVALID_HANDLE_VALUE) {
+		std::cout << "Unable to watch " << directory << std::endl;
+		return;
+	}
+	while (running) {
+		//The notification does not say which file changed, so compare modification times
+		if (WaitForSingleObject(notification, poll_timeout_ms) == WAIT_OBJECT_0) {
+			scan(true);
+			FindNextChangeNotification(notification);
+		}
+	}
+	FindCloseChangeNotification(notification);
+#else
+	while (running) {
+		usleep(poll_timeout_ms * 1000);
+		scan(true);
+	}
+#endif
+}
+
+#endif
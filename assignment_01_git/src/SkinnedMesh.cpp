@@ -0,0 +1,266 @@
+#include "SkinnedMesh.h"
+#include "GameException.h"
+#include "Parallel.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define SKINNING_SSE
+#endif
+
+namespace {
+	// Vertices skinned by one parallel work item
+	const unsigned int skin_block = 4096;
+}
+
+SkinnedMesh::SkinnedMesh(const MeshData& data)
+		: vertices(data.vertices), weights(data.weights), skeleton(data.skeleton), animator(skeleton) {
+	if (weights.size() != vertices.size())
+		THROW_EXCEPTION("A skinned mesh needs the weights of every vertex");
+	mode = SKINNING_GPU;
+	base_vertex = 0;
+	timer = 0;
+	stalls_at_reset = 0;
+
+	weight_buffer.create(GL_ARRAY_BUFFER);
+	weight_buffer.data(weights.size() * sizeof(SkinWeights), weights.data(), GL_STATIC_DRAW);
+	weight_buffer.unbind();
+
+	//Sized for the bones here, and orphaned every frame by update
+	bone_rows.assign(std::max<size_t>(skeleton.bone_nodes.size(), 1) * 12, 0.0f);
+	bone_buffer.create(GL_TEXTURE_BUFFER);
+	bone_buffer.data(bone_rows.size() * sizeof(float), bone_rows.data(), GL_STREAM_DRAW);
+	bone_buffer.unbind();
+	bone_texture.create(GL_TEXTURE_BUFFER);
+	bone_texture.bind();
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, bone_buffer.name());
+	bone_texture.unbind();
+
+	for (unsigned int i = 0; i < timer_frames; ++i) {
+		timers[i].begin.create();
+		timers[i].end.create();
+	}
+	CHECK_GL_ERROR();
+}
+
+const char* SkinnedMesh::getModeName(SkinningMode mode) {
+	switch (mode) {
+	case SKINNING_CPU: return "cpu";
+	case SKINNING_GPU: return "gpu";
+	default: return "unknown";
+	}
+}
+
+SkinningMode SkinnedMesh::parseMode(const std::string& name) {
+	if (name == "cpu") return SKINNING_CPU;
+	if (name == "gpu") return SKINNING_GPU;
+	THROW_EXCEPTION("Unknown skinning mode " + name + ", use cpu or gpu");
+}
+
+void SkinnedMesh::setMode(SkinningMode mode) {
+	this->mode = mode;
+	base_vertex = 0;
+	if (mode == SKINNING_CPU && !stream) {
+		stream.reset(new GLUtils::DynamicBuffer(static_cast<unsigned int>(vertices.size() * sizeof(VertexData))));
+		stalls_at_reset = stream->getStalls();
+	}
+}
+
+void SkinnedMesh::update(double seconds) {
+	Timer timer;
+	animator.advance(seconds);
+	animator.sample(bone_rows);
+	stats.animate_time += timer.elapsedAndRestart();
+
+	//New storage every frame, so that we never wait for the GPU to finish reading the last one
+	bone_buffer.data(bone_rows.size() * sizeof(float), bone_rows.data(), GL_STREAM_DRAW);
+	bone_buffer.unbind();
+	stats.upload_time += timer.elapsedAndRestart();
+	++stats.frames;
+
+	if (mode != SKINNING_CPU)
+		return;
+
+	//Regions are a whole number of vertices, so the offset is one too
+	unsigned int n = static_cast<unsigned int>(vertices.size());
+	unsigned int offset = 0;
+	VertexData* destination = static_cast<VertexData*>(stream->map(n * sizeof(VertexData), offset));
+	base_vertex = offset / sizeof(VertexData);
+	unsigned int blocks = (n + skin_block - 1) / skin_block;
+	parallelFor(blocks, [&](unsigned int b) {
+		skin(vertices.data(), weights.data(), bone_rows.data(), destination, b * skin_block, std::min(n, (b+1) * skin_block));
+	});
+	stream->unmap();
+	stats.vertices += n;
+	stats.skin_time += timer.elapsed();
+}
+
+/* * *
+* The matrices of up to four bones are blended by their weights, and the
+* position and normal are moved by the blend, like the vertex shaders do.
+* With SSE, the three rows of the blend are one register each, and the
+* products with the position are transposed so that adding them up gives
+* all three coordinates at once.
+* * */
+void SkinnedMesh::skin(const VertexData* source, const SkinWeights* weights, const float* bone_rows,
+		VertexData* destination, unsigned int begin, unsigned int end) {
+	for (unsigned int v = begin; v < end; ++v) {
+		const SkinWeights& w = weights[v];
+		const VertexData& in = source[v];
+		//Weights are sorted, largest first
+		if (w.weights[0] == 0) {
+			destination[v] = in;
+			continue;
+		}
+
+		float out[8];
+#ifdef SKINNING_SSE
+		__m128 row0 = _mm_setzero_ps();
+		__m128 row1 = _mm_setzero_ps();
+		__m128 row2 = _mm_setzero_ps();
+		for (int i = 0; i < 4 && w.weights[i] > 0; ++i) {
+			__m128 weight = _mm_set1_ps(w.weights[i] * (1.0f / 255.0f));
+			const float* bone = bone_rows + w.bones[i] * 12;
+			row0 = _mm_add_ps(row0, _mm_mul_ps(weight, _mm_loadu_ps(bone)));
+			row1 = _mm_add_ps(row1, _mm_mul_ps(weight, _mm_loadu_ps(bone + 4)));
+			row2 = _mm_add_ps(row2, _mm_mul_ps(weight, _mm_loadu_ps(bone + 8)));
+		}
+
+		__m128 p = _mm_set_ps(1.0f, in.position.z, in.position.y, in.position.x);
+		__m128 a = _mm_mul_ps(row0, p), b = _mm_mul_ps(row1, p), c = _mm_mul_ps(row2, p), d = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		_mm_storeu_ps(out, _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, d)));
+
+		__m128 n = _mm_set_ps(0.0f, in.normal.z, in.normal.y, in.normal.x);
+		a = _mm_mul_ps(row0, n), b = _mm_mul_ps(row1, n), c = _mm_mul_ps(row2, n), d = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		float normal[4];
+		_mm_storeu_ps(normal, _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, d)));
+		out[3] = normal[0];
+		out[4] = normal[1];
+		out[5] = normal[2];
+#else
+		float rows[12] = { 0.0f };
+		for (int i = 0; i < 4 && w.weights[i] > 0; ++i) {
+			float weight = w.weights[i] * (1.0f / 255.0f);
+			const float* bone = bone_rows + w.bones[i] * 12;
+			for (int j = 0; j < 12; ++j)
+				rows[j] += weight * bone[j];
+		}
+		const float* p = &in.position.x;
+		const float* n = &in.normal.x;
+		for (int r = 0; r < 3; ++r) {
+			out[r] = rows[r*4]*p[0] + rows[r*4 + 1]*p[1] + rows[r*4 + 2]*p[2] + rows[r*4 + 3];
+			out[3 + r] = rows[r*4]*n[0] + rows[r*4 + 1]*n[1] + rows[r*4 + 2]*n[2];
+		}
+#endif
+		//Blending bones shortens the normal
+		float length = std::sqrt(out[3]*out[3] + out[4]*out[4] + out[5]*out[5]);
+		float scale = (length > 0.0f) ? 1.0f / length : 0.0f;
+		out[3] *= scale;
+		out[4] *= scale;
+		out[5] *= scale;
+		out[6] = in.tex_coords.x;
+		out[7] = in.tex_coords.y;
+
+		//One whole vertex at a time, the streaming buffer may be write combined
+		memcpy(&destination[v], out, sizeof(out));
+	}
+}
+
+void SkinnedMesh::setAttributePointers(GLUtils::Program& program, GLUtils::VBO& interleaved) {
+	GLint bones = glGetAttribLocation(program.name(), "in_Bones");
+	GLint bone_weights = glGetAttribLocation(program.name(), "in_Weights");
+	if (mode == SKINNING_CPU) {
+		stream->bind();
+	} else {
+		interleaved.bind();
+	}
+	program.setAttributePointer("in_Position", 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_POSITION);
+	program.setAttributePointer("in_Normal", 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_NORMAL);
+	program.setAttributePointer("in_Texture_Coords", 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)V_TEX_COORD);
+
+	if (mode == SKINNING_CPU) {
+		stream->unbind();
+		if (bones >= 0) glDisableVertexAttribArray(bones);
+		if (bone_weights >= 0) glDisableVertexAttribArray(bone_weights);
+		return;
+	}
+
+	//Bone indices as floats, so that they need no integer attributes
+	weight_buffer.bind();
+	program.setAttributePointer("in_Bones", 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(SkinWeights), (void*)0);
+	program.setAttributePointer("in_Weights", 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(SkinWeights), (void*)4);
+	weight_buffer.unbind();
+}
+
+void SkinnedMesh::bind(GLUtils::Program& program, unsigned int texture_unit) {
+	glActiveTexture(GL_TEXTURE0 + texture_unit);
+	bone_texture.bind();
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(program.getUniform("bone_matrices"), texture_unit);
+	glUniform1i(program.getUniform("skinning"), (mode == SKINNING_GPU) ? 1 : 0);
+}
+
+void SkinnedMesh::beginDraw() {
+	readTimers();
+	DrawTimer& current = timers[timer];
+	if (!current.pending)
+		glQueryCounter(current.begin.name(), GL_TIMESTAMP);
+}
+
+void SkinnedMesh::endDraw() {
+	//A frame whose timer is still in flight from timer_frames frames ago is not timed
+	DrawTimer& current = timers[timer];
+	if (!current.pending) {
+		glQueryCounter(current.end.name(), GL_TIMESTAMP);
+		current.pending = true;
+		current.vertices = static_cast<unsigned int>(vertices.size());
+		timer = (timer + 1) % timer_frames;
+	}
+	if (mode == SKINNING_CPU)
+		stream->endFrame();
+}
+
+void SkinnedMesh::readTimers() {
+	for (unsigned int i = 0; i < timer_frames; ++i) {
+		DrawTimer& t = timers[i];
+		if (!t.pending)
+			continue;
+		GLint available = 0;
+		glGetQueryObjectiv(t.end.name(), GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			continue;
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(t.begin.name(), GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(t.end.name(), GL_QUERY_RESULT, &end);
+		t.pending = false;
+		++stats.gpu_frames;
+		stats.gpu_vertices += t.vertices;
+		stats.gpu_time += (end - begin) * 1.0e-9;
+	}
+}
+
+long long SkinnedMesh::bytes() const {
+	long long result = weight_buffer.bytes() + bone_buffer.bytes();
+	if (stream)
+		result += stream->bytes();
+	return result;
+}
+
+SkinningStats SkinnedMesh::getStats() const {
+	SkinningStats result = stats;
+	if (stream)
+		result.stalls = stream->getStalls() - stalls_at_reset;
+	return result;
+}
+
+void SkinnedMesh::resetStats() {
+	stats = SkinningStats();
+	if (stream)
+		stalls_at_reset = stream->getStalls();
+}
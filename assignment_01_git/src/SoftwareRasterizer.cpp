@@ -0,0 +1,586 @@
+#include "SoftwareRasterizer.h"
+#include "Parallel.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define RASTER_SSE
+#endif
+
+namespace {
+	const unsigned int tile_size = 64;
+
+	// Vertices transformed by one parallel work item
+	const unsigned int vertex_block = 4096;
+
+	// Floats per transformed vertex: clip position, view position, normal, texture coordinates
+	enum Channel {
+		CLIP_X = 0, CLIP_Y, CLIP_Z, CLIP_W,
+		VIEW_X, VIEW_Y, VIEW_Z,
+		NORMAL_X, NORMAL_Y, NORMAL_Z,
+		TEX_U, TEX_V,
+		CHANNELS
+	};
+
+	// The light of the shaders, in view space
+	const float light[3] = { 200.0f, 200.0f, 200.0f };
+
+	// Smallest depth difference of the 16 bit depth buffer we ask OpenGL for
+	const float depth_unit = 1.0f / 65536.0f;
+
+	/**
+	 * Column major 4x4 matrix product
+	 */
+	void multiply(const float* a, const float* b, float* out) {
+		for (int c=0; c<4; ++c)
+			for (int r=0; r<4; ++r)
+				out[c*4+r] = a[r]*b[c*4] + a[4+r]*b[c*4+1] + a[8+r]*b[c*4+2] + a[12+r]*b[c*4+3];
+	}
+
+	/**
+	 * The normal matrix, the transpose of the inverse of the upper 3x3 of
+	 * a column major 4x4 matrix, as a row major 3x3 matrix
+	 */
+	void normalMatrix(const float* m, float* out) {
+		float a = m[0], b = m[4], c = m[8];
+		float d = m[1], e = m[5], f = m[9];
+		float g = m[2], h = m[6], i = m[10];
+		float cofactors[9] = {
+			e*i - f*h, f*g - d*i, d*h - e*g,
+			c*h - b*i, a*i - c*g, b*g - a*h,
+			b*f - c*e, c*d - a*f, a*e - b*d
+		};
+		float det = a*cofactors[0] + b*cofactors[1] + c*cofactors[2];
+		float inv_det = (det != 0.0f) ? 1.0f / det : 0.0f;
+		for (int k=0; k<9; ++k)
+			out[k] = cofactors[k] * inv_det;
+	}
+
+	inline void normalize(float* v) {
+		float length = std::sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+		float inv = (length > 0.0f) ? 1.0f / length : 0.0f;
+		v[0] *= inv; v[1] *= inv; v[2] *= inv;
+	}
+
+	inline float dot(const float* a, const float* b) {
+		return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+	}
+
+	/**
+	 * max(0.1, n.l) as in the shaders, from a view position and a normal
+	 */
+	inline float diffuse(const float* position, const float* normal, float* light_direction) {
+		float n[3] = { normal[0], normal[1], normal[2] };
+		normalize(n);
+		light_direction[0] = light[0] - position[0];
+		light_direction[1] = light[1] - position[1];
+		light_direction[2] = light[2] - position[2];
+		normalize(light_direction);
+		return std::max(0.1f, dot(n, light_direction));
+	}
+
+	inline unsigned int pack(float r, float g, float b) {
+		unsigned int ri = static_cast<unsigned int>(std::min(std::max(r, 0.0f), 1.0f) * 255.0f + 0.5f);
+		unsigned int gi = static_cast<unsigned int>(std::min(std::max(g, 0.0f), 1.0f) * 255.0f + 0.5f);
+		unsigned int bi = static_cast<unsigned int>(std::min(std::max(b, 0.0f), 1.0f) * 255.0f + 0.5f);
+		return 0xff000000u | (bi << 16) | (gi << 8) | ri;
+	}
+
+	/**
+	 * Nearest texel with repeat wrapping, like the GL textures when minified.
+	 * White without a texture.
+	 */
+	inline void sample(const MipChain& texture, float u, float v, float* rgb) {
+		if (texture.levels.empty()) {
+			rgb[0] = rgb[1] = rgb[2] = 1.0f;
+			return;
+		}
+		u -= std::floor(u);
+		v -= std::floor(v);
+		unsigned int x = std::min(static_cast<unsigned int>(u * texture.width), texture.width - 1);
+		unsigned int y = std::min(static_cast<unsigned int>(v * texture.height), texture.height - 1);
+		const unsigned char* texel = &texture.levels[0][(static_cast<size_t>(y)*texture.width + x)*4];
+		rgb[0] = texel[0] * (1.0f / 255.0f);
+		rgb[1] = texel[1] * (1.0f / 255.0f);
+		rgb[2] = texel[2] * (1.0f / 255.0f);
+	}
+
+	/**
+	 * Clips a polygon against the near plane, z >= -w. Returns the number
+	 * of vertices left, at most one more than given.
+	 */
+	unsigned int clipNear(const float (*in)[CHANNELS], unsigned int n, float (*out)[CHANNELS]) {
+		unsigned int n_out = 0;
+		for (unsigned int i=0; i<n; ++i) {
+			const float* a = in[i];
+			const float* b = in[(i+1) % n];
+			float da = a[CLIP_Z] + a[CLIP_W];
+			float db = b[CLIP_Z] + b[CLIP_W];
+			if (da >= 0.0f)
+				memcpy(out[n_out++], a, sizeof(float)*CHANNELS);
+			if ((da >= 0.0f) != (db >= 0.0f)) {
+				float t = da / (da - db);
+				for (unsigned int c=0; c<CHANNELS; ++c)
+					out[n_out][c] = a[c] + (b[c] - a[c])*t;
+				++n_out;
+			}
+		}
+		return n_out;
+	}
+
+	/**
+	 * Draws the part of a line inside a tile, with its depth interpolated
+	 * and tested (less or equal) like a GL_LINE polygon edge
+	 */
+	template <class Shade>
+	unsigned long long drawLine(float x0, float y0, float z0, float x1, float y1, float z1,
+			int tile_x0, int tile_y0, int tile_x1, int tile_y1, unsigned int width,
+			float* depth, unsigned int* color, Shade shade) {
+		float dx = x1 - x0;
+		float dy = y1 - y0;
+		float steps = std::ceil(std::max(std::fabs(dx), std::fabs(dy)));
+		if (steps < 1.0f)
+			steps = 1.0f;
+
+		//Only walk the steps that may fall in the tile
+		float t0 = 0.0f, t1 = 1.0f;
+		const float p[4] = { -dx, dx, -dy, dy };
+		const float q[4] = { x0 - (tile_x0 - 1), (tile_x1 + 1) - x0, y0 - (tile_y0 - 1), (tile_y1 + 1) - y0 };
+		for (int k=0; k<4; ++k) {
+			if (p[k] == 0.0f) {
+				if (q[k] < 0.0f) return 0;
+				continue;
+			}
+			float r = q[k] / p[k];
+			if (p[k] < 0.0f) t0 = std::max(t0, r);
+			else t1 = std::min(t1, r);
+		}
+		if (t0 > t1)
+			return 0;
+
+		unsigned long long fragments = 0;
+		int first = static_cast<int>(std::floor(t0 * steps));
+		int last = static_cast<int>(std::ceil(t1 * steps));
+		for (int i=first; i<=last; ++i) {
+			float t = i / steps;
+			int x = static_cast<int>(std::floor(x0 + dx*t));
+			int y = static_cast<int>(std::floor(y0 + dy*t));
+			if (x < tile_x0 || x >= tile_x1 || y < tile_y0 || y >= tile_y1)
+				continue;
+			float z = z0 + (z1 - z0)*t;
+			size_t pixel = static_cast<size_t>(y)*width + x;
+			if (z <= depth[pixel]) {
+				depth[pixel] = z;
+				color[pixel] = shade(t);
+				++fragments;
+			}
+		}
+		return fragments;
+	}
+}
+
+SoftwareRasterizer::SoftwareRasterizer(unsigned int width, unsigned int height) {
+	this->width = width;
+	this->height = height;
+	tiles_x = (width + tile_size - 1) / tile_size;
+	tiles_y = (height + tile_size - 1) / tile_size;
+	color_buffer.resize(static_cast<size_t>(width)*height);
+	depth_buffer.resize(static_cast<size_t>(width)*height);
+	tile_fragments.resize(tiles_x*tiles_y);
+	n_triangles = 0;
+	n_output_vertices = 0;
+
+	bins.resize(getThreadCount());
+	for (unsigned int i=0; i<bins.size(); ++i)
+		bins[i].tiles.resize(tiles_x*tiles_y);
+}
+
+void SoftwareRasterizer::setMesh(const MeshPart& root, const std::vector<VertexData>& vertices,
+		const std::vector<unsigned int>& indices, const std::vector<MipChain>& images) {
+	this->vertices = vertices;
+	this->indices = indices;
+	parts.clear();
+	n_triangles = 0;
+	n_output_vertices = 0;
+	const float identity[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+	addParts(root, identity);
+	stream.resize(static_cast<size_t>(n_output_vertices)*CHANNELS);
+
+	textures.assign(images.size(), MipChain());
+	for (unsigned int i=0; i<images.size(); ++i) {
+		if (images[i].levels.empty())
+			continue;
+		textures[i].width = images[i].width;
+		textures[i].height = images[i].height;
+		textures[i].levels.push_back(images[i].levels[0]);
+	}
+}
+
+void SoftwareRasterizer::addParts(const MeshPart& mesh, const float* parent) {
+	Part part;
+	multiply(parent, glm::value_ptr(mesh.transform), part.transform);
+	part.first = mesh.first;
+	part.count = mesh.count - mesh.count % 3;
+	part.base_vertex = mesh.vertexCount;
+	part.vertex_count = 0;
+	for (unsigned int i=0; i<part.count; ++i)
+		part.vertex_count = std::max(part.vertex_count, indices[part.first + i] + 1);
+	part.output = n_output_vertices;
+	part.first_triangle = n_triangles;
+	part.material = mesh.material;
+	if (part.count > 0) {
+		parts.push_back(part);
+		n_output_vertices += part.vertex_count;
+		n_triangles += part.count / 3;
+	}
+
+	for (unsigned int i=0; i<mesh.children.size(); ++i)
+		addParts(mesh.children[i], part.transform);
+}
+
+void SoftwareRasterizer::render(const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model,
+		RenderMode mode, const glm::vec3& color, const glm::vec3& background) {
+	Timer timer;
+	stats = RasterStats();
+	stats.triangles = n_triangles;
+
+	glm::mat4 modelview = view * model;
+	transformVertices(projection, modelview);
+	stats.transform = timer.elapsedAndRestart();
+
+	//Each binning thread takes a contiguous range, so the order of triangles is kept
+	unsigned int n_bins = static_cast<unsigned int>(bins.size());
+	parallelFor(n_bins, [&](unsigned int b) {
+		binTriangles(b, static_cast<unsigned int>(static_cast<unsigned long long>(n_triangles)*b / n_bins),
+			static_cast<unsigned int>(static_cast<unsigned long long>(n_triangles)*(b+1) / n_bins));
+	});
+	for (unsigned int b=0; b<n_bins; ++b) {
+		stats.culled += bins[b].stats.culled;
+		stats.clipped += bins[b].stats.clipped;
+		stats.binned += bins[b].stats.binned;
+	}
+	stats.bin = timer.elapsedAndRestart();
+
+	parallelFor(tiles_x*tiles_y, [&](unsigned int tile) {
+		rasterTile(tile, mode, color, background);
+	});
+	for (unsigned int i=0; i<tile_fragments.size(); ++i)
+		stats.fragments += tile_fragments[i];
+	stats.raster = timer.elapsed();
+}
+
+void SoftwareRasterizer::transformVertices(const glm::mat4& projection, const glm::mat4& modelview) {
+	//Split the parts into blocks of vertices
+	std::vector<std::pair<unsigned int, unsigned int> > blocks; //< Part and first vertex
+	for (unsigned int p=0; p<parts.size(); ++p)
+		for (unsigned int v=0; v<parts[p].vertex_count; v+=vertex_block)
+			blocks.push_back(std::make_pair(p, v));
+
+	std::vector<float> matrices(parts.size()*(16+16+9)); //< Model view projection, model view, normal
+	for (unsigned int p=0; p<parts.size(); ++p) {
+		float* mvp = &matrices[p*41];
+		multiply(glm::value_ptr(modelview), parts[p].transform, mvp + 16);
+		multiply(glm::value_ptr(projection), mvp + 16, mvp);
+		normalMatrix(mvp + 16, mvp + 32);
+	}
+
+	parallelFor(static_cast<unsigned int>(blocks.size()), [&](unsigned int b) {
+		const Part& part = parts[blocks[b].first];
+		const float* mvp = &matrices[blocks[b].first*41];
+		const float* mv = mvp + 16;
+		const float* nm = mvp + 32;
+		unsigned int first = blocks[b].second;
+		unsigned int last = std::min(first + vertex_block, part.vertex_count);
+		unsigned int v = first;
+
+#ifdef RASTER_SSE
+		//Four vertices at a time, transposed from VertexData to one register per component
+		for (; v + 4 <= last; v += 4) {
+			const float* in = &vertices[part.base_vertex + v].position.x;
+			__m128 x = _mm_loadu_ps(in);
+			__m128 y = _mm_loadu_ps(in + 8);
+			__m128 z = _mm_loadu_ps(in + 16);
+			__m128 nx = _mm_loadu_ps(in + 24);
+			_MM_TRANSPOSE4_PS(x, y, z, nx);
+			__m128 ny = _mm_loadu_ps(in + 4);
+			__m128 nz = _mm_loadu_ps(in + 12);
+			__m128 tu = _mm_loadu_ps(in + 20);
+			__m128 tv = _mm_loadu_ps(in + 28);
+			_MM_TRANSPOSE4_PS(ny, nz, tu, tv);
+
+			__m128 out[12];
+			for (int r=0; r<4; ++r) {
+				out[CLIP_X + r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(mvp[r]), x), _mm_mul_ps(_mm_set1_ps(mvp[4+r]), y)),
+					_mm_add_ps(_mm_mul_ps(_mm_set1_ps(mvp[8+r]), z), _mm_set1_ps(mvp[12+r])));
+			}
+			for (int r=0; r<3; ++r) {
+				out[VIEW_X + r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(mv[r]), x), _mm_mul_ps(_mm_set1_ps(mv[4+r]), y)),
+					_mm_add_ps(_mm_mul_ps(_mm_set1_ps(mv[8+r]), z), _mm_set1_ps(mv[12+r])));
+				out[NORMAL_X + r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(nm[r*3]), nx), _mm_mul_ps(_mm_set1_ps(nm[r*3+1]), ny)),
+					_mm_mul_ps(_mm_set1_ps(nm[r*3+2]), nz));
+			}
+			out[TEX_U] = tu;
+			out[TEX_V] = tv;
+
+			//Back to one vertex per register, in groups of four channels
+			float* dst = &stream[static_cast<size_t>(part.output + v)*CHANNELS];
+			for (int g=0; g<3; ++g) {
+				__m128 a = out[g*4], b = out[g*4+1], c = out[g*4+2], d = out[g*4+3];
+				_MM_TRANSPOSE4_PS(a, b, c, d);
+				_mm_storeu_ps(dst + g*4, a);
+				_mm_storeu_ps(dst + CHANNELS + g*4, b);
+				_mm_storeu_ps(dst + 2*CHANNELS + g*4, c);
+				_mm_storeu_ps(dst + 3*CHANNELS + g*4, d);
+			}
+		}
+#endif
+		for (; v < last; ++v) {
+			const VertexData& in = vertices[part.base_vertex + v];
+			float* dst = &stream[static_cast<size_t>(part.output + v)*CHANNELS];
+			const float* p = &in.position.x;
+			const float* n = &in.normal.x;
+			for (int r=0; r<4; ++r)
+				dst[CLIP_X + r] = mvp[r]*p[0] + mvp[4+r]*p[1] + mvp[8+r]*p[2] + mvp[12+r];
+			for (int r=0; r<3; ++r) {
+				dst[VIEW_X + r] = mv[r]*p[0] + mv[4+r]*p[1] + mv[8+r]*p[2] + mv[12+r];
+				dst[NORMAL_X + r] = nm[r*3]*n[0] + nm[r*3+1]*n[1] + nm[r*3+2]*n[2];
+			}
+			dst[TEX_U] = in.tex_coords.x;
+			dst[TEX_V] = in.tex_coords.y;
+		}
+	});
+}
+
+void SoftwareRasterizer::binTriangles(unsigned int bin, unsigned int first, unsigned int last) {
+	Bins& b = bins[bin];
+	b.triangles.clear();
+	for (unsigned int i=0; i<b.tiles.size(); ++i)
+		b.tiles[i].clear();
+	b.stats = RasterStats();
+
+	unsigned int p = 0;
+	for (unsigned int t=first; t<last; ++t) {
+		while (t >= parts[p].first_triangle + parts[p].count/3)
+			++p;
+		const Part& part = parts[p];
+		const MipChain* texture = (part.material < textures.size()) ? &textures[part.material] : &untextured;
+		const unsigned int* triangle = &indices[part.first + (t - part.first_triangle)*3];
+
+		float polygon[3][CHANNELS];
+		for (int k=0; k<3; ++k)
+			memcpy(polygon[k], &stream[static_cast<size_t>(part.output + triangle[k])*CHANNELS], sizeof(float)*CHANNELS);
+
+		//Trivially outside one of the planes of the view volume
+		bool outside = false;
+		for (int axis=0; axis<3 && !outside; ++axis) {
+			outside = (polygon[0][axis] > polygon[0][CLIP_W] && polygon[1][axis] > polygon[1][CLIP_W] && polygon[2][axis] > polygon[2][CLIP_W])
+				|| (polygon[0][axis] < -polygon[0][CLIP_W] && polygon[1][axis] < -polygon[1][CLIP_W] && polygon[2][axis] < -polygon[2][CLIP_W]);
+		}
+		if (outside) {
+			++b.stats.culled;
+			continue;
+		}
+
+		//Flat shading uses the last vertex, like OpenGL
+		float light_direction[3];
+		float flat_diffuse = diffuse(&polygon[2][VIEW_X], &polygon[2][NORMAL_X], light_direction);
+
+		bool crosses_near = polygon[0][CLIP_Z] < -polygon[0][CLIP_W] || polygon[1][CLIP_Z] < -polygon[1][CLIP_W]
+			|| polygon[2][CLIP_Z] < -polygon[2][CLIP_W];
+		if (!crosses_near) {
+			setupTriangle(b, polygon, flat_diffuse, texture);
+			continue;
+		}
+
+		++b.stats.clipped;
+		float clipped[4][CHANNELS];
+		unsigned int n = clipNear(polygon, 3, clipped);
+		for (unsigned int k=1; k+1<n; ++k) {
+			float fan[3][CHANNELS];
+			memcpy(fan[0], clipped[0], sizeof(fan[0]));
+			memcpy(fan[1], clipped[k], sizeof(fan[1]));
+			memcpy(fan[2], clipped[k+1], sizeof(fan[2]));
+			setupTriangle(b, fan, flat_diffuse, texture);
+		}
+	}
+}
+
+void SoftwareRasterizer::setupTriangle(Bins& b, const float (*polygon)[12], float flat_diffuse, const MipChain* texture) {
+	RasterTriangle tri;
+	for (int k=0; k<3; ++k) {
+		const float* v = polygon[k];
+		float inv_w = 1.0f / v[CLIP_W];
+		tri.x[k] = (v[CLIP_X]*inv_w*0.5f + 0.5f) * width;
+		tri.y[k] = (v[CLIP_Y]*inv_w*0.5f + 0.5f) * height;
+		tri.z[k] = v[CLIP_Z]*inv_w*0.5f + 0.5f;
+		tri.inv_w[k] = inv_w;
+		for (int c=0; c<8; ++c)
+			tri.attributes[k][c] = v[VIEW_X + c] * inv_w;
+	}
+
+	//Counter clockwise is front facing, and back faces are culled
+	float area = (tri.x[1] - tri.x[0])*(tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0])*(tri.y[1] - tri.y[0]);
+	float min_x = std::max(std::min(std::min(tri.x[0], tri.x[1]), tri.x[2]), 0.0f);
+	float max_x = std::min(std::max(std::max(tri.x[0], tri.x[1]), tri.x[2]), static_cast<float>(width - 1));
+	float min_y = std::max(std::min(std::min(tri.y[0], tri.y[1]), tri.y[2]), 0.0f);
+	float max_y = std::min(std::max(std::max(tri.y[0], tri.y[1]), tri.y[2]), static_cast<float>(height - 1));
+	if (area <= 0.0f || min_x > max_x || min_y > max_y) {
+		++b.stats.culled;
+		return;
+	}
+
+	//The largest depth slope, for the polygon offset
+	float dzdx = ((tri.z[1] - tri.z[0])*(tri.y[2] - tri.y[0]) - (tri.z[2] - tri.z[0])*(tri.y[1] - tri.y[0])) / area;
+	float dzdy = ((tri.x[1] - tri.x[0])*(tri.z[2] - tri.z[0]) - (tri.x[2] - tri.x[0])*(tri.z[1] - tri.z[0])) / area;
+	tri.depth_offset = std::max(std::fabs(dzdx), std::fabs(dzdy)) + depth_unit;
+	tri.flat_diffuse = flat_diffuse;
+	tri.texture = texture;
+
+	unsigned int index = static_cast<unsigned int>(b.triangles.size());
+	b.triangles.push_back(tri);
+	unsigned int tx0 = static_cast<unsigned int>(min_x) / tile_size;
+	unsigned int tx1 = static_cast<unsigned int>(max_x) / tile_size;
+	unsigned int ty0 = static_cast<unsigned int>(min_y) / tile_size;
+	unsigned int ty1 = static_cast<unsigned int>(max_y) / tile_size;
+	for (unsigned int ty=ty0; ty<=ty1; ++ty) {
+		for (unsigned int tx=tx0; tx<=tx1; ++tx)
+			b.tiles[ty*tiles_x + tx].push_back(index);
+	}
+	b.stats.binned += (tx1 - tx0 + 1)*(ty1 - ty0 + 1);
+}
+
+void SoftwareRasterizer::rasterTile(unsigned int tile, RenderMode mode, const glm::vec3& color, const glm::vec3& background) {
+	int tile_x0 = (tile % tiles_x) * tile_size;
+	int tile_y0 = (tile / tiles_x) * tile_size;
+	int tile_x1 = std::min<int>(tile_x0 + tile_size, width);
+	int tile_y1 = std::min<int>(tile_y0 + tile_size, height);
+	unsigned long long fragments = 0;
+
+	unsigned int clear_color = pack(background.r, background.g, background.b);
+	for (int y=tile_y0; y<tile_y1; ++y) {
+		std::fill(&color_buffer[static_cast<size_t>(y)*width + tile_x0], &color_buffer[static_cast<size_t>(y)*width + tile_x1], clear_color);
+		std::fill(&depth_buffer[static_cast<size_t>(y)*width + tile_x0], &depth_buffer[static_cast<size_t>(y)*width + tile_x1], 1.0f);
+	}
+
+	//Hidden lines are drawn like the GL path: first filled with the background color and offset back, then as lines
+	bool fill = (mode != RENDERMODE_WIREFRAME);
+	bool lines = (mode == RENDERMODE_WIREFRAME || mode == RENDERMODE_HIDDENLINE);
+	bool offset = (mode == RENDERMODE_HIDDENLINE);
+	bool phong = (mode == RENDERMODE_PHONG);
+	float fill_color[3] = { color.r, color.g, color.b };
+	if (offset) {
+		fill_color[0] = background.r;
+		fill_color[1] = background.g;
+		fill_color[2] = background.b;
+	}
+
+	for (int pass=0; pass<2; ++pass) {
+		if ((pass == 0 && !fill) || (pass == 1 && !lines))
+			continue;
+
+		for (unsigned int b=0; b<bins.size(); ++b) {
+			const std::vector<unsigned int>& list = bins[b].tiles[tile];
+			for (unsigned int i=0; i<list.size(); ++i) {
+				const RasterTriangle& tri = bins[b].triangles[list[i]];
+
+				if (pass == 1) {
+					//Edges in the flat shader, with the model color
+					float line_color[3] = { tri.flat_diffuse*color.r, tri.flat_diffuse*color.g, tri.flat_diffuse*color.b };
+					for (int e=0; e<3; ++e) {
+						int a = e, c = (e+1) % 3;
+						float u0 = tri.attributes[a][6] / tri.inv_w[a], v0 = tri.attributes[a][7] / tri.inv_w[a];
+						float u1 = tri.attributes[c][6] / tri.inv_w[c], v1 = tri.attributes[c][7] / tri.inv_w[c];
+						const MipChain& tex = *tri.texture;
+						fragments += drawLine(tri.x[a], tri.y[a], tri.z[a], tri.x[c], tri.y[c], tri.z[c],
+							tile_x0, tile_y0, tile_x1, tile_y1, width, &depth_buffer[0], &color_buffer[0],
+							[&](float t) -> unsigned int {
+								float texel[3];
+								sample(tex, u0 + (u1 - u0)*t, v0 + (v1 - v0)*t, texel);
+								return pack(texel[0]*line_color[0], texel[1]*line_color[1], texel[2]*line_color[2]);
+							});
+					}
+					continue;
+				}
+
+				//Edge functions, stepped per pixel; the weight of a vertex is the edge opposite it
+				float area = (tri.x[1] - tri.x[0])*(tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0])*(tri.y[1] - tri.y[0]);
+				float inv_area = 1.0f / area;
+				int x0 = std::max(tile_x0, static_cast<int>(std::floor(std::min(std::min(tri.x[0], tri.x[1]), tri.x[2]))));
+				int x1 = std::min(tile_x1, static_cast<int>(std::ceil(std::max(std::max(tri.x[0], tri.x[1]), tri.x[2]))));
+				int y0 = std::max(tile_y0, static_cast<int>(std::floor(std::min(std::min(tri.y[0], tri.y[1]), tri.y[2]))));
+				int y1 = std::min(tile_y1, static_cast<int>(std::ceil(std::max(std::max(tri.y[0], tri.y[1]), tri.y[2]))));
+				if (x0 >= x1 || y0 >= y1)
+					continue;
+
+				float step_x[3], step_y[3], row[3];
+				bool top_left[3];
+				for (int e=0; e<3; ++e) {
+					int a = (e+1) % 3, c = (e+2) % 3;
+					float dx = tri.x[c] - tri.x[a];
+					float dy = tri.y[c] - tri.y[a];
+					step_x[e] = -dy;
+					step_y[e] = dx;
+					row[e] = dx*(y0 + 0.5f - tri.y[a]) - dy*(x0 + 0.5f - tri.x[a]);
+					top_left[e] = (dy < 0.0f) || (dy == 0.0f && dx > 0.0f);
+				}
+				float depth_offset = offset ? tri.depth_offset : 0.0f;
+
+				for (int y=y0; y<y1; ++y) {
+					float w[3] = { row[0], row[1], row[2] };
+					size_t pixel = static_cast<size_t>(y)*width + x0;
+					for (int x=x0; x<x1; ++x, ++pixel) {
+						bool inside = true;
+						for (int e=0; e<3; ++e)
+							inside = inside && (w[e] > 0.0f || (w[e] == 0.0f && top_left[e]));
+						if (inside) {
+							float b0 = w[0]*inv_area, b1 = w[1]*inv_area, b2 = w[2]*inv_area;
+							float z = b0*tri.z[0] + b1*tri.z[1] + b2*tri.z[2] + depth_offset;
+							if (z <= depth_buffer[pixel]) {
+								depth_buffer[pixel] = z;
+								++fragments;
+
+								//Perspective correct attributes
+								float inv = 1.0f / (b0*tri.inv_w[0] + b1*tri.inv_w[1] + b2*tri.inv_w[2]);
+								float attr[8];
+								for (int c=0; c<8; ++c)
+									attr[c] = (b0*tri.attributes[0][c] + b1*tri.attributes[1][c] + b2*tri.attributes[2][c]) * inv;
+								float texel[3];
+								sample(*tri.texture, attr[6], attr[7], texel);
+
+								if (phong) {
+									float light_direction[3];
+									float diff = diffuse(attr, attr + 3, light_direction);
+									float n[3] = { attr[3], attr[4], attr[5] };
+									normalize(n);
+									float h[3] = { -attr[0], -attr[1], -attr[2] };
+									normalize(h);
+									h[0] += light_direction[0]; h[1] += light_direction[1]; h[2] += light_direction[2];
+									normalize(h);
+									//pow(x, 128) by squaring
+									float spec = std::max(0.0f, dot(n, h));
+									for (int k=0; k<7; ++k)
+										spec *= spec;
+									color_buffer[pixel] = pack(diff*texel[0]*fill_color[0] + spec, diff*texel[1]*fill_color[1] + spec,
+										diff*texel[2]*fill_color[2] + spec);
+								} else {
+									float diff = tri.flat_diffuse;
+									color_buffer[pixel] = pack(diff*texel[0]*fill_color[0], diff*texel[1]*fill_color[1],
+										diff*texel[2]*fill_color[2]);
+								}
+							}
+						}
+						w[0] += step_x[0]; w[1] += step_x[1]; w[2] += step_x[2];
+					}
+					row[0] += step_y[0]; row[1] += step_y[1]; row[2] += step_y[2];
+				}
+			}
+		}
+	}
+	tile_fragments[tile] = fragments;
+}
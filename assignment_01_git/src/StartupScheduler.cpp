@@ -0,0 +1,192 @@
+#include "StartupScheduler.h"
+#include "GameException.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace {
+	// Characters in the widest bar of the printed timeline
+	const unsigned int timeline_width = 40;
+
+	// A join that waited less than this did not hold up the main lane, in seconds
+	const double wait_threshold = 0.0001;
+}
+
+StartupScheduler::StartupScheduler() {
+	start_time = Timer::getCurrentTime();
+	Lane* main_lane = new Lane();
+	main_lane->name = "main";
+	main_lane->id = std::this_thread::get_id();
+	main_lane->start = 0.0;
+	main_lane->parent = 0;
+	lanes.push_back(main_lane);
+}
+
+StartupScheduler::~StartupScheduler() {
+	for (unsigned int i=0; i<lanes.size(); ++i) {
+		if (lanes[i]->thread.joinable())
+			lanes[i]->thread.join();
+		delete lanes[i];
+	}
+}
+
+void StartupScheduler::start(const std::string& name, std::function<void()> fn) {
+	std::lock_guard<std::mutex> lock(mutex);
+	Lane* lane = new Lane();
+	lane->name = name;
+	lane->start = Timer::getCurrentTime() - start_time;
+	lane->parent = getLane();
+	lanes.push_back(lane);
+
+	//Phases are put in lanes by thread id, so it is set before the task runs
+	lane->thread = std::thread([this, lane, name, fn]() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			lane->id = std::this_thread::get_id();
+		}
+		begin(name);
+		try {
+			fn();
+		} catch (...) {
+			lane->error = std::current_exception();
+		}
+		end();
+	});
+}
+
+void StartupScheduler::join(const std::string& name) {
+	int lane = findLane(name);
+	if (lane < 0)
+		THROW_EXCEPTION("No startup task called " + name);
+
+	begin("wait for " + name);
+	if (lanes[lane]->thread.joinable())
+		lanes[lane]->thread.join();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (unsigned int i=phases.size(); i-- > 0; ) {
+			if (phases[i].lane == getLane()) {
+				phases[i].joined_lane = lane;
+				break;
+			}
+		}
+	}
+	end();
+
+	if (lanes[lane]->error)
+		std::rethrow_exception(lanes[lane]->error);
+}
+
+void StartupScheduler::begin(const std::string& name) {
+	std::lock_guard<std::mutex> lock(mutex);
+	double now = Timer::getCurrentTime() - start_time;
+	unsigned int lane = getLane();
+	endLane(lane, now);
+
+	Phase phase;
+	phase.name = name;
+	phase.lane = lane;
+	phase.start = now;
+	phase.end = -1.0;
+	phase.joined_lane = -1;
+	phases.push_back(phase);
+}
+
+void StartupScheduler::end() {
+	std::lock_guard<std::mutex> lock(mutex);
+	endLane(getLane(), Timer::getCurrentTime() - start_time);
+}
+
+void StartupScheduler::print(std::ostream& out) {
+	std::lock_guard<std::mutex> lock(mutex);
+	endLane(0, Timer::getCurrentTime() - start_time);
+
+	double total = 0.0;
+	for (unsigned int i=0; i<phases.size(); ++i)
+		total = std::max(total, phases[i].end);
+
+	//Walk back from the last phase of the main lane
+	std::vector<bool> critical(phases.size(), false);
+	std::vector<unsigned int> path;
+	int phase = findLastPhase(0, total + 1.0);
+	while (phase >= 0) {
+		const Phase& p = phases[phase];
+		if (p.joined_lane >= 0) {
+			//A join that waited is not work, the task it waited for is
+			int task = findLastPhase(p.joined_lane, total + 1.0);
+			if (task >= 0 && phases[task].end > p.start + wait_threshold) {
+				phase = task;
+				continue;
+			}
+		}
+		critical[phase] = true;
+		path.push_back(phase);
+		int previous = findLastPhase(p.lane, p.start);
+		if (previous < 0 && p.lane != 0) {
+			//The first phase of a task follows the phase that started it
+			const Lane& lane = *lanes[p.lane];
+			previous = findLastPhase(lane.parent, lane.start);
+		}
+		phase = previous;
+	}
+
+	out << "Startup timeline (ms), * is on the critical path:" << std::endl;
+	out << std::fixed << std::setprecision(1);
+	for (unsigned int i=0; i<phases.size(); ++i) {
+		const Phase& p = phases[i];
+		unsigned int first = (total > 0.0) ? static_cast<unsigned int>(p.start / total * timeline_width) : 0;
+		unsigned int last = (total > 0.0) ? static_cast<unsigned int>(p.end / total * timeline_width) : 0;
+		last = std::min(std::max(last, first + 1), timeline_width);
+		std::string bar(timeline_width, ' ');
+		std::fill(bar.begin() + first, bar.begin() + last, critical[i] ? '#' : '-');
+
+		out << (critical[i] ? " * " : "   ") << std::left << std::setw(8) << lanes[p.lane]->name.substr(0, 8) << std::right
+			<< std::setw(8) << p.start*1000.0 << std::setw(8) << p.end*1000.0 << " |" << bar << "| " << p.name << std::endl;
+	}
+
+	out << "Critical path: ";
+	for (unsigned int i=path.size(); i-- > 0; ) {
+		const Phase& p = phases[path[i]];
+		out << p.name << " " << (p.end - p.start)*1000.0 << (i > 0 ? " -> " : "");
+	}
+	out << " = " << total*1000.0 << " ms" << std::endl;
+	out.unsetf(std::ios::floatfield);
+	out << std::setprecision(6);
+}
+
+unsigned int StartupScheduler::getLane() {
+	std::thread::id id = std::this_thread::get_id();
+	for (unsigned int i=0; i<lanes.size(); ++i) {
+		if (lanes[i]->id == id)
+			return i;
+	}
+	return 0;
+}
+
+void StartupScheduler::endLane(unsigned int lane, double now) {
+	for (unsigned int i=phases.size(); i-- > 0; ) {
+		if (phases[i].lane == lane) {
+			if (phases[i].end < 0.0)
+				phases[i].end = now;
+			return;
+		}
+	}
+}
+
+int StartupScheduler::findLane(const std::string& name) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (unsigned int i=1; i<lanes.size(); ++i) {
+		if (lanes[i]->name == name)
+			return i;
+	}
+	return -1;
+}
+
+int StartupScheduler::findLastPhase(unsigned int lane, double before) {
+	for (unsigned int i=phases.size(); i-- > 0; ) {
+		if (phases[i].lane == lane && phases[i].start < before)
+			return i;
+	}
+	return -1;
+}
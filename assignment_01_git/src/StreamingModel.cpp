@@ -0,0 +1,809 @@
+#include "StreamingModel.h"
+#include "AssimpLoader.h"
+#include "GameException.h"
+#include "GeometryCodec.h"
+#include "ModelInterleavedArray.h"
+#include "ObjLoader.h"
+#include "Parallel.h"
+#include "Timer.h"
+#include "VertexWelder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <unordered_map>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace {
+	// Vertices per chunk of converted models, if the memory cap allows
+	const unsigned int convert_chunk_vertices = 65536;
+	// Host memory per chunk vertex while converting: the vertex, its key and about six indices
+	const size_t convert_vertex_bytes = 96;
+	// Elements in a page of a SpillArray
+	const size_t spill_page = 4096;
+	// Bytes copied at a time when the chunks are appended to the stream file
+	const size_t copy_bytes = 1 << 20;
+	// Parsed OBJ text takes up to this many times the bytes of the text
+	const size_t obj_block_expansion = 5;
+	// Triangles between updates of the memory held while converting OBJ files
+	const unsigned int obj_account_interval = 65536;
+	// A page of a SpillArray that is not cached
+	const unsigned int no_slot = 0xFFFFFFFF;
+
+	/**
+	 * Where a vertex of a chunk came from: the position, texture coordinate
+	 * and normal index of an OBJ corner, or the index of a mesh vertex
+	 */
+	struct VertexKey {
+		unsigned int a, b, c;
+		bool operator==(const VertexKey& other) const {
+			return a == other.a && b == other.b && c == other.c;
+		}
+	};
+
+	struct VertexKeyHash {
+		size_t operator()(const VertexKey& key) const {
+			return (key.a * 73856093u) ^ (key.b * 19349663u) ^ (key.c * 83492791u);
+		}
+	};
+
+	/**
+	 * A triangle of an OBJ file as ObjLoader::stream gives it
+	 */
+	struct ObjTriangle {
+		unsigned int corners[9];
+		unsigned int group;
+	};
+
+	/**
+	 * An array in a temporary file, appended to in order and then read and
+	 * updated at random through a cache of a few pages, the least recently
+	 * used going out first. The faces of OBJ files mostly use vertices
+	 * close to each other in the file, so few pages are read more than once.
+	 */
+	template<typename T>
+	class SpillArray {
+	public:
+		SpillArray(const std::string& filename, size_t cache_bytes) : filename(filename), count(0), uses(0), misses(0) {
+			file.open(filename.c_str(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!file.good())
+				THROW_EXCEPTION("Unable to write " + filename);
+			slots.resize(std::max<size_t>(2, cache_bytes / (spill_page*sizeof(T))));
+		}
+
+		~SpillArray() {
+			file.close();
+			std::remove(filename.c_str());
+		}
+
+		inline void push_back(const T& value) {
+			appending.push_back(value);
+			++count;
+			if (appending.size() == spill_page)
+				flush();
+		}
+
+		/**
+		 * Writes what push_back has kept back, needed before get and set
+		 */
+		void flush() {
+			if (appending.empty())
+				return;
+			file.seekp(static_cast<std::streamoff>((count - appending.size()) * sizeof(T)));
+			file.write(reinterpret_cast<const char*>(appending.data()), appending.size()*sizeof(T));
+			if (!file.good())
+				THROW_EXCEPTION("Unable to write " + filename);
+			appending.clear();
+		}
+
+		inline T get(size_t i) {
+			return getSlot(i).data[i % spill_page];
+		}
+
+		inline void set(size_t i, const T& value) {
+			Slot& slot = getSlot(i);
+			slot.data[i % spill_page] = value;
+			slot.dirty = true;
+		}
+
+		inline size_t size() const { return count; }
+		inline unsigned long long getMisses() const { return misses; }
+
+		long long getBytes() const {
+			size_t bytes = appending.capacity()*sizeof(T) + page_slots.capacity()*sizeof(unsigned int);
+			for (size_t i=0; i<slots.size(); ++i)
+				bytes += slots[i].data.capacity()*sizeof(T);
+			return static_cast<long long>(bytes);
+		}
+
+	private:
+		struct Slot {
+			Slot() : page(0), dirty(false), used(0) {}
+			size_t page;
+			bool dirty;
+			unsigned long long used; //< For least recently used
+			std::vector<T> data; //< Empty until first used
+		};
+
+		Slot& getSlot(size_t i) {
+			size_t page = i / spill_page;
+			if (page >= page_slots.size())
+				page_slots.resize((count + spill_page - 1) / spill_page, no_slot);
+			unsigned int index = page_slots[page];
+			if (index == no_slot) {
+				++misses;
+				index = 0;
+				for (unsigned int s=1; s<slots.size(); ++s)
+					if (slots[s].used < slots[index].used)
+						index = s;
+				Slot& slot = slots[index];
+				if (!slot.data.empty()) {
+					if (slot.dirty)
+						writePage(slot);
+					page_slots[slot.page] = no_slot;
+				}
+
+				size_t first = page * spill_page;
+				size_t n = std::min(spill_page, count - first);
+				slot.data.resize(spill_page);
+				file.seekg(static_cast<std::streamoff>(first * sizeof(T)));
+				file.read(reinterpret_cast<char*>(slot.data.data()), n*sizeof(T));
+				if (!file.good())
+					THROW_EXCEPTION("Unable to read " + filename);
+				slot.page = page;
+				slot.dirty = false;
+				page_slots[page] = index;
+			}
+			slots[index].used = ++uses;
+			return slots[index];
+		}
+
+		void writePage(const Slot& slot) {
+			size_t first = slot.page * spill_page;
+			file.seekp(static_cast<std::streamoff>(first * sizeof(T)));
+			file.write(reinterpret_cast<const char*>(slot.data.data()), std::min(spill_page, count - first)*sizeof(T));
+			if (!file.good())
+				THROW_EXCEPTION("Unable to write " + filename);
+		}
+
+		std::string filename;
+		std::fstream file;
+		size_t count;
+		std::vector<T> appending;
+		std::vector<Slot> slots;
+		std::vector<unsigned int> page_slots; //< Slot of every page, no_slot if not cached
+		unsigned long long uses;
+		unsigned long long misses;
+
+		SpillArray(const SpillArray&);
+		SpillArray& operator=(const SpillArray&);
+	};
+}
+
+/**
+ * Collects triangles into chunks part by part, and writes every chunk to
+ * a temporary file as soon as it is full, so only one chunk is in memory.
+ * The tables are written in front of the chunks at the end, when their
+ * size is known. A chunk is closed when the next triangle belongs to
+ * another part or might not fit, and duplicates the vertices it shares
+ * with other chunks.
+ */
+class StreamingModel::ChunkWriter {
+public:
+	ChunkWriter(const std::string& filename, unsigned int max_chunk_vertices, size_t max_chunk_bytes)
+			: filename(filename), chunks_filename(filename + ".chunks.tmp"),
+			max_chunk_vertices(std::max(3u, max_chunk_vertices)), max_chunk_bytes(max_chunk_bytes),
+			open(false), n_vertices(0), n_indices(0), max_bytes(0), other_bytes(0), peak_bytes(0) {
+		chunks_file.open(chunks_filename.c_str(), std::ios::binary | std::ios::trunc);
+		if (!chunks_file.good())
+			THROW_EXCEPTION("Unable to write " + chunks_filename);
+		min_pos = glm::vec3(std::numeric_limits<float>::max());
+		max_pos = -glm::vec3(std::numeric_limits<float>::max());
+	}
+
+	~ChunkWriter() {
+		chunks_file.close();
+		std::remove(chunks_filename.c_str());
+	}
+
+	/**
+	 * Adds a part after the ones before in preorder, and returns its index
+	 */
+	unsigned int addPart(const glm::mat4& transform, unsigned int n_children) {
+		StreamPart part;
+		for (int j=0; j<4; ++j)
+			for (int i=0; i<4; ++i)
+				part.transform[j*4+i] = transform[j][i];
+		part.n_children = n_children;
+		part.n_chunks = 0;
+		parts.push_back(part);
+		return static_cast<unsigned int>(parts.size() - 1);
+	}
+
+	/**
+	 * fetch(k) returns the vertex of the k-th corner, and is only called
+	 * for corners the chunk does not have yet
+	 */
+	template<typename Fetch>
+	void addTriangle(unsigned int part, const VertexKey keys[3], Fetch fetch) {
+		size_t triangle_bytes = 3 * (sizeof(VertexData) + sizeof(unsigned int));
+		if (open && (part != chunk.part || chunk.n_vertices + 3 > max_chunk_vertices || chunk.bytes() + triangle_bytes > max_chunk_bytes))
+			closeChunk();
+		if (!open) {
+			chunk.part = part;
+			chunk.n_vertices = 0;
+			chunk.n_indices = 0;
+			chunk.reserved = 0;
+			open = true;
+		}
+
+		for (unsigned int k=0; k<3; ++k) {
+			std::pair<std::unordered_map<VertexKey, unsigned int, VertexKeyHash>::iterator, bool> inserted =
+				local.insert(std::make_pair(keys[k], chunk.n_vertices));
+			if (inserted.second) {
+				vertices.push_back(fetch(k));
+				++chunk.n_vertices;
+			}
+			indices.push_back(inserted.first->second);
+			++chunk.n_indices;
+		}
+	}
+
+	void closeChunk() {
+		if (!open)
+			return;
+		open = false;
+
+		chunk.first_vertex = n_vertices;
+		chunk.first_index = n_indices;
+		chunks_file.write(reinterpret_cast<const char*>(vertices.data()), vertices.size()*sizeof(VertexData));
+		chunks_file.write(reinterpret_cast<const char*>(indices.data()), indices.size()*sizeof(unsigned int));
+		if (!chunks_file.good())
+			THROW_EXCEPTION("Unable to write " + chunks_filename);
+		for (size_t i=0; i<vertices.size(); ++i) {
+			min_pos = glm::min(min_pos, vertices[i].position);
+			max_pos = glm::max(max_pos, vertices[i].position);
+		}
+		n_vertices += chunk.n_vertices;
+		n_indices += chunk.n_indices;
+		max_bytes = std::max(max_bytes, chunk.bytes());
+		chunks.push_back(chunk);
+		++parts[chunk.part].n_chunks;
+
+		peak_bytes = std::max(peak_bytes, getBytes());
+		vertices.clear();
+		indices.clear();
+		local.clear();
+	}
+
+	/**
+	 * Writes the stream file. The transform of the first part is made to
+	 * scale the model to a unit cube and center it, as
+	 * ModelInterleavedArray does.
+	 */
+	void finish() {
+		closeChunk();
+		if (n_vertices > static_cast<unsigned long long>(std::numeric_limits<int>::max())
+				|| n_indices > static_cast<unsigned long long>(std::numeric_limits<unsigned int>::max()))
+			THROW_EXCEPTION("The model is too large for 32 bit indices");
+		if (parts.empty())
+			THROW_EXCEPTION("No parts to write to " + filename);
+
+		//Scale first, translate center second
+		glm::mat4 transform;
+		for (int j=0; j<4; ++j)
+			for (int i=0; i<4; ++i)
+				transform[j][i] = parts[0].transform[j*4+i];
+		glm::vec3 extent = max_pos - min_pos;
+		float scale = std::max(extent.x, std::max(extent.y, extent.z));
+		if (scale > 0.0f)
+			transform = glm::scale(transform, glm::vec3(1.0f / scale));
+		transform = glm::translate(transform, (min_pos + max_pos) / -2.0f);
+		for (int j=0; j<4; ++j)
+			for (int i=0; i<4; ++i)
+				parts[0].transform[j*4+i] = transform[j][i];
+
+		StreamHeader header;
+		header.magic = magic;
+		header.version = version;
+		header.n_parts = static_cast<unsigned int>(parts.size());
+		header.n_chunks = static_cast<unsigned int>(chunks.size());
+		header.n_vertices = n_vertices;
+		header.n_indices = n_indices;
+		header.max_chunk_bytes = static_cast<unsigned int>(max_bytes);
+		header.reserved = 0;
+
+		std::ofstream os(filename.c_str(), std::ios::binary);
+		if (!os.good())
+			THROW_EXCEPTION("Unable to write " + filename);
+		os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		os.write(reinterpret_cast<const char*>(parts.data()), parts.size()*sizeof(StreamPart));
+		os.write(reinterpret_cast<const char*>(chunks.data()), chunks.size()*sizeof(StreamChunk));
+
+		chunks_file.close();
+		std::ifstream is(chunks_filename.c_str(), std::ios::binary);
+		std::vector<char> buffer(copy_bytes);
+		peak_bytes = std::max(peak_bytes, getBytes() + static_cast<long long>(buffer.size()));
+		while (is.good()) {
+			is.read(buffer.data(), buffer.size());
+			os.write(buffer.data(), is.gcount());
+		}
+		if (!os.good() || !is.eof())
+			THROW_EXCEPTION("Unable to write " + filename);
+	}
+
+	/**
+	 * Host memory held by the caller besides the writer, for the peak
+	 */
+	inline void setOtherBytes(long long bytes) {
+		other_bytes = bytes;
+		peak_bytes = std::max(peak_bytes, getBytes());
+	}
+
+	long long getBytes() const {
+		size_t bytes = vertices.capacity()*sizeof(VertexData) + indices.capacity()*sizeof(unsigned int)
+			+ local.size()*(sizeof(std::pair<const VertexKey, unsigned int>) + 2*sizeof(void*)) + local.bucket_count()*sizeof(void*)
+			+ parts.capacity()*sizeof(StreamPart) + chunks.capacity()*sizeof(StreamChunk);
+		return other_bytes + static_cast<long long>(bytes);
+	}
+
+	inline const std::string& getFilename() const { return filename; }
+	inline size_t getChunks() const { return chunks.size(); }
+	inline unsigned long long getVertices() const { return n_vertices; }
+	inline unsigned long long getTriangles() const { return n_indices / 3; }
+	inline size_t getMaxChunkBytes() const { return max_bytes; }
+	inline long long getPeakBytes() const { return peak_bytes; }
+
+private:
+	std::string filename;
+	std::string chunks_filename;
+	std::ofstream chunks_file; //< The vertices and indices of every chunk, in order
+	unsigned int max_chunk_vertices;
+	size_t max_chunk_bytes;
+
+	std::vector<StreamPart> parts;
+	std::vector<StreamChunk> chunks;
+	bool open; //< If chunk has triangles
+	StreamChunk chunk;
+	std::vector<VertexData> vertices; //< Of chunk
+	std::vector<unsigned int> indices; //< Of chunk
+	std::unordered_map<VertexKey, unsigned int, VertexKeyHash> local; //< Vertices of chunk by key
+	unsigned long long n_vertices; //< Of the closed chunks
+	unsigned long long n_indices;
+	size_t max_bytes; //< Of the largest chunk
+	glm::vec3 min_pos;
+	glm::vec3 max_pos;
+
+	long long other_bytes;
+	long long peak_bytes;
+};
+
+StreamingModel::StreamingModel(const std::string& filename, size_t memory_cap) {
+	std::cout << "Streaming model: " << filename << std::endl;
+	start_time = Timer::getCurrentTime();
+
+	file = VirtualFileSystem::open(filename);
+	file_position = 0;
+
+	StreamHeader header;
+	if (!readBytes(&header, sizeof(header)) || header.magic != magic || header.version != version)
+		THROW_EXCEPTION(filename + " is not a stream file, convert it with --make-stream");
+
+	parts.resize(header.n_parts);
+	chunks.resize(header.n_chunks);
+	bool ok = readBytes(parts.data(), parts.size()*sizeof(StreamPart));
+	ok = ok && readBytes(chunks.data(), chunks.size()*sizeof(StreamChunk));
+	if (!ok || parts.empty())
+		THROW_EXCEPTION("Unable to read the chunk table of " + filename);
+
+	size_t block_bytes = memory_cap / n_blocks;
+	if (header.max_chunk_bytes > block_bytes) {
+		std::stringstream err;
+		err << "A memory cap of " << memory_cap << " bytes is too small for chunks of "
+			<< header.max_chunk_bytes << " bytes in " << filename;
+		THROW_EXCEPTION(err.str());
+	}
+
+	//Build the part tree, and find where the chunks of each part go.
+	//Pointers into the tree are only taken once it is complete.
+	unsigned int next = 0;
+	readParts(root, next);
+	chunk_parts.assign(parts.size(), NULL);
+	next = 0;
+	findChunkParts(root, next);
+
+	//The reader and the uploads trust the chunk table from here on
+	for (size_t i=0; i<chunks.size(); ++i) {
+		const StreamChunk& chunk = chunks[i];
+		bool valid = chunk.part < parts.size() && chunk_parts[chunk.part] != NULL
+			&& chunk.n_vertices <= header.n_vertices && chunk.first_vertex <= header.n_vertices - chunk.n_vertices
+			&& chunk.n_indices <= header.n_indices && chunk.first_index <= header.n_indices - chunk.n_indices
+			&& chunk.bytes() <= header.max_chunk_bytes;
+		if (!valid) {
+			std::stringstream err;
+			err << "Chunk " << i << " of " << filename << " is out of range";
+			THROW_EXCEPTION(err.str());
+		}
+	}
+
+	//Allocate GPU memory for the whole model up front
+	total_bytes = header.n_vertices*sizeof(VertexData) + header.n_indices*sizeof(unsigned int);
+	interleaved.reset(new GLUtils::VBO(NULL, header.n_vertices*sizeof(VertexData), GL_ARRAY_BUFFER));
+	indices.reset(new GLUtils::VBO(NULL, header.n_indices*sizeof(unsigned int), GL_ELEMENT_ARRAY_BUFFER));
+
+	//Small models do not need the whole memory cap
+	if (block_bytes > total_bytes)
+		block_bytes = static_cast<size_t>(total_bytes);
+	blocks.resize(n_blocks);
+	for (unsigned int i=0; i<n_blocks; ++i) {
+		blocks[i].data.resize(block_bytes);
+		free_blocks.push_back(&blocks[i]);
+	}
+
+	uploading = NULL;
+	uploading_chunk = 0;
+	uploading_offset = 0;
+	uploaded_chunks = 0;
+	uploaded_bytes = 0;
+
+	std::cout << chunks.size() << " chunks, " << header.n_vertices << " vertices, " << header.n_indices/3 << " triangles, "
+		<< total_bytes << " bytes, reading through " << n_blocks << " x " << block_bytes << " bytes of host memory" << std::endl;
+
+	running = true;
+	reader = std::thread(&StreamingModel::readChunks, this);
+}
+
+StreamingModel::~StreamingModel() {
+	running = false;
+	block_freed.notify_all();
+	if (reader.joinable())
+		reader.join();
+}
+
+void StreamingModel::readParts(MeshPart& part, unsigned int& next) {
+	if (next >= parts.size())
+		THROW_EXCEPTION("The part tree of the stream file has more parts than its header");
+	const StreamPart& stream_part = parts[next++];
+	for (int j=0; j<4; ++j)
+		for (int i=0; i<4; ++i)
+			part.transform[j][i] = stream_part.transform[j*4+i];
+
+	part.children.reserve(stream_part.n_children + 1);
+	part.children.resize(stream_part.n_children);
+	for (unsigned int i=0; i<stream_part.n_children; ++i)
+		readParts(part.children[i], next);
+
+	//The chunks of this part are drawn as children of an extra child
+	if (stream_part.n_chunks > 0)
+		part.children.push_back(MeshPart());
+}
+
+void StreamingModel::findChunkParts(MeshPart& part, unsigned int& next) {
+	unsigned int index = next++;
+	for (unsigned int i=0; i<parts[index].n_children; ++i)
+		findChunkParts(part.children[i], next);
+	if (parts[index].n_chunks > 0)
+		chunk_parts[index] = &part.children.back();
+}
+
+bool StreamingModel::readBytes(void* data, size_t bytes) {
+	if (bytes > file->size() - file_position)
+		return false;
+	memcpy(data, file->data() + file_position, bytes);
+	file_position += bytes;
+	return true;
+}
+
+/**
+ * Runs on the reader thread: fills free blocks with as many whole
+ * chunks as fit, in file order, and hands them to update()
+ */
+void StreamingModel::readChunks() {
+	unsigned int next = 0;
+	while (running && next < chunks.size()) {
+		Block* block;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (running && free_blocks.empty())
+				block_freed.wait(lock);
+			if (!running)
+				break;
+			block = free_blocks.front();
+			free_blocks.pop_front();
+		}
+
+		block->used = 0;
+		block->first_chunk = next;
+		block->n_chunks = 0;
+		while (next < chunks.size() && block->used + chunks[next].bytes() <= block->data.size()) {
+			if (!readBytes(&block->data[block->used], chunks[next].bytes())) {
+				std::cout << "Unable to read chunk " << next << " of the stream file" << std::endl;
+				running = false;
+				break;
+			}
+			block->used += chunks[next].bytes();
+			++block->n_chunks;
+			++next;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (block->n_chunks > 0)
+			full_blocks.push_back(block);
+		else
+			free_blocks.push_back(block);
+	}
+}
+
+bool StreamingModel::update(double time_budget) {
+	Timer timer;
+	bool changed = false;
+
+	do {
+		if (uploading == NULL) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (full_blocks.empty())
+				break;
+			uploading = full_blocks.front();
+			full_blocks.pop_front();
+			uploading_chunk = 0;
+			uploading_offset = 0;
+		}
+
+		//Upload one chunk through the copy target, so that no VAO state is touched
+		const StreamChunk& chunk = chunks[uploading->first_chunk + uploading_chunk];
+		const char* data = &uploading->data[uploading_offset];
+		size_t vertex_bytes = chunk.n_vertices*sizeof(VertexData);
+		size_t index_bytes = chunk.n_indices*sizeof(unsigned int);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, interleaved->name());
+		glBufferSubData(GL_COPY_WRITE_BUFFER, chunk.first_vertex*sizeof(VertexData), vertex_bytes, data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, indices->name());
+		glBufferSubData(GL_COPY_WRITE_BUFFER, chunk.first_index*sizeof(unsigned int), index_bytes, data + vertex_bytes);
+
+		MeshPart part;
+		part.first = static_cast<unsigned int>(chunk.first_index);
+		part.count = chunk.n_indices;
+		part.vertexCount = static_cast<unsigned int>(chunk.first_vertex);
+		chunk_parts[chunk.part]->children.push_back(part);
+
+		uploading_offset += chunk.bytes();
+		uploaded_bytes += chunk.bytes();
+		++uploaded_chunks;
+		changed = true;
+
+		if (++uploading_chunk == uploading->n_chunks) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				free_blocks.push_back(uploading);
+			}
+			block_freed.notify_one();
+			uploading = NULL;
+		}
+	} while (timer.elapsed() < time_budget);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	if (changed && isComplete()) {
+		double time = Timer::getCurrentTime() - start_time;
+		std::cout << "Streamed " << uploaded_bytes << " bytes in " << time*1000.0 << " ms ("
+			<< uploaded_bytes / (time * 1024.0 * 1024.0) << " MiB/s)" << std::endl;
+	}
+	return changed;
+}
+
+void StreamingModel::bindTextures() {
+	texture.bind();
+}
+
+void StreamingModel::write(const MeshData& data, const std::string& filename, unsigned int max_chunk_vertices, size_t memory_cap) {
+	Timer timer;
+	ChunkWriter writer(filename, max_chunk_vertices, memory_cap / n_blocks);
+	writePart(data, data.root, writer);
+	writer.finish();
+
+	std::cout << "Wrote " << filename << ": " << writer.getChunks() << " chunks, " << writer.getVertices() << " vertices ("
+		<< data.vertices.size() << " before splitting), " << writer.getTriangles() << " triangles in "
+		<< timer.elapsed()*1000.0 << " ms" << std::endl;
+}
+
+void StreamingModel::writePart(const MeshData& data, const MeshPart& part, ChunkWriter& writer) {
+	unsigned int index = writer.addPart(part.transform, static_cast<unsigned int>(part.children.size()));
+
+	//Split the triangles of the part into chunks with their own vertices
+	for (unsigned int t=0; t+2<part.count; t+=3) {
+		VertexKey keys[3];
+		for (unsigned int k=0; k<3; ++k) {
+			keys[k].a = part.vertexCount + data.indices[part.first + t + k];
+			keys[k].b = 0;
+			keys[k].c = 0;
+		}
+		writer.addTriangle(index, keys, [&](unsigned int k) { return data.vertices[keys[k].a]; });
+	}
+	writer.closeChunk();
+
+	for (unsigned int i=0; i<part.children.size(); ++i)
+		writePart(data, part.children[i], writer);
+}
+
+/* * *
+* Only GeometryCodec files are loaded whole: they are written from models
+* that were loaded whole already. The peak is the memory the converter
+* accounts for; Assimp holds its scene on top of it.
+* * */
+void StreamingModel::convert(const std::string& model_filename, const std::string& filename, size_t memory_cap) {
+	if (GeometryCodec::isCompressedFile(model_filename)) {
+		MeshData data;
+		ModelInterleavedArray::loadMeshData(model_filename, data);
+		write(data, filename, convert_chunk_vertices, memory_cap);
+		return;
+	}
+
+	Timer timer;
+	bool obj = model_filename.size() > 4 && (model_filename.compare(model_filename.size() - 4, 4, ".obj") == 0
+		|| model_filename.compare(model_filename.size() - 4, 4, ".OBJ") == 0);
+	//The chunk being written takes up to half the memory cap
+	size_t chunk_vertices = std::min<size_t>(convert_chunk_vertices, memory_cap / 2 / convert_vertex_bytes);
+	ChunkWriter writer(filename, static_cast<unsigned int>(chunk_vertices), memory_cap / n_blocks);
+	if (obj)
+		convertObj(model_filename, writer, memory_cap);
+	else
+		convertAssimp(model_filename, writer);
+	writer.finish();
+
+	std::cout << "Wrote " << filename << ": " << writer.getChunks() << " chunks, " << writer.getVertices() << " vertices, "
+		<< writer.getTriangles() << " triangles in " << timer.elapsed()*1000.0 << " ms, largest chunk "
+		<< writer.getMaxChunkBytes() / 1024 << " KiB, peak host memory " << writer.getPeakBytes() / (1024*1024) << " MiB ("
+		<< (obj ? "" : "plus the Assimp scene, ") << "stream cap " << (memory_cap >> 20) << " MiB)" << std::endl;
+}
+
+/* * *
+* The file is read once. Vertex attributes and triangles go to spill
+* files, whose pages then take a quarter of the memory cap, and so does
+* the parser, next to the half of the chunk being written. Missing
+* normals are the area weighted normals of all triangles at a position,
+* summed in another spill file in a second pass over the triangles;
+* unlike ObjLoader this also smoothes across groups. The third
+* pass writes the chunks, the triangles of a group in one part each as
+* ObjLoader makes them.
+* * */
+void StreamingModel::convertObj(const std::string& model_filename, ChunkWriter& writer, size_t memory_cap) {
+	Timer timer;
+	const std::string& base = writer.getFilename();
+	size_t block_bytes = std::max<size_t>(64 << 10, memory_cap / (4 * obj_block_expansion * getThreadCount()));
+	SpillArray<glm::vec3> positions(base + ".positions.tmp", memory_cap / 16);
+	SpillArray<glm::vec3> normals(base + ".normals.tmp", memory_cap / 16);
+	SpillArray<glm::vec2> tex_coords(base + ".texcoords.tmp", memory_cap / 16);
+	SpillArray<ObjTriangle> triangles(base + ".triangles.tmp", 0);
+	bool missing_normals = false;
+
+	unsigned int n_groups = ObjLoader::stream(model_filename, block_bytes, [&](ObjBlock& block) {
+		for (size_t i=0; i<block.positions.size(); ++i)
+			positions.push_back(block.positions[i]);
+		for (size_t i=0; i<block.normals.size(); ++i)
+			normals.push_back(block.normals[i]);
+		for (size_t i=0; i<block.tex_coords.size(); ++i)
+			tex_coords.push_back(block.tex_coords[i]);
+		for (size_t t=0; t<block.groups.size(); ++t) {
+			ObjTriangle triangle;
+			std::copy(&block.corners[t*9], &block.corners[t*9] + 9, triangle.corners);
+			triangle.group = block.groups[t];
+			triangles.push_back(triangle);
+			for (unsigned int k=0; k<3; ++k)
+				missing_normals = missing_normals || (triangle.corners[k*3+2] == ObjLoader::no_index);
+		}
+		writer.setOtherBytes(static_cast<long long>(block.bytes) + positions.getBytes() + normals.getBytes()
+			+ tex_coords.getBytes() + triangles.getBytes());
+	});
+	positions.flush();
+	normals.flush();
+	tex_coords.flush();
+	triangles.flush();
+	if (triangles.size() == 0)
+		THROW_EXCEPTION("Unable to load mesh from " + model_filename);
+	double parse_time = timer.elapsedAndRestart();
+
+	//Every group is a child of the root
+	writer.addPart(glm::mat4(1.0f), n_groups);
+	for (unsigned int i=0; i<n_groups; ++i)
+		writer.addPart(glm::mat4(1.0f), 0);
+
+	//Indices may refer to later vertices, so they are checked once all are read
+	std::function<ObjTriangle(size_t)> getTriangle = [&](size_t t) {
+		ObjTriangle triangle = triangles.get(t);
+		for (unsigned int k=0; k<3; ++k) {
+			const unsigned int* corner = &triangle.corners[k*3];
+			if (corner[0] >= positions.size()
+					|| (corner[1] != ObjLoader::no_index && corner[1] >= tex_coords.size())
+					|| (corner[2] != ObjLoader::no_index && corner[2] >= normals.size()))
+				THROW_EXCEPTION("OBJ face index out of range");
+		}
+		return triangle;
+	};
+
+	std::unique_ptr<SpillArray<glm::vec3> > smooth;
+	if (missing_normals) {
+		smooth.reset(new SpillArray<glm::vec3>(base + ".smooth.tmp", memory_cap / 16));
+		for (size_t i=0; i<positions.size(); ++i)
+			smooth->push_back(glm::vec3(0.0f));
+		smooth->flush();
+		for (size_t t=0; t<triangles.size(); ++t) {
+			ObjTriangle triangle = getTriangle(t);
+			glm::vec3 a = positions.get(triangle.corners[0]);
+			glm::vec3 n = glm::cross(positions.get(triangle.corners[3]) - a, positions.get(triangle.corners[6]) - a);
+			for (unsigned int k=0; k<3; ++k)
+				smooth->set(triangle.corners[k*3], smooth->get(triangle.corners[k*3]) + n);
+		}
+	}
+	double normals_time = timer.elapsedAndRestart();
+
+	for (size_t t=0; t<triangles.size(); ++t) {
+		ObjTriangle triangle = getTriangle(t);
+		VertexKey keys[3];
+		for (unsigned int k=0; k<3; ++k) {
+			keys[k].a = triangle.corners[k*3];
+			keys[k].b = triangle.corners[k*3+1];
+			keys[k].c = triangle.corners[k*3+2];
+		}
+		writer.addTriangle(1 + triangle.group, keys, [&](unsigned int k) {
+			VertexData vertex;
+			vertex.position = positions.get(keys[k].a);
+			vertex.tex_coords = (keys[k].b != ObjLoader::no_index) ? tex_coords.get(keys[k].b) : glm::vec2(0.0f);
+			if (keys[k].c != ObjLoader::no_index) {
+				vertex.normal = normals.get(keys[k].c);
+			} else {
+				glm::vec3 n = smooth->get(keys[k].a);
+				vertex.normal = (glm::dot(n, n) > 0.0f) ? glm::normalize(n) : glm::vec3(0.0f);
+			}
+			return vertex;
+		});
+		if (t % obj_account_interval == 0)
+			writer.setOtherBytes(positions.getBytes() + normals.getBytes() + tex_coords.getBytes()
+				+ triangles.getBytes() + (smooth ? smooth->getBytes() : 0));
+	}
+	writer.closeChunk();
+	writer.setOtherBytes(positions.getBytes() + normals.getBytes() + tex_coords.getBytes()
+		+ triangles.getBytes() + (smooth ? smooth->getBytes() : 0));
+
+	std::cout << "OBJ converter: " << model_filename << " read in " << parse_time*1000.0 << " ms ("
+		<< positions.size() << " positions, " << triangles.size() << " triangles, " << n_groups << " parts), normals in "
+		<< normals_time*1000.0 << " ms, chunks in " << timer.elapsed()*1000.0 << " ms, " << positions.getMisses()
+		+ normals.getMisses() + tex_coords.getMisses() + (smooth ? smooth->getMisses() : 0) << " pages read" << std::endl;
+}
+
+void StreamingModel::convertAssimp(const std::string& model_filename, ChunkWriter& writer) {
+	const aiScene* scene = AssimpLoader::importFile(model_filename, AssimpLoader::getAssimpFlags(IMPORT_BALANCED));
+	ImportTimings timings;
+	std::function<void(const aiNode*)> convertNode = [&](const aiNode* node) {
+		unsigned int part = writer.addPart(AssimpLoader::getTransform(node), node->mNumChildren);
+		for (unsigned int n=0; n<node->mNumMeshes; ++n) {
+			MeshData mesh;
+			AssimpLoader::loadMesh(mesh.root, IMPORT_BALANCED, timings, mesh, scene, scene->mMeshes[node->mMeshes[n]]);
+			VertexWelder::weld(mesh);
+			writer.setOtherBytes(static_cast<long long>(mesh.vertices.capacity()*sizeof(VertexData) + mesh.indices.capacity()*sizeof(unsigned int)));
+			for (unsigned int t=0; t+2<mesh.root.count; t+=3) {
+				VertexKey keys[3];
+				for (unsigned int k=0; k<3; ++k) {
+					keys[k].a = mesh.root.vertexCount + mesh.indices[mesh.root.first + t + k];
+					keys[k].b = 0;
+					keys[k].c = 0;
+				}
+				writer.addTriangle(part, keys, [&](unsigned int k) { return mesh.vertices[keys[k].a]; });
+			}
+			//Keys are only unique within a mesh
+			writer.closeChunk();
+		}
+		for (unsigned int n=0; n<node->mNumChildren; ++n)
+			convertNode(node->mChildren[n]);
+	};
+
+	try {
+		convertNode(scene->mRootNode);
+	} catch (...) {
+		aiReleaseImport(scene);
+		throw;
+	}
+	aiReleaseImport(scene);
+}
@@ -1,5 +1,15 @@
 #include "Texture2D.h"
+#include "TextureCache.h"
+#include "GameException.h"
+#include "VirtualFileSystem.h"
+#include "VirtualTexture.h"
+#include <algorithm>
 #include <iostream>
+#include <mutex>
+
+namespace {
+	std::mutex devil_mutex; //< DevIL is not thread safe
+}
 
 Texture2D::Texture2D() {
 	createWhiteImage();
@@ -7,12 +17,97 @@ Texture2D::Texture2D() {
 }
 
 Texture2D::Texture2D(const std::string& filename) {
+	if (TextureCache::isCacheFile(filename)) {
+		readCacheFile(filename);
+		return;
+	}
 	readImageFile(filename);
 	createGLTexture();
 }
 
+Texture2D::Texture2D(unsigned int width, unsigned int height, unsigned int levels, unsigned int layers) {
+	texture.create(GL_TEXTURE_2D_ARRAY);
+	texture.bind();
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, (levels > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levels) - 1);
+
+	size_t bytes = 0;
+	for (unsigned int i=0; i<levels; ++i) {
+		unsigned int level_width = std::max(1u, width >> i);
+		unsigned int level_height = std::max(1u, height >> i);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_RGBA, level_width, level_height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		level_widths.push_back(level_width);
+		bytes += static_cast<size_t>(level_width) * level_height * layers * 4;
+	}
+	texture.setBytes(bytes);
+}
+
+Texture2D::Texture2D(Texture2D&& other) : image(other.image), texture(std::move(other.texture)),
+		level_widths(std::move(other.level_widths)) {
+	other.image.reset();
+}
+
+Texture2D& Texture2D::operator=(Texture2D&& other) {
+	image = other.image;
+	texture = std::move(other.texture);
+	other.image.reset();
+	level_widths = std::move(other.level_widths);
+	return *this;
+}
+
 void Texture2D::bind() {
-	glBindTexture(GL_TEXTURE_2D, texture_name);
+	texture.bind();
+}
+
+void Texture2D::uploadRows(unsigned int level, unsigned int first_row, unsigned int rows, const void* pixels, unsigned int layer) {
+	if (level >= level_widths.size())
+		THROW_EXCEPTION("Uploading to a mip level the texture does not have");
+	texture.bind();
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, first_row, layer, level_widths[level], rows, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+}
+
+bool Texture2D::decode(const std::string& filename, MipChain& chain) {
+	if (VirtualTexture::isPageFile(filename))
+		return false;
+
+	if (TextureCache::isCacheFile(filename)) {
+		try {
+			TextureCache::read(filename, chain);
+			return true;
+		} catch (GameException&) {
+			return false;
+		}
+	}
+
+	std::shared_ptr<VirtualFile> file;
+	try {
+		file = VirtualFileSystem::open(filename);
+	} catch (GameException&) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(devil_mutex);
+	ILuint image_name;
+	ilGenImages(1, &image_name);
+	ilBindImage(image_name);
+
+	if(!ilLoadL(ilTypeFromExt(filename.c_str()), file->data(), static_cast<ILuint>(file->size()))) {
+		ILenum error;
+		while((error = ilGetError()) != IL_NO_ERROR) {
+			std::cout << error << " " << iluErrorString(error) << " " << filename << std::endl;
+		}
+		ilDeleteImages(1, &image_name);	
+		return false;
+	}
+
+	chain.width = ilGetInteger(IL_IMAGE_WIDTH);
+	chain.height = ilGetInteger(IL_IMAGE_HEIGHT);
+	chain.levels.resize(1);
+	chain.levels[0].resize(static_cast<size_t>(chain.width) * chain.height * 4);
+	ilCopyPixels(0, 0, 0, chain.width, chain.height, 1, IL_RGBA, IL_UNSIGNED_BYTE, chain.levels[0].data());
+	ilDeleteImages(1, &image_name);
+	return true;
 }
 
 void Texture2D::createWhiteImage() {
@@ -30,40 +125,50 @@ void Texture2D::createWhiteImage() {
 }
 
 void Texture2D::readImageFile(const std::string& filename) {
-	image.reset(new Image());
-
-	ILuint image_name;
-	ilGenImages(1, &image_name);
-	ilBindImage(image_name);
-
-	if(!ilLoadImage(filename.c_str())) {
-		ILenum error;
-		while((error = ilGetError()) != IL_NO_ERROR) {
-			std::cout << error << " " << iluErrorString(error) << " " << filename << std::endl;
-		}
-		ilDeleteImages(1, &image_name);	
+	MipChain chain;
+	if (!decode(filename, chain)) {
 		createWhiteImage();
-	} else {
-		image->widht = ilGetInteger(IL_IMAGE_WIDTH);
-		image->height = ilGetInteger(IL_IMAGE_HEIGHT);
-		image->components = 4;
-		int memory_needed = image->widht * image->height * image->components;
-		image->data.resize(memory_needed);
-
-		ilCopyPixels(0, 0, 0, image->widht, image->height, 1, IL_RGBA, IL_UNSIGNED_BYTE, &image->data[0]);
-		ilDeleteImages(1, &image_name);
+		return;
 	}
+
+	image.reset(new Image());
+	image->widht = chain.width;
+	image->height = chain.height;
+	image->components = 4;
+	image->data.assign(chain.levels[0].begin(), chain.levels[0].end());
 }
 
 void Texture2D::createGLTexture() {
-	glGenTextures(1, &texture_name);
-	glBindTexture(GL_TEXTURE_2D, texture_name);
+	texture.create(GL_TEXTURE_2D_ARRAY);
+	texture.bind();
 
-// 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-// 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+// 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+// 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image->widht, image->height,
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, image->widht, image->height, 1,
 				 0, GL_RGBA, GL_UNSIGNED_BYTE, &image->data[0]);
-}
\ No newline at end of file
+	level_widths.assign(1, image->widht);
+	texture.setBytes(image->data.size());
+}
+
+void Texture2D::readCacheFile(const std::string& filename) {
+	MipChain chain;
+	TextureCache::read(filename, chain);
+
+	texture.create(GL_TEXTURE_2D_ARRAY);
+	texture.bind();
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, (chain.levels.size() > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(chain.levels.size()) - 1);
+
+	size_t bytes = 0;
+	for (unsigned int i=0; i<chain.levels.size(); ++i) {
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_RGBA, chain.getLevelWidth(i), chain.getLevelHeight(i), 1,
+					 0, GL_RGBA, GL_UNSIGNED_BYTE, chain.levels[i].data());
+		level_widths.push_back(chain.getLevelWidth(i));
+		bytes += chain.levels[i].size();
+	}
+	texture.setBytes(bytes);
+}
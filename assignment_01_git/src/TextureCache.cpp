@@ -0,0 +1,103 @@
+#include "TextureCache.h"
+#include "GameException.h"
+#include "VirtualFileSystem.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+	const char magic[4] = { 'P', 'G', 'T', 'X' };
+	const unsigned int version = 1;
+
+	struct TextureHeader {
+		char magic[4];
+		unsigned int version;
+		unsigned int width;
+		unsigned int height;
+		unsigned int levels;
+		unsigned int reserved;
+	};
+
+	inline size_t getLevelBytes(const MipChain& chain, unsigned int level) {
+		return static_cast<size_t>(chain.getLevelWidth(level)) * chain.getLevelHeight(level) * 4;
+	}
+}
+
+void TextureCache::generateMipmaps(MipChain& chain) {
+	chain.levels.resize(1);
+	unsigned int level = 0;
+	while (chain.getLevelWidth(level) > 1 || chain.getLevelHeight(level) > 1) {
+		unsigned int src_width = chain.getLevelWidth(level);
+		unsigned int src_height = chain.getLevelHeight(level);
+		unsigned int dst_width = chain.getLevelWidth(level+1);
+		unsigned int dst_height = chain.getLevelHeight(level+1);
+		chain.levels.push_back(std::vector<unsigned char>(getLevelBytes(chain, level+1)));
+		const unsigned char* src = chain.levels[level].data();
+		unsigned char* dst = chain.levels[level+1].data();
+
+		//Odd sizes clamp to the last row and column
+		for (unsigned int y=0; y<dst_height; ++y) {
+			unsigned int y0 = std::min(2*y, src_height-1);
+			unsigned int y1 = std::min(2*y+1, src_height-1);
+			for (unsigned int x=0; x<dst_width; ++x) {
+				unsigned int x0 = std::min(2*x, src_width-1);
+				unsigned int x1 = std::min(2*x+1, src_width-1);
+				for (unsigned int c=0; c<4; ++c) {
+					unsigned int sum = src[(y0*src_width + x0)*4 + c] + src[(y0*src_width + x1)*4 + c]
+						+ src[(y1*src_width + x0)*4 + c] + src[(y1*src_width + x1)*4 + c];
+					dst[(y*dst_width + x)*4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+				}
+			}
+		}
+		++level;
+	}
+}
+
+void TextureCache::write(const MipChain& chain, const std::string& filename) {
+	TextureHeader header;
+	memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.width = chain.width;
+	header.height = chain.height;
+	header.levels = static_cast<unsigned int>(chain.levels.size());
+	header.reserved = 0;
+
+	std::ofstream file(filename.c_str(), std::ios::binary);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (unsigned int i=0; i<chain.levels.size(); ++i)
+		file.write(reinterpret_cast<const char*>(chain.levels[i].data()), chain.levels[i].size());
+	if (!file.good())
+		THROW_EXCEPTION("Could not write " + filename);
+}
+
+void TextureCache::read(const std::string& filename, MipChain& chain) {
+	std::shared_ptr<VirtualFile> file = VirtualFileSystem::open(filename);
+	decode(reinterpret_cast<const unsigned char*>(file->data()), file->size(), chain);
+}
+
+void TextureCache::decode(const unsigned char* data, size_t size, MipChain& chain) {
+	TextureHeader header;
+	if (size < sizeof(header))
+		THROW_EXCEPTION("Not a texture cache file");
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version || header.levels == 0 || header.levels > 32)
+		THROW_EXCEPTION("Not a texture cache file, or the wrong version");
+
+	chain.width = header.width;
+	chain.height = header.height;
+	chain.levels.resize(header.levels);
+	size_t offset = sizeof(header);
+	for (unsigned int i=0; i<header.levels; ++i) {
+		size_t bytes = getLevelBytes(chain, i);
+		if (offset + bytes > size)
+			THROW_EXCEPTION("Truncated texture cache file");
+		chain.levels[i].assign(data + offset, data + offset + bytes);
+		offset += bytes;
+	}
+}
+
+bool TextureCache::isCacheFile(const std::string& filename) {
+	return filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".pgt") == 0;
+}
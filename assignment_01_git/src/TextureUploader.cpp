@@ -0,0 +1,64 @@
+#include "TextureUploader.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <cstring>
+
+TextureUploader::TextureUploader(unsigned int frame_bytes)
+		: buffer(frame_bytes, GL_PIXEL_UNPACK_BUFFER), frame_bytes(frame_bytes) {
+	used = 0;
+	full = false;
+	stalls_at_reset = buffer.getStalls();
+}
+
+unsigned int TextureUploader::reserveRows(unsigned int row_bytes, unsigned int rows) {
+	if (row_bytes > frame_bytes)
+		return rows;
+	unsigned int fit = std::min(rows, (frame_bytes - used) / row_bytes);
+	full = (fit == 0);
+	return fit;
+}
+
+void TextureUploader::uploadRows(Texture2D& texture, unsigned int level, unsigned int first_row, unsigned int rows,
+		unsigned int width, const void* pixels, unsigned int layer) {
+	Timer timer;
+	unsigned int bytes = width * rows * 4;
+	if (bytes > frame_bytes - used) {
+		texture.uploadRows(level, first_row, rows, pixels, layer);
+		++stats.direct;
+		stats.copy_time += timer.elapsed();
+		return;
+	}
+
+	//Waits for the GPU only if it still reads this region from frames_in_flight frames ago
+	unsigned int offset = 0;
+	void* destination = buffer.map(bytes, offset);
+	memcpy(destination, pixels, bytes);
+	buffer.unmap();
+
+	buffer.bind();
+	texture.uploadRows(level, first_row, rows, reinterpret_cast<const void*>(static_cast<size_t>(offset)), layer);
+	buffer.unbind();
+
+	used += bytes;
+	stats.bytes += bytes;
+	++stats.uploads;
+	stats.copy_time += timer.elapsed();
+}
+
+void TextureUploader::endFrame() {
+	buffer.endFrame();
+	used = 0;
+	full = false;
+}
+
+UploadStats TextureUploader::getStats() const {
+	UploadStats result = stats;
+	result.stalls = buffer.getStalls() - stalls_at_reset;
+	return result;
+}
+
+void TextureUploader::resetStats() {
+	stats = UploadStats();
+	stalls_at_reset = buffer.getStalls();
+}
@@ -0,0 +1,152 @@
+#include "VertexWelder.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+
+	// Vertices per task when computing keys
+	const unsigned int key_block_size = 1 << 16;
+	const unsigned int key_components = sizeof(VertexData) / sizeof(float);
+	// Grid cells further from the origin than this (2^62) are clamped
+	const double max_cell = 4611686018427387904.0;
+	// The cell of NaN components, below the clamped cells
+	const long long nan_cell = std::numeric_limits<long long>::min();
+
+	struct VertexKey {
+		unsigned long long hash;
+		unsigned int range; //< Vertex range (part) the vertex belongs to
+		unsigned long long components[key_components]; //< Bits of the float, or the grid cell
+
+		bool operator==(const VertexKey& other) const {
+			return range == other.range && memcmp(components, other.components, sizeof(components)) == 0;
+		}
+	};
+
+	struct VertexKeyHash {
+		size_t operator()(const VertexKey& key) const {
+			return static_cast<size_t>(key.hash);
+		}
+	};
+
+	void collectParts(MeshPart& part, std::vector<MeshPart*>& parts) {
+		parts.push_back(&part);
+		for (unsigned int i=0; i<part.children.size(); ++i)
+			collectParts(part.children[i], parts);
+	}
+
+	/**
+	 * The grid cell of value, computed in double and clamped, as the
+	 * conversion of an out of range value to an integer is undefined
+	 */
+	inline long long getCell(float value, float epsilon) {
+		double cell = std::floor(static_cast<double>(value) / epsilon + 0.5);
+		if (cell != cell)
+			return nan_cell;
+		return static_cast<long long>(std::max(-max_cell, std::min(max_cell, cell)));
+	}
+
+	inline unsigned int findRange(const std::vector<unsigned int>& starts, unsigned int vertex) {
+		return static_cast<unsigned int>(std::upper_bound(starts.begin(), starts.end(), vertex) - starts.begin()) - 1;
+	}
+}
+
+void VertexWelder::weld(MeshData& data, float epsilon, float normal_epsilon, float tex_coord_epsilon) {
+	unsigned int n = static_cast<unsigned int>(data.vertices.size());
+	if (n == 0)
+		return;
+
+	//The vertices of a part start at its vertexCount, and end where the next part starts
+	std::vector<MeshPart*> parts;
+	collectParts(data.root, parts);
+	std::vector<unsigned int> starts(1, 0);
+	for (unsigned int i=0; i<parts.size(); ++i)
+		if (parts[i]->count > 0)
+			starts.push_back(parts[i]->vertexCount);
+	std::sort(starts.begin(), starts.end());
+	starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+	//Compute the key of every vertex, with the tolerance of each component
+	float tolerances[key_components];
+	for (unsigned int c=0; c<key_components; ++c)
+		tolerances[c] = (c < V_NORMAL / sizeof(float)) ? epsilon : ((c < V_TEX_COORD / sizeof(float)) ? normal_epsilon : tex_coord_epsilon);
+	std::vector<VertexKey> keys(n);
+	unsigned int blocks = (n + key_block_size - 1) / key_block_size;
+	parallelFor(blocks, [&](unsigned int b) {
+		unsigned int end = std::min(n, (b+1)*key_block_size);
+		for (unsigned int i=b*key_block_size; i<end; ++i) {
+			VertexKey& key = keys[i];
+			const float* v = reinterpret_cast<const float*>(&data.vertices[i]);
+			key.range = findRange(starts, i);
+			for (unsigned int c=0; c<key_components; ++c) {
+				if (tolerances[c] > 0.0f) {
+					long long cell = getCell(v[c], tolerances[c]);
+					memcpy(&key.components[c], &cell, sizeof(cell));
+				} else {
+					float value = v[c] + 0.0f; //< -0 and +0 are the same vertex
+					unsigned int bits;
+					memcpy(&bits, &value, sizeof(bits));
+					key.components[c] = bits;
+				}
+			}
+			unsigned long long hash = key.range * 0x9E3779B97F4A7C15ULL;
+			for (unsigned int c=0; c<key_components; ++c)
+				hash = (hash ^ key.components[c]) * 0x100000001B3ULL;
+			key.hash = hash ^ (hash >> 29);
+		}
+	});
+
+	//Each thread owns the keys whose hash falls in its partition, and
+	//finds the first vertex with the same key for each of them
+	std::vector<unsigned int> first(n);
+	unsigned int partitions = getThreadCount();
+	parallelFor(partitions, [&](unsigned int p) {
+		std::unordered_map<VertexKey, unsigned int, VertexKeyHash> seen;
+		seen.reserve(n / partitions + 1);
+		for (unsigned int i=0; i<n; ++i) {
+			if ((keys[i].hash >> 40) % partitions != p)
+				continue;
+			first[i] = seen.insert(std::make_pair(keys[i], i)).first->second;
+		}
+	});
+	std::vector<VertexKey>().swap(keys);
+
+	//Keep the first vertex of each key, in the original order, so that
+	//the vertices of each part stay together
+	std::vector<unsigned int> remap(n);
+	std::vector<unsigned int> new_starts(starts.size());
+	std::vector<VertexData> vertices;
+	std::vector<SkinWeights> weights;
+	unsigned int range = 0;
+	for (unsigned int i=0; i<n; ++i) {
+		while (range < starts.size() && starts[range] <= i)
+			new_starts[range++] = static_cast<unsigned int>(vertices.size());
+		if (first[i] == i) {
+			remap[i] = static_cast<unsigned int>(vertices.size());
+			vertices.push_back(data.vertices[i]);
+			if (!data.weights.empty())
+				weights.push_back(data.weights[i]);
+		} else {
+			remap[i] = remap[first[i]];
+		}
+	}
+	while (range < starts.size())
+		new_starts[range++] = static_cast<unsigned int>(vertices.size());
+
+	//Indices are relative to the start of their part
+	parallelFor(static_cast<unsigned int>(parts.size()), [&](unsigned int p) {
+		MeshPart& part = *parts[p];
+		unsigned int r = findRange(starts, part.vertexCount);
+		for (unsigned int i=part.first; i<part.first+part.count; ++i)
+			data.indices[i] = remap[part.vertexCount + data.indices[i]] - new_starts[r];
+		part.vertexCount = new_starts[r];
+	});
+
+	data.vertices.swap(vertices);
+	if (!data.weights.empty())
+		data.weights.swap(weights);
+}
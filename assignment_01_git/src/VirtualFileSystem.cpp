@@ -0,0 +1,93 @@
+#include "VirtualFileSystem.h"
+#include "Archive.h"
+#include "MappedFile.h"
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+
+#include <sys/stat.h>
+
+namespace {
+
+	std::mutex mutex; //< Guards archives
+	std::vector<std::shared_ptr<Archive> > archives; //< Most recently mounted first
+	std::atomic<unsigned int> archive_opens(0);
+	std::atomic<unsigned int> disk_opens(0);
+
+	std::vector<std::shared_ptr<Archive> > getArchives() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return archives;
+	}
+}
+
+void VirtualFileSystem::mount(const std::string& filename) {
+	std::shared_ptr<Archive> archive(new Archive(filename));
+	std::cout << "Mounted " << filename << ": " << archive->getEntryCount() << " files, "
+		<< archive->getSize() / 1024 << " KiB" << std::endl;
+	std::lock_guard<std::mutex> lock(mutex);
+	archives.insert(archives.begin(), archive);
+}
+
+void VirtualFileSystem::unmountAll() {
+	std::lock_guard<std::mutex> lock(mutex);
+	archives.clear();
+}
+
+std::shared_ptr<VirtualFile> VirtualFileSystem::open(const std::string& filename) {
+	std::vector<std::shared_ptr<Archive> > mounted = getArchives();
+	for (unsigned int i=0; i<mounted.size(); ++i) {
+		std::shared_ptr<VirtualFile> file = mounted[i]->open(filename);
+		if (file) {
+			++archive_opens;
+			return file;
+		}
+	}
+	++disk_opens;
+	return openFromDisk(filename);
+}
+
+bool VirtualFileSystem::exists(const std::string& filename) {
+	std::vector<std::shared_ptr<Archive> > mounted = getArchives();
+	for (unsigned int i=0; i<mounted.size(); ++i)
+		if (mounted[i]->contains(filename))
+			return true;
+	struct stat st;
+	return stat(filename.c_str(), &st) == 0;
+}
+
+void VirtualFileSystem::printStats() {
+	std::cout << "Files opened: " << archive_opens << " from archives, " << disk_opens << " from disk" << std::endl;
+}
+
+std::string VirtualFileSystem::normalizePath(const std::string& path) {
+	std::vector<std::string> parts;
+	size_t begin = 0;
+	while (begin <= path.size()) {
+		size_t end = path.find_first_of("/\\", begin);
+		if (end == std::string::npos)
+			end = path.size();
+		std::string part = path.substr(begin, end - begin);
+		if (part == ".." && !parts.empty() && parts.back() != "..")
+			parts.pop_back();
+		else if (!part.empty() && part != ".")
+			parts.push_back(part);
+		begin = end + 1;
+	}
+
+	std::string result = (!path.empty() && (path[0] == '/' || path[0] == '\\')) ? "/" : "";
+	for (unsigned int i=0; i<parts.size(); ++i) {
+		if (i > 0)
+			result += '/';
+		result += parts[i];
+	}
+	return result;
+}
+
+std::shared_ptr<VirtualFile> VirtualFileSystem::openFromDisk(const std::string& filename) {
+	std::shared_ptr<VirtualFile> file(new VirtualFile());
+	file->mapping.reset(new MappedFile(filename));
+	file->ptr = file->mapping->data();
+	file->length = file->mapping->size();
+	return file;
+}
@@ -0,0 +1,675 @@
+#include "VirtualTexture.h"
+#include "GameException.h"
+#include "Texture2D.h"
+#include "TextureCache.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+	// "PGVT", the first bytes of a page file
+	const unsigned int page_file_magic = 0x54564750;
+	const unsigned int page_file_version = 1;
+
+	// Page reads handed to the worker and not uploaded yet, so that the
+	// queue does not fill up with pages the view has moved away from
+	const unsigned int max_reads = 64;
+
+	// Rows of a level read at a time by convert, to build the next level from
+	const unsigned int downsample_rows = 32;
+
+	struct PageFileHeader {
+		unsigned int magic;
+		unsigned int version;
+		unsigned int width;
+		unsigned int height;
+		unsigned int levels;
+		unsigned int page_size;
+		unsigned int border;
+		unsigned int reserved;
+	};
+
+	unsigned int wrap(int coordinate, unsigned int size) {
+		int n = static_cast<int>(size);
+		return static_cast<unsigned int>(((coordinate % n) + n) % n);
+	}
+
+	inline std::streamoff getPageOffset(unsigned int page, unsigned int page_bytes) {
+		return static_cast<std::streamoff>(sizeof(PageFileHeader)) + static_cast<std::streamoff>(page) * page_bytes;
+	}
+
+	bool isPpmFile(const std::string& filename) {
+		return filename.size() >= 4 && (filename.compare(filename.size() - 4, 4, ".ppm") == 0
+			|| filename.compare(filename.size() - 4, 4, ".PPM") == 0);
+	}
+}
+
+VirtualTexture::VirtualTexture(const std::string& filename, unsigned int cache_pages)
+		: cache_pages(cache_pages), reader(1) {
+	if (cache_pages == 0 || cache_pages > 256)
+		THROW_EXCEPTION("The virtual texture cache must be 1 to 256 pages across");
+
+	file.open(filename.c_str(), std::ios::binary);
+	if (!file.good())
+		THROW_EXCEPTION("Could not open " + filename);
+	file.seekg(0, std::ios::end);
+	std::streamoff file_size = file.tellg();
+	file.seekg(0, std::ios::beg);
+	PageFileHeader header;
+	if (file_size < static_cast<std::streamoff>(sizeof(header)))
+		THROW_EXCEPTION(filename + " is not a page file");
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (header.magic != page_file_magic || header.version != page_file_version)
+		THROW_EXCEPTION(filename + " is not a page file of this version");
+	if (header.page_size != page_size || header.border != border)
+		THROW_EXCEPTION(filename + " has pages of another size");
+
+	width = header.width;
+	height = header.height;
+	n_pages = buildLevels(width, height, levels);
+	if (levels.size() != header.levels || levels.size() > max_levels)
+		THROW_EXCEPTION(filename + " has the wrong number of levels");
+	if (file_size < getPageOffset(n_pages, getPageBytes()))
+		THROW_EXCEPTION(filename + " is truncated");
+
+	unsigned int slots = cache_pages * cache_pages;
+	slot_page.assign(slots, -1);
+	slot_used.assign(slots, 0);
+	slot_pinned.assign(slots, false);
+	page_slot.assign(n_pages, -1);
+	page_requested.assign(n_pages, 0);
+	page_loading.assign(n_pages, false);
+	feedback_count = 0;
+	reads = 0;
+	feedback_width = 0;
+	feedback_height = 0;
+	feedback_view_width = 0;
+	feedback_view_height = 0;
+	oldest = 0;
+	in_flight = 0;
+
+	//Pages are filtered within their borders, so the cache has no mip levels
+	unsigned int side = cache_pages * (page_size + 2*border);
+	cache.create(GL_TEXTURE_2D);
+	cache.bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, side, side, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	cache.setBytes(static_cast<long long>(side) * side * 4);
+
+	table.assign(n_pages, 0);
+	table_buffer.create(GL_TEXTURE_BUFFER);
+	table_buffer.data(n_pages * sizeof(unsigned int), NULL, GL_DYNAMIC_DRAW);
+	table_buffer.unbind();
+	table_texture.create(GL_TEXTURE_BUFFER);
+	table_texture.bind();
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, table_buffer.name());
+	table_texture.unbind();
+
+	//The levels that fit in one page are always resident, so every page has a resident ancestor
+	unsigned int slot = 0;
+	std::vector<unsigned char> texels(getPageBytes());
+	for (unsigned int l = 0; l < levels.size(); ++l) {
+		if (levels[l].pages_x > 1 || levels[l].pages_y > 1)
+			continue;
+		if (slot == slots)
+			THROW_EXCEPTION("The virtual texture cache is too small for the coarsest levels of " + filename);
+		file.seekg(getPageOffset(levels[l].first, getPageBytes()));
+		file.read(reinterpret_cast<char*>(texels.data()), texels.size());
+		if (!file.good())
+			THROW_EXCEPTION("Unable to read " + filename);
+		uploadPage(slot, levels[l].first, texels.data());
+		slot_pinned[slot] = true;
+		++slot;
+	}
+	cache.unbind();
+	updateTable();
+	CHECK_GL_ERROR();
+
+	std::cout << "Virtual texture " << filename << ": " << width << "x" << height << ", "
+		<< levels.size() << " levels, " << n_pages << " pages, cache of " << slots << " pages ("
+		<< cache.bytes() / (1024*1024) << " MiB)" << std::endl;
+}
+
+VirtualTexture::~VirtualTexture() {
+	reader.wait();
+	for (unsigned int i = 0; i < feedback_frames; ++i)
+		if (readbacks[i].fence != 0)
+			glDeleteSync(readbacks[i].fence);
+}
+
+bool VirtualTexture::isPageFile(const std::string& filename) {
+	return filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".pgv") == 0;
+}
+
+unsigned int VirtualTexture::buildLevels(unsigned int width, unsigned int height, std::vector<Level>& levels) {
+	levels.clear();
+	unsigned int pages = 0;
+	for (unsigned int l = 0; ; ++l) {
+		Level level;
+		level.width = std::max(1u, width >> l);
+		level.height = std::max(1u, height >> l);
+		level.pages_x = (level.width + page_size - 1) / page_size;
+		level.pages_y = (level.height + page_size - 1) / page_size;
+		level.first = pages;
+		levels.push_back(level);
+		pages += level.pages_x * level.pages_y;
+		if (level.width == 1 && level.height == 1)
+			return pages;
+	}
+}
+
+/* * *
+* Pages are stored level by level, row by row. Each is page_size texels
+* of the level plus border texels on every side, which wrap around the
+* level like GL_REPEAT, as do the texels past the edge of the last pages.
+*
+* Only a band of page rows of one level is in memory at a time: level 0
+* comes from the image, and every other level from the pages of the level
+* before it, read back from the file and filtered downsample_rows at a time.
+* * */
+void VirtualTexture::convert(const std::string& image, const std::string& page_file) {
+	Timer timer;
+	unsigned int width, height;
+	RowReader rows;
+	MipChain chain; //< Formats that DevIL decodes, which it can only do whole
+	if (isPpmFile(image)) {
+		rows = openPpm(image, width, height);
+	} else {
+		if (!Texture2D::decode(image, chain))
+			THROW_EXCEPTION("Unable to read " + image);
+		width = chain.width;
+		height = chain.height;
+		const unsigned char* pixels = chain.levels[0].data();
+		rows = [pixels, width](unsigned int first, unsigned int count, unsigned char* out) {
+			memcpy(out, pixels + static_cast<size_t>(first) * width * 4, static_cast<size_t>(count) * width * 4);
+		};
+	}
+
+	std::vector<Level> levels;
+	unsigned int n_pages = buildLevels(width, height, levels);
+	if (levels.size() > max_levels)
+		THROW_EXCEPTION(image + " is too large for a virtual texture");
+
+	PageFileHeader header;
+	header.magic = page_file_magic;
+	header.version = page_file_version;
+	header.width = width;
+	header.height = height;
+	header.levels = static_cast<unsigned int>(levels.size());
+	header.page_size = page_size;
+	header.border = border;
+	header.reserved = 0;
+
+	std::fstream file(page_file.c_str(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.good())
+		THROW_EXCEPTION("Unable to write " + page_file);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	for (unsigned int l = 0; l < levels.size(); ++l) {
+		if (l > 0)
+			rows = downsample(readLevel(file, levels[l-1]), levels[l-1].width, levels[l-1].height);
+		writeLevel(file, levels[l], rows);
+		if (l == 0)
+			chain = MipChain();
+	}
+	file.flush();
+	if (!file)
+		THROW_EXCEPTION("Unable to write " + page_file);
+
+	std::cout << "Wrote " << page_file << ": " << width << "x" << height << ", "
+		<< levels.size() << " levels, " << n_pages << " pages in " << timer.elapsed() << " s" << std::endl;
+}
+
+VirtualTexture::RowReader VirtualTexture::openPpm(const std::string& filename, unsigned int& width, unsigned int& height) {
+	std::shared_ptr<std::ifstream> file(new std::ifstream(filename.c_str(), std::ios::binary));
+	if (!file->good())
+		THROW_EXCEPTION("Unable to read " + filename);
+
+	//P6, width, height and the largest value, separated by whitespace and comments
+	std::string fields[4];
+	for (unsigned int i = 0; i < 4; ++i) {
+		int c = file->get();
+		while (c != EOF && (isspace(c) || c == '#')) {
+			if (c == '#')
+				while (c != EOF && c != '\n')
+					c = file->get();
+			c = file->get();
+		}
+		while (c != EOF && !isspace(c)) {
+			fields[i] += static_cast<char>(c);
+			c = file->get();
+		}
+	}
+	width = static_cast<unsigned int>(strtoul(fields[1].c_str(), NULL, 10));
+	height = static_cast<unsigned int>(strtoul(fields[2].c_str(), NULL, 10));
+	if (fields[0] != "P6" || fields[3] != "255" || width == 0 || height == 0)
+		THROW_EXCEPTION(filename + " is not an 8 bit binary PPM image");
+	std::streamoff data_start = file->tellg();
+
+	unsigned int w = width, h = height;
+	return [file, data_start, w, h, filename](unsigned int first, unsigned int count, unsigned char* out) {
+		//The file has the top row first
+		std::vector<unsigned char> rgb(static_cast<size_t>(count) * w * 3);
+		file->seekg(data_start + static_cast<std::streamoff>(h - first - count) * w * 3);
+		file->read(reinterpret_cast<char*>(rgb.data()), rgb.size());
+		if (!file->good())
+			THROW_EXCEPTION(filename + " is truncated");
+		for (unsigned int r = 0; r < count; ++r) {
+			const unsigned char* source = &rgb[static_cast<size_t>(count - 1 - r) * w * 3];
+			unsigned char* destination = out + static_cast<size_t>(r) * w * 4;
+			for (unsigned int x = 0; x < w; ++x) {
+				destination[x*4] = source[x*3];
+				destination[x*4 + 1] = source[x*3 + 1];
+				destination[x*4 + 2] = source[x*3 + 2];
+				destination[x*4 + 3] = 255;
+			}
+		}
+	};
+}
+
+VirtualTexture::RowReader VirtualTexture::readLevel(std::fstream& file, const Level& level) {
+	return [&file, level](unsigned int first, unsigned int count, unsigned char* out) {
+		const unsigned int side = page_size + 2*border;
+		std::vector<unsigned char> texels;
+		while (count > 0) {
+			unsigned int py = first / page_size;
+			unsigned int y = first % page_size;
+			unsigned int n = std::min(count, page_size - y);
+			texels.resize(static_cast<size_t>(n) * side * 4);
+			for (unsigned int px = 0; px < level.pages_x; ++px) {
+				file.seekg(getPageOffset(level.first + py*level.pages_x + px, getPageBytes()) + (border + y) * side * 4);
+				file.read(reinterpret_cast<char*>(texels.data()), texels.size());
+				unsigned int columns = std::min(page_size, level.width - px*page_size);
+				for (unsigned int r = 0; r < n; ++r)
+					memcpy(out + (static_cast<size_t>(r) * level.width + px*page_size) * 4, &texels[(r*side + border) * 4], columns * 4);
+			}
+			if (!file.good())
+				THROW_EXCEPTION("Unable to read back the pages of a level");
+			out += static_cast<size_t>(n) * level.width * 4;
+			first += n;
+			count -= n;
+		}
+	};
+}
+
+VirtualTexture::RowReader VirtualTexture::downsample(const RowReader& rows, unsigned int width, unsigned int height) {
+	unsigned int dst_width = std::max(1u, width >> 1);
+	return [rows, width, height, dst_width](unsigned int first, unsigned int count, unsigned char* out) {
+		std::vector<unsigned char> source;
+		while (count > 0) {
+			unsigned int n = std::min(count, downsample_rows);
+			unsigned int src_first = std::min(2*first, height - 1);
+			unsigned int src_last = std::min(2*(first + n) - 1, height - 1);
+			source.resize(static_cast<size_t>(src_last - src_first + 1) * width * 4);
+			rows(src_first, src_last - src_first + 1, source.data());
+
+			//Odd sizes clamp to the last row and column
+			for (unsigned int y = 0; y < n; ++y) {
+				const unsigned char* row0 = &source[static_cast<size_t>(std::min(2*(first + y), height - 1) - src_first) * width * 4];
+				const unsigned char* row1 = &source[static_cast<size_t>(std::min(2*(first + y) + 1, height - 1) - src_first) * width * 4];
+				unsigned char* destination = out + static_cast<size_t>(y) * dst_width * 4;
+				for (unsigned int x = 0; x < dst_width; ++x) {
+					unsigned int x0 = std::min(2*x, width - 1) * 4;
+					unsigned int x1 = std::min(2*x + 1, width - 1) * 4;
+					for (unsigned int c = 0; c < 4; ++c) {
+						unsigned int sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+						destination[x*4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+					}
+				}
+			}
+			out += static_cast<size_t>(n) * dst_width * 4;
+			first += n;
+			count -= n;
+		}
+	};
+}
+
+void VirtualTexture::writeLevel(std::fstream& file, const Level& level, const RowReader& rows) {
+	const unsigned int side = page_size + 2*border;
+	std::vector<unsigned char> band(static_cast<size_t>(side) * level.width * 4);
+	std::vector<unsigned char> texels(getPageBytes());
+	for (unsigned int py = 0; py < level.pages_y; ++py) {
+		//The rows of the band wrap around the level, read them in runs of consecutive rows
+		int top = static_cast<int>(py*page_size) - static_cast<int>(border);
+		for (unsigned int y = 0; y < side; ) {
+			unsigned int first = wrap(top + static_cast<int>(y), level.height);
+			unsigned int count = std::min(side - y, level.height - first);
+			rows(first, count, &band[static_cast<size_t>(y) * level.width * 4]);
+			y += count;
+		}
+
+		file.seekp(getPageOffset(level.first + py*level.pages_x, getPageBytes()));
+		for (unsigned int px = 0; px < level.pages_x; ++px) {
+			int left = static_cast<int>(px*page_size) - static_cast<int>(border);
+			for (unsigned int y = 0; y < side; ++y) {
+				const unsigned char* source = &band[static_cast<size_t>(y) * level.width * 4];
+				for (unsigned int x = 0; x < side; ) {
+					unsigned int sx = wrap(left + static_cast<int>(x), level.width);
+					unsigned int count = std::min(side - x, level.width - sx);
+					memcpy(&texels[(y*side + x)*4], &source[sx*4], count*4);
+					x += count;
+				}
+			}
+			file.write(reinterpret_cast<const char*>(texels.data()), texels.size());
+		}
+	}
+}
+
+void VirtualTexture::createFeedback(unsigned int width, unsigned int height) {
+	feedback_width = width;
+	feedback_height = height;
+
+	//Page x, y and level per pixel, and 0 where no virtual texture was drawn
+	feedback_color.create(GL_TEXTURE_2D);
+	feedback_color.bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16UI, width, height, 0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, NULL);
+	feedback_color.setBytes(width * height * 8);
+
+	feedback_depth.create(GL_TEXTURE_2D);
+	feedback_depth.bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	feedback_depth.setBytes(width * height * 4);
+	feedback_depth.unbind();
+
+	feedback_framebuffer.create();
+	feedback_framebuffer.bind();
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedback_color.name(), 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, feedback_depth.name(), 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		THROW_EXCEPTION("The virtual texture feedback framebuffer is incomplete");
+	GLUtils::FramebufferHandle::unbind();
+
+	for (unsigned int i = 0; i < feedback_frames; ++i) {
+		readbacks[i].buffer.create(GL_PIXEL_PACK_BUFFER);
+		readbacks[i].buffer.data(width * height * 8, NULL, GL_STREAM_READ);
+		readbacks[i].buffer.unbind();
+	}
+	CHECK_GL_ERROR();
+}
+
+void VirtualTexture::beginFeedback(unsigned int width, unsigned int height) {
+	unsigned int view_width = std::max(1u, width / feedback_divisor);
+	unsigned int view_height = std::max(1u, height / feedback_divisor);
+	if (!feedback_framebuffer.valid())
+		createFeedback(view_width, view_height);
+	feedback_view_width = std::min(view_width, feedback_width);
+	feedback_view_height = std::min(view_height, feedback_height);
+
+	feedback_framebuffer.bind();
+	glViewport(0, 0, feedback_view_width, feedback_view_height);
+	const GLuint none[4] = { 0, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, none);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualTexture::bindFeedback(GLUtils::Program& program) {
+	setLevelUniforms(program);
+
+	//The feedback is smaller than the window, so its derivatives are larger
+	glUniform1f(program.getUniform("vt_lod_bias"), -std::log(static_cast<float>(feedback_divisor)) / std::log(2.0f));
+}
+
+void VirtualTexture::endFeedback() {
+	//Every pixel buffer is in flight, so this frame is not read back rather than waited for
+	if (in_flight < feedback_frames) {
+		Readback& readback = readbacks[(oldest + in_flight) % feedback_frames];
+		readback.width = feedback_view_width;
+		readback.height = feedback_view_height;
+		readback.buffer.bind();
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glReadPixels(0, 0, readback.width, readback.height, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, NULL);
+		readback.buffer.unbind();
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		++in_flight;
+	}
+	GLUtils::FramebufferHandle::unbind();
+}
+
+bool VirtualTexture::update(unsigned int max_uploads) {
+	Timer timer;
+
+	//Feedback the GPU has finished, oldest first, without waiting
+	while (in_flight > 0) {
+		GLenum result = glClientWaitSync(readbacks[oldest].fence, 0, 0);
+		if (result == GL_TIMEOUT_EXPIRED)
+			break;
+		if (result == GL_WAIT_FAILED)
+			THROW_EXCEPTION("glClientWaitSync failed");
+		readFeedback(readbacks[oldest]);
+	}
+	stats.feedback_time += timer.elapsedAndRestart();
+
+	std::vector<std::shared_ptr<LoadedPage> > ready;
+	{
+		std::lock_guard<std::mutex> lock(loaded_mutex);
+		while (!loaded.empty() && ready.size() < max_uploads) {
+			ready.push_back(loaded.front());
+			loaded.pop_front();
+		}
+	}
+
+	if (!ready.empty())
+		cache.bind();
+	for (unsigned int i = 0; i < ready.size(); ++i) {
+		unsigned int page = ready[i]->page;
+		--reads;
+		page_loading[page] = false;
+		if (ready[i]->texels.empty())
+			continue; //< Could not be read, asked for again by the next feedback
+
+		int slot = findSlot();
+		if (slot < 0) {
+			++stats.dropped;
+			continue;
+		}
+		if (slot_page[slot] >= 0) {
+			page_slot[slot_page[slot]] = -1;
+			++stats.evicted;
+			--stats.resident;
+		}
+		uploadPage(slot, page, ready[i]->texels.data());
+		slot_used[slot] = page_requested[page];
+		++stats.loaded;
+	}
+	if (!ready.empty())
+		cache.unbind();
+	stats.upload_time += timer.elapsedAndRestart();
+
+	if (!table_dirty)
+		return false;
+	updateTable();
+	return true;
+}
+
+/* * *
+* Every pixel of the feedback names the page it needs. The pages and their
+* ancestors are stamped with the number of the feedback, which keeps them
+* in the cache, and the missing ones are read coarsest first: a coarse
+* page covers more of the view, and the finer ones are drawn from it until
+* they arrive.
+* * */
+void VirtualTexture::readFeedback(Readback& readback) {
+	size_t pixels = static_cast<size_t>(readback.width) * readback.height;
+	readback.buffer.bind();
+	const unsigned short* texels = static_cast<const unsigned short*>(
+		glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixels * 8, GL_MAP_READ_BIT));
+	if (texels == NULL)
+		THROW_EXCEPTION("Unable to map the virtual texture feedback buffer");
+
+	++feedback_count;
+	stats.requested = 0;
+	missing.clear();
+	for (size_t i = 0; i < pixels; ++i) {
+		const unsigned short* texel = texels + i*4;
+		if (texel[3] == 0 || texel[2] >= levels.size())
+			continue;
+		const Level& level = levels[texel[2]];
+		request(texel[2], std::min<unsigned int>(texel[0], level.pages_x - 1), std::min<unsigned int>(texel[1], level.pages_y - 1));
+	}
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	readback.buffer.unbind();
+
+	glDeleteSync(readback.fence);
+	readback.fence = 0;
+	oldest = (oldest + 1) % feedback_frames;
+	--in_flight;
+
+	//Coarser levels have higher page numbers. The reader takes the last
+	//task first, so the coarsest pages are submitted last.
+	std::sort(missing.begin(), missing.end());
+	stats.missing = static_cast<unsigned int>(missing.size());
+	unsigned int first = static_cast<unsigned int>(missing.size() - std::min<size_t>(missing.size(), max_reads - reads));
+	for (unsigned int i = first; i < missing.size(); ++i) {
+		unsigned int page = missing[i];
+		page_loading[page] = true;
+		++reads;
+		reader.submit([this, page]() {
+			std::shared_ptr<LoadedPage> loaded_page(new LoadedPage());
+			loaded_page->page = page;
+			loaded_page->texels.resize(getPageBytes());
+			file.seekg(getPageOffset(page, getPageBytes()));
+			file.read(reinterpret_cast<char*>(loaded_page->texels.data()), loaded_page->texels.size());
+			if (!file.good()) {
+				file.clear();
+				loaded_page->texels.clear();
+			}
+			std::lock_guard<std::mutex> lock(loaded_mutex);
+			loaded.push_back(loaded_page);
+		});
+	}
+}
+
+void VirtualTexture::request(unsigned int level, unsigned int x, unsigned int y) {
+	for (; level < levels.size(); ++level) {
+		unsigned int page = levels[level].first + y*levels[level].pages_x + x;
+		if (page_requested[page] == feedback_count)
+			return; //< And so are its ancestors
+		page_requested[page] = feedback_count;
+		++stats.requested;
+
+		int slot = page_slot[page];
+		if (slot >= 0)
+			slot_used[slot] = feedback_count;
+		else if (!page_loading[page])
+			missing.push_back(page);
+
+		//Odd sizes can put the last page past the last one of the level above
+		if (level + 1 < levels.size()) {
+			x = std::min(x >> 1, levels[level + 1].pages_x - 1);
+			y = std::min(y >> 1, levels[level + 1].pages_y - 1);
+		}
+	}
+}
+
+void VirtualTexture::uploadPage(unsigned int slot, unsigned int page, const unsigned char* texels) {
+	//Assumes the cache is bound
+	const unsigned int side = page_size + 2*border;
+	glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % cache_pages) * side, (slot / cache_pages) * side,
+		side, side, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+	slot_page[slot] = page;
+	page_slot[page] = slot;
+	table_dirty = true;
+	++stats.resident;
+}
+
+int VirtualTexture::findSlot() const {
+	int oldest = -1;
+	for (unsigned int s = 0; s < slot_page.size(); ++s) {
+		if (slot_pinned[s])
+			continue;
+		if (slot_page[s] < 0)
+			return s;
+		if (slot_used[s] == feedback_count)
+			continue;
+		if (oldest < 0 || slot_used[s] < slot_used[oldest])
+			oldest = s;
+	}
+	return oldest;
+}
+
+/* * *
+* Built from the coarsest level down, so that a page that is not resident
+* takes the entry of its parent, which is already final. The coarsest
+* level is always resident.
+* * */
+void VirtualTexture::updateTable() {
+	Timer timer;
+	for (int l = static_cast<int>(levels.size()) - 1; l >= 0; --l) {
+		const Level& level = levels[l];
+		for (unsigned int y = 0; y < level.pages_y; ++y) {
+			for (unsigned int x = 0; x < level.pages_x; ++x) {
+				unsigned int page = level.first + y*level.pages_x + x;
+				int slot = page_slot[page];
+				if (slot >= 0) {
+					table[page] = (slot % cache_pages) | (slot / cache_pages) << 8 | l << 16;
+				} else {
+					const Level& parent = levels[l + 1];
+					unsigned int parent_x = std::min(x >> 1, parent.pages_x - 1);
+					unsigned int parent_y = std::min(y >> 1, parent.pages_y - 1);
+					table[page] = table[parent.first + parent_y*parent.pages_x + parent_x];
+				}
+			}
+		}
+	}
+
+	//Orphans the old table, which the GPU may still be reading
+	table_buffer.data(table.size() * sizeof(unsigned int), table.data(), GL_DYNAMIC_DRAW);
+	table_buffer.unbind();
+	table_dirty = false;
+	stats.table_time += timer.elapsed();
+}
+
+void VirtualTexture::setLevelUniforms(GLUtils::Program& program) {
+	GLint data[max_levels * 4] = { 0 };
+	for (unsigned int l = 0; l < levels.size(); ++l) {
+		data[l*4 + 0] = levels[l].first;
+		data[l*4 + 1] = levels[l].pages_x;
+		data[l*4 + 2] = levels[l].width;
+		data[l*4 + 3] = levels[l].height;
+	}
+	glUniform4iv(program.getUniform("vt_levels"), max_levels, data);
+	glUniform1i(program.getUniform("vt_level_count"), static_cast<GLint>(levels.size()));
+	glUniform2f(program.getUniform("vt_size"), static_cast<float>(width), static_cast<float>(height));
+}
+
+void VirtualTexture::bind(GLUtils::Program& program, unsigned int first_unit) {
+	glActiveTexture(GL_TEXTURE0 + first_unit);
+	cache.bind();
+	glActiveTexture(GL_TEXTURE0 + first_unit + 1);
+	table_texture.bind();
+	glActiveTexture(GL_TEXTURE0);
+
+	glUniform1i(program.getUniform("vt_cache"), first_unit);
+	glUniform1i(program.getUniform("vt_table"), first_unit + 1);
+	glUniform1f(program.getUniform("vt_cache_size"), static_cast<float>(cache_pages * (page_size + 2*border)));
+	setLevelUniforms(program);
+}
+
+long long VirtualTexture::bytes() const {
+	long long result = cache.bytes() + table_buffer.bytes() + feedback_color.bytes() + feedback_depth.bytes();
+	for (unsigned int i = 0; i < feedback_frames; ++i)
+		result += readbacks[i].buffer.bytes();
+	return result;
+}
+
+void VirtualTexture::resetStats() {
+	//The counts of the last update and the cache carry over
+	VirtualTextureStats last = stats;
+	stats = VirtualTextureStats();
+	stats.requested = last.requested;
+	stats.missing = last.missing;
+	stats.resident = last.resident;
+}
@@ -1,6 +1,15 @@
 #include "GameManager.h"
+#include "GeometryCodec.h"
+#include "MeshBVH.h"
+#include "PointOctree.h"
+#include "VirtualFileSystem.h"
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include <IL/il.h>
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -8,11 +17,271 @@
 
 /**
  * Simple program that starts our game manager
+ *
+ * Usage: <model> [more models...] [options]. N loads the next model in the
+ * background, and swaps it in once it is uploaded.
+ *
+ * Options:
+ *   --swap-interval <n>  0 = immediate, 1 = vsync, -1 = adaptive vsync
+ *   --fps <n>            limit the frame rate, 0 = unlimited
+ *   --idle               only redraw when the view changes
+ *   --no-program-cache   always compile shader programs from source
+ *   --reload-test <n>    reload the model n times, check the GPU memory ledger, and with
+ *                        n >= 20 driver and process memory, for leaks and exit
+ *   --bench-loaders <f>  time the Assimp and the native OBJ loader on f and exit
+ *   --make-stream <f> <out.pgs>  convert model f to a stream file for the --stream-cap,
+ *                        holding about that much host memory, and exit
+ *   --make-virtual-texture <f> <out.pgv>  cut image f and its mip levels into the
+ *                        pages of a virtual texture and exit, a band at a time for
+ *                        binary PPM images. Models whose material refers to the .pgv
+ *                        file stream it as they are drawn.
+ *   --stream-cap <MiB>   host memory used when reading and writing stream files
+ *   --legacy-model <e>   load with the legacy Model class, indexed, welding vertices
+ *                        whose positions are closer than e (0 = identical only)
+ *   --weld-tolerances <n> <t>  with --legacy-model, also weld normals closer than n and
+ *                        texture coordinates closer than t (default 0 0, identical only)
+ *   --import-profile <p> fast, balanced or quality post-processing for Assimp imports
+ *   --compress <f> <out.pgz>  compress model f with GeometryCodec and exit
+ *   --bench-codec <f>    time compressing and decompressing model f and exit
+ *   --gpu-budget <MiB>   GPU memory for buffers and textures, models that were not
+ *                        drawn recently are evicted above it (0 = no limit, default 1024)
+ *   --software           render with the software rasterizer (B toggles it)
+ *   --bench-raster <n>   time n frames per render mode with OpenGL and the software
+ *                        rasterizer and exit
+ *   --bench-stream <n>   stream a deformed grid through a dynamic buffer for n frames,
+ *                        print the bytes and stalls per frame and exit
+ *   --lights <n>         n point lights orbiting the model (L cycles 0, 16, 256, 4096)
+ *   --bench-lights <n>   time n Phong frames each with 1 to 10000 lights and exit
+ *   --prepass <m>        depth pre-pass before the Phong pass: off, on, or auto to use it
+ *                        while the measured overdraw is high (default, P cycles)
+ *   --skinning <m>       skin models with bones on the cpu (SSE, all cores) or the gpu
+ *                        (vertex shaders, default, K toggles it)
+ *   --bench-skinning <n> time n frames with CPU and with GPU skinning and exit
+ *   --bench-bvh <f>      time building the picking hierarchy of model f, and rays,
+ *                        closest points and frusta against it, and exit
+ *   --dynamic-resolution <ms>  render at the resolution that holds this GPU time per frame
+ *                        and upscale to the window (D toggles it)
+ *   --upscale <f>        bilinear or sharpen (U toggles it)
+ *   --min-scale <s>      lowest dynamic resolution scale, default 0.5
+ *   --capture-dir <d>    where screenshots (F12) and video frames (C) are written,
+ *                        ending with a path separator
+ *   --record             capture every frame from the start
+ *   --screenshot <n>     take a screenshot of rendered frame n and exit
+ *   --points <f>         draw the point cloud f, a .pgp file or a .xyz scan or .ply scan
+ *                        without faces that is converted into cache/ first, as splats
+ *                        (5 selects the mode)
+ *   --point-budget <n>   millions of points of the cloud drawn per frame at most, default 10
+ *   --make-points <f> <out.pgp>  sort the points of scan f into a point octree and exit
+ *   --bench-points <n>   convert synthetic scans of 1, 10, 100, ... up to n million points,
+ *                        print the points per second and the peak memory, and exit
+ *   --archive <f.pga>    read files from archive f first (pack one with assetc --pack),
+ *                        may be given several times, the last one is searched first
  */
 int main(int argc, char *argv[]) {
+	char* model = NULL;
+	int swap_interval = 1;
+	double fps = 60.0;
+	bool idle = false;
+	int reload_test = 0;
+	bool software = false;
+	int bench_raster = 0;
+	int bench_stream = 0;
+	int light_count = 0;
+	PrepassMode prepass = PREPASS_AUTO;
+	double resolution_target = 0.0;
+	UpscaleFilter upscale = UPSCALE_BILINEAR;
+	float min_scale = 0.5f;
+	int bench_lights = 0;
+	SkinningMode skinning = SKINNING_GPU;
+	int bench_skinning = 0;
+	std::string capture_dir;
+	bool record = false;
+	int screenshot_frame = 0;
+	bool program_cache = true;
+	size_t stream_cap = 64;
+	std::string make_stream;
+	std::string make_stream_out;
+	long long gpu_budget = 1024;
+	bool legacy_model = false;
+	float weld_epsilon = 0.0f;
+	float weld_normal_epsilon = 0.0f;
+	float weld_tex_coord_epsilon = 0.0f;
+	ImportProfile import_profile = IMPORT_BALANCED;
+	std::string point_file;
+	double point_budget = 10.0;
+	std::vector<std::string> more_models; //< Cycled through with N
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--swap-interval" && i+1 < argc)
+			swap_interval = atoi(argv[++i]);
+		else if (arg == "--fps" && i+1 < argc)
+			fps = atof(argv[++i]);
+		else if (arg == "--idle")
+			idle = true;
+		else if (arg == "--no-program-cache")
+			program_cache = false;
+		else if (arg == "--software")
+			software = true;
+		else if (arg == "--bench-raster" && i+1 < argc)
+			bench_raster = atoi(argv[++i]);
+		else if (arg == "--bench-stream" && i+1 < argc)
+			bench_stream = atoi(argv[++i]);
+		else if (arg == "--lights" && i+1 < argc)
+			light_count = atoi(argv[++i]);
+		else if (arg == "--bench-lights" && i+1 < argc)
+			bench_lights = atoi(argv[++i]);
+		else if (arg == "--prepass" && i+1 < argc)
+			prepass = DepthPrepass::parseMode(argv[++i]);
+		else if (arg == "--skinning" && i+1 < argc)
+			skinning = SkinnedMesh::parseMode(argv[++i]);
+		else if (arg == "--bench-skinning" && i+1 < argc)
+			bench_skinning = atoi(argv[++i]);
+		else if (arg == "--dynamic-resolution" && i+1 < argc)
+			resolution_target = atof(argv[++i]) / 1000.0;
+		else if (arg == "--upscale" && i+1 < argc)
+			upscale = DynamicResolution::parseFilter(argv[++i]);
+		else if (arg == "--min-scale" && i+1 < argc)
+			min_scale = static_cast<float>(atof(argv[++i]));
+		else if (arg == "--capture-dir" && i+1 < argc)
+			capture_dir = argv[++i];
+		else if (arg == "--record")
+			record = true;
+		else if (arg == "--screenshot" && i+1 < argc)
+			screenshot_frame = atoi(argv[++i]);
+		else if (arg == "--reload-test" && i+1 < argc)
+			reload_test = atoi(argv[++i]);
+		else if (arg == "--bench-loaders" && i+1 < argc) {
+			ModelInterleavedArray::benchmarkLoaders(argv[++i]);
+			return 0;
+		}
+		else if (arg == "--compress" && i+2 < argc) {
+			MeshData data;
+			ModelInterleavedArray::loadMeshData(argv[i+1], data, LOADER_AUTO, import_profile);
+			GeometryCodec::write(data, argv[i+2]);
+			return 0;
+		}
+		else if (arg == "--bench-codec" && i+1 < argc) {
+			MeshData data;
+			ModelInterleavedArray::loadMeshData(argv[++i], data, LOADER_AUTO, import_profile);
+			GeometryCodec::benchmark(data);
+			return 0;
+		}
+		else if (arg == "--bench-bvh" && i+1 < argc) {
+			MeshData data;
+			ModelInterleavedArray::loadMeshData(argv[++i], data, LOADER_AUTO, import_profile);
+			MeshBVH::benchmark(data);
+			return 0;
+		}
+		else if (arg == "--points" && i+1 < argc)
+			point_file = argv[++i];
+		else if (arg == "--point-budget" && i+1 < argc)
+			point_budget = atof(argv[++i]);
+		else if (arg == "--make-points" && i+2 < argc) {
+			PointOctree::convert(argv[i+1], argv[i+2]);
+			return 0;
+		}
+		else if (arg == "--bench-points" && i+1 < argc) {
+			PointOctree::benchmark(atoi(argv[++i]), "");
+			return 0;
+		}
+		else if (arg == "--make-stream" && i+2 < argc) {
+			make_stream = argv[++i];
+			make_stream_out = argv[++i];
+		}
+		else if (arg == "--make-virtual-texture" && i+2 < argc) {
+			//Bottom row first, like the textures decoded when drawing
+			ilInit();
+			ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+			ilEnable(IL_ORIGIN_SET);
+			VirtualTexture::convert(argv[i+1], argv[i+2]);
+			return 0;
+		}
+		else if (arg == "--stream-cap" && i+1 < argc)
+			stream_cap = atoi(argv[++i]);
+		else if (arg == "--gpu-budget" && i+1 < argc)
+			gpu_budget = atoi(argv[++i]);
+		else if (arg == "--archive" && i+1 < argc)
+			VirtualFileSystem::mount(argv[++i]);
+		else if (arg == "--import-profile" && i+1 < argc)
+			import_profile = AssimpLoader::parseProfile(argv[++i]);
+		else if (arg == "--legacy-model" && i+1 < argc) {
+			legacy_model = true;
+			weld_epsilon = static_cast<float>(atof(argv[++i]));
+		}
+		else if (arg == "--weld-tolerances" && i+2 < argc) {
+			weld_normal_epsilon = static_cast<float>(atof(argv[++i]));
+			weld_tex_coord_epsilon = static_cast<float>(atof(argv[++i]));
+		}
+		else if (arg.compare(0, 2, "--") == 0)
+			std::cout << "Ignoring unknown argument " << arg << std::endl;
+		else if (model == NULL)
+			model = argv[i];
+		else
+			more_models.push_back(arg);
+	}
+	if (!make_stream.empty()) {
+		StreamingModel::convert(make_stream, make_stream_out, stream_cap << 20);
+		return 0;
+	}
+	if (model == NULL) {
+		static char default_model[] = "models/lara.obj";
+		model = default_model;
+	}
+
 	std::shared_ptr<GameManager> game;
-	game.reset(new GameManager(argv[1]));
+	game.reset(new GameManager(model));
+	game->setSwapInterval(swap_interval);
+	game->setTargetFrameRate(fps);
+	game->setIdleRendering(idle);
+	game->setProgramCacheEnabled(program_cache);
+	game->setStreamingMemoryCap(stream_cap << 20);
+	game->setGpuBudget(gpu_budget << 20);
+	game->setLegacyModel(legacy_model, weld_epsilon, weld_normal_epsilon, weld_tex_coord_epsilon);
+	game->setImportProfile(import_profile);
+	game->setSoftwareRendering(software);
+	game->setDepthPrepass(prepass);
+	game->setSkinningMode(skinning);
+	if (resolution_target > 0.0)
+		game->setDynamicResolution(resolution_target, upscale, min_scale);
+	if (light_count > 0)
+		game->setLightCount(light_count);
+	game->setCaptureDirectory(capture_dir);
+	if (record)
+		game->setRecording(true);
+	if (screenshot_frame > 0)
+		game->setScreenshotFrame(screenshot_frame);
+	for (unsigned int i = 0; i < more_models.size(); ++i)
+		game->addModel(more_models[i]);
+	if (!point_file.empty())
+		game->setPointCloud(point_file, static_cast<unsigned long long>(point_budget * 1.0e6));
 	game->init();
+	VirtualFileSystem::printStats();
+	if (bench_raster > 0) {
+		game->benchmarkRasterizers(bench_raster);
+		game.reset();
+		return 0;
+	}
+	if (bench_stream > 0) {
+		game->benchmarkStreaming(bench_stream);
+		game.reset();
+		return 0;
+	}
+	if (bench_lights > 0) {
+		game->benchmarkLights(bench_lights);
+		game.reset();
+		return 0;
+	}
+	if (bench_skinning > 0) {
+		game->benchmarkSkinning(bench_skinning);
+		game.reset();
+		return 0;
+	}
+	if (reload_test > 0) {
+		bool flat = game->reloadTest(reload_test);
+		game.reset();
+		return flat ? 0 : 1;
+	}
 	game->play();
 	game.reset();
 	return 0;